@@ -21,19 +21,31 @@
 #include <stdio.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/resource.h>
 
 #include "log.h"
 #include "conf.h"
 #include "iface.h"
+#include "kern.h"
 #include "script.h"
 #include "mcgroup.h"
+#include "netns.h"
 #include "util.h"
 
 #define MAX_LINE_LEN 512
 
+/* Cost of reading and applying the .conf file, shown with 'show stats' */
+static struct conf_phase phases[CONF_PHASES] = {
+	{ .name = "Read"   },
+	{ .name = "Apply"  },
+	{ .name = "Reload" },
+};
+static unsigned long num_lines;
+
 #define DEBUG(fmt, args...) do {					\
 	if (conf)							\
 		smclog(LOG_DEBUG, "%s line %d: " fmt, conf->file,	\
@@ -159,7 +171,8 @@ done:
 	return rc;
 }
 
-int conf_mroute(struct conf *conf, int cmd, char *iif, char *source, char *group, char *oif[], int num)
+int conf_mroute(struct conf *conf, int cmd, char *iif, char *source, char *group, int prio,
+		char *oif[], int num)
 {
 	struct ifmatch state_in, state_out;
 	struct mroute mroute = { 0 };
@@ -212,6 +225,18 @@ int conf_mroute(struct conf *conf, int cmd, char *iif, char *source, char *group
 	if (!mroute.src_len)
 		mroute.src_len = len_max;
 
+	if (prio < 0 || prio > MROUTE_PRIO_MAX) {
+		WARN("mroute: Invalid priority %d (0-%d)", prio, MROUTE_PRIO_MAX);
+		goto done;
+	}
+	mroute.prio = prio;
+
+	if (cmd && !conf_vrfy) {
+		mroute_lazy_vif(iif);
+		for (int i = 0; i < num; i++)
+			mroute_lazy_vif(oif[i]);
+	}
+
 	iface_match_init(&state_in);
 	DEBUG("mroute: checking for input iface %s ...", iif);
 	while (iface_match_vif_by_name(iif, &state_in, &iface_in) != NO_VIF) {
@@ -297,15 +322,20 @@ static int conf_phyint(struct conf *conf, int enable, char *iif, int mrdisc, int
  * routes accordingly in the kernel.  Whitespace is ignored.
  *
  * Format:
- *    phyint IFNAME <enable|disable> [ttl-threshold <1-255>]
+ *    phyint IFNAME <enable|disable> [ttl-threshold <1-255>] [required]
  *    mgroup   from IFNAME [source ADDRESS] group MCGROUP
- *    mroute   from IFNAME source ADDRESS   group MCGROUP to IFNAME [IFNAME ...]
+ *    mroute   from IFNAME source ADDRESS   group MCGROUP [priority <0-7>] to IFNAME [IFNAME ...]
  *    include FILEPATTERN
+ *    netns   NAME
+ *
+ * Lines after 'netns NAME' apply to that network namespace, until the
+ * next netns line or the end of the file.
  */
 int conf_parse(struct conf *conf, int do_vifs)
 {
+	struct netns *prev = netns_current();
 	char *linebuf, *line;
-	int rc = 0;
+	int rc = 0, skip = 0;
 	FILE *fp;
 
 	fp = fopen(conf->file, "r");
@@ -335,9 +365,10 @@ int conf_parse(struct conf *conf, int do_vifs)
 next:
 	while ((line = fgets(linebuf, MAX_LINE_LEN, fp))) {
 		int   mrdisc = 0, threshold = DEFAULT_THRESHOLD;
-		int   op = 0, num = 0, enable = do_vifs;
+		int   op = 0, num = 0, enable = do_vifs, prio = 0, required = 0;
 		char *oif[MAX_MC_VIFS];
 		char *include = NULL;
+		char *name = NULL;
 		char *source = NULL;
 		char *group  = NULL;
 		char *iif = NULL;
@@ -349,6 +380,7 @@ next:
 		/* Strip any line end character(s) */
 		chomp(line);
 		conf->lineno++;
+		num_lines++;
 
 		DEBUG("%s", line);
 		while ((token = pop_token(&line))) {
@@ -375,6 +407,10 @@ next:
 					include = pop_token(&line);
 					smclog(LOG_DEBUG, "Found include --> %s", include);
 					break;
+				} else if (match("netns", token)) {
+					op = NETNS;
+					name = pop_token(&line);
+					break;
 				} else {
 					WARN("Unknown command %s, skipping.", token);
 					goto next;
@@ -396,11 +432,49 @@ next:
 				enable = 0;
 			} else if (match("mrdisc", token)) {
 				mrdisc = 1;
+			} else if (match("required", token)) {
+				required = 1;
 			} else if (match("ttl-threshold", token)) {
 				ttl = pop_token(&line);
+			} else if (match("priority", token)) {
+				token = pop_token(&line);
+				prio = token ? atoi(token) : -1;
 			}
 		}
 
+		if (op == NETNS) {
+			struct netns *ns;
+
+			skip = 0;
+			if (!name) {
+				WARN("netns missing name, skipping until next netns ...");
+				skip = 1;
+				continue;
+			}
+			if (conf_vrfy)
+				continue;
+
+			ns = netns_open(name);
+			if (!ns) {
+				WARN("netns %s: %s, skipping until next netns ...", name, strerror(errno));
+				skip = 1;
+				continue;
+			}
+
+			netns_enter(ns);
+			continue;
+		}
+		if (skip)
+			continue;
+
+		/* Track before the existence check, it may not exist yet */
+		if (op == PHYINT && required) {
+			if (strchr(iif, '+'))
+				WARN("phyint %s, wildcards cannot be required", iif);
+			else
+				iface_require(iif);
+		}
+
 		if (iif && !iface_exist(iif)) {
 			switch (op) {
 			case MGROUP:
@@ -436,7 +510,7 @@ next:
 			break;
 
 		case MROUTE:
-			rc += conf_mroute(conf, 1, iif, source, group, oif, num);
+			rc += conf_mroute(conf, 1, iif, source, group, prio, oif, num);
 			break;
 
 		case PHYINT:
@@ -464,6 +538,7 @@ next:
 
 	free(linebuf);
 	fclose(fp);
+	netns_enter(prev);
 
 	if (rc) {
 		errno = EOPNOTSUPP;
@@ -477,8 +552,18 @@ next:
 int conf_read(char *file, int do_vifs)
 {
 	struct conf conf = { .file = file };
+	int rc;
+
+	/* Set of required interfaces is rebuilt from .conf every time */
+	iface_require(NULL);
+
+	num_lines = 0;
+	conf_phase_beg(CONF_READ);
+	rc = conf_parse(&conf, do_vifs);
+	phases[CONF_READ].lines = num_lines;
+	conf_phase_end(CONF_READ);
 
-	if (conf_parse(&conf, do_vifs)) {
+	if (rc) {
 		if (errno == EOPNOTSUPP)
 			smclog(LOG_WARNING, "Parse error in %s", file);
 		return EX_CONFIG;
@@ -490,6 +575,52 @@ int conf_read(char *file, int do_vifs)
 	return script_exec(NULL);
 }
 
+/**
+ * conf_phase_beg - Start measuring a phase of reading or applying .conf
+ * @phase: One of %CONF_READ, %CONF_APPLY, or %CONF_RELOAD
+ */
+void conf_phase_beg(int phase)
+{
+	struct conf_phase *p = &phases[phase];
+
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	p->writes0 = kern_wq.writes;
+	p->active  = 1;
+}
+
+/**
+ * conf_phase_end - Stop measuring a phase, no-op if not started
+ * @phase: One of %CONF_READ, %CONF_APPLY, or %CONF_RELOAD
+ *
+ * Wall time, and not the timer API, which may run on a virtual clock.
+ * The peak RSS is for the whole process, so it never goes down.
+ */
+void conf_phase_end(int phase)
+{
+	struct conf_phase *p = &phases[phase];
+	struct timespec now;
+	struct rusage ru;
+
+	if (!p->active)
+		return;
+	p->active = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	p->usec   = (now.tv_sec - p->start.tv_sec) * 1000000 +
+		    (now.tv_nsec - p->start.tv_nsec) / 1000;
+	p->writes = kern_wq.writes - p->writes0;
+	if (!getrusage(RUSAGE_SELF, &ru))
+		p->rss = ru.ru_maxrss;
+
+	smclog(LOG_INFO, "%s of .conf done in %lu usec, %lu kernel writes, peak RSS %lu kB",
+	       p->name, p->usec, p->writes, p->rss);
+}
+
+struct conf_phase *conf_phase(int phase)
+{
+	return &phases[phase];
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -2,26 +2,55 @@
 #define SMCROUTE_CONF_H_
 
 #include "config.h"
+#include <time.h>
 
 #define EMPTY   0
 #define MGROUP  1
 #define MROUTE  2
 #define PHYINT  3
 #define INCLUDE 4
+#define NETNS   5
 
 struct conf {
 	const char   *file;
 	unsigned int  lineno;
 };
 
+/*
+ * Phases of reading and applying the .conf file.  Apply is from the end
+ * of the initial read until all tasks are done, reload is the same for
+ * a reload, including the read.
+ */
+#define CONF_READ   0
+#define CONF_APPLY  1
+#define CONF_RELOAD 2
+#define CONF_PHASES 3
+
+struct conf_phase {
+	const char     *name;
+	int             active;
+	struct timespec start;
+	unsigned long   writes0;	/* kernel writes at start */
+
+	unsigned long   lines;		/* read, incl. include files */
+	unsigned long   usec;		/* wall time of last run */
+	unsigned long   writes;		/* kernel writes, see struct kern_wq */
+	unsigned long   rss;		/* peak RSS at end, kB */
+};
+
 extern int conf_vrfy;
 
 int conf_mgroup (struct conf *conf, int cmd, char *iif, char *source, char *group);
-int conf_mroute (struct conf *conf, int cmd, char *iif, char *source, char *group, char *oif[], int num);
+int conf_mroute (struct conf *conf, int cmd, char *iif, char *source, char *group, int prio,
+		 char *oif[], int num);
 int conf_parse  (struct conf *conf, int do_vifs);
 
 int conf_read   (char *file, int do_vifs);
 
+void               conf_phase_beg (int phase);
+void               conf_phase_end (int phase);
+struct conf_phase *conf_phase     (int phase);
+
 #endif /* SMCROUTE_CONF_H_ */
 
 /**
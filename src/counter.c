@@ -0,0 +1,390 @@
+/* Cumulative per-route counters, across kernel MFC reinstalls and restarts
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "counter.h"
+#include "kern.h"
+#include "log.h"
+#include "netns.h"
+#include "timer.h"
+
+/*
+ * The kernel MFC counters of an (S,G) start over from zero every time
+ * its entry is reinstalled: when it expires and is learned again, when
+ * the reconciler restores it, on reload, and on restart.  Some kernels
+ * also only have 32-bit counters.  So userspace keeps 64-bit cumulative
+ * counters per (S,G), and namespace, and folds in the kernel counters on
+ * every sample, and before every removal.
+ *
+ * The difference since the last sample is computed modulo the kernel
+ * counter width, 32 bits unless the counter has already passed that, so
+ * a byte counter wrapping is not taken for a reset.  A packet counter
+ * lower than at the last sample is taken as a reinstall behind our back,
+ * unless it went from the top quarter of its range to the bottom quarter,
+ * which is a wrap.  A reinstall is only seen if the new entry has fewer
+ * packets than the old one had at the last sample.  If it has already
+ * passed that, the new counters are counted as the delta, and packets of
+ * the old entry since the last sample are lost.
+ *
+ * Counters of (S,G) no longer in the kernel MFC are kept COUNTER_RETAIN
+ * seconds, for when the flow comes back.  With smcrouted -J FILE they
+ * are also saved in FILE.counters, see journal.c, and loaded on start.
+ */
+#define COUNTER_PRUNE 3600
+
+static RB_HEAD(cnt_tree, counter) cnt_tree = RB_INITIALIZER(&cnt_tree);
+
+static int counter_cmp(struct counter *a, struct counter *b)
+{
+	int rc;
+
+	if (a->ns != b->ns)
+		return a->ns < b->ns ? -1 : 1;
+
+	rc = inet_addr_order(&a->group, &b->group);
+	if (rc)
+		return rc;
+
+	return inet_addr_order(&a->source, &b->source);
+}
+RB_GENERATE_STATIC(cnt_tree, counter, node, counter_cmp)
+
+static time_t now_sec(void)
+{
+	struct timespec now;
+
+	timer_now(&now);
+	return now.tv_sec;
+}
+
+static struct counter *find(struct netns *ns, inet_addr_t *source, inet_addr_t *group)
+{
+	struct counter key;
+
+	memset(&key, 0, sizeof(key));
+	key.ns     = ns;
+	key.source = *source;
+	key.group  = *group;
+
+	return RB_FIND(cnt_tree, &cnt_tree, &key);
+}
+
+static struct counter *get(struct netns *ns, inet_addr_t *source, inet_addr_t *group)
+{
+	struct counter *c;
+
+	c = find(ns, source, group);
+	if (c)
+		return c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		exit(EX_OSERR);
+	}
+	c->ns     = ns;
+	c->source = *source;
+	c->group  = *group;
+	RB_INSERT(cnt_tree, &cnt_tree, c);
+
+	return c;
+}
+
+/* Largest value of a kernel counter that is at @val */
+static unsigned long top(unsigned long val)
+{
+	return val <= UINT32_MAX ? UINT32_MAX : ULONG_MAX;
+}
+
+/* Kernel counter at @val, since @prev, modulo its width */
+static unsigned long delta(unsigned long val, unsigned long prev)
+{
+	if (val < prev && top(prev) == UINT32_MAX)
+		return (uint32_t)(val - prev);
+
+	return val - prev;
+}
+
+/* Kernel counter dropped from @prev to @val by wrapping, not a reset */
+static int wrapped(unsigned long val, unsigned long prev)
+{
+	unsigned long max = top(prev);
+
+	return prev > max - max / 4 && val < max / 4;
+}
+
+/* Fold kernel counters @ms of the installed entry into @c */
+static void fold(struct counter *c, struct mroute_stats *ms)
+{
+	if (ms->ms_pktcnt < c->k_pkt && !wrapped(ms->ms_pktcnt, c->k_pkt))
+		c->k_pkt = c->k_bytes = c->k_wrong_if = 0;
+
+	c->pkt      += delta(ms->ms_pktcnt,   c->k_pkt);
+	c->bytes    += delta(ms->ms_bytecnt,  c->k_bytes);
+	c->wrong_if += delta(ms->ms_wrong_if, c->k_wrong_if);
+
+	c->k_pkt      = ms->ms_pktcnt;
+	c->k_bytes    = ms->ms_bytecnt;
+	c->k_wrong_if = ms->ms_wrong_if;
+	c->live       = 1;
+	c->seen       = now_sec();
+}
+
+static void gone(struct counter *c)
+{
+	c->k_pkt = c->k_bytes = c->k_wrong_if = 0;
+	c->live  = 0;
+	c->seen  = now_sec();
+}
+
+/*
+ * Sample kernel counters of (S,G) in @c, in the current namespace.
+ * An (S,G) not in the kernel MFC has been removed behind our back.
+ */
+static int sample(struct counter *c, struct mroute *route)
+{
+	struct mroute_stats ms = { 0 };
+
+	if (kern_stats(route, &ms)) {
+		if (c && errno == EADDRNOTAVAIL)
+			gone(c);
+		return -1;
+	}
+
+	if (!c)
+		c = get(netns_current(), &route->source, &route->group);
+	fold(c, &ms);
+
+	return 0;
+}
+
+/**
+ * counter_sample - Fold kernel MFC counters of @route into its counters
+ * @route: Kernel MFC entry, (S,G), in the current namespace
+ *
+ * Returns:
+ * The cumulative counters of @route, or %NULL if it has never been seen
+ * in the kernel MFC.
+ */
+struct counter *counter_sample(struct mroute *route)
+{
+	struct counter *c;
+
+	c = find(netns_current(), &route->source, &route->group);
+	if (sample(c, route) || c)
+		return c;
+
+	/* First sample, created by sample() */
+	return find(netns_current(), &route->source, &route->group);
+}
+
+/**
+ * counter_gone - Kernel MFC entry of @route has been removed
+ * @route: Kernel MFC entry, (S,G), in the current namespace
+ *
+ * Called after removing the entry, or when restoring an entry lost
+ * behind our back.  The counters of the next entry start from zero.
+ */
+void counter_gone(struct mroute *route)
+{
+	struct counter *c;
+
+	c = find(netns_current(), &route->source, &route->group);
+	if (c)
+		gone(c);
+}
+
+/* Drop counters of (S,G) not in the kernel MFC for COUNTER_RETAIN sec */
+static void prune(void *arg)
+{
+	struct counter *c, *tmp;
+	time_t now = now_sec();
+	size_t num = 0;
+
+	(void)arg;
+
+	RB_FOREACH_SAFE(c, cnt_tree, &cnt_tree, tmp) {
+		if (c->live || c->seen + COUNTER_RETAIN > now)
+			continue;
+
+		RB_REMOVE(cnt_tree, &cnt_tree, c);
+		free(c);
+		num++;
+	}
+
+	if (num)
+		smclog(LOG_DEBUG, "Pruned counters of %zu stale routes", num);
+}
+
+/**
+ * counter_load - Load saved counters from @file
+ * @file: Saved by counter_save()
+ *
+ * Counters of namespaces no longer in the .conf file are skipped.  The
+ * kernel MFC starts out empty, so the next sample is folded in whole.
+ *
+ * Returns:
+ * Number of counters loaded.
+ */
+int counter_load(const char *file)
+{
+	char ns[NETNS_NAMELEN], src[64], grp[64];
+	uint64_t pkt, bytes, wrong_if;
+	inet_addr_t source, group;
+	char *line = NULL;
+	struct netns *n;
+	struct counter *c;
+	size_t len = 0;
+	int num = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			smclog(LOG_WARNING, "Failed reading counters %s: %s", file, strerror(errno));
+		return 0;
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		line[strcspn(line, "\n")] = 0;
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%63s %63s %63s %" SCNu64 " %" SCNu64 " %" SCNu64,
+			   ns, src, grp, &pkt, &bytes, &wrong_if) != 6 ||
+		    inet_str2addr(src, &source) || inet_str2addr(grp, &group)) {
+			smclog(LOG_WARNING, "Skipping invalid counter record: %s", line);
+			continue;
+		}
+
+		n = NULL;
+		if (strcmp(ns, "-")) {
+			n = netns_find(ns);
+			if (!n)
+				continue;
+		}
+
+		c = get(n, &source, &group);
+		c->pkt      = pkt;
+		c->bytes    = bytes;
+		c->wrong_if = wrong_if;
+		gone(c);
+		num++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return num;
+}
+
+/**
+ * counter_save - Save all counters to @file
+ * @file: File to replace, the directory must be writable
+ *
+ * Counters of installed entries are sampled first, so this is also
+ * called on exit, before the kernel MFC is flushed.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int counter_save(const char *file)
+{
+	char src[INET_ADDRSTR_LEN], grp[INET_ADDRSTR_LEN];
+	char tmp[strlen(file) + 5];
+	struct netns *prev, *ns;
+	struct mroute route;
+	struct counter *c;
+	int rc = 0;
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		smclog(LOG_WARNING, "Failed saving counters, cannot create %s: %s",
+		       tmp, strerror(errno));
+		return -1;
+	}
+
+	/* Sorted by namespace, so each is only entered once */
+	prev = ns = netns_current();
+	memset(&route, 0, sizeof(route));
+	RB_FOREACH(c, cnt_tree, &cnt_tree) {
+		if (c->live) {
+			if (c->ns != ns) {
+				netns_enter(c->ns);
+				ns = c->ns;
+			}
+			route.source = c->source;
+			route.group  = c->group;
+			sample(c, &route);
+		}
+
+		inet_addr2str(&c->source, src, sizeof(src));
+		inet_addr2str(&c->group, grp, sizeof(grp));
+		if (fprintf(fp, "%s %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			    c->ns ? netns_name(c->ns) : "-", src, grp,
+			    c->pkt, c->bytes, c->wrong_if) < 0)
+			rc = -1;
+	}
+	if (ns != prev)
+		netns_enter(prev);
+
+	if (rc || fflush(fp) || fsync(fileno(fp))) {
+		smclog(LOG_WARNING, "Failed writing counters %s: %s", tmp, strerror(errno));
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	fclose(fp);
+
+	if (rename(tmp, file)) {
+		smclog(LOG_WARNING, "Failed replacing counters %s: %s", file, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+void counter_init(void)
+{
+	timer_add(COUNTER_PRUNE, prune, NULL);
+}
+
+void counter_exit(void)
+{
+	struct counter *c, *tmp;
+
+	timer_del(prune, NULL);
+	RB_FOREACH_SAFE(c, cnt_tree, &cnt_tree, tmp) {
+		RB_REMOVE(cnt_tree, &cnt_tree, c);
+		free(c);
+	}
+}
@@ -0,0 +1,58 @@
+/* Cumulative per-route counters, across kernel MFC reinstalls and restarts
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_COUNTER_H_
+#define SMCROUTE_COUNTER_H_
+
+#include <stdint.h>
+#include "mroute.h"
+#include "tree.h"
+
+/* Keep counters of (S,G) not in the kernel MFC this long, in seconds */
+#define COUNTER_RETAIN (24 * 60 * 60)
+
+struct netns;
+
+struct counter {
+	RB_ENTRY(counter) node;
+	struct netns  *ns;		/* %NULL for our own */
+	inet_addr_t    source;
+	inet_addr_t    group;
+
+	uint64_t       pkt;		/* cumulative, since first seen */
+	uint64_t       bytes;
+	uint64_t       wrong_if;
+
+	int            live;		/* kernel MFC entry installed */
+	unsigned long  k_pkt;		/* kernel counters at last sample */
+	unsigned long  k_bytes;
+	unsigned long  k_wrong_if;
+	time_t         seen;		/* last sample, CLOCK_MONOTONIC sec */
+};
+
+void            counter_init   (void);
+void            counter_exit   (void);
+
+struct counter *counter_sample (struct mroute *route);
+void            counter_gone   (struct mroute *route);
+
+int             counter_load   (const char *file);
+int             counter_save   (const char *file);
+
+#endif /* SMCROUTE_COUNTER_H_ */
@@ -0,0 +1,240 @@
+/* Generation counter and changelog of route and group tables
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "gen.h"
+#include "iface.h"
+#include "ipc.h"
+#include "oifset.h"
+#include "util.h"
+
+/*
+ * Every change to a configured route, a kernel MFC entry, or a group
+ * join bumps the generation counter and is recorded in a ring of the
+ * last GEN_LOG_MAX changes.  Removals are recorded as tombstones.  A
+ * client mirroring the tables only needs to fetch the changes since the
+ * last generation it has seen, unless the ring has wrapped past it, in
+ * which case it has to resync with a full show.
+ */
+#define GEN_LOG_MAX 1024
+
+struct change {
+	uint64_t    gen;
+	uint8_t     table;
+	uint8_t     gone;
+	uint8_t     src_len;
+	uint8_t     len;
+	vifi_t      inbound;
+	char        ifname[IFNAMSIZ];	/* IIF, or interface of group */
+	inet_addr_t source;
+	inet_addr_t group;
+	uint8_t     ttl[MAX_MC_VIFS];
+};
+
+static struct change ring[GEN_LOG_MAX];
+static uint64_t generation = 0;
+
+static struct change *next(void)
+{
+	struct change *c = &ring[generation % GEN_LOG_MAX];
+
+	memset(c, 0, sizeof(*c));
+	c->gen = ++generation;
+
+	return c;
+}
+
+/**
+ * gen_route - Record change to a configured route or kernel MFC entry
+ * @table: GEN_RULE or GEN_MFC
+ * @gone:  Non-zero if the route has been removed
+ * @route: The route, after the change
+ *
+ * Returns:
+ * The new generation.
+ */
+uint64_t gen_route(int table, int gone, struct mroute *route)
+{
+	struct change *c = next();
+	struct iface *iface;
+
+	c->table   = table;
+	c->gone    = gone;
+	c->source  = route->source;
+	c->src_len = route->src_len;
+	c->group   = route->group;
+	c->len     = route->len;
+	c->inbound = route->inbound;
+	if (!gone)
+		memcpy(c->ttl, mroute_ttl(route), sizeof(c->ttl));
+
+	iface = iface_find_by_inbound(route);
+	strlcpy(c->ifname, iface ? iface->ifname : "?", sizeof(c->ifname));
+
+	return c->gen;
+}
+
+/**
+ * gen_group - Record change to a configured group join
+ * @gone:    Non-zero if the group has been left
+ * @ifname:  Interface, or wildcard, of the join
+ * @source:  Source address, may be inet_anyaddr()
+ * @src_len: Source prefix length
+ * @group:   Multicast group
+ * @len:     Group prefix length
+ *
+ * Returns:
+ * The new generation.
+ */
+uint64_t gen_group(int gone, const char *ifname, inet_addr_t *source, int src_len,
+		   inet_addr_t *group, int len)
+{
+	struct change *c = next();
+
+	c->table   = GEN_GROUP;
+	c->gone    = gone;
+	c->source  = *source;
+	c->src_len = src_len;
+	c->group   = *group;
+	c->len     = len;
+	strlcpy(c->ifname, ifname, sizeof(c->ifname));
+
+	return c->gen;
+}
+
+/* Current generation, 0 before the first change */
+uint64_t gen_current(void)
+{
+	return generation;
+}
+
+static int show_change(int sd, struct change *c, int inw)
+{
+	const char *table[] = { "rule", "mfc", "group" };
+	char src[INET_ADDRSTR_LEN] = "*", grp[INET_ADDRSTR_LEN];
+	char sg[(INET_ADDRSTR_LEN + 5) * 2 + 5];
+	char buf[MAX_MC_VIFS * 17 + 120];
+	int max_len;
+
+	max_len = inet_max_len(&c->group);
+	if (!is_anyaddr(&c->source)) {
+		inet_addr2str(&c->source, src, sizeof(src));
+		if (c->src_len != max_len)
+			snprintf(src + strlen(src), sizeof(src) - strlen(src), "/%u", c->src_len);
+	}
+	inet_addr2str(&c->group, grp, sizeof(grp));
+	if (c->len != max_len)
+		snprintf(grp + strlen(grp), sizeof(grp) - strlen(grp), "/%u", c->len);
+	snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
+
+	snprintf(buf, sizeof(buf), "%-10" PRIu64 " %-2s %-5s %-42s %-*s ", c->gen,
+		 c->gone ? "-" : "+", table[c->table], sg, inw, c->ifname);
+
+	if (c->table != GEN_GROUP && !c->gone) {
+		struct mroute route;
+		struct iface *iface;
+
+		memset(&route, 0, sizeof(route));
+		route.group = c->group;
+		memcpy(route.ttl, c->ttl, sizeof(route.ttl));
+
+		iface = iface_outbound_iterator(&route, 1);
+		while (iface) {
+			char tmp[22];
+
+			snprintf(tmp, sizeof(tmp), " %s", iface->ifname);
+			strlcat(buf, tmp, sizeof(buf));
+
+			iface = iface_outbound_iterator(&route, 0);
+		}
+	}
+	strlcat(buf, "\n", sizeof(buf));
+
+	if (ipc_send(sd, buf, strlen(buf)) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * gen_show - Show changes to route and group tables since a generation
+ * @sd:    Client socket
+ * @since: Last generation seen by client
+ *
+ * Shows each change after @since in order, with '+' for added, or
+ * updated, entries and '-' for removed.  If the changelog no longer
+ * holds all changes after @since, only a resync marker is shown.  The
+ * last line holds the current generation, to use in the next query.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int gen_show(int sd, uint64_t since)
+{
+	const char *g = "GEN", *o = "OP", *t = "TABLE", *r = "ROUTE (S,G)", *i = "IIF", *f = "OIFS";
+	uint64_t oldest = generation > GEN_LOG_MAX ? generation - GEN_LOG_MAX + 1 : 1;
+	char line[256];
+	uint64_t gen;
+	int inw;
+
+	if (since > generation || since + 1 < oldest) {
+		snprintf(line, sizeof(line), "Resync required, oldest generation %" PRIu64 "\n", oldest);
+		ipc_send(sd, line, strlen(line));
+		goto done;
+	}
+
+	inw = iface_ifname_maxlen();
+	if (inw < (int)strlen(i))
+		inw = (int)strlen(i);
+
+	snprintf(line, sizeof(line), "Changes Since %" PRIu64 "_\n", since);
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-10s %-2s %-5s %-42s %-*s  %s=\n", g, o, t, r, inw, i, f);
+	ipc_send(sd, line, strlen(line));
+
+	for (gen = since + 1; gen <= generation; gen++) {
+		if (show_change(sd, &ring[(gen - 1) % GEN_LOG_MAX], inw))
+			return 1;
+	}
+
+done:
+	snprintf(line, sizeof(line), "Generation: %" PRIu64 "\n", generation);
+	if (ipc_send(sd, line, strlen(line)) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
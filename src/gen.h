@@ -0,0 +1,37 @@
+/* Generation counter and changelog of route and group tables
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_GEN_H_
+#define SMCROUTE_GEN_H_
+
+#include <stdint.h>
+#include "mroute.h"
+
+/* Tables tracked in the changelog */
+#define GEN_RULE  0		/* configured (*,G) and (S,G) routes */
+#define GEN_MFC   1		/* kernel MFC entries */
+#define GEN_GROUP 2		/* configured group joins */
+
+uint64_t gen_route   (int table, int gone, struct mroute *route);
+uint64_t gen_group   (int gone, const char *ifname, inet_addr_t *source, int src_len,
+		      inet_addr_t *group, int len);
+uint64_t gen_current (void);
+int      gen_show    (int sd, uint64_t since);
+
+#endif /* SMCROUTE_GEN_H_ */
@@ -21,6 +21,7 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
  */
 
+#include "config.h"
 #include "queue.h"
 
 #include <errno.h>
@@ -34,17 +35,38 @@
 #include <limits.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 
 #include "log.h"
 #include "ipc.h"
 #include "iface.h"
 #include "mcgroup.h"
+#include "netns.h"
+#include "oifset.h"
+#include "socket.h"
 #include "timer.h"
 #include "util.h"
 
 static TAILQ_HEAD(iflist, iface) iface_list = TAILQ_HEAD_INITIALIZER(iface_list);
 extern int do_vifs;
 
+/*
+ * Interfaces from 'phyint IFNAME required', readiness is signaled only
+ * when all of them exist and are up.
+ */
+struct required {
+	TAILQ_ENTRY(required) link;
+	char ifname[IFNAMSIZ];
+	struct netns *ns;
+};
+static TAILQ_HEAD(, required) required_list = TAILQ_HEAD_INITIALIZER(required_list);
+
+static void (*watch_cb)(void *arg);
+static void  *watch_arg;
+
 /**
  * iface_update - Check of new interfaces
  */
@@ -114,6 +136,19 @@ void iface_update(void)
 	freeifaddrs(ifaddr);
 }
 
+/* Exchange interface list with a saved network namespace */
+void iface_netns_swap(void **state)
+{
+	struct iflist *list = *state;
+
+	if (!list) {
+		list = *state = netns_alloc(sizeof(*list));
+		TAILQ_INIT(list);
+	}
+
+	NETNS_SWAP_TAILQ(&iface_list, list, link);
+}
+
 /**
  * iface_init - Probe for interaces at startup
  *
@@ -341,7 +376,7 @@ struct iface *iface_outbound_iterator(struct mroute *route, int first)
 	while (i < MAX_MC_VIFS) {
 		vifi_t vif = i++;
 
-		if (route->ttl[vif] == 0)
+		if (mroute_ttl(route)[vif] == 0)
 			continue;
 
 #ifdef HAVE_IPV6_MULTICAST_ROUTING
@@ -425,6 +460,213 @@ mifi_t iface_match_mif_by_name(const char *ifname, struct ifmatch *state, struct
 	return NO_VIF;
 }
 
+/**
+ * iface_require - Add interface to set of required interfaces
+ * @ifname: Interface name, NULL to clear the set, e.g., on reload
+ */
+void iface_require(const char *ifname)
+{
+	struct required *req, *tmp;
+
+	if (!ifname) {
+		TAILQ_FOREACH_SAFE(req, &required_list, link, tmp) {
+			TAILQ_REMOVE(&required_list, req, link);
+			free(req);
+		}
+		return;
+	}
+
+	TAILQ_FOREACH(req, &required_list, link) {
+		if (!strcmp(req->ifname, ifname) && req->ns == netns_current())
+			return;
+	}
+
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		smclog(LOG_ERR, "Failed allocating required interface: %s", strerror(errno));
+		return;
+	}
+
+	strlcpy(req->ifname, ifname, sizeof(req->ifname));
+	req->ns = netns_current();
+	TAILQ_INSERT_TAIL(&required_list, req, link);
+}
+
+/**
+ * iface_required - Check required interfaces
+ * @buf: Buffer for space separated list of missing interfaces
+ * @len: Size of @buf
+ *
+ * A required interface is missing if it does not exist, or is not up.
+ *
+ * Returns:
+ * Number of missing required interfaces.
+ */
+int iface_required(char *buf, size_t len)
+{
+	struct required *req;
+	int num = 0;
+
+	if (len > 0)
+		buf[0] = 0;
+
+	TAILQ_FOREACH(req, &required_list, link) {
+		struct iface *iface;
+		struct netns *prev;
+
+		prev  = netns_enter(req->ns);
+		iface = iface_find_by_name(req->ifname);
+		netns_enter(prev);
+		if (iface && (iface->flags & IFF_UP))
+			continue;
+
+		strlcat(buf, " ", len);
+		strlcat(buf, req->ifname, len);
+		if (req->ns) {
+			strlcat(buf, "@", len);
+			strlcat(buf, netns_name(req->ns), len);
+		}
+		num++;
+	}
+
+	return num;
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+/*
+ * Only interfaces we have not seen, or that change state in a way that
+ * affects VIFs, routes or joins, are of interest.  Everything else is
+ * filtered out here to not reload on every link event in the system.
+ */
+static int is_relevant(struct nlmsghdr *nh)
+{
+	char ifname[IFNAMSIZ] = { 0 };
+	struct iface *iface;
+	struct rtattr *rta;
+	int len;
+
+	if (nh->nlmsg_type == RTM_NEWADDR) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+
+		iface = iface_find(ifa->ifa_index);
+		if (!iface)
+			return 1;
+
+		/* First IPv4 address, needed for VIFs on some systems */
+		return ifa->ifa_family == AF_INET && !iface->inaddr.s_addr;
+	}
+
+	if (nh->nlmsg_type == RTM_NEWLINK) {
+		struct ifinfomsg *ifi = NLMSG_DATA(nh);
+
+		len = IFLA_PAYLOAD(nh);
+		for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+			if (rta->rta_type == IFLA_IFNAME)
+				strlcpy(ifname, RTA_DATA(rta), sizeof(ifname));
+		}
+
+		iface = iface_find_by_name(ifname);
+		if (!iface || iface->ifindex != ifi->ifi_index)
+			return 1;
+
+		return (iface->flags & (IFF_UP | IFF_MULTICAST)) != (ifi->ifi_flags & (IFF_UP | IFF_MULTICAST));
+	}
+
+	return 0;
+}
+
+static void watch_read(int sd, void *arg)
+{
+	char buf[8192];
+	struct nlmsghdr *nh;
+	int changed = 0;
+	ssize_t len;
+
+	(void)arg;
+	len = recv(sd, buf, sizeof(buf), 0);
+	if (len < 0) {
+		/* ENOBUFS: we lost events, check everything */
+		if (errno != ENOBUFS)
+			return;
+		changed = 1;
+	}
+
+	for (nh = (struct nlmsghdr *)buf; len > 0 && NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+		if (is_relevant(nh))
+			changed = 1;
+	}
+
+	if (changed && watch_cb)
+		watch_cb(watch_arg);
+}
+
+/**
+ * iface_watch_init - Watch for new interfaces and addresses
+ * @cb:  Called when an interface appears, or changes state
+ * @arg: Optional argument to @cb
+ *
+ * Uses rtnetlink link and address events on Linux.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int iface_watch_init(void (*cb)(void *), void *arg)
+{
+	struct sockaddr_nl sa = { 0 };
+	int type = SOCK_RAW;
+	int sd;
+
+#ifdef HAVE_SOCK_CLOEXEC
+	type |= SOCK_CLOEXEC;
+#endif
+	sd = socket(AF_NETLINK, type, NETLINK_ROUTE);
+	if (sd < 0)
+		return 1;
+
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(sd, (struct sockaddr *)&sa, sizeof(sa)) || socket_register(sd, watch_read, NULL) < 0) {
+		close(sd);
+		return 1;
+	}
+
+	watch_cb  = cb;
+	watch_arg = arg;
+
+	return 0;
+}
+#else
+/*
+ * Poll for missing required interfaces, the callback runs every time the
+ * number missing changes, also when the last one appears, then we stop.
+ */
+static void watch_poll(void *arg)
+{
+	static int missing = -1;
+	char buf[2];
+	int num;
+
+	(void)arg;
+
+	iface_update();
+	num = iface_required(buf, sizeof(buf));
+	if (num != missing && watch_cb)
+		watch_cb(watch_arg);
+	missing = num;
+
+	if (!num)
+		timer_del(watch_poll, NULL);
+}
+
+int iface_watch_init(void (*cb)(void *), void *arg)
+{
+	watch_cb  = cb;
+	watch_arg = arg;
+
+	return timer_add(1, watch_poll, NULL) < 0;
+}
+#endif
+
 /* Return all currently known interfaces */
 int iface_show(int sd, int detail)
 {
@@ -29,6 +29,9 @@ struct iface {
 	mifi_t   mif;
 	uint8_t  mrdisc;		/* Enable multicast router discovery */
 	uint8_t  threshold;		/* TTL threshold: 1-255, default: 1 */
+	int      joins;			/* paced joins this second, see mcgroup.c */
+	int      lazy;			/* VIF/MIF created on demand, smcrouted -L */
+	int      idle;			/* on demand VIF/MIF unused since last pass */
 };
 
 struct ifmatch {
@@ -36,6 +39,8 @@ struct ifmatch {
 	size_t match_count;
 };
 
+void          iface_netns_swap        (void **state);
+
 void          iface_init              (void);
 void          iface_exit              (void);
 void          iface_update            (void);
@@ -55,6 +60,10 @@ vifi_t        iface_get_vif           (int af_family, struct iface *iface);
 vifi_t        iface_match_vif_by_name (const char *ifname, struct ifmatch *state, struct iface **found);
 mifi_t        iface_match_mif_by_name (const char *ifname, struct ifmatch *state, struct iface **found);
 
+void          iface_require           (const char *ifname);
+int           iface_required          (char *buf, size_t len);
+int           iface_watch_init        (void (*cb)(void *), void *arg);
+
 int           iface_show              (int sd, int detail);
 
 /*
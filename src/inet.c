@@ -89,42 +89,76 @@ void inet_anyaddr(sa_family_t family, inet_addr_t *addr)
 	sin->sin_addr.s_addr = htonl(INADDR_ANY);
 }
 
-inet_addr_t inet_netaddr(inet_addr_t *addr, int len)
+/*
+ * Load address into host order 32-bit words, most significant first,
+ * an IPv4 address is stored in the last word.  Returns the max prefix
+ * length of the address family.
+ */
+static int inet_words(inet_addr_t *addr, uint32_t w[4])
 {
-	inet_addr_t net = *addr;
-	uint32_t bits;
-	int max_len;
+	memset(w, 0, 4 * sizeof(w[0]));
 
-	assert(addr);
 #ifdef HAVE_IPV6_MULTICAST_HOST
-	if (addr->ss_family == AF_INET6)
-		max_len = 128;
-	else
+	if (addr->ss_family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = inet_addr6_get(addr);
+		int i;
+
+		for (i = 0; i < 4; i++)
+			w[i] = ntohl(sin6->sin6_addr.s6_addr32[i]);
+
+		return 128;
+	}
 #endif
-		max_len = 32;
-	assert(len > 0 && len <= max_len);
-	bits = max_len - len;
+	w[3] = ntohl(inet_addr_get(addr)->s_addr);
+
+	return 32;
+}
 
+static void inet_store(inet_addr_t *addr, uint32_t w[4])
+{
 #ifdef HAVE_IPV6_MULTICAST_HOST
 	if (addr->ss_family == AF_INET6) {
-		struct sockaddr_in6 *sin6 = inet_addr6_get(&net);
-		struct in6_addr s6 = sin6->sin6_addr;
-		uint32_t pos = 3;
+		struct sockaddr_in6 *sin6 = inet_addr6_get(addr);
+		int i;
 
-		while (bits >= 32) {
-			s6.s6_addr32[pos--] = 0;
-			bits -= 32;
-		}
-
-		s6.s6_addr32[pos] = htonl(ntohl(s6.s6_addr32[pos]) & (0xffffffffu << bits));
-		sin6->sin6_addr = s6;
-	} else
+		for (i = 0; i < 4; i++)
+			sin6->sin6_addr.s6_addr32[i] = htonl(w[i]);
+		return;
+	}
 #endif
-	{
-		struct in_addr *ina = inet_addr_get(&net);
+	inet_addr_get(addr)->s_addr = htonl(w[3]);
+}
+
+/* Clear, or set, the @bits least significant bits, i.e., the host part */
+static void inet_hostbits(uint32_t w[4], int bits, int set)
+{
+	int pos = 3;
+
+	while (bits > 0 && pos >= 0) {
+		uint32_t mask = bits >= 32 ? 0xffffffffu : (1u << bits) - 1;
+
+		if (set)
+			w[pos] |= mask;
+		else
+			w[pos] &= ~mask;
 
-		ina->s_addr = htonl(ntohl(ina->s_addr) & (0xffffffffu << bits));
+		bits -= 32;
+		pos--;
 	}
+}
+
+inet_addr_t inet_netaddr(inet_addr_t *addr, int len)
+{
+	inet_addr_t net = *addr;
+	uint32_t w[4];
+	int max_len;
+
+	assert(addr);
+	max_len = inet_words(&net, w);
+	assert(len >= 0 && len <= max_len);
+
+	inet_hostbits(w, max_len - len, 0);
+	inet_store(&net, w);
 
 	return net;
 }
@@ -156,6 +190,24 @@ int inet_addr_cmp(inet_addr_t *a, inet_addr_t *b)
 	return 1;
 }
 
+/*
+ * Total order of addresses, first by family then numerically, unlike
+ * inet_addr_cmp() this can be used for sorting.
+ */
+int inet_addr_order(inet_addr_t *a, inet_addr_t *b)
+{
+	if (a->ss_family != b->ss_family)
+		return a->ss_family < b->ss_family ? -1 : 1;
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (a->ss_family == AF_INET6)
+		return memcmp(&inet_addr6_get(a)->sin6_addr, &inet_addr6_get(b)->sin6_addr,
+			      sizeof(struct in6_addr));
+#endif
+
+	return memcmp(inet_addr_get(a), inet_addr_get(b), sizeof(struct in_addr));
+}
+
 const char *inet_addr2str(inet_addr_t *addr, char *str, size_t len)
 {
 	struct sockaddr_in *sin = (struct sockaddr_in *)addr;
@@ -233,81 +285,199 @@ int is_anyaddr(inet_addr_t *addr)
 	return sin->sin_addr.s_addr == htonl(INADDR_ANY);
 }
 
-int inet_iter_init(struct inet_iter *iter, inet_addr_t *addr, int len)
+/**
+ * inet_range_init - Set up a range from a prefix
+ * @range: Range to set up
+ * @addr:  Any address in the range, host bits are cleared
+ * @len:   Prefix length, 0 up to the max for the address family
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int inet_range_init(struct inet_range *range, inet_addr_t *addr, int len)
 {
+	if (!range || !addr)
+		return errno = EINVAL;
+	if (len < 0 || len > inet_max_len(addr))
+		return errno = EINVAL;
+
+	range->addr = inet_netaddr(addr, len);
+	range->len  = len;
+
+	return 0;
+}
+
+/* Number of host bits, the range holds 2^bits addresses */
+int inet_range_bits(struct inet_range *range)
+{
+	return inet_max_len(&range->addr) - range->len;
+}
+
+/* Last address in range, with all host bits set */
+inet_addr_t inet_range_last(struct inet_range *range)
+{
+	inet_addr_t last = range->addr;
+	uint32_t w[4];
 	int max_len;
 
-	if (!iter)
+	max_len = inet_words(&last, w);
+	inet_hostbits(w, max_len - range->len, 1);
+	inet_store(&last, w);
+
+	return last;
+}
+
+int inet_range_contains(struct inet_range *range, inet_addr_t *addr)
+{
+	inet_addr_t net;
+
+	if (range->addr.ss_family != addr->ss_family)
+		return 0;
+
+	net = inet_netaddr(addr, range->len);
+
+	return !inet_addr_order(&range->addr, &net);
+}
+
+/**
+ * inet_range_intersect - Find overlap of two ranges
+ * @a:   First range
+ * @b:   Second range
+ * @out: Optional, set to the overlap, if any
+ *
+ * Two prefixes either do not overlap at all, or one contains the other,
+ * in which case the overlap is the longer prefix.
+ *
+ * Returns:
+ * Non-zero if the ranges overlap, otherwise zero.
+ */
+int inet_range_intersect(struct inet_range *a, struct inet_range *b, struct inet_range *out)
+{
+	struct inet_range *longer, *shorter;
+
+	if (a->len >= b->len) {
+		longer  = a;
+		shorter = b;
+	} else {
+		longer  = b;
+		shorter = a;
+	}
+
+	if (!inet_range_contains(shorter, &longer->addr))
+		return 0;
+
+	if (out)
+		*out = *longer;
+
+	return 1;
+}
+
+/* Split range in two halves, fails with EINVAL for a single address */
+int inet_range_split(struct inet_range *range, struct inet_range *lo, struct inet_range *hi)
+{
+	inet_addr_t addr;
+	uint32_t w[4];
+	int bit;
+
+	if (range->len >= inet_max_len(&range->addr))
 		return errno = EINVAL;
 
-#ifdef HAVE_IPV6_MULTICAST_HOST
-	if (addr->ss_family == AF_INET6)
-		max_len = 128;
-	else
-#endif
-	max_len = 32;
-	if (len < 0 || len > max_len) {
-		iter->num = 0;
+	addr = range->addr;
+	bit  = inet_words(&addr, w) - range->len - 1;
+	w[3 - bit / 32] |= 1u << (bit % 32);
+	inet_store(&addr, w);
+
+	inet_range_init(lo, &range->addr, range->len + 1);
+	inet_range_init(hi, &addr, range->len + 1);
+
+	return 0;
+}
+
+/*
+ * The iterator keeps the next address and the last address of the
+ * range, so it works for any prefix length, including IPv6 ranges with
+ * more than 2^32 addresses.  It holds all state needed to resume, so a
+ * caller may process a range in chunks, see inet_iter_chunk().
+ */
+int inet_iter_init(struct inet_iter *iter, inet_addr_t *addr, int len)
+{
+	struct inet_range range;
+
+	if (!iter)
 		return errno = EINVAL;
-	}
+
+	iter->done = 1;
+	if (inet_range_init(&range, addr, len))
+		return errno;
 
 	iter->orig = *addr;
 	iter->len  = len;
-	iter->addr = inet_netaddr(addr, len);
-	iter->num  = 1 << (max_len - len);
+	iter->addr = range.addr;
+	iter->last = inet_range_last(&range);
+	iter->done = 0;
 
 	return 0;
 }
 
 int inet_iterator(struct inet_iter *iter, inet_addr_t *addr)
 {
+	uint32_t w[4];
+	int pos;
+
 	if (!iter) {
 		errno = EINVAL;
 		return 0;
 	}
-	if (iter->num-- == 0)
+	if (iter->done)
 		return 0;
 
 	*addr = iter->addr;		/* prepared already */
+	if (!inet_addr_order(&iter->addr, &iter->last)) {
+		iter->done = 1;
+		return 1;
+	}
 
-#ifdef HAVE_IPV6_MULTICAST_HOST
-	if (addr->ss_family == AF_INET6) {
-		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&iter->addr;
-		struct in6_addr s6 = sin6->sin6_addr;
-		uint32_t pos = 4;
-
-		while (pos--) {
-			uint32_t addr32 = ntohl(s6.s6_addr32[pos]);
+	inet_words(&iter->addr, w);
+	for (pos = 3; pos >= 0; pos--) {
+		if (++w[pos])
+			break;
+	}
+	inet_store(&iter->addr, w);
 
-			addr32++;
-			s6.s6_addr32[pos] = htonl(addr32);
-			if (addr32 > 0)
-				break;
-		}
+	return 1;
+}
 
-		sin6->sin6_addr = s6;
-	} else
-#endif
-	{
-		struct sockaddr_in *sin = (struct sockaddr_in *)&iter->addr;
-		in_addr_t ina;
+/**
+ * inet_iter_chunk - Get next chunk of addresses from an iterator
+ * @iter: Iterator from inet_iter_init()
+ * @vec:  Array of at least @max addresses
+ * @max:  Max number of addresses to return
+ *
+ * Returns:
+ * Number of addresses stored in @vec, zero when the range is done.
+ */
+size_t inet_iter_chunk(struct inet_iter *iter, inet_addr_t *vec, size_t max)
+{
+	size_t num = 0;
 
-		ina = ntohl(sin->sin_addr.s_addr);
-		sin->sin_addr.s_addr = htonl(++ina);
-	}
+	while (num < max && inet_iterator(iter, &vec[num]))
+		num++;
 
-	return 1;
+	return num;
 }
 
 #ifdef _UNIT_TEST
 #include <err.h>
 #include <stdio.h>
+#define NELEMS(array) (sizeof(array) / sizeof(array[0]))
 
 int main(void)
 {
+	struct inet_range range, lo, hi;
 	char str[INET_ADDRSTR_LEN];
 	struct inet_iter iter;
-	inet_addr_t addr;
+	inet_addr_t addr, vec[3];
+	size_t num;
 
 	inet_anyaddr(AF_INET6, &addr);
 	if (!is_anyaddr(&addr))
@@ -316,21 +486,33 @@ int main(void)
 
 	inet_str2addr("192.168.1.42", &addr);
 	inet_iter_init(&iter, &addr, 24);
-	printf("Got num: %u\n", iter.num);
 	while (inet_iterator(&iter, &addr))
-		printf("%s num %u\n", inet_addr2str(&addr, str, sizeof(str)), iter.num);
+		printf("%s\n", inet_addr2str(&addr, str, sizeof(str)));
 
 	inet_str2addr("2001::1", &addr);
 	inet_iter_init(&iter, &addr, 122);
-	printf("Got num: %u -> initial str %s\n", iter.num, inet_addr2str(&addr, str, sizeof(str)));
-	while (inet_iterator(&iter, &addr))
-		printf("%s num %u\n", inet_addr2str(&addr, str, sizeof(str)), iter.num);
+	printf("Initial str %s\n", inet_addr2str(&addr, str, sizeof(str)));
+	while ((num = inet_iter_chunk(&iter, vec, NELEMS(vec))))
+		printf("%zu: %s ...\n", num, inet_addr2str(&vec[0], str, sizeof(str)));
 
 	inet_str2addr("192.168.1.42", &addr);
 	inet_iter_init(&iter, &addr, 1);
-	printf("Got num: %u\n", iter.num);
-	while (inet_iterator(&iter, &addr))
-		printf("%s num %u\n", inet_addr2str(&addr, str, sizeof(str)), iter.num);
+	inet_iterator(&iter, &addr);
+	printf("First of /1: %s\n", inet_addr2str(&addr, str, sizeof(str)));
+
+	inet_str2addr("ff05::1", &addr);
+	inet_range_init(&range, &addr, 16);
+	addr = inet_range_last(&range);
+	printf("ff05::/16 has 2^%d addresses, last %s\n", inet_range_bits(&range),
+	       inet_addr2str(&addr, str, sizeof(str)));
+
+	inet_str2addr("0.0.0.0", &addr);
+	inet_range_init(&range, &addr, 0);
+	inet_range_split(&range, &lo, &hi);
+	printf("0.0.0.0/0 split: %s/%d", inet_addr2str(&lo.addr, str, sizeof(str)), lo.len);
+	printf(" %s/%d\n", inet_addr2str(&hi.addr, str, sizeof(str)), hi.len);
+	if (!inet_range_intersect(&range, &hi, &lo) || lo.len != 1)
+		err(1, "FAIL intersect");
 
 	return 0;
 }
@@ -46,12 +46,19 @@ typedef struct sockaddr_storage inet_addr_t;
 # endif
 #endif
 
+/* Prefix, i.e., network address and length */
+struct inet_range {
+	inet_addr_t addr;
+	int         len;
+};
+
 struct inet_iter {
 	inet_addr_t orig;
 	int         len;
 
-	inet_addr_t addr;
-	uint32_t    num;
+	inet_addr_t addr;		/* next address */
+	inet_addr_t last;		/* last address in range */
+	int         done;
 };
 
 void                 inet_addr_set  (inet_addr_t *addr, const struct in_addr *ina);
@@ -66,6 +73,7 @@ void                 inet_anyaddr   (sa_family_t family, inet_addr_t *addr);
 inet_addr_t          inet_netaddr   (inet_addr_t *addr, int len);
 
 int                  inet_addr_cmp  (inet_addr_t *a, inet_addr_t *b);
+int                  inet_addr_order(inet_addr_t *a, inet_addr_t *b);
 
 const char          *inet_addr2str  (inet_addr_t *addr, char *str, size_t len);
 int                  inet_str2addr  (const char *str, inet_addr_t *addr);
@@ -73,8 +81,16 @@ int                  inet_str2addr  (const char *str, inet_addr_t *addr);
 int                  is_multicast   (inet_addr_t *addr);
 int                  is_anyaddr     (inet_addr_t *addr);
 
+int                  inet_range_init     (struct inet_range *range, inet_addr_t *addr, int len);
+int                  inet_range_bits     (struct inet_range *range);
+inet_addr_t          inet_range_last     (struct inet_range *range);
+int                  inet_range_contains (struct inet_range *range, inet_addr_t *addr);
+int                  inet_range_intersect(struct inet_range *a, struct inet_range *b, struct inet_range *out);
+int                  inet_range_split    (struct inet_range *range, struct inet_range *lo, struct inet_range *hi);
+
 int                  inet_iter_init (struct inet_iter *iter, inet_addr_t *addr, int len);
 int                  inet_iterator  (struct inet_iter *iter, inet_addr_t *addr);
+size_t               inet_iter_chunk(struct inet_iter *iter, inet_addr_t *vec, size_t max);
 
 static inline int    inet_max_len   (inet_addr_t *addr)
 {
@@ -37,43 +37,79 @@
 #include "util.h"
 #include "socket.h"
 #include "mroute.h"
+#include "timer.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 extern char *ident;
 
 static struct sockaddr_un sun;
 static int ipc_socket = -1;
 
+/* Client socket taken over by a task, see ipc_detach() */
+static int detached = 0;
+
 /* max word count in one command:
  * smcroutectl add in1 source group out1 out2 .. out32 
  */
 #define CMD_MAX_WORDS (MAXVIFS + 3)
 
 
-/* Receive command from the smcroutectl */
-static void ipc_read(int sd)
+/*
+ * Client with a replace transaction in progress.  Its socket is read
+ * from the event loop as data arrives, see ipc_attach(), and it is
+ * dropped if idle for more than REPLACE_TIMEOUT seconds.
+ */
+#define REPLACE_TIMEOUT 5
+
+static struct {
+	int    sd;
+	char   buf[MX_CMDPKT_SZ];
+	size_t rx;
+	time_t last;
+} pending = { .sd = -1 };
+
+
+static time_t now_sec(void)
+{
+	struct timespec now;
+
+	timer_now(&now);
+	return now.tv_sec;
+}
+
+/*
+ * Receive command(s) from the smcroutectl.  @buf holds @len bytes of a
+ * partial command from a previous call, on return the partial command
+ * received now.  Returns non-zero if the client has a replace in
+ * progress, and more is expected, otherwise the client is done.
+ */
+static int ipc_read(int sd, char *buf, size_t *len, int first_call)
 {
 	/* since command len must be limited by the max number of oifs
 	preallocate ipc_msg only once in advance */  
 	char msg_buf[sizeof(struct ipc_msg) + CMD_MAX_WORDS * sizeof(char *)];
-	char buf[MX_CMDPKT_SZ];
 	const char* buf_ptr;
-	ssize_t rx = 0, rx_curr;
-	int first_call = 1;
-
-	memset(buf, 0, sizeof(buf));
+	ssize_t rx = *len, rx_curr;
 
 	/* since client message would be big enough and couldn't fit into buffer
 	we have to make multiple iterations to receive all data */ 
 	while(1) {
-		rx_curr = ipc_receive(sd, buf + rx, sizeof(buf) - rx, first_call);
+		/* the command follows a namespace selection at once */
+		rx_curr = ipc_receive(sd, buf + rx, MX_CMDPKT_SZ - rx, first_call || msg_selecting());
 		first_call = 0;
 		if(rx_curr <= 0) {
-			if (errno == EAGAIN)
-				return; /* no more data from client */
+			if (errno == EAGAIN) {
+				/* no more data from client, for now */
+				*len = rx;
+				return msg_replacing(sd);
+			}
 			/* Skip logging client disconnects */
 			else if (errno != ECONNRESET)
 				smclog(LOG_WARNING, "Failed receiving IPC message from client: %s", strerror(errno));
-			return;
+			return 0;
 		}
 
 		rx += rx_curr;
@@ -94,7 +130,7 @@ static void ipc_read(int sd)
 					break;
 				}
 				smclog(LOG_WARNING, "Failed to parse IPC message from client: %s", strerror(errno));
-				return;
+				return 0;
 			}
 
 			if (msg_do(sd, msg)) {
@@ -102,7 +138,10 @@ static void ipc_read(int sd)
 					smclog(LOG_WARNING, "Unknown or malformed IPC message '%c' from client.", msg->cmd);
 				errno = 0;
 				ipc_send(sd, log_message, strlen(log_message) + 1);
-			} else {
+			} else if (detached) {
+				/* Reply sent by task, see ipc_done() */
+				return 0;
+			} else if (!msg_selecting() && !msg_replacing(sd)) {
 				ipc_send(sd, "", 1);
 			}
 			/* shift to the next command if any and reduce remaining bytes in buffer */
@@ -112,9 +151,69 @@ static void ipc_read(int sd)
 	}
 }
 
+/* Client done, or gone, close its socket unless taken over by a task */
+static void ipc_release(int sd)
+{
+	msg_disconnect(sd);
+	if (detached)
+		detached = 0;
+	else
+		close(sd);
+}
+
+static void ipc_timeout(void *arg);
+
+/* Stop reading the client with a replace in progress, see ipc_attach() */
+static void ipc_drop(void)
+{
+	int sd = pending.sd;
+
+	timer_del(ipc_timeout, NULL);
+	socket_unregister(sd);
+	pending.sd = -1;
+	ipc_release(sd);
+}
+
+static void ipc_pending(int sd, void *arg)
+{
+	(void)arg;
+
+	pending.last = now_sec();
+	if (!ipc_read(sd, pending.buf, &pending.rx, 0))
+		ipc_drop();
+}
+
+static void ipc_timeout(void *arg)
+{
+	(void)arg;
+
+	if (pending.sd < 0 || now_sec() - pending.last < REPLACE_TIMEOUT)
+		return;
+
+	smclog(LOG_WARNING, "Client idle more than %d sec during replace", REPLACE_TIMEOUT);
+	ipc_drop();
+}
+
+/*
+ * Keep reading the rest of a replace transaction from the event loop,
+ * instead of blocking until the client is done.
+ */
+static void ipc_attach(int sd, const char *buf, size_t len)
+{
+	memcpy(pending.buf, buf, len);
+	pending.rx   = len;
+	pending.sd   = sd;
+	pending.last = now_sec();
+
+	socket_register(sd, ipc_pending, NULL);
+	timer_add(1, ipc_timeout, NULL);
+}
+
 static void ipc_accept(int sd, void *arg)
 {
+	char buf[MX_CMDPKT_SZ];
 	socklen_t socklen = 0;
+	size_t len = 0;
 	int client;
 
 	(void)arg;
@@ -122,8 +221,10 @@ static void ipc_accept(int sd, void *arg)
 	if (client < 0)
 		return;
 
-	ipc_read(client);
-	close(client);
+	if (ipc_read(client, buf, &len, 1))
+		ipc_attach(client, buf, len);
+	else
+		ipc_release(client);
 }
 
 /**
@@ -174,6 +275,8 @@ int ipc_init(char *path)
  */
 void ipc_exit(void)
 {
+	if (pending.sd >= 0)
+		socket_close(pending.sd);
 	if (ipc_socket >= 0)
 		socket_close(ipc_socket);
 	unlink(sun.sun_path);
@@ -192,12 +295,39 @@ void ipc_exit(void)
  */
 int ipc_send(int sd, const char *buf, size_t len)
 {
-	if (write(sd, buf, len) != (ssize_t)len)
+	/* Client may be gone, e.g., timed out waiting for a task, see ipc_done() */
+	if (send(sd, buf, len, MSG_NOSIGNAL) != (ssize_t)len)
 		return -1;
 
 	return len;
 }
 
+/**
+ * ipc_detach - Keep client socket open after the current command
+ *
+ * Called by a command that runs as a task, in slices, see task.c.  The
+ * task takes over the client socket, any further commands from the
+ * client are ignored, and the task calls ipc_done() when finished.
+ */
+void ipc_detach(void)
+{
+	detached = 1;
+}
+
+/**
+ * ipc_done - Send reply to, and close, a detached client socket
+ * @sd:     Client socket, from the task's command
+ * @result: Result of the command, non-zero sends last log message
+ */
+void ipc_done(int sd, int result)
+{
+	if (result)
+		ipc_send(sd, log_message, strlen(log_message) + 1);
+	else
+		ipc_send(sd, "", 1);
+	close(sd);
+}
+
 /**
  * ipc_server_read - Read IPC message from client
  * @sd:  Client socket from ipc_accept()
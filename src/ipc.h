@@ -11,6 +11,9 @@ int     ipc_send   (int sd, const char *buf, size_t len);
 ssize_t ipc_receive(int sd, char *buf, size_t len, int first_call);
 int     ipc_parse  (const char *buf, size_t sz, void *msg_buf);
 
+void    ipc_detach (void);
+void    ipc_done   (int sd, int result);
+
 #endif /* SMCROUTE_IPC_H_ */
 
 /**
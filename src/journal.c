@@ -0,0 +1,831 @@
+/* Journal of runtime changes, with snapshot, replayed on restart
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+#include "queue.h"
+#include "tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "counter.h"
+#include "inet.h"
+#include "journal.h"
+#include "log.h"
+#include "mroute.h"
+#include "netns.h"
+#include "timer.h"
+#include "util.h"
+
+/*
+ * Routes and groups added, or removed, with smcroutectl only live in
+ * memory.  With smcrouted -J FILE each successful change is appended to
+ * FILE, one record per line, in the same form as the IPC message:
+ *
+ *     CMD NETNS ARG...
+ *
+ * where NETNS is '-' for our own namespace.  A committed replace is
+ * appended as a block of records, from 'B' to 'C'.
+ *
+ * All records are also folded into an in-memory model, by route and by
+ * group.  Later changes to the same route, or group, are merged into
+ * its record, so the model only grows with the number of routes and
+ * groups, not with the number of changes.  Records with wildcards or
+ * prefix lengths may overlap others, so they are kept verbatim, and
+ * nothing before them is folded with anything after them.  A replace
+ * drops all earlier records of its namespace.
+ *
+ * When the journal has grown to the size of the snapshot, the model is
+ * written to FILE.snap and the journal is truncated.  On startup, and
+ * after each reload of the .conf file, the model is replayed in bulk.
+ * Replaying a record twice has no further effect, so a crash between
+ * writing the snapshot and truncating the journal is harmless.
+ *
+ * The cumulative route counters, see counter.c, are saved alongside in
+ * FILE.counters, every JOURNAL_SAVE seconds and on exit.
+ */
+
+/* Max length of a record, and words: cmd, namespace, and IPC args */
+#define REC_LEN   (MX_CMDPKT_SZ + NETNS_NAMELEN + 8)
+#define REC_WORDS (MAX_MC_VIFS + 5)
+
+struct rec {
+	TAILQ_ENTRY(rec) link;
+	RB_ENTRY(rec)    node;
+	uint64_t         seq;
+	int              indexed;	/* in tree, newest for its key */
+
+	char            *ns;		/* "-" for our own */
+	char            *line;		/* verbatim record, or NULL */
+
+	/* Folded route ('R') or group ('G'), the key */
+	char             type;
+	char             iif[IFNAMSIZ];
+	char             src[INET_ADDRSTR_LEN];
+	char             grp[INET_ADDRSTR_LEN];
+
+	/* Folded route, or group, net change */
+	int              gone;		/* route removed */
+	int              present;	/* route added, or group joined */
+	char            *del;		/* OIFs removed, space separated */
+	char            *add;		/* OIFs added */
+};
+
+static TAILQ_HEAD(, rec) rec_list = TAILQ_HEAD_INITIALIZER(rec_list);
+static RB_HEAD(jtree, rec) rec_tree = RB_INITIALIZER(&rec_tree);
+
+static uint64_t seq;		/* of last record */
+static uint64_t barrier;	/* seq of last verbatim record */
+
+static char  *jfile;		/* FILE */
+static char  *sfile;		/* FILE.snap */
+static char  *cfile;		/* FILE.counters */
+static int    jfd = -1;
+static size_t jlines;		/* records in journal */
+static size_t slines;		/* records in snapshot */
+
+/* Replace in progress, records staged until commit */
+static char **stage;
+static size_t nstage;
+
+static int rec_cmp(struct rec *a, struct rec *b)
+{
+	int rc;
+
+	if (a->type != b->type)
+		return a->type - b->type;
+
+	rc = strcmp(a->ns, b->ns);
+	if (!rc)
+		rc = strcmp(a->iif, b->iif);
+	if (!rc)
+		rc = strcmp(a->src, b->src);
+	if (!rc)
+		rc = strcmp(a->grp, b->grp);
+
+	return rc;
+}
+
+RB_GENERATE_STATIC(jtree, rec, node, rec_cmp)
+
+static void *zalloc(size_t len)
+{
+	void *ptr;
+
+	ptr = calloc(1, len);
+	if (!ptr) {
+		smclog(LOG_ERR, "Out of memory in journal: %s", strerror(errno));
+		exit(EX_OSERR);
+	}
+
+	return ptr;
+}
+
+static char *sdup(const char *str)
+{
+	char *ptr;
+
+	ptr = zalloc(strlen(str) + 1);
+	strcpy(ptr, str);
+
+	return ptr;
+}
+
+/* Is @name one of the words in @set? */
+static int set_has(const char *set, const char *name)
+{
+	size_t len = strlen(name);
+	const char *ptr = set;
+
+	while (ptr && *ptr) {
+		if (!strncmp(ptr, name, len) && (ptr[len] == ' ' || !ptr[len]))
+			return 1;
+
+		ptr = strchr(ptr, ' ');
+		if (ptr)
+			ptr++;
+	}
+
+	return 0;
+}
+
+static char *set_add(char *set, const char *name)
+{
+	size_t len;
+
+	if (set_has(set, name))
+		return set;
+
+	len = set ? strlen(set) : 0;
+	set = realloc(set, len + strlen(name) + 2);
+	if (!set) {
+		smclog(LOG_ERR, "Out of memory in journal: %s", strerror(errno));
+		exit(EX_OSERR);
+	}
+	if (len)
+		set[len++] = ' ';
+	strcpy(&set[len], name);
+
+	return set;
+}
+
+static void set_del(char *set, const char *name)
+{
+	size_t len = strlen(name);
+	char *ptr = set;
+
+	while (ptr && *ptr) {
+		if (!strncmp(ptr, name, len) && (ptr[len] == ' ' || !ptr[len])) {
+			char *next = ptr[len] ? &ptr[len + 1] : &ptr[len];
+
+			memmove(ptr, next, strlen(next) + 1);
+			len = strlen(set);
+			if (len && set[len - 1] == ' ')
+				set[len - 1] = 0;
+			return;
+		}
+
+		ptr = strchr(ptr, ' ');
+		if (ptr)
+			ptr++;
+	}
+}
+
+/* Normalize address in @str, to @buf, returns non-zero if not foldable */
+static int addr(const char *str, char *buf, size_t len)
+{
+	inet_addr_t ina;
+
+	if (strchr(str, '/') || inet_str2addr(str, &ina))
+		return 1;
+
+	inet_addr2str(&ina, buf, len);
+
+	return 0;
+}
+
+/*
+ * Set key of route, or group, in @msg to @key, and the position of the
+ * first OIF to @oif.  Returns non-zero if @msg may overlap other routes
+ * or groups, i.e., has wildcards or prefix lengths.
+ */
+static int classify(struct ipc_msg *msg, struct rec *key, int *oif)
+{
+	inet_addr_t ina;
+	int pos = 1;
+	int i;
+
+	if (msg->count < 2 || strchr(msg->argv[0], '+') || strlen(msg->argv[0]) >= IFNAMSIZ)
+		return 1;
+	strlcpy(key->iif, msg->argv[0], sizeof(key->iif));
+
+	switch (msg->cmd) {
+	case 'a':
+	case 'r':
+		key->type = 'R';
+		if (inet_str2addr(msg->argv[1], &ina) || !is_multicast(&ina)) {
+			if (msg->count < 3 || addr(msg->argv[pos++], key->src, sizeof(key->src)))
+				return 1;
+		}
+		if (addr(msg->argv[pos++], key->grp, sizeof(key->grp)))
+			return 1;
+
+		for (i = pos; i < msg->count; i++) {
+			if (strchr(msg->argv[i], '+'))
+				return 1;
+		}
+		*oif = pos;
+		return 0;
+
+	case 'j':
+	case 'l':
+		key->type = 'G';
+		if (msg->count == 3 && addr(msg->argv[pos++], key->src, sizeof(key->src)))
+			return 1;
+		if (addr(msg->argv[pos++], key->grp, sizeof(key->grp)))
+			return 1;
+		*oif = pos;
+		return 0;
+
+	default:
+		break;
+	}
+
+	return 1;
+}
+
+static struct rec *rec_new(const char *ns)
+{
+	struct rec *r;
+
+	r = zalloc(sizeof(*r));
+	r->seq = ++seq;
+	r->ns  = sdup(ns);
+	TAILQ_INSERT_TAIL(&rec_list, r, link);
+
+	return r;
+}
+
+static void rec_free(struct rec *r)
+{
+	TAILQ_REMOVE(&rec_list, r, link);
+	if (r->indexed)
+		RB_REMOVE(jtree, &rec_tree, r);
+
+	free(r->ns);
+	free(r->line);
+	free(r->del);
+	free(r->add);
+	free(r);
+}
+
+/* Add record verbatim, nothing before it may be folded after it */
+static void verbatim(const char *ns, const char *line)
+{
+	struct rec *r;
+
+	r = rec_new(ns);
+	r->line = sdup(line);
+	barrier = r->seq;
+}
+
+/* Fold change in @msg, from record @line, into the model */
+static void fold(const char *ns, struct ipc_msg *msg, const char *line)
+{
+	struct rec key = { 0 }, *r;
+	int i, oif;
+
+	if (classify(msg, &key, &oif)) {
+		verbatim(ns, line);
+		return;
+	}
+
+	key.ns = (char *)ns;
+	r = RB_FIND(jtree, &rec_tree, &key);
+	if (!r || r->seq <= barrier) {
+		if (r) {
+			RB_REMOVE(jtree, &rec_tree, r);
+			r->indexed = 0;
+		}
+
+		r = rec_new(ns);
+		r->type = key.type;
+		strlcpy(r->iif, key.iif, sizeof(r->iif));
+		strlcpy(r->src, key.src, sizeof(r->src));
+		strlcpy(r->grp, key.grp, sizeof(r->grp));
+		RB_INSERT(jtree, &rec_tree, r);
+		r->indexed = 1;
+	}
+
+	switch (msg->cmd) {
+	case 'j':
+	case 'l':
+		r->present = msg->cmd == 'j';
+		break;
+
+	case 'a':
+		r->present = 1;
+		for (i = oif; i < msg->count; i++)
+			r->add = set_add(r->add, msg->argv[i]);
+		break;
+
+	case 'r':
+		if (oif == msg->count) {
+			r->gone = 1;
+			r->present = 0;
+			free(r->add);
+			free(r->del);
+			r->add = r->del = NULL;
+			break;
+		}
+
+		for (i = oif; i < msg->count; i++) {
+			set_del(r->add, msg->argv[i]);
+			if (!r->gone)
+				r->del = set_add(r->del, msg->argv[i]);
+		}
+		break;
+	}
+}
+
+/* A committed replace supersedes all earlier records of its namespace */
+static void block(const char *ns, char **lines, size_t num)
+{
+	struct rec *r, *tmp;
+	size_t i;
+
+	TAILQ_FOREACH_SAFE(r, &rec_list, link, tmp) {
+		if (!strcmp(r->ns, ns))
+			rec_free(r);
+	}
+
+	for (i = 0; i < num; i++)
+		verbatim(ns, lines[i]);
+}
+
+/* Split record in @line, modified, into @msg and namespace @ns */
+static int parse(char *line, struct ipc_msg *msg, char **ns)
+{
+	char *word, *ptr = NULL;
+	int i = 0;
+
+	word = strtok_r(line, " \t\n", &ptr);
+	if (!word || word[1])
+		return -1;
+	msg->cmd = word[0];
+
+	*ns = strtok_r(NULL, " \t\n", &ptr);
+	if (!*ns)
+		return -1;
+
+	while ((word = strtok_r(NULL, " \t\n", &ptr))) {
+		if (i == REC_WORDS)
+			return -1;
+		msg->argv[i++] = word;
+	}
+	msg->count = i;
+	msg->len   = 0;
+
+	return 0;
+}
+
+/* Format @msg as a record in @buf, in the current network namespace */
+static char *format(struct ipc_msg *msg, char *buf, size_t len)
+{
+	const char *ns = netns_name(netns_current());
+	size_t pos;
+	int i;
+
+	pos = snprintf(buf, len, "%c %s", msg->cmd, ns[0] ? ns : "-");
+	for (i = 0; i < msg->count && pos < len; i++)
+		pos += snprintf(&buf[pos], len - pos, " %s", msg->argv[i]);
+
+	return buf;
+}
+
+/* Call @cb for each record needed to recreate @r */
+static int emit(struct rec *r, int (*cb)(const char *, void *), void *arg)
+{
+	char line[REC_LEN], key[IFNAMSIZ + INET_ADDRSTR_LEN * 2 + 3];
+	int rc = 0;
+
+	if (!r->type)
+		return cb(r->line, arg);
+
+	snprintf(key, sizeof(key), "%s%s%s %s", r->iif, r->src[0] ? " " : "", r->src, r->grp);
+	if (r->type == 'G') {
+		snprintf(line, sizeof(line), "%c %s %s", r->present ? 'j' : 'l', r->ns, key);
+		return cb(line, arg);
+	}
+
+	if (r->gone || (r->del && r->del[0])) {
+		snprintf(line, sizeof(line), "r %s %s%s%s", r->ns, key,
+			 r->gone ? "" : " ", r->gone ? "" : r->del);
+		rc += cb(line, arg);
+	}
+
+	if (r->present) {
+		snprintf(line, sizeof(line), "a %s %s%s%s", r->ns, key,
+			 r->add && r->add[0] ? " " : "", r->add ? r->add : "");
+		rc += cb(line, arg);
+	}
+
+	return rc;
+}
+
+/* Load records from @file into the model, returns number of records */
+static size_t load(const char *file)
+{
+	char msg_buf[sizeof(struct ipc_msg) + REC_WORDS * sizeof(char *)];
+	struct ipc_msg *msg = (struct ipc_msg *)msg_buf;
+	char *line = NULL, *buf, *ns;
+	char **blk = NULL;
+	size_t len = 0, num = 0, nblk = 0, i;
+	int in_blk = 0;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			smclog(LOG_WARNING, "Failed reading journal %s: %s", file, strerror(errno));
+		return 0;
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		line[strcspn(line, "\n")] = 0;
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		buf = sdup(line);
+		if (parse(buf, msg, &ns)) {
+			smclog(LOG_WARNING, "Skipping invalid journal record: %s", line);
+			free(buf);
+			continue;
+		}
+		num++;
+
+		if (msg->cmd == 'B') {
+			if (in_blk)
+				smclog(LOG_WARNING, "Dropping incomplete replace in journal %s", file);
+			for (i = 0; i < nblk; i++)
+				free(blk[i]);
+			nblk = 0;
+			in_blk = 1;
+		}
+
+		if (in_blk) {
+			blk = realloc(blk, (nblk + 1) * sizeof(char *));
+			if (!blk) {
+				smclog(LOG_ERR, "Out of memory in journal: %s", strerror(errno));
+				exit(EX_OSERR);
+			}
+			blk[nblk++] = sdup(line);
+
+			if (msg->cmd == 'C') {
+				block(ns, blk, nblk);
+				for (i = 0; i < nblk; i++)
+					free(blk[i]);
+				nblk = 0;
+				in_blk = 0;
+			}
+		} else if (msg->cmd != 'C')
+			fold(ns, msg, line);
+
+		free(buf);
+	}
+
+	if (in_blk)
+		smclog(LOG_WARNING, "Dropping incomplete replace in journal %s", file);
+	for (i = 0; i < nblk; i++)
+		free(blk[i]);
+	free(blk);
+	free(line);
+	fclose(fp);
+
+	return num;
+}
+
+static int write_rec(const char *line, void *arg)
+{
+	FILE *fp = arg;
+
+	if (fprintf(fp, "%s\n", line) < 0)
+		return 1;
+	slines++;
+
+	return 0;
+}
+
+/*
+ * Write the model to a new snapshot, replacing the old one, and then
+ * truncate the journal.  The directory of the journal must be writable.
+ */
+static int compact(void)
+{
+	char tmp[strlen(sfile) + 5];
+	struct rec *r;
+	FILE *fp;
+	int rc = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", sfile);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		smclog(LOG_WARNING, "Failed compacting journal, cannot create %s: %s",
+		       tmp, strerror(errno));
+		return -1;
+	}
+
+	slines = 0;
+	TAILQ_FOREACH(r, &rec_list, link)
+		rc += emit(r, write_rec, fp);
+
+	if (rc || fflush(fp) || fsync(fileno(fp))) {
+		smclog(LOG_WARNING, "Failed writing snapshot %s: %s", tmp, strerror(errno));
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	fclose(fp);
+
+	if (rename(tmp, sfile)) {
+		smclog(LOG_WARNING, "Failed replacing snapshot %s: %s", sfile, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	if (ftruncate(jfd, 0))
+		smclog(LOG_WARNING, "Failed truncating journal %s: %s", jfile, strerror(errno));
+
+	smclog(LOG_DEBUG, "Compacted %zu journal records, snapshot has %zu", jlines, slines);
+	jlines = 0;
+
+	return 0;
+}
+
+/* Append @len bytes of records in @buf, @num of them, to the journal */
+static void append(const char *buf, size_t len, size_t num)
+{
+	if (write(jfd, buf, len) != (ssize_t)len)
+		smclog(LOG_WARNING, "Failed writing journal %s: %s", jfile, strerror(errno));
+
+	jlines += num;
+	if (jlines >= JOURNAL_MIN && jlines >= slines)
+		compact();
+}
+
+static int apply(const char *line, void *arg)
+{
+	char msg_buf[sizeof(struct ipc_msg) + REC_WORDS * sizeof(char *)];
+	struct ipc_msg *msg = (struct ipc_msg *)msg_buf;
+	size_t *num = arg;
+	char buf[REC_LEN];
+	char *ns;
+
+	strlcpy(buf, line, sizeof(buf));
+	if (parse(buf, msg, &ns))
+		return 1;
+
+	/* Removing a route, or leaving a group, not in .conf is a no-op */
+	num[0]++;
+	if (msg_replay(strcmp(ns, "-") ? ns : NULL, msg)) {
+		smclog(LOG_DEBUG, "Journal record not applied: %s", line);
+		num[1]++;
+	}
+
+	return 0;
+}
+
+static void save(void *arg)
+{
+	(void)arg;
+	counter_save(cfile);
+}
+
+static void flush(void)
+{
+	mroute_flush();
+}
+
+/**
+ * journal_replay - Apply all recorded changes
+ *
+ * Called on startup, after reading the .conf file, and on reload, after
+ * reading the .conf file but before removing routes and groups not in
+ * it, so changes made with smcroutectl are kept in place.
+ */
+void journal_replay(void)
+{
+	size_t num[2] = { 0 };
+	struct rec *r;
+
+	if (jfd == -1)
+		return;
+
+	TAILQ_FOREACH(r, &rec_list, link)
+		emit(r, apply, num);
+
+	/* Write kernel MFC once, in batches, for all namespaces */
+	netns_foreach(flush);
+
+	smclog(LOG_INFO, "Replayed journal, %zu records, %zu not applied", num[0], num[1]);
+}
+
+/**
+ * journal_init - Open journal and snapshot, replay recorded changes
+ * @file: Journal file, the snapshot is @file.snap, or %NULL to disable
+ *
+ * Returns:
+ * POSIX OK(0) on success, or non-zero on error, when the journal is
+ * disabled.
+ */
+int journal_init(const char *file)
+{
+	size_t num;
+
+	if (!file)
+		return 0;
+
+	jfile = sdup(file);
+	sfile = zalloc(strlen(file) + 6);
+	snprintf(sfile, strlen(file) + 6, "%s.snap", file);
+	cfile = zalloc(strlen(file) + 10);
+	snprintf(cfile, strlen(file) + 10, "%s.counters", file);
+
+	jfd = open(jfile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (jfd == -1) {
+		smclog(LOG_ERR, "Failed opening journal %s: %s", jfile, strerror(errno));
+		journal_exit();
+		return -1;
+	}
+
+	num  = load(sfile);
+	num += load(jfile);
+	jlines = num;
+
+	/* Before replay, so routes pick up where they left off */
+	smclog(LOG_DEBUG, "Loaded counters of %d routes", counter_load(cfile));
+	timer_add(JOURNAL_SAVE, save, NULL);
+
+	/* Start over with a compacted snapshot and an empty journal */
+	compact();
+	journal_replay();
+	smclog(LOG_DEBUG, "Loaded %zu journal records, %zu after compaction", num, slines);
+
+	return 0;
+}
+
+void journal_exit(void)
+{
+	struct rec *r, *tmp;
+
+	journal_abort();
+	TAILQ_FOREACH_SAFE(r, &rec_list, link, tmp)
+		rec_free(r);
+
+	if (jfd != -1) {
+		timer_del(save, NULL);
+		counter_save(cfile);
+		close(jfd);
+	}
+	jfd = -1;
+
+	free(jfile);
+	free(sfile);
+	free(cfile);
+	jfile = sfile = cfile = NULL;
+	jlines = slines = 0;
+}
+
+/**
+ * journal_add - Record a change, made by smcroutectl
+ * @msg: Successful IPC message, only add, remove, join, and leave
+ *
+ * Called in the network namespace the change was made in.
+ */
+void journal_add(struct ipc_msg *msg)
+{
+	char line[REC_LEN];
+	size_t len;
+	char *ns;
+
+	if (jfd == -1)
+		return;
+
+	switch (msg->cmd) {
+	case 'a':
+	case 'r':
+	case 'j':
+	case 'l':
+		break;
+
+	default:
+		return;
+	}
+
+	format(msg, line, sizeof(line) - 1);
+	len = strlen(line);
+	line[len++] = '\n';
+	line[len] = 0;
+	append(line, len, 1);
+
+	line[len - 1] = 0;
+	ns = sdup(line + 2);
+	ns[strcspn(ns, " ")] = 0;
+	fold(ns, msg, line);
+	free(ns);
+}
+
+/* Record change in replace, applied to the model on journal_commit() */
+void journal_stage(struct ipc_msg *msg)
+{
+	char line[REC_LEN];
+
+	if (jfd == -1)
+		return;
+
+	stage = realloc(stage, (nstage + 1) * sizeof(char *));
+	if (!stage) {
+		smclog(LOG_ERR, "Out of memory in journal: %s", strerror(errno));
+		exit(EX_OSERR);
+	}
+	stage[nstage++] = sdup(format(msg, line, sizeof(line)));
+}
+
+/* Replace committed, called in its network namespace */
+void journal_commit(void)
+{
+	const char *name = netns_name(netns_current());
+	char **lines, *buf, *ptr;
+	size_t i, len = 0;
+
+	if (jfd == -1)
+		return;
+
+	lines = zalloc((nstage + 2) * sizeof(char *));
+	lines[0] = zalloc(REC_LEN);
+	snprintf(lines[0], REC_LEN, "B %s", name[0] ? name : "-");
+	for (i = 0; i < nstage; i++)
+		lines[i + 1] = stage[i];
+	lines[nstage + 1] = zalloc(REC_LEN);
+	snprintf(lines[nstage + 1], REC_LEN, "C %s", name[0] ? name : "-");
+
+	for (i = 0; i < nstage + 2; i++)
+		len += strlen(lines[i]) + 1;
+
+	/* One write, so a crash leaves a complete block or a partial one */
+	ptr = buf = zalloc(len + 1);
+	for (i = 0; i < nstage + 2; i++)
+		ptr += sprintf(ptr, "%s\n", lines[i]);
+	append(buf, len, nstage + 2);
+	free(buf);
+
+	block(name[0] ? name : "-", lines, nstage + 2);
+
+	for (i = 0; i < nstage + 2; i++)
+		free(lines[i]);
+	free(lines);
+	free(stage);
+	stage  = NULL;
+	nstage = 0;
+}
+
+/* Replace aborted, drop staged records */
+void journal_abort(void)
+{
+	size_t i;
+
+	for (i = 0; i < nstage; i++)
+		free(stage[i]);
+	free(stage);
+	stage  = NULL;
+	nstage = 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
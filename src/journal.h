@@ -0,0 +1,44 @@
+/* Journal of runtime changes, with snapshot, replayed on restart
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_JOURNAL_H_
+#define SMCROUTE_JOURNAL_H_
+
+#include "msg.h"
+
+/*
+ * Compact the journal into the snapshot when it has grown to the size
+ * of the snapshot, but never before JOURNAL_MIN records
+ */
+#define JOURNAL_MIN 1024
+
+/* Save route counters to FILE.counters this often, in seconds */
+#define JOURNAL_SAVE 60
+
+int  journal_init   (const char *file);
+void journal_exit   (void);
+
+void journal_replay (void);
+
+void journal_add    (struct ipc_msg *msg);
+void journal_stage  (struct ipc_msg *msg);
+void journal_commit (void);
+void journal_abort  (void);
+
+#endif /* SMCROUTE_JOURNAL_H_ */
@@ -18,18 +18,28 @@
 #include "config.h"
 
 #include <errno.h>
+#include <stdio.h>
 #ifdef HAVE_FCNTL_H
 #include <fcntl.h>
 #endif
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 
 #include "iface.h"
 #include "kern.h"
 #include "log.h"
 #include "mrdisc.h"
+#include "netns.h"
+#include "oifset.h"
 #include "socket.h"
+#include "timer.h"
+#include "uring.h"
 #include "util.h"
 
 /*
@@ -53,6 +63,55 @@ static struct mif {
 	struct iface *iface;
 } mif_list[MAX_MC_VIFS];
 
+/* Saved state of other network namespaces, see netns.c */
+struct kern_netns {
+	int           sd4;
+	int           sd6;
+	struct iface *vif[MAX_MC_VIFS];
+	struct iface *mif[MAX_MC_VIFS];
+};
+
+/* Multicast routing table ID, for filtering netlink MFC dumps */
+static int mrt_table = 0;
+
+/* Retry counters, for all kernel writes, see kern_retry() */
+struct kern_wq kern_wq;
+
+/* Kernel MFC add/del, the setsockopt() arguments from mfc_req() */
+struct mfc_req {
+	int            sd;
+	int            level;
+	int            op;
+	socklen_t      len;
+	union {
+		struct mfcctl  mfcc;
+#ifdef HAVE_IPV6_MULTICAST_HOST
+		struct mf6cctl mf6cc;
+#endif
+	};
+};
+
+/*
+ * Simulated kernel backend, for benchmarking and testing.  All calls
+ * succeed but nothing is set in the kernel, no upcalls are received.
+ */
+static int mrt_setsockopt(int sd, int level, int op, const void *arg, socklen_t len)
+{
+	kern_wq.writes++;
+	if (kern_sim)
+		return 0;
+
+	return setsockopt(sd, level, op, arg, len);
+}
+
+static int mrt_socket(int domain, int proto, void (*cb)(int, void *), void *arg)
+{
+	if (kern_sim)
+		return socket_create(domain, SOCK_DGRAM, 0, NULL, NULL);
+
+	return socket_create(domain, SOCK_RAW, proto, cb, arg);
+}
+
 
 /*
  * This function handles both ASM and SSM join/leave for IPv4 and IPv6
@@ -164,11 +223,78 @@ static int group_req(int sd, int cmd, struct mcgroup *mcg)
 }
 #endif
 
+/* Exchange routing sockets and VIF/MIF tables with a saved namespace */
+void kern_netns_swap(void **state)
+{
+	struct kern_netns *ns = *state;
+	size_t i;
+
+	if (!ns) {
+		ns = *state = netns_alloc(sizeof(*ns));
+		ns->sd4 = ns->sd6 = -1;
+	}
+
+	NETNS_SWAP(sd4, ns->sd4);
+	NETNS_SWAP(sd6, ns->sd6);
+	for (i = 0; i < MAX_MC_VIFS; i++) {
+		NETNS_SWAP(vif_list[i].iface, ns->vif[i]);
+		NETNS_SWAP(mif_list[i].iface, ns->mif[i]);
+	}
+}
+
+/**
+ * kern_retry - Classify a failed kernel write and schedule any retry
+ * @err:     errno from the failed write
+ * @retries: Number of retries so far, incremented
+ * @when:    Time of next retry, CLOCK_MONOTONIC sec, updated
+ *
+ * Running out of memory, or buffers, is transient, the kernel is busy
+ * and the write may succeed later.  Anything else, e.g., an invalid
+ * VIF, is permanent and retrying only adds load.
+ *
+ * Returns:
+ * Non-zero if the write should be retried at @when, zero if the error
+ * is permanent, or @retries has reached KERN_RETRY_LIMIT.
+ */
+int kern_retry(int err, int *retries, time_t *when)
+{
+	struct timespec now;
+
+	switch (err) {
+	case ENOBUFS:
+	case ENOMEM:
+	case EBUSY:
+	case EINTR:
+		break;
+
+	default:
+		kern_wq.permanent++;
+		return 0;
+	}
+
+	kern_wq.transient++;
+	if (*retries >= KERN_RETRY_LIMIT) {
+		kern_wq.expired++;
+		return 0;
+	}
+
+	timer_now(&now);
+	*when = now.tv_sec + MIN(1 << *retries, KERN_RETRY_MAX);
+	(*retries)++;
+
+	return 1;
+}
+
 int kern_join_leave(int sd, int cmd, struct mcgroup *mcg)
 {
+	kern_wq.writes++;
+	if (kern_sim)
+		return 0;
+
 	if (group_req(sd, cmd, mcg)) {
 		char source[INET_ADDRSTR_LEN] = "*";
 		char group[INET_ADDRSTR_LEN];
+		int err = errno;
 		int len;
 
 		if (!is_anyaddr(&mcg->source))
@@ -179,7 +305,8 @@ int kern_join_leave(int sd, int cmd, struct mcgroup *mcg)
 		smclog(LOG_ERR, "Failed %s group (%s,%s/%d) on sd %d ... %d: %s",
 		       cmd ? "joining" : "leaving",
 		       source, group, len, sd,
-		       errno, strerror(errno));
+		       err, strerror(err));
+		errno = err;
 		return 1;
 	}
 
@@ -190,8 +317,10 @@ int kern_mroute_init(int table_id, void (*cb)(int, void *), void *arg)
 {
 	int val = 1;
 
+	mrt_table = table_id;
+
 	if (sd4 < 0) {
-		sd4 = socket_create(AF_INET, SOCK_RAW, IPPROTO_IGMP, cb, arg);
+		sd4 = mrt_socket(AF_INET, IPPROTO_IGMP, cb, arg);
 		if (sd4 < 0)
 			return -1;
 	}
@@ -199,7 +328,7 @@ int kern_mroute_init(int table_id, void (*cb)(int, void *), void *arg)
 #ifdef MRT_TABLE /* Currently only available on Linux  */
 	if (table_id != 0) {
 		smclog(LOG_INFO, "Setting IPv4 multicast routing table id %d", table_id);
-		if (setsockopt(sd4, IPPROTO_IP, MRT_TABLE, &table_id, sizeof(table_id)) < 0) {
+		if (mrt_setsockopt(sd4, IPPROTO_IP, MRT_TABLE, &table_id, sizeof(table_id)) < 0) {
 			errno = EPROTONOSUPPORT;
 			goto error;
 		}
@@ -208,11 +337,11 @@ int kern_mroute_init(int table_id, void (*cb)(int, void *), void *arg)
 	(void)table_id;
 #endif
 
-	if (setsockopt(sd4, IPPROTO_IP, MRT_INIT, &val, sizeof(val)))
+	if (mrt_setsockopt(sd4, IPPROTO_IP, MRT_INIT, &val, sizeof(val)))
 		goto error;
 
 	/* Enable "PIM" to get WRONGVIF messages */
-	if (setsockopt(sd4, IPPROTO_IP, MRT_PIM, &val, sizeof(val)))
+	if (mrt_setsockopt(sd4, IPPROTO_IP, MRT_PIM, &val, sizeof(val)))
 		smclog(LOG_ERR, "Failed enabling PIM IGMPMSG_WRONGVIF, ignoring: %s", strerror(errno));
 
 	/* Initialize virtual interface table */
@@ -232,7 +361,7 @@ int kern_mroute_exit(void)
 		return errno = EAGAIN;
 
 	/* Drop all kernel routes set by smcroute */
-	if (setsockopt(sd4, IPPROTO_IP, MRT_DONE, NULL, 0))
+	if (mrt_setsockopt(sd4, IPPROTO_IP, MRT_DONE, NULL, 0))
 		smclog(LOG_WARNING, "Failed shutting down IPv4 multicast routing socket: %s",
 		       strerror(errno));
 
@@ -284,7 +413,7 @@ int kern_vif_add(struct iface *iface)
 	smclog(LOG_DEBUG, "Map iface %-16s => VIF %-2d ifindex %2d flags 0x%04x TTL threshold %u",
 	       iface->ifname, vifc.vifc_vifi, iface->ifindex, vifc.vifc_flags, iface->threshold);
 
-	if (setsockopt(sd4, IPPROTO_IP, MRT_ADD_VIF, &vifc, sizeof(vifc)))
+	if (mrt_setsockopt(sd4, IPPROTO_IP, MRT_ADD_VIF, &vifc, sizeof(vifc)))
 		return 1;
 
 	iface->vif = vif;
@@ -309,9 +438,9 @@ int kern_vif_del(struct iface *iface)
 
 	vifc.vifc_vifi = iface->vif;
 #ifdef __linux__
-	rc = setsockopt(sd4, IPPROTO_IP, MRT_DEL_VIF, &vifc, sizeof(vifc));
+	rc = mrt_setsockopt(sd4, IPPROTO_IP, MRT_DEL_VIF, &vifc, sizeof(vifc));
 #else
-	rc = setsockopt(sd4, IPPROTO_IP, MRT_DEL_VIF, &vifc.vifc_vifi, sizeof(vifc.vifc_vifi));
+	rc = mrt_setsockopt(sd4, IPPROTO_IP, MRT_DEL_VIF, &vifc.vifc_vifi, sizeof(vifc.vifc_vifi));
 #endif
 	if (!rc) {
 		vif_list[iface->vif].iface = NULL;
@@ -321,43 +450,33 @@ int kern_vif_del(struct iface *iface)
 	return rc;
 }
 
-static int kern_mroute4(int cmd, struct mroute *route)
+static int mfc4_req(int cmd, struct mroute *route, struct mfc_req *req)
 {
-	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
-	int op = cmd ? MRT_ADD_MFC : MRT_DEL_MFC;
-	struct mfcctl mfcc = { 0 };
 	size_t i;
 
 	if (sd4 == -1) {
 		smclog(LOG_DEBUG, "No IPv4 multicast socket");
-		return -1;
+		return errno = EAGAIN;
 	}
 
-	memset(&mfcc, 0, sizeof(mfcc));
-	mfcc.mfcc_origin   = *inet_addr_get(&route->source);
-	mfcc.mfcc_mcastgrp = *inet_addr_get(&route->group);
-	mfcc.mfcc_parent   = route->inbound;
+	memset(req, 0, sizeof(*req));
+	req->sd    = sd4;
+	req->level = IPPROTO_IP;
+	req->op    = cmd ? MRT_ADD_MFC : MRT_DEL_MFC;
+	req->len   = sizeof(req->mfcc);
 
-	inet_addr2str(&route->source, origin, sizeof(origin));
-	inet_addr2str(&route->group, group, sizeof(group));
+	req->mfcc.mfcc_origin   = *inet_addr_get(&route->source);
+	req->mfcc.mfcc_mcastgrp = *inet_addr_get(&route->group);
+	req->mfcc.mfcc_parent   = route->inbound;
 
-	/* copy the TTL vector, as many as the kernel supports */
-	for (i = 0; i < NELEMS(mfcc.mfcc_ttls); i++)
-		mfcc.mfcc_ttls[i] = route->ttl[i];
+	/* copy the TTL vector, as many as the kernel supports, add only */
+	if (cmd) {
+		const uint8_t *ttl = mroute_ttl(route);
 
-	if (setsockopt(sd4, IPPROTO_IP, op, &mfcc, sizeof(mfcc))) {
-		if (ENOENT == errno)
-			smclog(LOG_DEBUG, "failed removing multicast route (%s,%s), does not exist.",
-				origin, group);
-		else
-			smclog(LOG_WARNING, "failed %s IPv4 multicast route (%s,%s): %s",
-			       cmd ? "adding" : "removing", origin, group, strerror(errno));
-		return 1;
+		for (i = 0; i < NELEMS(req->mfcc.mfcc_ttls); i++)
+			req->mfcc.mfcc_ttls[i] = ttl[i];
 	}
 
-	smclog(LOG_DEBUG, "%s %s -> %s from VIF %d", cmd ? "Add" : "Del",
-	       origin, group, route->inbound);
-
 	return 0;
 }
 
@@ -410,8 +529,10 @@ int kern_mroute6_init(int table_id, void (*cb)(int, void *), void *arg)
 {
 	int val = 1;
 
+	mrt_table = table_id;
+
 	if (sd6 < 0) {
-		sd6 = socket_create(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6, cb, arg);
+		sd6 = mrt_socket(AF_INET6, IPPROTO_ICMPV6, cb, arg);
 		if (sd6 < 0)
 			return -1;
 	}
@@ -419,7 +540,7 @@ int kern_mroute6_init(int table_id, void (*cb)(int, void *), void *arg)
 #ifdef MRT6_TABLE /* Currently only available on Linux  */
 	if (table_id != 0) {
 		smclog(LOG_INFO, "Setting IPv6 multicast routing table id %d", table_id);
-		if (setsockopt(sd6, IPPROTO_IPV6, MRT6_TABLE, &table_id, sizeof(table_id)) < 0) {
+		if (mrt_setsockopt(sd6, IPPROTO_IPV6, MRT6_TABLE, &table_id, sizeof(table_id)) < 0) {
 			errno = EPROTONOSUPPORT;
 			goto error;
 		}
@@ -428,7 +549,7 @@ int kern_mroute6_init(int table_id, void (*cb)(int, void *), void *arg)
 	(void)table_id;
 #endif
 
-	if (setsockopt(sd6, IPPROTO_IPV6, MRT6_INIT, &val, sizeof(val)))
+	if (mrt_setsockopt(sd6, IPPROTO_IPV6, MRT6_INIT, &val, sizeof(val)))
 		goto error;
 
 	/* Initialize virtual interface table */
@@ -439,7 +560,7 @@ int kern_mroute6_init(int table_id, void (*cb)(int, void *), void *arg)
 	 * On Linux pre 2.6.29 kernels net.ipv6.conf.all.mc_forwarding
 	 * is not set on MRT6_INIT so we have to do this manually
 	 */
-	if (proc_set_val(IPV6_ALL_MC_FORWARD, 1)) {
+	if (!kern_sim && proc_set_val(IPV6_ALL_MC_FORWARD, 1)) {
 		if (errno != EACCES) {
 			smclog(LOG_ERR, "Failed enabling IPv6 multicast forwarding: %s",
 			       strerror(errno));
@@ -461,7 +582,7 @@ int kern_mroute6_exit(void)
 	if (sd6 == -1)
 		return errno = EAGAIN;
 
-	if (setsockopt(sd6, IPPROTO_IPV6, MRT6_DONE, NULL, 0))
+	if (mrt_setsockopt(sd6, IPPROTO_IPV6, MRT6_DONE, NULL, 0))
 		smclog(LOG_WARNING, "Failed shutting down IPv6 multicast routing socket: %s",
 		       strerror(errno));
 
@@ -512,7 +633,7 @@ int kern_mif_add(struct iface *iface)
 	smclog(LOG_DEBUG, "Map iface %-16s => MIF %-2d ifindex %2d flags 0x%04x TTL threshold %u",
 	       iface->ifname, mif6c.mif6c_mifi, mif6c.mif6c_pifi, mif6c.mif6c_flags, iface->threshold);
 
-	if (setsockopt(sd6, IPPROTO_IPV6, MRT6_ADD_MIF, &mif6c, sizeof(mif6c)))
+	if (mrt_setsockopt(sd6, IPPROTO_IPV6, MRT6_ADD_MIF, &mif6c, sizeof(mif6c)))
 		return -1;
 
 	iface->mif = mif;
@@ -534,7 +655,7 @@ int kern_mif_del(struct iface *iface)
 
 	smclog(LOG_DEBUG, "Removing  %-16s => MIF %-2d", iface->ifname, iface->mif);
 
-	rc = setsockopt(sd6, IPPROTO_IPV6, MRT6_DEL_MIF, &iface->mif, sizeof(iface->mif));
+	rc = mrt_setsockopt(sd6, IPPROTO_IPV6, MRT6_DEL_MIF, &iface->mif, sizeof(iface->mif));
 	if (!rc) {
 		mif_list[iface->mif].iface = NULL;
 		iface->mif = -1;
@@ -543,46 +664,34 @@ int kern_mif_del(struct iface *iface)
 	return rc;
 }
 
-static int kern_mroute6(int cmd, struct mroute *route)
+static int mfc6_req(int cmd, struct mroute *route, struct mfc_req *req)
 {
-	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
-	int op = cmd ? MRT6_ADD_MFC : MRT6_DEL_MFC;
-	struct mf6cctl mf6cc = { 0 };
 	size_t i;
 
 	if (sd6 == -1)
 		return errno = EAGAIN;
-	if (!route)
-		return errno = EINVAL;
 
-	memset(&mf6cc, 0, sizeof(mf6cc));
-	mf6cc.mf6cc_origin   = *inet_addr6_get(&route->source);
-	mf6cc.mf6cc_mcastgrp = *inet_addr6_get(&route->group);
-	mf6cc.mf6cc_parent   = route->inbound;
+	memset(req, 0, sizeof(*req));
+	req->sd    = sd6;
+	req->level = IPPROTO_IPV6;
+	req->op    = cmd ? MRT6_ADD_MFC : MRT6_DEL_MFC;
+	req->len   = sizeof(req->mf6cc);
 
-	inet_addr2str(&route->source, origin, INET_ADDRSTR_LEN);
-	inet_addr2str(&route->group, group, INET_ADDRSTR_LEN);
+	req->mf6cc.mf6cc_origin   = *inet_addr6_get(&route->source);
+	req->mf6cc.mf6cc_mcastgrp = *inet_addr6_get(&route->group);
+	req->mf6cc.mf6cc_parent   = route->inbound;
 
-	IF_ZERO(&mf6cc.mf6cc_ifset);
-	for (i = 0; i < NELEMS(route->ttl); i++) {
-		if (route->ttl[i]) {
-			IF_SET(i, &mf6cc.mf6cc_ifset);
-		}
-	}
+	IF_ZERO(&req->mf6cc.mf6cc_ifset);
+	if (cmd) {
+		const uint8_t *ttl = mroute_ttl(route);
 
-	if (setsockopt(sd6, IPPROTO_IPV6, op, &mf6cc, sizeof(mf6cc))) {
-		if (ENOENT == errno)
-			smclog(LOG_DEBUG, "failed removing IPv6 multicast route (%s,%s), "
-			       "does not exist.", origin, group);
-		else
-			smclog(LOG_WARNING, "failed %s IPv6 multicast route (%s,%s): %s",
-			       cmd ? "adding" : "removing", origin, group, strerror(errno));
-		return 1;
+		for (i = 0; i < MAX_MC_VIFS; i++) {
+			if (ttl[i]) {
+				IF_SET(i, &req->mf6cc.mf6cc_ifset);
+			}
+		}
 	}
 
-	smclog(LOG_DEBUG, "%s %s -> %s from VIF %d", cmd ? "Add" : "Del",
-	       origin, group, route->inbound);
-
 	return 0;
 }
 
@@ -617,6 +726,10 @@ int kern_stats(struct mroute *route, struct mroute_stats *ms)
 {
 	if (!route || !ms)
 		return errno = EINVAL;
+	if (kern_sim) {
+		memset(ms, 0, sizeof(*ms));
+		return 0;
+	}
 
 #ifdef  HAVE_IPV6_MULTICAST_HOST
 	if (route->group.ss_family == AF_INET6)
@@ -626,31 +739,583 @@ int kern_stats(struct mroute *route, struct mroute_stats *ms)
 	return kern_stats4(route, ms);
 }
 
-int kern_mroute_add(struct mroute *route)
+/* Prepare add/del of @route in @req, returns non-zero if no routing socket */
+static int mfc_req(int cmd, struct mroute *route, struct mfc_req *req)
 {
-	if (!route)
-		return errno = EINVAL;
-
 #ifdef  HAVE_IPV6_MULTICAST_HOST
 	if (route->group.ss_family == AF_INET6)
-		return kern_mroute6(1, route);
+		return mfc6_req(cmd, route, req);
 #endif
 
-	return kern_mroute4(1, route);
+	return mfc4_req(cmd, route, req);
 }
 
-int kern_mroute_del(struct mroute *route)
+/* Log result of add/del of @route, returns non-zero with errno set on error */
+static int mfc_done(int cmd, struct mroute *route, int err)
+{
+	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
+	int ipv = route->group.ss_family == AF_INET6 ? 6 : 4;
+
+	inet_addr2str(&route->source, origin, sizeof(origin));
+	inet_addr2str(&route->group, group, sizeof(group));
+
+	if (err) {
+		if (ENOENT == err)
+			smclog(LOG_DEBUG, "failed removing IPv%d multicast route (%s,%s), does not exist.",
+			       ipv, origin, group);
+		else
+			smclog(LOG_WARNING, "failed %s IPv%d multicast route (%s,%s): %s",
+			       cmd ? "adding" : "removing", ipv, origin, group, strerror(err));
+		errno = err;
+		return 1;
+	}
+
+	smclog(LOG_DEBUG, "%s %s -> %s from VIF %d", cmd ? "Add" : "Del",
+	       origin, group, route->inbound);
+
+	return 0;
+}
+
+static int kern_mroute(int cmd, struct mroute *route)
 {
+	struct mfc_req req;
+
 	if (!route)
 		return errno = EINVAL;
 
-#ifdef  HAVE_IPV6_MULTICAST_HOST
-	if (route->group.ss_family == AF_INET6)
-		return kern_mroute6(0, route);
+	if (mfc_req(cmd, route, &req))
+		return 1;
+
+	if (mrt_setsockopt(req.sd, req.level, req.op, &req.mfcc, req.len))
+		return mfc_done(cmd, route, errno);
+
+	return mfc_done(cmd, route, 0);
+}
+
+int kern_mroute_add(struct mroute *route)
+{
+	return kern_mroute(1, route);
+}
+
+int kern_mroute_del(struct mroute *route)
+{
+	return kern_mroute(0, route);
+}
+
+#ifdef ENABLE_IO_URING
+static void batch_done(void *ctx, int res)
+{
+	struct kern_op *op = ctx;
+
+	op->err = -res;
+}
+
+/*
+ * Submit up to KERN_BATCH writes from @ops with one system call, the
+ * result of each is logged like in kern_mroute().  Returns the number
+ * of @ops handled, zero if the caller must do them one by one.  Writes
+ * not completed when the submit fails are left with err -1, for the
+ * caller to do one by one.
+ */
+static size_t mfc_batch(struct kern_op *ops, size_t num)
+{
+	struct mfc_req req[KERN_BATCH];
+	size_t i, queued = 0, done = 0;
+	int failed;
+
+	num = MIN(num, KERN_BATCH);
+	for (i = 0; i < num; i++) {
+		if (mfc_req(ops[i].add, ops[i].route, &req[i])) {
+			ops[i].err = errno;
+			req[i].sd  = -1;
+			continue;
+		}
+
+		if (uring_setsockopt(req[i].sd, req[i].level, req[i].op, &req[i].mfcc,
+				     req[i].len, &ops[i]))
+			break;
+		ops[i].err = -1;	/* not done, set by batch_done() */
+		queued++;
+	}
+
+	/* Ring not available */
+	if (i < num && !queued)
+		return 0;
+
+	failed = uring_submit(batch_done);
+
+	num = i;
+	for (i = 0; i < num; i++) {
+		if (req[i].sd == -1 || ops[i].err == -1)
+			continue;
+
+		mfc_done(ops[i].add, ops[i].route, ops[i].err);
+		done++;
+	}
+
+	kern_wq.writes  += done;
+	kern_wq.batched += done;
+	if (!failed)
+		kern_wq.submits++;
+
+	return num;
+}
+#endif /* ENABLE_IO_URING */
+
+/**
+ * kern_mroute_batch - Add and remove many kernel MFC entries
+ * @ops: Routes to add or remove, the result of each is set in @ops
+ * @num: Number of entries in @ops
+ *
+ * With io_uring, and a kernel supporting socket commands (Linux 6.7),
+ * the writes are submitted KERN_BATCH at a time, each batch with one
+ * system call.  Otherwise they are written one by one, as are the writes
+ * not completed when a submit fails partway.
+ */
+void kern_mroute_batch(struct kern_op *ops, size_t num)
+{
+	size_t i = 0, j;
+
+#ifdef ENABLE_IO_URING
+	while (!kern_sim && i < num) {
+		size_t done;
+
+		done = mfc_batch(&ops[i], num - i);
+		if (!done)
+			break;
+		i += done;
+	}
 #endif
 
-	return kern_mroute4(0, route);
+	/* Writes not completed by a failed batch, and any left */
+	for (j = 0; j < num; j++) {
+		if (j < i && ops[j].err != -1)
+			continue;
+
+		ops[j].err = kern_mroute(ops[j].add, ops[j].route) ? errno : 0;
+	}
+}
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+/* Map ifindex from netlink to our VIF/MIF, NO_VIF if not known to us */
+static vifi_t mfc_vif(int family, int ifindex)
+{
+	struct iface *iface;
+
+	iface = iface_find(ifindex);
+	if (!iface)
+		return NO_VIF;
+
+	if (family == AF_INET6)
+		return iface->mif;
+
+	return iface->vif;
+}
+
+/*
+ * Is @table ours?  Without -t ID the kernel uses its default table,
+ * which for IPv6 is the main table on some kernel configurations.
+ */
+static int mfc_table(int family, int table)
+{
+	if (mrt_table)
+		return table == mrt_table;
+	if (table == RT_TABLE_DEFAULT)
+		return 1;
+
+	return family == AF_INET6 && table == RT_TABLE_MAIN;
+}
+
+/*
+ * Parse one RTM_NEWROUTE from an IPMR/IP6MR dump into @route.  The
+ * inbound is set to NO_VIF if the IIF, or any of the OIFs, cannot be
+ * mapped to a VIF/MIF of ours.  Returns non-zero if the message is not
+ * for our table, or is an unresolved (pending) cache entry.
+ */
+static int mfc_parse(int family, struct nlmsghdr *nh, struct mroute *route)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nh);
+	int table = rtm->rtm_table;
+	struct rtattr *rta;
+	int unknown = 0;
+	int len;
+
+	if (rtm->rtm_flags & RTNH_F_UNRESOLVED)
+		return 1;
+
+	memset(route, 0, sizeof(*route));
+	route->inbound = NO_VIF;
+	route->group.ss_family  = family;
+	route->source.ss_family = family;
+	route->len     = rtm->rtm_dst_len;
+	route->src_len = rtm->rtm_src_len;
+
+	len = RTM_PAYLOAD(nh);
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		struct rtnexthop *rtnh;
+		int alen;
+
+		switch (rta->rta_type) {
+		case RTA_TABLE:
+			table = *(uint32_t *)RTA_DATA(rta);
+			break;
+
+		case RTA_SRC:
+		case RTA_DST:
+#ifdef HAVE_IPV6_MULTICAST_HOST
+			if (family == AF_INET6)
+				inet_addr6_set(rta->rta_type == RTA_SRC ? &route->source : &route->group,
+					       RTA_DATA(rta));
+			else
+#endif
+				inet_addr_set(rta->rta_type == RTA_SRC ? &route->source : &route->group,
+					      RTA_DATA(rta));
+			break;
+
+		case RTA_IIF:
+			route->inbound = mfc_vif(family, *(int *)RTA_DATA(rta));
+			break;
+
+		case RTA_MULTIPATH:
+			rtnh = RTA_DATA(rta);
+			alen = RTA_PAYLOAD(rta);
+			while (RTNH_OK(rtnh, alen)) {
+				vifi_t vif = mfc_vif(family, rtnh->rtnh_ifindex);
+
+				if (vif < NELEMS(route->ttl))
+					route->ttl[vif] = rtnh->rtnh_hops ? rtnh->rtnh_hops : 1;
+				else
+					unknown++;
+
+				alen -= RTNH_ALIGN(rtnh->rtnh_len);
+				rtnh  = RTNH_NEXT(rtnh);
+			}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (!mfc_table(family, table))
+		return 1;
+
+	if (unknown)
+		route->inbound = NO_VIF;
+
+	return 0;
+}
+
+/*
+ * Bulk dump of the kernel MFC for @family over rtnetlink, calling @cb
+ * for each resolved entry in our routing table.  Note, @cb must not
+ * modify the kernel MFC, that would disturb the ongoing dump.
+ */
+int kern_mfc_dump(int family, void (*cb)(struct mroute *, void *), void *arg)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg    rtm;
+	} req;
+	static uint32_t seq = 0;
+	char buf[16384];
+	int done = 0;
+	int rc = 0;
+	int sd;
+
+	if (!cb)
+		return errno = EINVAL;
+	if (kern_sim)
+		return errno = ENOSYS;
+
+	switch (family) {
+	case AF_INET:
+		if (sd4 == -1)
+			return errno = EAGAIN;
+		break;
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	case AF_INET6:
+		if (sd6 == -1)
+			return errno = EAGAIN;
+		break;
+#endif
+
+	default:
+		return errno = EAFNOSUPPORT;
+	}
+
+	sd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sd < 0)
+		return 1;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(req.rtm));
+	req.nh.nlmsg_type  = RTM_GETROUTE;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq   = ++seq;
+	req.rtm.rtm_family = family == AF_INET6 ? RTNL_FAMILY_IP6MR : RTNL_FAMILY_IPMR;
+
+	if (send(sd, &req, req.nh.nlmsg_len, 0) < 0) {
+		rc = 1;
+		goto done;
+	}
+
+	while (!done) {
+		struct nlmsghdr *nh;
+		ssize_t len;
+
+		len = recv(sd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			rc = 1;
+			break;
+		}
+		if (len == 0)
+			break;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			struct mroute route;
+
+			if (nh->nlmsg_seq != seq)
+				continue;
+
+			if (nh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(nh);
+
+				errno = -e->error;
+				rc = 1;
+				done = 1;
+				break;
+			}
+
+			if (nh->nlmsg_type != RTM_NEWROUTE)
+				continue;
+
+			if (mfc_parse(family, nh, &route))
+				continue;
+
+			cb(&route, arg);
+		}
+	}
+done:
+	close(sd);
+
+	return rc;
+}
+#else
+int kern_mfc_dump(int family, void (*cb)(struct mroute *, void *), void *arg)
+{
+	(void)family;
+	(void)cb;
+	(void)arg;
+
+	return errno = ENOSYS;
+}
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+#ifdef __linux__
+#define PROC_IGMP      "/proc/net/igmp"
+#define PROC_MCFILTER  "/proc/net/mcfilter"
+#define PROC_IGMP6     "/proc/net/igmp6"
+#define PROC_MCFILTER6 "/proc/net/mcfilter6"
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+/* IPv6 address in /proc/net, 32 hex digits without separators */
+static int proc_addr6(const char *str, inet_addr_t *addr)
+{
+	struct in6_addr ina;
+	size_t i;
+
+	if (strlen(str) != 2 * sizeof(ina))
+		return 1;
+
+	for (i = 0; i < sizeof(ina); i++) {
+		unsigned int byte;
+
+		if (sscanf(&str[2 * i], "%2x", &byte) != 1)
+			return 1;
+		ina.s6_addr[i] = byte;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	inet_addr6_set(addr, &ina);
+
+	return 0;
+}
+#endif
+
+/* Any-source memberships, the device lines are followed by its groups */
+static void proc_igmp(FILE *fp, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	inet_addr_t any, grp;
+	char line[256];
+	int ifindex = 0;
+
+	memset(&any, 0, sizeof(any));
+	inet_anyaddr(AF_INET, &any);
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct in_addr ina;
+		unsigned int addr;
+
+		if (line[0] != '\t') {
+			if (sscanf(line, "%d", &ifindex) != 1)
+				ifindex = 0;
+			continue;
+		}
+
+		/* Raw network byte order value, printed as a host integer */
+		if (!ifindex || sscanf(line, "%x", &addr) != 1)
+			continue;
+
+		ina.s_addr = addr;
+		memset(&grp, 0, sizeof(grp));
+		inet_addr_set(&grp, &ina);
+		cb(ifindex, &any, &grp, arg);
+	}
+}
+
+static void proc_mcfilter(FILE *fp, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	inet_addr_t src, grp;
+	char line[256];
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned int group, source;
+		struct in_addr ina;
+		int ifindex;
+
+		if (sscanf(line, "%d %*s %x %x", &ifindex, &group, &source) != 3)
+			continue;
+
+		memset(&grp, 0, sizeof(grp));
+		ina.s_addr = htonl(group);
+		inet_addr_set(&grp, &ina);
+		memset(&src, 0, sizeof(src));
+		ina.s_addr = htonl(source);
+		inet_addr_set(&src, &ina);
+		cb(ifindex, &src, &grp, arg);
+	}
+}
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+static void proc_igmp6(FILE *fp, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	inet_addr_t any, grp;
+	char line[256];
+
+	memset(&any, 0, sizeof(any));
+	inet_anyaddr(AF_INET6, &any);
+
+	while (fgets(line, sizeof(line), fp)) {
+		char group[40];
+		int ifindex;
+
+		if (sscanf(line, "%d %*s %39s", &ifindex, group) != 2 || proc_addr6(group, &grp))
+			continue;
+
+		cb(ifindex, &any, &grp, arg);
+	}
+}
+
+static void proc_mcfilter6(FILE *fp, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	inet_addr_t src, grp;
+	char line[256];
+
+	while (fgets(line, sizeof(line), fp)) {
+		char group[40], source[40];
+		int ifindex;
+
+		if (sscanf(line, "%d %*s %39s %39s", &ifindex, group, source) != 3 ||
+		    proc_addr6(group, &grp) || proc_addr6(source, &src))
+			continue;
+
+		cb(ifindex, &src, &grp, arg);
+	}
+}
+#endif
+
+/*
+ * Bulk read of all group memberships in the kernel for @family, of all
+ * sockets, not only ours, calling @cb with the interface index, source,
+ * and group of each.  Any-source memberships have the any address as
+ * source.  Source specific ones are reported with their source, in
+ * addition to the membership of the group they imply.
+ */
+int kern_mcgroup_dump(int family, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	const char *files[2];
+	size_t i;
+
+	if (!cb)
+		return errno = EINVAL;
+	if (kern_sim)
+		return errno = ENOSYS;
+
+	switch (family) {
+	case AF_INET:
+		files[0] = PROC_IGMP;
+		files[1] = PROC_MCFILTER;
+		break;
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	case AF_INET6:
+		files[0] = PROC_IGMP6;
+		files[1] = PROC_MCFILTER6;
+		break;
+#endif
+
+	default:
+		return errno = EAFNOSUPPORT;
+	}
+
+	for (i = 0; i < NELEMS(files); i++) {
+		FILE *fp;
+
+		fp = fopen(files[i], "r");
+		if (!fp) {
+			/* IPv6 disabled in kernel */
+			if (errno == ENOENT)
+				errno = EAFNOSUPPORT;
+			return 1;
+		}
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+		if (family == AF_INET6) {
+			if (i == 0)
+				proc_igmp6(fp, cb, arg);
+			else
+				proc_mcfilter6(fp, cb, arg);
+		} else
+#endif
+		if (i == 0)
+			proc_igmp(fp, cb, arg);
+		else
+			proc_mcfilter(fp, cb, arg);
+
+		fclose(fp);
+	}
+
+	return 0;
+}
+#else
+int kern_mcgroup_dump(int family, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg)
+{
+	(void)family;
+	(void)cb;
+	(void)arg;
+
+	return errno = ENOSYS;
 }
+#endif /* __linux__ */
 
 /**
  * Local Variables:
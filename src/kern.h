@@ -27,6 +27,43 @@ struct mroute_stats {
 	unsigned long ms_wrong_if;
 };
 
+/*
+ * Kernel writes refused with a transient error are retried with
+ * exponential backoff, 1, 2, 4, ... KERN_RETRY_MAX sec, at most
+ * KERN_RETRY_LIMIT times, see kern_retry()
+ */
+#define KERN_RETRY_MAX   32
+#define KERN_RETRY_LIMIT 10
+
+struct kern_wq {
+	unsigned long writes;		/* MRT ops, joins and leaves, also simulated */
+	unsigned long transient;	/* refused, queued for retry */
+	unsigned long permanent;	/* refused, not retried */
+	unsigned long retries;		/* retry attempts */
+	unsigned long expired;		/* gave up after KERN_RETRY_LIMIT */
+	unsigned long throttled;	/* upcalls dropped, backpressure */
+	unsigned long batched;		/* writes submitted in batches */
+	unsigned long submits;		/* system calls for batches */
+};
+
+/*
+ * Kernel MFC writes in kern_mroute_batch() are submitted in chunks of
+ * at most KERN_BATCH, each with a single system call, see uring.c
+ */
+#define KERN_BATCH 64
+
+struct kern_op {
+	struct mroute *route;
+	int            add;		/* add or remove */
+	int            err;		/* result, 0 or errno */
+};
+
+extern int kern_sim;
+extern struct kern_wq kern_wq;
+
+void kern_netns_swap(void **state);
+int kern_retry       (int err, int *retries, time_t *when);
+
 int kern_join_leave  (int sd, int cmd, struct mcgroup *mcg);
 
 int kern_mroute_init (int table_id, void (*cb)(int, void *), void *arg);
@@ -43,7 +80,11 @@ int kern_mif_del     (struct iface *iface);
 
 int kern_mroute_add  (struct mroute *route);
 int kern_mroute_del  (struct mroute *route);
+void kern_mroute_batch(struct kern_op *ops, size_t num);
 
 int kern_stats       (struct mroute *route, struct mroute_stats *ms);
 
+int kern_mfc_dump    (int family, void (*cb)(struct mroute *, void *), void *arg);
+int kern_mcgroup_dump(int family, void (*cb)(int, inet_addr_t *, inet_addr_t *, void *), void *arg);
+
 #endif /* SMCROUTE_KERN_H_ */
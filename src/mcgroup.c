@@ -34,14 +34,19 @@
 #include <linux/filter.h>
 #endif
 #include <sys/resource.h>
+#include <time.h>
 
 #include "log.h"
+#include "gen.h"
 #include "ipc.h"
 #include "util.h"
 #include "iface.h"
 #include "socket.h"
 #include "mcgroup.h"
 #include "kern.h"
+#include "netns.h"
+#include "task.h"
+#include "timer.h"
 
 /*
  * Track IGMP join, any-source and source specific
@@ -49,6 +54,13 @@
 static TAILQ_HEAD(kmcglist, mcgroup) kern_list = TAILQ_HEAD_INITIALIZER(kern_list);
 static TAILQ_HEAD(cmcglist, mcgroup) conf_list = TAILQ_HEAD_INITIALIZER(conf_list);
 
+/*
+ * Desired set of groups from a replace transaction, ordered the same
+ * as sorted(), see mcgroup_replace_beg()
+ */
+static RB_HEAD(mstree, mcgroup) stage_tree = RB_INITIALIZER(&stage_tree);
+static int staging = 0;
+
 #ifdef HAVE_LINUX_FILTER_H
 /*
  * Extremely simple "drop everything" filter for Linux so we do not get
@@ -72,6 +84,45 @@ static struct sock_fprog fprog = {
 #define MAX_GROUPS 20
 static int max_groups = MAX_GROUPS;
 
+/*
+ * Single (S,G) joins refused with a transient error, e.g., ENOMEM, are
+ * retried with backoff from a timer, see retry_add()
+ */
+static TAILQ_HEAD(, mcgroup) retry_list = TAILQ_HEAD_INITIALIZER(retry_list);
+
+/*
+ * With join pacing, smcrouted -j RATE, single (S,G) joins are queued
+ * and issued from a timer, at most RATE per interface and second, to
+ * avoid a storm of IGMP/MLD reports at startup and reload.  The timer
+ * runs PACE_TICKS times per second, so the joins are spread evenly over
+ * each second, not sent in one burst.  Groups with a matching route are
+ * joined first, see pace_run().  Without pacing, the joins of large
+ * ranges are queued the same way and issued by a task, TASK_SLICE joins
+ * per slice, see pace_step().
+ */
+#define PACE_TICKS 10
+
+static TAILQ_HEAD(plist, mcgroup) pace_new = TAILQ_HEAD_INITIALIZER(pace_new);
+static struct plist pace_hi = TAILQ_HEAD_INITIALIZER(pace_hi);
+static struct plist pace_lo = TAILQ_HEAD_INITIALIZER(pace_lo);
+static size_t pace_depth = 0;
+static unsigned long pace_joined = 0;
+static int pace_tick = 0;
+static int pace_rate = 0;
+
+/*
+ * Anti-entropy reconciliation of kern_list vs the group memberships in
+ * the kernel, at most SYNC_BUDGET rejoins per pass, the rest deferred.
+ */
+#define SYNC_BUDGET 64
+
+static int sync_interval = 0;
+static unsigned int sync_pass = 0;
+static struct mcgroup_sync drift;
+
+/* Max (S/LEN,G/LEN) range size for a single join, 2^16 groups */
+#define MAX_RANGE_BITS 16
+
 struct mc_sock {
 	TAILQ_ENTRY(mc_sock) link;
 
@@ -82,6 +133,57 @@ struct mc_sock {
 
 TAILQ_HEAD(mcslist, mc_sock) mc_sock_list= TAILQ_HEAD_INITIALIZER(mc_sock_list);
 
+/* Saved state of other network namespaces, see netns.c */
+struct mcgroup_netns {
+	struct kmcglist        kern_list;
+	struct cmcglist        conf_list;
+	struct mstree          stage_tree;
+	int                    staging;
+	int                    max_groups;
+	__typeof__(retry_list) retry_list;
+	struct plist           pace_new;
+	struct plist           pace_hi;
+	struct plist           pace_lo;
+	size_t                 pace_depth;
+	unsigned long          pace_joined;
+	int                    pace_tick;
+	struct mcslist         mc_sock_list;
+	struct mcgroup_sync    drift;
+};
+
+/* Exchange groups and group sockets with a saved network namespace */
+void mcgroup_netns_swap(void **state)
+{
+	struct mcgroup_netns *ns = *state;
+
+	if (!ns) {
+		ns = *state = netns_alloc(sizeof(*ns));
+		TAILQ_INIT(&ns->kern_list);
+		TAILQ_INIT(&ns->conf_list);
+		TAILQ_INIT(&ns->retry_list);
+		TAILQ_INIT(&ns->pace_new);
+		TAILQ_INIT(&ns->pace_hi);
+		TAILQ_INIT(&ns->pace_lo);
+		TAILQ_INIT(&ns->mc_sock_list);
+		ns->max_groups = MAX_GROUPS;
+	}
+
+	NETNS_SWAP_TAILQ(&kern_list,    &ns->kern_list,    link);
+	NETNS_SWAP_TAILQ(&conf_list,    &ns->conf_list,    link);
+	NETNS_SWAP_TAILQ(&retry_list,   &ns->retry_list,   link);
+	NETNS_SWAP_TAILQ(&pace_new,     &ns->pace_new,     link);
+	NETNS_SWAP_TAILQ(&pace_hi,      &ns->pace_hi,      link);
+	NETNS_SWAP_TAILQ(&pace_lo,      &ns->pace_lo,      link);
+	NETNS_SWAP_TAILQ(&mc_sock_list, &ns->mc_sock_list, link);
+	NETNS_SWAP(stage_tree,  ns->stage_tree);
+	NETNS_SWAP(staging,     ns->staging);
+	NETNS_SWAP(max_groups,  ns->max_groups);
+	NETNS_SWAP(pace_depth,  ns->pace_depth);
+	NETNS_SWAP(pace_joined, ns->pace_joined);
+	NETNS_SWAP(pace_tick,   ns->pace_tick);
+	NETNS_SWAP(drift,       ns->drift);
+}
+
 static int alloc_mc_sock(int family)
 {
 	struct mc_sock *entry;
@@ -184,10 +286,509 @@ static void list_rem(int sd, struct mcgroup *mcg)
 	}
 }
 
-void mcgroup_init(void)
+/* Retry joins waiting for retry, see retry_add() */
+static void retry_run(void *arg)
+{
+	char src[INET_ADDRSTR_LEN] = "*", grp[INET_ADDRSTR_LEN];
+	struct mcgroup *entry, *tmp;
+	struct timespec now;
+
+	(void)arg;
+	timer_now(&now);
+
+	TAILQ_FOREACH_SAFE(entry, &retry_list, link, tmp) {
+		int sd, err;
+
+		if (entry->retry_at > now.tv_sec)
+			continue;
+
+		kern_wq.retries++;
+		sd = alloc_mc_sock(entry->group.ss_family);
+		if (sd != -1 && !kern_join_leave(sd, 1, entry)) {
+			TAILQ_REMOVE(&retry_list, entry, link);
+			list_add(sd, entry);
+			free(entry);
+			continue;
+		}
+
+		err = errno;
+		if (sd != -1)
+			free_mc_sock(sd);
+		if (kern_retry(err, &entry->retries, &entry->retry_at))
+			continue;
+
+		if (!is_anyaddr(&entry->source))
+			inet_addr2str(&entry->source, src, sizeof(src));
+		inet_addr2str(&entry->group, grp, sizeof(grp));
+		smclog(LOG_WARNING, "Giving up joining (%s,%s) on %s after %d retries",
+		       src, grp, entry->ifname, entry->retries);
+
+		TAILQ_REMOVE(&retry_list, entry, link);
+		free(entry);
+	}
+
+	if (TAILQ_EMPTY(&retry_list))
+		timer_del(retry_run, NULL);
+}
+
+/*
+ * Join of the current (S,G) in @mcg failed, queue it for a retry if
+ * the error is transient.  Returns non-zero if queued.
+ */
+static int retry_add(struct mcgroup *mcg)
+{
+	struct mcgroup *entry;
+	int retries = 0;
+	time_t when;
+
+	if (!kern_retry(errno, &retries, &when))
+		return 0;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		smclog(LOG_ERR, "Failed queueing join for retry: %s", strerror(errno));
+		return 0;
+	}
+
+	*entry = *mcg;
+	entry->retries  = retries;
+	entry->retry_at = when;
+	TAILQ_INSERT_TAIL(&retry_list, entry, link);
+	timer_add(1, retry_run, NULL);
+
+	return 1;
+}
+
+/* Leaving a group, drop any pending join retry of the current (S,G) */
+static void retry_del(struct mcgroup *mcg)
+{
+	struct mcgroup *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, &retry_list, link, tmp) {
+		if (strcmp(entry->ifname, mcg->ifname))
+			continue;
+		if (inet_addr_cmp(&entry->source, &mcg->source) ||
+		    inet_addr_cmp(&entry->group, &mcg->group))
+			continue;
+
+		TAILQ_REMOVE(&retry_list, entry, link);
+		free(entry);
+	}
+}
+
+/*
+ * Join the current (S,G) in @entry, a queued paced join.  Errors are
+ * handled like in mcgroup_action(), transient ones are retried later.
+ */
+static void pace_join(struct mcgroup *entry)
+{
+	char src[INET_ADDRSTR_LEN] = "*", grp[INET_ADDRSTR_LEN];
+	int sd;
+
+retry:
+	sd = alloc_mc_sock(entry->group.ss_family);
+	if (sd != -1 && !kern_join_leave(sd, 1, entry)) {
+		list_add(sd, entry);
+		pace_joined++;
+		return;
+	}
+
+	if (sd != -1) {
+		int err = errno;
+
+		free_mc_sock(sd);
+		errno = err;
+	}
+
+	switch (errno) {
+	case EADDRINUSE:
+		return;
+
+	case ENOBUFS:
+		if (max_groups > 1) {
+			max_groups--;
+			goto retry;
+		}
+		break;
+
+	default:
+		if (retry_add(entry))
+			return;
+		break;
+	}
+
+	if (!is_anyaddr(&entry->source))
+		inet_addr2str(&entry->source, src, sizeof(src));
+	inet_addr2str(&entry->group, grp, sizeof(grp));
+	smclog(LOG_ERR, "Failed joining (%s,%s) on %s: %s", src, grp,
+	       entry->iface->ifname, strerror(errno));
+}
+
+/* Issue queued joins from @list, within each interface's @budget this second */
+static void pace_list_run(struct plist *list, int budget)
+{
+	struct mcgroup *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, list, link, tmp) {
+		if (entry->iface->joins >= budget)
+			continue;
+
+		entry->iface->joins++;
+		TAILQ_REMOVE(list, entry, link);
+		pace_depth--;
+
+		pace_join(entry);
+		free(entry);
+	}
+}
+
+/* Called PACE_TICKS times per second while there are queued joins, see pace_add() */
+static void pace_run(void *arg)
+{
+	struct mcgroup *entry, *tmp;
+	struct iface *iface;
+	int first = 1;
+	int budget;
+
+	(void)arg;
+
+	if (pace_tick == 0) {
+		while ((iface = iface_iterator(first))) {
+			first = 0;
+			iface->joins = 0;
+		}
+	}
+	budget = pace_rate * (pace_tick + 1) / PACE_TICKS;
+	pace_tick = (pace_tick + 1) % PACE_TICKS;
+
+	/* Classify here, when all routes from .conf are known */
+	TAILQ_FOREACH_SAFE(entry, &pace_new, link, tmp) {
+		TAILQ_REMOVE(&pace_new, entry, link);
+		if (mroute_has_group(&entry->group))
+			TAILQ_INSERT_TAIL(&pace_hi, entry, link);
+		else
+			TAILQ_INSERT_TAIL(&pace_lo, entry, link);
+	}
+
+	pace_list_run(&pace_hi, budget);
+	pace_list_run(&pace_lo, budget);
+
+	if (pace_depth) {
+		if (pace_tick == 0)
+			smclog(LOG_DEBUG, "Paced joins: %lu joined, %zu pending", pace_joined, pace_depth);
+		return;
+	}
+
+	smclog(LOG_INFO, "Paced joins done, %lu groups joined", pace_joined);
+	timer_del(pace_run, NULL);
+	pace_tick = 0;
+}
+
+/* Issue queued joins of large ranges, when not pacing, see pace_add() */
+static int pace_step(void *arg)
+{
+	struct mcgroup *entry;
+	int num = 0;
+
+	(void)arg;
+	while (num++ < TASK_SLICE && (entry = TAILQ_FIRST(&pace_new))) {
+		TAILQ_REMOVE(&pace_new, entry, link);
+		pace_depth--;
+
+		pace_join(entry);
+		free(entry);
+	}
+
+	if (pace_depth)
+		return 1;
+
+	smclog(LOG_DEBUG, "Queued joins done, %lu groups joined", pace_joined);
+	return 0;
+}
+
+/* Queue join of the current (S,G) in @mcg, returns non-zero on error */
+static int pace_add(struct mcgroup *mcg)
+{
+	struct mcgroup *entry;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry) {
+		smclog(LOG_ERR, "Failed queueing join: %s", strerror(errno));
+		return 1;
+	}
+
+	*entry = *mcg;
+	TAILQ_INSERT_TAIL(&pace_new, entry, link);
+	pace_depth++;
+	if (pace_rate)
+		timer_add_msec(1000 / PACE_TICKS, pace_run, NULL);
+	else
+		task_add(pace_step, NULL);
+
+	return 0;
+}
+
+/* Leaving a group, drop any queued join of the current (S,G) */
+static void pace_del(struct mcgroup *mcg)
+{
+	struct plist *lists[] = { &pace_new, &pace_hi, &pace_lo };
+	struct mcgroup *entry, *tmp;
+
+	for (size_t i = 0; i < NELEMS(lists); i++) {
+		TAILQ_FOREACH_SAFE(entry, lists[i], link, tmp) {
+			if (entry->iface != mcg->iface)
+				continue;
+			if (inet_addr_cmp(&entry->source, &mcg->source) ||
+			    inet_addr_cmp(&entry->group, &mcg->group))
+				continue;
+
+			TAILQ_REMOVE(lists[i], entry, link);
+			pace_depth--;
+			free(entry);
+		}
+	}
+}
+
+/* Number of joins queued by join pacing */
+size_t mcgroup_pace_depth(void)
+{
+	return pace_depth;
+}
+
+/* Number of groups joined by join pacing */
+unsigned long mcgroup_pace_joined(void)
+{
+	return pace_joined;
+}
+
+/* Number of joins waiting for retry */
+size_t mcgroup_retry_depth(void)
+{
+	struct mcgroup *entry;
+	size_t num = 0;
+
+	TAILQ_FOREACH(entry, &retry_list, link)
+		num++;
+
+	return num;
+}
+
+/* Group membership reconciler counters, of the current namespace */
+struct mcgroup_sync *mcgroup_sync_stats(void)
+{
+	return &drift;
+}
+
+/* FNV-1a */
+static uint32_t hash(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+
+static uint32_t hash_addr(uint32_t h, inet_addr_t *addr)
+{
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (addr->ss_family == AF_INET6)
+		return hash(h, &inet_addr6_get(addr)->sin6_addr, sizeof(struct in6_addr));
+#endif
+	return hash(h, inet_addr_get(addr), sizeof(struct in_addr));
+}
+
+static uint32_t sync_hash(int ifindex, inet_addr_t *source, inet_addr_t *group)
+{
+	uint32_t h = 0x811c9dc5;
+
+	h = hash(h, &ifindex, sizeof(ifindex));
+	h = hash_addr(h, source);
+	h = hash_addr(h, group);
+
+	return h;
+}
+
+/* Open addressing index of kern_list, by interface, source, and group */
+struct sync_index {
+	struct mcgroup **slot;
+	size_t           mask;
+};
+
+/*
+ * Called for each membership in the kernel.  Mark all our entries for
+ * it as seen.  Memberships of other sockets are not ours to touch.
+ */
+static void sync_entry(int ifindex, inet_addr_t *source, inet_addr_t *group, void *arg)
+{
+	struct sync_index *idx = arg;
+	struct mcgroup *entry;
+	size_t i;
+
+	i = sync_hash(ifindex, source, group) & idx->mask;
+	while ((entry = idx->slot[i])) {
+		if (entry->iface->ifindex == ifindex &&
+		    !inet_addr_order(&entry->source, source) &&
+		    !inet_addr_order(&entry->group, group))
+			entry->sync = sync_pass;
+
+		i = (i + 1) & idx->mask;
+	}
+}
+
+static void sync_rejoin(struct mcgroup *entry, int *budget)
+{
+	char src[INET_ADDRSTR_LEN] = "*", grp[INET_ADDRSTR_LEN];
+
+	if (*budget <= 0) {
+		drift.deferred++;
+		return;
+	}
+	(*budget)--;
+
+	if (!is_anyaddr(&entry->source))
+		inet_addr2str(&entry->source, src, sizeof(src));
+	inet_addr2str(&entry->group, grp, sizeof(grp));
+	smclog(LOG_NOTICE, "Group membership out of sync, rejoining (%s,%s) on %s",
+	       src, grp, entry->ifname);
+
+	if (!kern_join_leave(entry->sd, 1, entry)) {
+		drift.repaired++;
+		return;
+	}
+
+	/* Our socket still has it, e.g., interface moved and back again */
+	if (errno == EADDRINUSE) {
+		kern_join_leave(entry->sd, 0, entry);
+		if (!kern_join_leave(entry->sd, 1, entry)) {
+			drift.repaired++;
+			return;
+		}
+	}
+
+	drift.failed++;
+}
+
+/**
+ * mcgroup_reconcile - Rejoin groups missing in the kernel
+ *
+ * A join that failed after the fact, or an interface losing all its
+ * memberships, e.g., when moved to another network namespace and back,
+ * makes kern_list believe we are joined when the kernel is not.  This
+ * function reads all memberships from the kernel in bulk, looks each
+ * up in a hashed index of kern_list, and rejoins only the entries not
+ * found.  At most SYNC_BUDGET rejoins are made per pass, the rest are
+ * deferred to the next pass.  Called periodically, see smcrouted -r.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mcgroup_reconcile(void)
+{
+	int families[] = { AF_INET, AF_INET6 };
+	int dumped[NELEMS(families)] = { 0 };
+	struct sync_index idx = { 0 };
+	unsigned long deferred = drift.deferred;
+	unsigned long found = 0;
+	int budget = SYNC_BUDGET;
+	struct mcgroup *entry;
+	size_t num = 0, len;
+	size_t i;
+
+	TAILQ_FOREACH(entry, &kern_list, link)
+		num++;
+	if (!num)
+		return 0;
+
+	/* At most half full, keeps probe sequences short */
+	for (len = 16; len < 2 * num; len <<= 1)
+		;
+	idx.slot = calloc(len, sizeof(struct mcgroup *));
+	if (!idx.slot) {
+		smclog(LOG_WARNING, "Cannot reconcile group memberships: %s", strerror(errno));
+		return 1;
+	}
+	idx.mask = len - 1;
+
+	TAILQ_FOREACH(entry, &kern_list, link) {
+		i = sync_hash(entry->iface->ifindex, &entry->source, &entry->group) & idx.mask;
+		while (idx.slot[i])
+			i = (i + 1) & idx.mask;
+		idx.slot[i] = entry;
+	}
+
+	sync_pass++;
+	for (i = 0; i < NELEMS(families); i++) {
+		if (!kern_mcgroup_dump(families[i], sync_entry, &idx)) {
+			dumped[i] = 1;
+			continue;
+		}
+
+		/* Address family not enabled, or not supported */
+		if (errno == EAFNOSUPPORT)
+			continue;
+
+		if (errno != ENOSYS)
+			smclog(LOG_WARNING, "Failed reading group memberships: %s", strerror(errno));
+		free(idx.slot);
+		return 1;
+	}
+	free(idx.slot);
+
+	TAILQ_FOREACH(entry, &kern_list, link) {
+		for (i = 0; i < NELEMS(families); i++) {
+			if (families[i] == entry->group.ss_family)
+				break;
+		}
+		if (i == NELEMS(families) || !dumped[i])
+			continue;
+
+		if (entry->sync != sync_pass) {
+			drift.missing++;
+			found++;
+			sync_rejoin(entry, &budget);
+		}
+	}
+
+	drift.passes++;
+	drift.last_drift = found;
+	if (found)
+		smclog(LOG_INFO, "Reconciled group memberships, %lu missing, %lu rejoins deferred.",
+		       found, drift.deferred - deferred);
+
+	return 0;
+}
+
+static void reconcile_one(void)
+{
+	mcgroup_reconcile();
+}
+
+static void reconcile(void *arg)
+{
+	(void)arg;
+	netns_foreach(reconcile_one);
+}
+
+/**
+ * mcgroup_init - Set up group joins
+ * @join_rate: Max joins per interface and second, 0 to join immediately
+ * @sync_ivl:  Interval to reconcile with kernel memberships, 0 to disable
+ */
+void mcgroup_init(int join_rate, int sync_ivl)
 {
 	struct rlimit rlim;
 
+	pace_rate = join_rate;
+
+	if (sync_ivl > 0 && !sync_interval) {
+		sync_interval = sync_ivl;
+		timer_add(sync_ivl, reconcile, NULL);
+	}
+
 	if (getrlimit(RLIMIT_NOFILE, &rlim)) {
 		smclog(LOG_ERR, "Failed reading RLIMIT_NOFILE");
 		return;
@@ -219,6 +820,22 @@ void mcgroup_exit(void)
 		free_mc_sock(entry->sd);
 		free(entry);
 	}
+	TAILQ_FOREACH_SAFE(entry, &retry_list, link, tmp) {
+		TAILQ_REMOVE(&retry_list, entry, link);
+		free(entry);
+	}
+	timer_del(retry_run, NULL);
+
+	TAILQ_CONCAT(&pace_new, &pace_hi, link);
+	TAILQ_CONCAT(&pace_new, &pace_lo, link);
+	TAILQ_FOREACH_SAFE(entry, &pace_new, link, tmp) {
+		TAILQ_REMOVE(&pace_new, entry, link);
+		free(entry);
+	}
+	pace_depth = 0;
+	pace_tick = 0;
+	timer_del(pace_run, NULL);
+	task_del(pace_step, NULL);
 }
 
 static struct mcgroup *find_conf(const char *ifname, inet_addr_t *source, inet_addr_t *group, int len)
@@ -257,18 +874,117 @@ static struct mcgroup *find_kern(struct mcgroup *mcg)
 	return NULL;
 }
 
+/* Same lookup key as find_conf() */
+static int mcgroup_cmp(const void *a, const void *b)
+{
+	struct mcgroup *x = *(struct mcgroup **)a;
+	struct mcgroup *y = *(struct mcgroup **)b;
+	int rc;
+
+	rc = strcmp(x->ifname, y->ifname);
+	if (rc)
+		return rc;
+
+	rc = inet_addr_order(&x->group, &y->group);
+	if (rc)
+		return rc;
+	if (x->len != y->len)
+		return x->len - y->len;
+
+	return inet_addr_order(&x->source, &y->source);
+}
+
+static int stage_cmp(struct mcgroup *a, struct mcgroup *b)
+{
+	return mcgroup_cmp(&a, &b);
+}
+RB_GENERATE_STATIC(mstree, mcgroup, node, stage_cmp)
+
+static int stage_add(const char *ifname, inet_addr_t *source, int src_len, inet_addr_t *group, int len)
+{
+	struct mcgroup *mcg;
+
+	mcg = calloc(1, sizeof(*mcg));
+	if (!mcg) {
+		smclog(LOG_ERR, "Out of memory staging group: %s", strerror(errno));
+		return 1;
+	}
+
+	strlcpy(mcg->ifname, ifname, sizeof(mcg->ifname));
+	mcg->source  = *source;
+	mcg->src_len = src_len;
+	mcg->group   = *group;
+	mcg->len     = len;
+
+	/* Already staged */
+	if (RB_INSERT(mstree, &stage_tree, mcg))
+		free(mcg);
+
+	return 0;
+}
+
+static struct mcgroup **sorted(struct cmcglist *list, size_t *num)
+{
+	struct mcgroup **vec, *entry;
+	size_t i = 0;
+
+	*num = 0;
+	TAILQ_FOREACH(entry, list, link)
+		(*num)++;
+
+	vec = calloc(*num + 1, sizeof(*vec));
+	if (!vec)
+		return NULL;
+
+	TAILQ_FOREACH(entry, list, link)
+		vec[i++] = entry;
+	qsort(vec, *num, sizeof(*vec), mcgroup_cmp);
+
+	return vec;
+}
+
+/*
+ * Each address in a (S/LEN,G/LEN) range is a separate join, so refuse
+ * ranges that would exhaust the system, e.g., ff0e::/16.
+ */
+static int range_bits(inet_addr_t *addr, int len)
+{
+	struct inet_range range;
+
+	if (inet_range_init(&range, addr, len))
+		return 0;
+
+	return inet_range_bits(&range);
+}
+
 int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len, inet_addr_t *group, int len)
 {
 	char src[INET_ADDRSTR_LEN] = "*", grp[INET_ADDRSTR_LEN];
 	struct mcgroup *mcg;
 	struct ifmatch state;
-	int rc = 0;
+	size_t queued = 0;
+	int rc = 0, bits;
+	int queue;
 	int sd;
 
+	if (staging && cmd)
+		return stage_add(ifname, source, src_len, group, len);
+
 	if (!is_anyaddr(source))
 		inet_addr2str(source, src, sizeof(src));
 	inet_addr2str(group, grp, sizeof(grp));
 
+	bits = range_bits(source, src_len) + range_bits(group, len);
+	if (cmd && bits > MAX_RANGE_BITS) {
+		smclog(LOG_WARNING, "Too large range (%s/%d,%s/%d) on %s, max %d addresses",
+		       src, src_len, grp, len, ifname, 1 << MAX_RANGE_BITS);
+		errno = E2BIG;
+		return 1;
+	}
+
+	/* Paced, or too many to join at once, see pace_step() */
+	queue = pace_rate || (bits <= MAX_RANGE_BITS && (1 << bits) > TASK_SLICE);
+
 	mcg = find_conf(ifname, source, group, len);
 	if (mcg) {
 		if (cmd) {
@@ -301,6 +1017,7 @@ int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len
 		mcg->len     = len;
 
 		TAILQ_INSERT_TAIL(&conf_list, mcg, link);
+		gen_group(0, ifname, source, src_len, group, len);
 	}
 
 	iface_match_init(&state);
@@ -317,11 +1034,21 @@ int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len
 					struct mcgroup *kmcg;
 
 					kmcg = find_kern(mcg);
-					if (!kmcg)
+					if (!kmcg) {
+						retry_del(mcg);
+						pace_del(mcg);
 						continue;
+					}
 
 					sd = kmcg->sd;
 				} else {
+					if (queue) {
+						if (pace_add(mcg))
+							rc++;
+						else
+							queued++;
+						continue;
+					}
 				retry:
 					sd = alloc_mc_sock(group->ss_family);
 				}
@@ -352,6 +1079,9 @@ int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len
 							goto retry;
 
 						default:
+							free_mc_sock(sd);
+							if (retry_add(mcg))
+								continue;
 							break;
 						}
 					}
@@ -371,9 +1101,13 @@ int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len
 		mcg->source = siter.orig;
 	}
 
+	if (queued)
+		smclog(LOG_INFO, "Queued %zu joins of (%s,%s) on %s, %zu pending",
+		       queued, src, grp, ifname, pace_depth);
+
 	if (!cmd) {
-		TAILQ_REMOVE(&kern_list, mcg, link);
-		free_mc_sock(mcg->sd);
+		TAILQ_REMOVE(&conf_list, mcg, link);
+		gen_group(1, mcg->ifname, &mcg->source, mcg->src_len, &mcg->group, mcg->len);
 		free(mcg);
 	}
 
@@ -383,6 +1117,61 @@ int mcgroup_action(int cmd, const char *ifname, inet_addr_t *source, int src_len
 	return rc;
 }
 
+/*
+ * Join a link-local group on behalf of another subsystem, e.g. mrdisc.
+ * The membership is not listed in conf_list or kern_list, it only uses
+ * the shared pool of join sockets so that callers do not run into the
+ * per-socket membership limit.  The caller must use mcgroup_leave_local()
+ * with the returned socket when done.
+ *
+ * Returns:
+ * Join socket, or -1 on error.
+ */
+int mcgroup_join_local(struct iface *iface, inet_addr_t *group)
+{
+	struct mcgroup mcg = { 0 };
+	int sd;
+
+	strlcpy(mcg.ifname, iface->ifname, sizeof(mcg.ifname));
+	mcg.iface = iface;
+	inet_anyaddr(group->ss_family, &mcg.source);
+	mcg.group = *group;
+	mcg.len   = inet_max_len(group);
+retry:
+	sd = alloc_mc_sock(group->ss_family);
+	if (sd == -1)
+		return -1;
+
+	if (kern_join_leave(sd, 1, &mcg)) {
+		free_mc_sock(sd);
+		if (errno == ENOBUFS && max_groups > 1) {
+			max_groups--;
+			goto retry;
+		}
+
+		return -1;
+	}
+
+	return sd;
+}
+
+void mcgroup_leave_local(int sd, struct iface *iface, inet_addr_t *group)
+{
+	struct mcgroup mcg = { 0 };
+
+	if (sd == -1)
+		return;
+
+	strlcpy(mcg.ifname, iface->ifname, sizeof(mcg.ifname));
+	mcg.iface = iface;
+	inet_anyaddr(group->ss_family, &mcg.source);
+	mcg.group = *group;
+	mcg.len   = inet_max_len(group);
+
+	kern_join_leave(sd, 0, &mcg);
+	free_mc_sock(sd);
+}
+
 /*
  * Called on SIGHUP/reload.  Mark all known configured groups as
  * 'unused', let mcgroup_action() unmark and mcgroup_reload_end()
@@ -418,6 +1207,80 @@ void mcgroup_reload_end(void)
 	}
 }
 
+/*
+ * Start of a replace transaction from smcroutectl.  Until the matching
+ * mcgroup_replace_end(), joins are only recorded in stage_tree.
+ */
+void mcgroup_replace_beg(void)
+{
+	staging = 1;
+}
+
+/**
+ * mcgroup_replace_end - Commit, or abort, a replace transaction
+ * @commit: Non-zero to apply the staged set of groups, zero to abort
+ *
+ * Both the current and the desired (staged) set of groups are sorted
+ * and compared in one pass.  Groups only in the current set are left,
+ * groups only in the desired set are joined, and the rest are kept as
+ * they are, without touching the kernel.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mcgroup_replace_end(int commit)
+{
+	struct mcgroup **conf = NULL, *stage, *entry, *tmp;
+	size_t i = 0, nconf;
+	int rc = 0;
+
+	staging = 0;
+	if (!commit)
+		goto done;
+
+	conf = sorted(&conf_list, &nconf);
+	if (!conf) {
+		smclog(LOG_ERR, "Out of memory replacing groups: %s", strerror(errno));
+		rc = 1;
+		goto done;
+	}
+
+	stage = RB_MIN(mstree, &stage_tree);
+	while (i < nconf || stage) {
+		int cmp;
+
+		if (i == nconf)
+			cmp = 1;
+		else if (!stage)
+			cmp = -1;
+		else
+			cmp = mcgroup_cmp(&conf[i], &stage);
+
+		if (cmp < 0) {
+			entry = conf[i++];
+			rc += mcgroup_action(0, entry->ifname, &entry->source, entry->src_len,
+					     &entry->group, entry->len);
+		} else if (cmp > 0) {
+			entry = stage;
+			stage = RB_NEXT(mstree, &stage_tree, stage);
+			rc += mcgroup_action(1, entry->ifname, &entry->source, entry->src_len,
+					     &entry->group, entry->len);
+		} else {
+			stage = RB_NEXT(mstree, &stage_tree, stage);
+			i++;
+		}
+	}
+
+done:
+	free(conf);
+	RB_FOREACH_SAFE(entry, mstree, &stage_tree, tmp) {
+		RB_REMOVE(mstree, &stage_tree, entry);
+		free(entry);
+	}
+
+	return rc;
+}
+
 /*
  * When an interface is removed from the system, or its flags are
  * changed to exclude the MULTICAST flag, we must prune groups.
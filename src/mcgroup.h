@@ -4,9 +4,11 @@
 
 #include "inet.h"
 #include "queue.h"
+#include "tree.h"
 
 struct mcgroup {
 	TAILQ_ENTRY(mcgroup) link;
+	RB_ENTRY(mcgroup) node;		/* staged groups, see stage_add() */
 	int            unused;
 
 	char           ifname[IFNAMSIZ];
@@ -16,17 +18,44 @@ struct mcgroup {
 	inet_addr_t    group;
 	uint8_t        len;
 	int            sd;
+
+	int            retries;		/* failed joins, see kern_retry() */
+	time_t         retry_at;	/* next retry, CLOCK_MONOTONIC sec */
+	unsigned int   sync;		/* reconcile pass last seen in kernel */
+};
+
+/* Group membership reconciler counters, see mcgroup_reconcile() */
+struct mcgroup_sync {
+	unsigned long passes;
+	unsigned long last_drift;	/* missing joins found in last pass */
+	unsigned long missing;		/* in kern_list, not in kernel */
+	unsigned long repaired;
+	unsigned long failed;
+	unsigned long deferred;
 };
 
 void mcgroup_reload_beg(void);
 void mcgroup_reload_end(void);
+void mcgroup_replace_beg(void);
+int  mcgroup_replace_end(int commit);
 void mcgroup_prune     (char *ifname);
+size_t mcgroup_retry_depth(void);
+size_t mcgroup_pace_depth(void);
+unsigned long mcgroup_pace_joined(void);
+struct mcgroup_sync *mcgroup_sync_stats(void);
 
-void mcgroup_init      (void);
+void mcgroup_netns_swap(void **state);
+
+void mcgroup_init      (int join_rate, int sync_ivl);
 void mcgroup_exit      (void);
 
+int  mcgroup_reconcile (void);
+
 int  mcgroup_action    (int cmd, const char *ifname, inet_addr_t *source, int src_len, inet_addr_t *group, int len);
 
+int  mcgroup_join_local (struct iface *iface, inet_addr_t *group);
+void mcgroup_leave_local(int sd, struct iface *iface, inet_addr_t *group);
+
 int  mcgroup_show      (int sd, int detail);
 
 #endif /* SMCROUTE_MCGROUP_H_ */
@@ -1,4 +1,4 @@
-/* Multicast Router Discovery Protocol, RFC4286 (IPv4 only)
+/* Multicast Router Discovery Protocol, RFC4286
  *
  * Copyright (C) 2017-2021  Joachim Wiberg <troglobit@gmail.com>
  *
@@ -18,12 +18,14 @@
  */
 
 #ifndef __linux__
-/* We use SO_BINDTODEVICE to be able to send MRDISC on interfaces that
- * may not have an IP address yet.  I have not found any way of doing
- * this on FreeBSD.  Best I could find was an aging patch for IP_SENDIF
+/* We use one raw socket per address family and IP_PKTINFO/IPV6_PKTINFO
+ * to select the outbound interface of each message, this also works on
+ * interfaces that do not have an IP address yet.  I have not found any
+ * way of doing this on FreeBSD.  Best I could find was an aging patch
+ * for IP_SENDIF that never got merged.
  * https://forums.freebsd.org/threads/so_bindtodevice-undeclared-on-freebsd-12.73731/
- * that never got merged.  It's possible there are other ways to do the
- * same, but now you know as much as I do.
+ * It's possible there are other ways to do the same, but now you know
+ * as much as I do.
  */
 #error Currently only works on Linux, patches for FreeBSD are most welcome.
 #endif
@@ -40,41 +42,99 @@
 
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/igmp.h>
+#ifdef HAVE_IPV6_MULTICAST_HOST
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#endif
 #include <sys/socket.h>
 
 #include "log.h"
+#include "iface.h"
+#include "mcgroup.h"
 #include "mrdisc.h"
+#include "netns.h"
 #include "socket.h"
 #include "timer.h"
 #include "util.h"
 
 #define MC_ALL_ROUTERS       "224.0.0.2"
 #define MC_ALL_SNOOPERS      "224.0.0.106"
+#define MC6_ALL_ROUTERS      "ff02::2"
+#define MC6_ALL_SNOOPERS     "ff02::6a"
 
 #define IGMP_MRDISC_ANNOUNCE 0x30
 #define IGMP_MRDISC_SOLICIT  0x31
 #define IGMP_MRDISC_TERM     0x32
 
-struct ifsock {
-	LIST_ENTRY(ifsock) link;
+#define MLD_MRDISC_ANNOUNCE  151
+#define MLD_MRDISC_SOLICIT   152
+#define MLD_MRDISC_TERM      153
+
+/*
+ * The first announcement on an interface is sent at a random time
+ * within MAX_INITIAL_ADVERT_INTERVAL (2 sec), see RFC4286.  The same
+ * value is used as jitter for the periodic announcements, so that a
+ * large number of interfaces are not all served in the same tick.
+ */
+#define MRDISC_JITTER        2000
+
+/* Solicitations are only type, reserved, and checksum */
+#define MRDISC_MIN_LEN       4
+
+/* Same layout for IGMP (IPv4) and ICMPv6 (IPv6), RFC4286 */
+struct mrdisc_msg {
+	uint8_t  type;
+	uint8_t  interval;		/* Advertisement Interval, sec */
+	uint16_t cksum;
+	uint16_t qi;			/* Query Interval, unused */
+	uint16_t rv;			/* Robustness Variable, unused */
+};
+
+struct mdif {
+	LIST_ENTRY(mdif) link;
 
-	int    sd;
+	int    family;
 	char   ifname[IFNAMSIZ];
-	vifi_t vif;
+	int    ifindex;
+	int    jsd;			/* join socket for All-Routers */
 };
 
-static uint8_t interval       = 20;
-static LIST_HEAD(ifslist, ifsock) ifsock_list = LIST_HEAD_INITIALIZER();
+static uint8_t interval       = MRDISC_INTERVAL_DEFAULT;
+static int     sd4            = -1;
+#ifdef HAVE_IPV6_MULTICAST_HOST
+static int     sd6            = -1;
+#endif
+static LIST_HEAD(mdlist, mdif) mdif_list = LIST_HEAD_INITIALIZER();
+
+/* Saved state of other network namespaces, see netns.c */
+struct mrdisc_netns {
+	int           sd4;
+	int           sd6;
+	struct mdlist mdif_list;
+};
 
 
-static struct ifsock *find(int sd)
+static struct mdif *find(int family, int ifindex)
 {
-	struct ifsock *entry;
+	struct mdif *entry;
 
-	LIST_FOREACH(entry, &ifsock_list, link) {
-		if (entry->sd == sd)
+	LIST_FOREACH(entry, &mdif_list, link) {
+		if (entry->family == family && entry->ifindex == ifindex)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct mdif *find_by_name(int family, const char *ifname)
+{
+	struct mdif *entry;
+
+	LIST_FOREACH(entry, &mdif_list, link) {
+		if (entry->family == family && !strcmp(entry->ifname, ifname))
 			return entry;
 	}
 
@@ -120,160 +180,407 @@ static void compose_addr(struct sockaddr_in *sin, char *group)
 	sin->sin_addr.s_addr = inet_addr(group);
 }
 
-static int inet_send(int sd, uint8_t type, uint8_t interval)
+static int inet_send(int ifindex, uint8_t type, uint8_t interval)
 {
-	struct sockaddr dest;
-	struct igmp igmp;
-	ssize_t num;
-
-	memset(&igmp, 0, sizeof(igmp));
-	igmp.igmp_type = type;
-	igmp.igmp_code = interval;
-	igmp.igmp_cksum = in_cksum((unsigned short *)&igmp, sizeof(igmp));
-
-	compose_addr((struct sockaddr_in *)&dest, MC_ALL_SNOOPERS);
-
-	num = sendto(sd, &igmp, sizeof(igmp), 0, &dest, sizeof(dest));
-	if (num < 0)
+	char cmsgbuf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	struct sockaddr_in dest;
+	struct in_pktinfo *ipi;
+	struct mrdisc_msg msg;
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type     = type;
+	msg.interval = interval;
+	msg.cksum    = in_cksum((unsigned short *)&msg, sizeof(msg));
+
+	compose_addr(&dest, MC_ALL_SNOOPERS);
+
+	iov.iov_base = &msg;
+	iov.iov_len  = sizeof(msg);
+
+	memset(cmsgbuf, 0, sizeof(cmsgbuf));
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_name       = &dest;
+	mh.msg_namelen    = sizeof(dest);
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = cmsgbuf;
+	mh.msg_controllen = sizeof(cmsgbuf);
+
+	/* Select outbound interface per message */
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = IPPROTO_IP;
+	cmsg->cmsg_type  = IP_PKTINFO;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(*ipi));
+	ipi = (struct in_pktinfo *)CMSG_DATA(cmsg);
+	ipi->ipi_ifindex = ifindex;
+
+	if (sendmsg(sd4, &mh, 0) < 0)
 		return -1;
 
 	return 0;
 }
 
-/* If called with interval=0, only read() */
-static int inet_recv(int sd, uint8_t interval)
+static void announce(struct mdif *entry);
+
+static void inet_recv(int sd, void *arg)
 {
-	struct igmp *igmp;
+	char cmsgbuf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	struct mrdisc_msg *msg;
+	struct cmsghdr *cmsg;
+	struct mdif *entry;
+	struct msghdr mh;
+	struct iovec iov;
 	char buf[1530];
 	struct ip *ip;
+	int ifindex = 0;
 	ssize_t num;
 
-	memset(buf, 0, sizeof(buf));
-	num = read(sd, buf, sizeof(buf));
-	if (num < 0)
-		return -1;
+	(void)arg;
 
-	ip = (struct ip *)buf;
-	igmp = (struct igmp *)(buf + (ip->ip_hl << 2));
-	if (igmp->igmp_type == IGMP_MRDISC_SOLICIT && interval > 0) {
-		smclog(LOG_DEBUG, "Received mrdisc solicitation");
-		return inet_send(sd, IGMP_MRDISC_ANNOUNCE, interval);
+	iov.iov_base = buf;
+	iov.iov_len  = sizeof(buf);
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = cmsgbuf;
+	mh.msg_controllen = sizeof(cmsgbuf);
+
+	num = recvmsg(sd, &mh, 0);
+	if (num < 0) {
+		smclog(LOG_WARNING, "Failed receiving IGMP control message: %s", strerror(errno));
+		return;
 	}
 
-	return 0;
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+			ifindex = ((struct in_pktinfo *)CMSG_DATA(cmsg))->ipi_ifindex;
+	}
+
+	ip = (struct ip *)buf;
+	if (num < (ssize_t)sizeof(*ip) || num < (ip->ip_hl << 2) + MRDISC_MIN_LEN)
+		return;
+
+	msg = (struct mrdisc_msg *)(buf + (ip->ip_hl << 2));
+	if (msg->type != IGMP_MRDISC_SOLICIT)
+		return;
+
+	/* Only reply on interfaces with mrdisc enabled */
+	entry = find(AF_INET, ifindex);
+	if (!entry)
+		return;
+
+	smclog(LOG_DEBUG, "Received mrdisc solicitation on %s", entry->ifname);
+	announce(entry);
 }
 
-static int inet_open(char *ifname)
+static int inet_open(void)
 {
 	unsigned char ra[4] = { IPOPT_RA, 0x04, 0x00, 0x00 };
-	struct ip_mreqn mreq;
-	struct ifreq ifr;
-	int sd, val, rc;
-	char loop;
+	int sd, val;
+
+	if (sd4 != -1)
+		return 0;
 
-	sd = socket_create(AF_INET, SOCK_RAW, IPPROTO_IGMP, mrdisc_recv, NULL);
+	sd = socket_create(AF_INET, SOCK_RAW, IPPROTO_IGMP, inet_recv, NULL);
 	if (sd < 0) {
 		smclog(LOG_ERR, "Cannot open socket: %s", strerror(errno));
 		return -1;
 	}
 
-	memset(&ifr, 0, sizeof(ifr));
-	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
-	if (setsockopt(sd, SOL_SOCKET, SO_BINDTODEVICE, (void *)&ifr, sizeof(ifr)) < 0) {
-		if (ENODEV == errno) {
-			smclog(LOG_WARNING, "Not a valid interface, %s, skipping ...", ifname);
-			socket_close(sd);
-			return -1;
-		}
+#ifdef IP_MULTICAST_ALL
+	/*
+	 * The All-Routers memberships are held by the mcgroup join
+	 * sockets, socket_create() disables this by default.
+	 */
+	val = 1;
+	if (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_ALL, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot enable IP_MULTICAST_ALL: %s", strerror(errno));
+		goto error;
+	}
+#endif
 
-		smclog(LOG_ERR, "Cannot bind socket to interface %s: %s", ifname, strerror(errno));
-		socket_close(sd);
-		return -1;
+	val = 1;
+	if (setsockopt(sd, IPPROTO_IP, IP_PKTINFO, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot enable IP_PKTINFO: %s", strerror(errno));
+		goto error;
 	}
 
-	memset(&mreq, 0, sizeof(mreq));
-	mreq.imr_multiaddr.s_addr = inet_addr(MC_ALL_SNOOPERS);
-	mreq.imr_ifindex = if_nametoindex(ifname);
-        if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
-		smclog(LOG_ERR, "Failed joining group %s: %s", MC_ALL_SNOOPERS, strerror(errno));
+	val = 1;
+	if (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot set TTL: %s", strerror(errno));
+		goto error;
+	}
+
+	if (setsockopt(sd, IPPROTO_IP, IP_OPTIONS, &ra, sizeof(ra)) < 0) {
+		smclog(LOG_ERR, "Cannot set IP OPTIONS: %s", strerror(errno));
+		goto error;
+	}
+
+	sd4 = sd;
+	return 0;
+error:
+	socket_close(sd);
+	return -1;
+}
+
+#ifdef HAVE_IPV6_MULTICAST_HOST
+static int inet6_send(int ifindex, uint8_t type, uint8_t interval)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	struct in6_pktinfo *ipi;
+	struct sockaddr_in6 dest;
+	struct mrdisc_msg msg;
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+
+	/* The kernel computes the ICMPv6 checksum for us */
+	memset(&msg, 0, sizeof(msg));
+	msg.type     = type;
+	msg.interval = interval;
+
+	memset(&dest, 0, sizeof(dest));
+	dest.sin6_family   = AF_INET6;
+	dest.sin6_scope_id = ifindex;
+	inet_pton(AF_INET6, MC6_ALL_SNOOPERS, &dest.sin6_addr);
+
+	iov.iov_base = &msg;
+	iov.iov_len  = sizeof(msg);
+
+	memset(cmsgbuf, 0, sizeof(cmsgbuf));
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_name       = &dest;
+	mh.msg_namelen    = sizeof(dest);
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = cmsgbuf;
+	mh.msg_controllen = sizeof(cmsgbuf);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = IPPROTO_IPV6;
+	cmsg->cmsg_type  = IPV6_PKTINFO;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(*ipi));
+	ipi = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+	ipi->ipi6_ifindex = ifindex;
+
+	if (sendmsg(sd6, &mh, 0) < 0)
 		return -1;
+
+	return 0;
+}
+
+static void inet6_recv(int sd, void *arg)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	struct mrdisc_msg *msg;
+	struct cmsghdr *cmsg;
+	struct mdif *entry;
+	struct msghdr mh;
+	struct iovec iov;
+	char buf[1530];
+	int ifindex = 0;
+	ssize_t num;
+
+	(void)arg;
+
+	iov.iov_base = buf;
+	iov.iov_len  = sizeof(buf);
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov        = &iov;
+	mh.msg_iovlen     = 1;
+	mh.msg_control    = cmsgbuf;
+	mh.msg_controllen = sizeof(cmsgbuf);
+
+	num = recvmsg(sd, &mh, 0);
+	if (num < 0) {
+		smclog(LOG_WARNING, "Failed receiving ICMPv6 control message: %s", strerror(errno));
+		return;
 	}
 
-	/* mrdisc solicitation messages goes to the All-Routers group */
-	mreq.imr_multiaddr.s_addr = inet_addr(MC_ALL_ROUTERS);
-	mreq.imr_ifindex = if_nametoindex(ifname);
-        if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
-		smclog(LOG_ERR, "Failed joining group %s: %s", MC_ALL_ROUTERS, strerror(errno));
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO)
+			ifindex = ((struct in6_pktinfo *)CMSG_DATA(cmsg))->ipi6_ifindex;
+	}
+
+	/* No IPv6 header on raw ICMPv6 sockets */
+	if (num < MRDISC_MIN_LEN)
+		return;
+
+	msg = (struct mrdisc_msg *)buf;
+	if (msg->type != MLD_MRDISC_SOLICIT)
+		return;
+
+	entry = find(AF_INET6, ifindex);
+	if (!entry)
+		return;
+
+	smclog(LOG_DEBUG, "Received IPv6 mrdisc solicitation on %s", entry->ifname);
+	announce(entry);
+}
+
+static int inet6_open(void)
+{
+	/* Hop-by-Hop options header w/ Router Alert (MLD), RFC2711 */
+	uint8_t hbh[8] = { 0, 0, IP6OPT_ROUTER_ALERT, 2, 0, 0, IP6OPT_PADN, 0 };
+	struct icmp6_filter filter;
+	int sd, val;
+
+	if (sd6 != -1)
+		return 0;
+
+	sd = socket_create(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6, inet6_recv, NULL);
+	if (sd < 0) {
+		smclog(LOG_ERR, "Cannot open IPv6 socket: %s", strerror(errno));
 		return -1;
 	}
 
+	/* Only solicitations, the kernel handles everything else */
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	ICMP6_FILTER_SETPASS(MLD_MRDISC_SOLICIT, &filter);
+	if (setsockopt(sd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) < 0) {
+		smclog(LOG_ERR, "Cannot set ICMPv6 filter: %s", strerror(errno));
+		goto error;
+	}
+
+#ifdef IPV6_MULTICAST_ALL
 	val = 1;
-	rc = setsockopt(sd, IPPROTO_IP, IP_MULTICAST_TTL, &val, sizeof(val));
-	if (rc < 0) {
-		smclog(LOG_ERR, "Cannot set TTL: %s", strerror(errno));
-		socket_close(sd);
-		return -1;
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot enable IPV6_MULTICAST_ALL: %s", strerror(errno));
+		goto error;
 	}
+#endif
 
-	loop = 0;
-	rc = setsockopt(sd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
-	if (rc < 0) {
-		smclog(LOG_ERR, "Cannot disable MC loop: %s", strerror(errno));
-		socket_close(sd);
-		return -1;
+	val = 1;
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot enable IPV6_RECVPKTINFO: %s", strerror(errno));
+		goto error;
 	}
 
-	rc = setsockopt(sd, IPPROTO_IP, IP_OPTIONS, &ra, sizeof(ra));
-	if (rc < 0) {
-		smclog(LOG_ERR, "Cannot set IP OPTIONS: %s", strerror(errno));
-		socket_close(sd);
-		return -1;
+	val = 1;
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &val, sizeof(val)) < 0) {
+		smclog(LOG_ERR, "Cannot set hop limit: %s", strerror(errno));
+		goto error;
+	}
+
+	if (setsockopt(sd, IPPROTO_IPV6, IPV6_HOPOPTS, hbh, sizeof(hbh)) < 0) {
+		smclog(LOG_ERR, "Cannot set Router Alert option: %s", strerror(errno));
+		goto error;
+	}
+
+	sd6 = sd;
+	return 0;
+error:
+	socket_close(sd);
+	return -1;
+}
+#endif /* HAVE_IPV6_MULTICAST_HOST */
+
+static int send_msg(struct mdif *entry, int announce)
+{
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (entry->family == AF_INET6)
+		return inet6_send(entry->ifindex, announce ? MLD_MRDISC_ANNOUNCE : MLD_MRDISC_TERM,
+				  announce ? interval : 0);
+#endif
+
+	return inet_send(entry->ifindex, announce ? IGMP_MRDISC_ANNOUNCE : IGMP_MRDISC_TERM,
+			 announce ? interval : 0);
+}
+
+static void announce(struct mdif *entry)
+{
+	smclog(LOG_DEBUG, "Sending %smrdisc announcement on %s",
+	       entry->family == AF_INET6 ? "IPv6 " : "", entry->ifname);
+	if (send_msg(entry, 1)) {
+		if (ENETUNREACH == errno || ENETDOWN == errno || ENXIO == errno)
+			return;	/* Link down, ignore. */
+		if (EADDRNOTAVAIL == errno)
+			return;	/* No (IPv6 link-local) address yet, ignore. */
+
+		smclog(LOG_WARNING, "Failed sending mrdisc announcement on %s, error %d: %s",
+		       entry->ifname, errno, strerror(errno));
 	}
+}
 
-	return sd;
+static void announce_cb(void *arg)
+{
+	announce(arg);
 }
 
-static int inet_close(int sd)
+static void all_routers(int family, inet_addr_t *group)
 {
-	return  inet_send(sd, IGMP_MRDISC_TERM, 0) ||
-		socket_close(sd);
+	if (family == AF_INET6)
+		inet_str2addr(MC6_ALL_ROUTERS, group);
+	else
+		inet_str2addr(MC_ALL_ROUTERS, group);
 }
 
-static void announce(struct ifsock *entry)
+static void close_entry(struct mdif *entry)
 {
-	if (!entry)
-		return;
+	struct iface *iface;
+	inet_addr_t group;
 
-	smclog(LOG_DEBUG, "Sending mrdisc announcement on %s", entry->ifname);
-	if (inet_send(entry->sd, IGMP_MRDISC_ANNOUNCE, interval)) {
-		if (ENETUNREACH == errno || ENETDOWN == errno)
-			return;	/* Link down, ignore. */
+	timer_del(announce_cb, entry);
+	send_msg(entry, 0);
 
-		smclog(LOG_WARNING, "Failed sending IGMP control message 0x%x on %s, error %d: %s",
-		       IGMP_MRDISC_ANNOUNCE, entry->ifname, errno, strerror(errno));
+	iface = iface_find_by_name(entry->ifname);
+	if (iface) {
+		all_routers(entry->family, &group);
+		mcgroup_leave_local(entry->jsd, iface, &group);
 	}
+
+	LIST_REMOVE(entry, link);
+	free(entry);
 }
 
+/* Exchange sockets and interfaces with a saved network namespace */
+void mrdisc_netns_swap(void **state)
+{
+	struct mrdisc_netns *ns = *state;
+
+	if (!ns) {
+		ns = *state = netns_alloc(sizeof(*ns));
+		ns->sd4 = ns->sd6 = -1;
+	}
+
+	NETNS_SWAP(sd4, ns->sd4);
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	NETNS_SWAP(sd6, ns->sd6);
+#endif
+	NETNS_SWAP_LIST(&mdif_list, &ns->mdif_list, link);
+}
+
+/*
+ * Must be called before the first mrdisc_register(), i.e. before any
+ * VIFs/MIFs are created, to have the correct announcement interval.
+ */
 int mrdisc_init(int period)
 {
 	interval = period;
-	if (timer_add(interval, mrdisc_send, NULL) < 0 && errno != EEXIST) {
-		smclog(LOG_ERR, "Failed starting mrdisc announcement timer.");
-		return -1;
-	}
 
 	return 0;
 }
 
 int mrdisc_exit(void)
 {
-	struct ifsock *entry, *tmp;
-
-	LIST_FOREACH_SAFE(entry, &ifsock_list, link, tmp) {
-		inet_close(entry->sd);
-		LIST_REMOVE(entry, link);
-		free(entry);
-	}
+	struct mdif *entry, *tmp;
+
+	LIST_FOREACH_SAFE(entry, &mdif_list, link, tmp)
+		close_entry(entry);
+
+	if (sd4 != -1)
+		socket_close(sd4);
+	sd4 = -1;
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (sd6 != -1)
+		socket_close(sd6);
+	sd6 = -1;
+#endif
 
 	return 0;
 }
@@ -281,80 +588,71 @@ int mrdisc_exit(void)
 /*
  * Register possible interface for mrdisc
  */
-int mrdisc_register(char *ifname, short vif)
+int mrdisc_register(int family, struct iface *iface)
 {
-	struct ifsock *entry;
+	struct mdif *entry;
+	inet_addr_t group;
 
-	LIST_FOREACH(entry, &ifsock_list, link) {
-		if (!strcmp(entry->ifname, ifname))
-			goto reload;
+	entry = find_by_name(family, iface->ifname);
+	if (entry) {
+		/* Reload, interface may have been recreated */
+		entry->ifindex = iface->ifindex;
+		return 0;
 	}
 
-	entry = malloc(sizeof(*entry));
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (family == AF_INET6) {
+		if (inet6_open())
+			return -1;
+	} else
+#endif
+	if (family != AF_INET) {
+		errno = EAFNOSUPPORT;
+		return -1;
+	} else if (inet_open())
+		return -1;
+
+	entry = calloc(1, sizeof(*entry));
 	if (!entry) {
 		smclog(LOG_ERR, "Out of memory in %s()", __func__);
 		return -1;
 	}
 
-	entry->vif = vif;
-	strlcpy(entry->ifname, ifname, sizeof(entry->ifname));
-	LIST_INSERT_HEAD(&ifsock_list, entry, link);
+	entry->family  = family;
+	entry->ifindex = iface->ifindex;
+	strlcpy(entry->ifname, iface->ifname, sizeof(entry->ifname));
+
+	/* mrdisc solicitation messages goes to the All-Routers group */
+	all_routers(family, &group);
+	entry->jsd = mcgroup_join_local(iface, &group);
+	if (entry->jsd == -1)
+		smclog(LOG_WARNING, "Cannot receive mrdisc solicitations on %s", iface->ifname);
 
-	entry->sd = inet_open(entry->ifname);
-	if (entry->sd < 0)
+	LIST_INSERT_HEAD(&mdif_list, entry, link);
+
+	if (timer_add_jitter(interval, MRDISC_JITTER, announce_cb, entry)) {
+		smclog(LOG_ERR, "Failed starting mrdisc announcement timer for %s.", iface->ifname);
+		close_entry(entry);
 		return -1;
-reload:
-	announce(entry);
+	}
+
 	return 0;
 }
 
 /*
  * Unregister mrdisc interface, regardless of refcnt
  */
-int mrdisc_deregister(short vif)
+int mrdisc_deregister(int family, struct iface *iface)
 {
-	struct ifsock *entry;
-
-	LIST_FOREACH(entry, &ifsock_list, link) {
-		if (entry->vif != vif)
-			continue;
+	struct mdif *entry;
 
-		inet_close(entry->sd);
-		LIST_REMOVE(entry, link);
-		free(entry);
-		return 0;
-	}
+	entry = find_by_name(family, iface->ifname);
+	if (entry)
+		close_entry(entry);
 
 	return 0;
 }
 
-void mrdisc_send(void *arg)
-{
-	struct ifsock *entry;
-
-	(void)arg;
-	LIST_FOREACH(entry, &ifsock_list, link)
-		announce(entry);
-}
-
-void mrdisc_recv(int sd, void *arg)
-{
-	struct ifsock *entry;
-
-	(void)arg;
-
-	/* Verify we are reading from an active socket */
-	entry = find(sd);
-	if (!entry) {
-		smclog(LOG_WARNING, "Bug in mrdisc, received frame on unknown socket %d", sd);
-		return;
-	}
-
-	/* Only do a "dummy" read on inactive interfaces */
-	if (inet_recv(sd, interval))
-		smclog(LOG_WARNING, "Failed receiving IGMP control message from %s", entry->ifname);
-}
-
 /**
  * Local Variables:
  *  indent-tabs-mode: t
@@ -1,4 +1,4 @@
-/* Multicast Router Discovery Protocol, RFC4286 (IPv4 only)
+/* Multicast Router Discovery Protocol, RFC4286
  *
  * Copyright (C) 2017-2021  Joachim Wiberg <troglobit@gmail.com>
  *
@@ -24,30 +24,24 @@
 #define MRDISC_INTERVAL_DEFAULT 20
 
 #ifdef ENABLE_MRDISC
-int mrdisc_init       (int interval);
-int mrdisc_exit       (void);
+struct iface;
 
-int mrdisc_register   (char *ifname, short vif);
-int mrdisc_deregister (              short vif);
+void mrdisc_netns_swap(void **state);
 
-int mrdisc_enable     (short vif);
-int mrdisc_disable    (short vif);
+int mrdisc_init       (int interval);
+int mrdisc_exit       (void);
 
-void mrdisc_send      (        void *arg);
-void mrdisc_recv      (int sd, void *arg);
+int mrdisc_register   (int family, struct iface *iface);
+int mrdisc_deregister (int family, struct iface *iface);
 
 #else
+#define mrdisc_netns_swap(state)
+
 #define mrdisc_init(interval)
 #define mrdisc_exit()
 
-#define mrdisc_register(ifname, vif) 0
-#define mrdisc_deregister(vif)       0
-
-#define mrdisc_enable(ifname)
-#define mrdisc_disable(ifname)       {}
-
-#define mrdisc_send(arg)
-#define mrdisc_recv(sd, arg)
+#define mrdisc_register(family, iface)   0
+#define mrdisc_deregister(family, iface) 0
 #endif
 
 #endif /* SMCROUTE_MRDISC_H_ */
@@ -25,6 +25,8 @@
 #include "queue.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>		/* offsetof() */
 #include <string.h>
 #include <stdio.h>		/* snprintf() */
 #include <sysexits.h>
@@ -32,12 +34,19 @@
 #include <time.h>
 
 #include "log.h"
+#include "conf.h"
+#include "counter.h"
 #include "iface.h"
 #include "ipc.h"
 #include "script.h"
 #include "mrdisc.h"
 #include "mroute.h"
+#include "gen.h"
 #include "kern.h"
+#include "netns.h"
+#include "oifset.h"
+#include "reject.h"
+#include "task.h"
 #include "timer.h"
 #include "util.h"
 
@@ -46,6 +55,47 @@
  */
 static int cache_timeout = 0;
 
+/*
+ * On demand VIFs/MIFs, smcrouted -L SEC.  Created when a route refers
+ * to an interface, released when no route has used them for at least
+ * vif_hold sec.  Saves the scarce VIF slots for interfaces that carry
+ * multicast.
+ */
+static int vif_hold = 0;
+
+/*
+ * Anti-entropy reconciliation of kern_list vs the actual kernel MFC,
+ * at most RECONCILE_BUDGET repairs per pass, the rest is deferred.
+ */
+#define RECONCILE_BUDGET 64
+
+static int sync_interval = 0;
+static unsigned int sync_pass = 0;
+static struct {
+	unsigned long passes;
+	unsigned long last_drift;	/* discrepancies found in last pass */
+	unsigned long missing;		/* in kern_list, not in kernel */
+	unsigned long stray;		/* in kernel, not in kern_list */
+	unsigned long mismatch;		/* IIF or OIFs differ */
+	unsigned long repaired;
+	unsigned long failed;
+	unsigned long deferred;
+} drift;
+
+/*
+ * Kernel upcalls are read in batches of at most UPCALL_BATCH messages.
+ * The (*,G) template of each NOCACHE upcall is looked up once, when it is
+ * read.  When more than one is pending, they are served by the priority
+ * class of their template, highest first, in arrival order within each
+ * class.
+ */
+#define UPCALL_BATCH 64
+
+static struct upcall {
+	struct mroute  route;
+	struct mroute *tmpl;		/* matching (*,G) template, or NULL */
+} upcalls[UPCALL_BATCH];
+
 /*
  * User added/configured routes, both ASM and SSM
  */
@@ -56,29 +106,344 @@ static TAILQ_HEAD(cl, mroute) conf_list = TAILQ_HEAD_INITIALIZER(conf_list);
  */
 static TAILQ_HEAD(kl, mroute) kern_list = TAILQ_HEAD_INITIALIZER(kern_list);
 
+/*
+ * Kernel MFC entries with a pending update.  Changes to an entry are
+ * combined and written to the kernel once, by mroute_flush() at the end
+ * of an IPC command, or by a task after each event loop tick.  The task
+ * writes TASK_SLICE entries per slice, e.g., after a reload.
+ */
+static TAILQ_HEAD(dl, mroute) dirty_list = TAILQ_HEAD_INITIALIZER(dirty_list);
+static unsigned long mfc_combined = 0;
+
+/*
+ * Kernel MFC writes refused with a transient error, e.g., ENOBUFS, stay
+ * queued and are retried with backoff, updates on the dirty_list and
+ * removals on the gone_list.  When more than WQ_HIGH_WATER writes are
+ * waiting for retry the kernel is not keeping up, so new upcalls are
+ * dropped.  The kernel sends a new upcall for active streams later.
+ */
+#define WQ_HIGH_WATER 256
+
+static TAILQ_HEAD(gl, mroute) gone_list = TAILQ_HEAD_INITIALIZER(gone_list);
+static size_t wq_depth = 0;		/* writes waiting for retry */
+static size_t wq_peak  = 0;
+
+/*
+ * Ordered index of the above lists, used for paginated show, and of the
+ * kernel MFC by source, for range queries, see query_init()
+ */
+static int conf_cmp(struct mroute *a, struct mroute *b);
+static int kern_cmp(struct mroute *a, struct mroute *b);
+static int src_cmp (struct mroute *a, struct mroute *b);
+
+static RB_HEAD(ctree, mroute) conf_tree = RB_INITIALIZER(&conf_tree);
+static RB_HEAD(ktree, mroute) kern_tree = RB_INITIALIZER(&kern_tree);
+static RB_HEAD(stree, mroute) src_tree  = RB_INITIALIZER(&src_tree);
+RB_GENERATE_STATIC(ctree, mroute, node, conf_cmp)
+RB_GENERATE_STATIC(ktree, mroute, node, kern_cmp)
+RB_GENERATE_STATIC(stree, mroute, snode, src_cmp)
+
+/*
+ * Range query over the kernel MFC, e.g., all flows to 239.10.0.0/16,
+ * or all flows from 10.1.0.0/24.  The query walks the index with the
+ * longest prefix, from the first entry in range, so the cost is
+ * O(log n + k) rather than a scan of kern_list.
+ */
+struct query {
+	struct inet_range group;
+	struct inet_range source;
+	int               has_source;
+	int               by_source;
+};
+
+/*
+ * Desired set of routes from a replace transaction, same order as
+ * conf_tree, see mroute_replace_beg()
+ */
+static struct ctree stage_tree = RB_INITIALIZER(&stage_tree);
+static int staging = 0;
+
+/* Saved state of other network namespaces, see netns.c */
+struct mroute_netns {
+	struct cl             conf_list;
+	struct kl             kern_list;
+	struct dl             dirty_list;
+	struct gl             gone_list;
+	struct ctree          conf_tree;
+	struct ktree          kern_tree;
+	struct stree          src_tree;
+	struct ctree          stage_tree;
+	int                   staging;
+	unsigned long         mfc_combined;
+	size_t                wq_depth;
+	size_t                wq_peak;
+	int                   cache_timeout;
+	int                   vif_hold;
+	int                   sync_interval;
+	unsigned int          sync_pass;
+	__typeof__(drift)     drift;
+};
+
+/* Exchange routes and kernel MFC with a saved network namespace */
+void mroute_netns_swap(void **state)
+{
+	struct mroute_netns *ns = *state;
+
+	if (!ns) {
+		ns = *state = netns_alloc(sizeof(*ns));
+		TAILQ_INIT(&ns->conf_list);
+		TAILQ_INIT(&ns->kern_list);
+		TAILQ_INIT(&ns->dirty_list);
+		TAILQ_INIT(&ns->gone_list);
+	}
+
+	NETNS_SWAP_TAILQ(&conf_list,  &ns->conf_list,  link);
+	NETNS_SWAP_TAILQ(&kern_list,  &ns->kern_list,  link);
+	NETNS_SWAP_TAILQ(&dirty_list, &ns->dirty_list, dlink);
+	NETNS_SWAP_TAILQ(&gone_list,  &ns->gone_list,  dlink);
+	NETNS_SWAP(conf_tree,     ns->conf_tree);
+	NETNS_SWAP(kern_tree,     ns->kern_tree);
+	NETNS_SWAP(src_tree,      ns->src_tree);
+	NETNS_SWAP(stage_tree,    ns->stage_tree);
+	NETNS_SWAP(staging,       ns->staging);
+	NETNS_SWAP(mfc_combined,  ns->mfc_combined);
+	NETNS_SWAP(wq_depth,      ns->wq_depth);
+	NETNS_SWAP(wq_peak,       ns->wq_peak);
+	NETNS_SWAP(cache_timeout, ns->cache_timeout);
+	NETNS_SWAP(vif_hold,      ns->vif_hold);
+	NETNS_SWAP(sync_interval, ns->sync_interval);
+	NETNS_SWAP(sync_pass,     ns->sync_pass);
+	NETNS_SWAP(drift,         ns->drift);
+}
+
 static int  mroute4_add_vif    (struct iface *iface);
-static int  mroute_dyn_add     (struct mroute *route);
+static int  mroute_dyn_add     (struct mroute *route, struct mroute *tmpl);
 static int  is_match           (struct mroute *rule, struct mroute *cand);
-static int  is_exact_match     (struct mroute *rule, struct mroute *cand);
 static int  mfc_install        (struct mroute *route);
 static int  mfc_uninstall      (struct mroute *route);
+static int  is_ssm             (struct mroute *route);
+static int  kern_gone          (struct mroute *route);
+static void wq_cancel          (struct mroute *route);
+static void wq_done            (struct mroute *route);
+static int  flush_step         (void *arg);
+static void show_unlink        (struct mroute *route);
+
+static void conf_add(struct mroute *route)
+{
+	TAILQ_INSERT_TAIL(&conf_list, route, link);
+	RB_INSERT(ctree, &conf_tree, route);
+	gen_route(GEN_RULE, 0, route);
+}
 
-/* Check for kernel IGMPMSG_NOCACHE for (*,G) hits. I.e., source-less routes. */
-static void handle_nocache4(int sd, void *arg)
+static void conf_del(struct mroute *route)
+{
+	show_unlink(route);
+	TAILQ_REMOVE(&conf_list, route, link);
+	RB_REMOVE(ctree, &conf_tree, route);
+	gen_route(GEN_RULE, 1, route);
+}
+
+static void kern_add(struct mroute *route)
+{
+	wq_cancel(route);
+	TAILQ_INSERT_TAIL(&kern_list, route, link);
+	RB_INSERT(ktree, &kern_tree, route);
+	RB_INSERT(stree, &src_tree, route);
+}
+
+static void kern_del(struct mroute *route)
+{
+	if (route->dirty) {
+		TAILQ_REMOVE(&dirty_list, route, dlink);
+		route->dirty = 0;
+	}
+	wq_done(route);
+	oifset_move(route, NULL);
+	show_unlink(route);
+	TAILQ_REMOVE(&kern_list, route, link);
+	RB_REMOVE(ktree, &kern_tree, route);
+	RB_REMOVE(stree, &src_tree, route);
+	gen_route(GEN_MFC, 1, route);
+}
+
+/* Queue update of kernel MFC entry, see mroute_flush() */
+static void kern_dirty(struct mroute *route)
+{
+	if (route->dirty) {
+		mfc_combined++;
+		return;
+	}
+
+	route->dirty = 1;
+	TAILQ_INSERT_TAIL(&dirty_list, route, dlink);
+	task_add(flush_step, NULL);
+}
+
+/* Move kernel MFC entry to the OIF set @set, queue update if it changed */
+static void kern_oifs(struct mroute *route, struct oifset *set)
+{
+	if (oifset_move(route, set))
+		kern_dirty(route);
+}
+
+/* Sort order: family, group, source, inbound */
+static int kern_cmp(struct mroute *a, struct mroute *b)
+{
+	int rc;
+
+	rc = inet_addr_order(&a->group, &b->group);
+	if (rc)
+		return rc;
+	if (a->len != b->len)
+		return a->len - b->len;
+
+	rc = inet_addr_order(&a->source, &b->source);
+	if (rc)
+		return rc;
+	if (a->src_len != b->src_len)
+		return a->src_len - b->src_len;
+
+	return (int)a->inbound - (int)b->inbound;
+}
+
+/* Sort order: family, source, group, inbound */
+static int src_cmp(struct mroute *a, struct mroute *b)
+{
+	int rc;
+
+	rc = inet_addr_order(&a->source, &b->source);
+	if (rc)
+		return rc;
+	if (a->src_len != b->src_len)
+		return a->src_len - b->src_len;
+
+	rc = inet_addr_order(&a->group, &b->group);
+	if (rc)
+		return rc;
+	if (a->len != b->len)
+		return a->len - b->len;
+
+	return (int)a->inbound - (int)b->inbound;
+}
+
+/* Same as kern_cmp(), but (*,G) templates before (S,G) rules, like show */
+static int conf_cmp(struct mroute *a, struct mroute *b)
+{
+	int rc;
+
+	rc = is_ssm(a) - is_ssm(b);
+	if (rc)
+		return rc;
+
+	return kern_cmp(a, b);
+}
+
+/* First (*,G) template in .conf order that @route matches, or NULL */
+static struct mroute *tmpl_find(struct mroute *route)
+{
+	struct mroute *entry;
+
+	TAILQ_FOREACH(entry, &conf_list, link) {
+		if (!is_ssm(entry) && is_match(entry, route))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* Install (S,G) from matching (*,G) template @tmpl, or add a stop filter */
+static void upcall_serve(struct mroute *route, struct mroute *tmpl)
+{
+	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
+	struct iface *iface;
+
+	inet_addr2str(&route->source, origin, sizeof(origin));
+	inet_addr2str(&route->group, group, sizeof(group));
+
+	iface = iface_find_by_inbound(route);
+	if (!iface)
+		return;
+
+	smclog(LOG_DEBUG, "New multicast data from %s to group %s on %s",
+	       origin, group, iface->ifname);
+
+	if (mroute_dyn_add(route, tmpl)) {
+		/*
+		 * This is a common error, the router receives streams it is not
+		 * set up to route -- we ignore these by default, but if the user
+		 * sets a more permissive log level we help out by showing what
+		 * is going on.
+		 */
+		if (ENOENT == errno) {
+			smclog(LOG_INFO, "Multicast from %s, group %s, on %s does not match any (*,G) rule",
+			       origin, group, iface->ifname);
+			reject_add(route, iface->ifname);
+		}
+		return;
+	}
+
+	/* Script may inspect the kernel MFC */
+	mroute_flush();
+	script_exec(route);
+}
+
+/*
+ * Drain pending upcalls from @sd using @parse, which returns 1 for a
+ * NOCACHE upcall, 0 for any other message, and -1 when there are no
+ * more messages.  Under backlog, serve them by priority class.
+ */
+static void upcall_handle(int sd, int (*parse)(int, struct mroute *))
+{
+	size_t num = 0, i;
+	int prio;
+
+	while (num < NELEMS(upcalls)) {
+		int rc;
+
+		rc = parse(sd, &upcalls[num].route);
+		if (rc < 0)
+			break;
+		if (rc > 0) {
+			upcalls[num].tmpl = tmpl_find(&upcalls[num].route);
+			num++;
+		}
+	}
+
+	/* Backpressure, the kernel is refusing MFC writes */
+	if (num > 0 && wq_depth >= WQ_HIGH_WATER) {
+		smclog(LOG_DEBUG, "Kernel write queue full, dropping %zu upcalls", num);
+		kern_wq.throttled += num;
+		return;
+	}
+
+	if (num > 1)
+		smclog(LOG_DEBUG, "Upcall backlog of %zu, serving by priority", num);
+
+	for (prio = MROUTE_PRIO_MAX; prio >= 0; prio--) {
+		for (i = 0; i < num; i++) {
+			struct mroute *tmpl = upcalls[i].tmpl;
+
+			if ((tmpl ? tmpl->prio : 0) == prio)
+				upcall_serve(&upcalls[i].route, tmpl);
+		}
+	}
+}
+
+/* Read one IGMP message, NOCACHE upcalls for (*,G) hits are returned in @route */
+static int upcall_parse4(int sd, struct mroute *route)
 {
 	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
-	struct mroute mroute = { 0 };
 	struct igmpmsg *im;
 	struct iface *iface;
 	struct ip *ip;
 	char tmp[128];
-	int result;
+	ssize_t result;
 
-	(void)arg;
-	result = read(sd, tmp, sizeof(tmp));
+	result = recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT);
 	if (result < 0) {
-		smclog(LOG_WARNING, "Failed reading IGMP message from kernel: %s", strerror(errno));
-		return;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			smclog(LOG_WARNING, "Failed reading IGMP message from kernel: %s", strerror(errno));
+		return -1;
 	}
 
 	ip = (struct ip *)tmp;
@@ -86,55 +451,37 @@ static void handle_nocache4(int sd, void *arg)
 	/* Basic validation, filter out non igmpmsg */
 	im = (struct igmpmsg *)tmp;
 	if (im->im_mbz != 0 || im->im_msgtype == 0)
-		return;
+		return 0;
 
 	/* packets sent up from kernel to daemon have ip->ip_p = 0 */
 	if (ip->ip_p != 0)
-		return;
+		return 0;
 
-	inet_addr_set(&mroute.source, &im->im_src);
-	inet_addr_set(&mroute.group, &im->im_dst);
-	mroute.inbound = im->im_vif;
-	mroute.len     = 32;
-	mroute.src_len = 32;
+	memset(route, 0, sizeof(*route));
+	inet_addr_set(&route->source, &im->im_src);
+	inet_addr_set(&route->group, &im->im_dst);
+	route->inbound = im->im_vif;
+	route->len     = 32;
+	route->src_len = 32;
 
-	inet_addr2str(&mroute.source, origin, sizeof(origin));
-	inet_addr2str(&mroute.group, group, sizeof(group));
+	inet_addr2str(&route->source, origin, sizeof(origin));
+	inet_addr2str(&route->group, group, sizeof(group));
 
-	iface = iface_find_by_inbound(&mroute);
+	iface = iface_find_by_inbound(route);
 	if (!iface) {
 		smclog(LOG_WARNING, "No matching interface for VIF %u, cannot handle IGMP message %d.",
-		       mroute.inbound, im->im_msgtype);
-		return;
+		       route->inbound, im->im_msgtype);
+		return 0;
 	}
 
 	/* check for IGMPMSG_NOCACHE to do (*,G) based routing. */
 	switch (im->im_msgtype) {
 	case IGMPMSG_NOCACHE:
-		/* Find any matching route for this group on that iif. */
-		smclog(LOG_DEBUG, "New multicast data from %s to group %s on %s",
-		       origin, group, iface->ifname);
-
-		result = mroute_dyn_add(&mroute);
-		if (result) {
-			/*
-			 * This is a common error, the router receives streams it is not
-			 * set up to route -- we ignore these by default, but if the user
-			 * sets a more permissive log level we help out by showing what
-			 * is going on.
-			 */
-			if (ENOENT == errno)
-				smclog(LOG_INFO, "Multicast from %s, group %s, on %s does not match any (*,G) rule",
-				       origin, group, iface->ifname);
-			return;
-		}
-
-		script_exec(&mroute);
-		break;
+		return 1;
 
 	case IGMPMSG_WRONGVIF:
 		smclog(LOG_WARNING, "Multicast from %s, group %s, coming in on wrong VIF %u, iface %s",
-		       origin, group, mroute.inbound, iface->ifname);
+		       origin, group, route->inbound, iface->ifname);
 		break;
 
 	case IGMPMSG_WHOLEPKT:
@@ -148,6 +495,15 @@ static void handle_nocache4(int sd, void *arg)
 		smclog(LOG_DEBUG, "Unknown IGMP message %d from kernel", im->im_msgtype);
 		break;
 	}
+
+	return 0;
+}
+
+/* Check for kernel IGMPMSG_NOCACHE for (*,G) hits. I.e., source-less routes. */
+static void handle_nocache4(int sd, void *arg)
+{
+	(void)arg;
+	upcall_handle(sd, upcall_parse4);
 }
 
 static void cache_flush(void *arg)
@@ -155,7 +511,7 @@ static void cache_flush(void *arg)
 	(void)arg;
 
 	smclog(LOG_INFO, "Cache timeout, flushing unused (*,G) routes!");
-	mroute_expire(cache_timeout);
+	mroute_expire(-1, cache_timeout, NULL);
 }
 
 /**
@@ -222,11 +578,11 @@ static void mroute4_disable(void)
 		return;
 
 	TAILQ_FOREACH_SAFE(entry, &conf_list, link, tmp) {
-		TAILQ_REMOVE(&conf_list, entry, link);
+		conf_del(entry);
 		free(entry);
 	}
 	TAILQ_FOREACH_SAFE(entry, &kern_list, link, tmp) {
-		TAILQ_REMOVE(&kern_list, entry, link);
+		kern_del(entry);
 		free(entry);
 	}
 }
@@ -244,12 +600,13 @@ static void mroute4_prune_vif(int vif)
 			continue;
 
 		if (entry->inbound == vif) {
-			TAILQ_REMOVE(&conf_list, entry, link);
+			conf_del(entry);
 			entry->unused = 1;
 			mfc_uninstall(entry);
 			free(entry);
 		} else if (entry->ttl[vif] > 0) {
 			entry->ttl[vif] = 0;
+			gen_route(GEN_RULE, 0, entry);
 			mfc_install(entry);
 		}
 	}
@@ -275,7 +632,7 @@ static int mroute4_add_vif(struct iface *iface)
 
 		case EEXIST:
 			smclog(LOG_DEBUG, "Interface %s already has VIF %d.", iface->ifname, iface->vif);
-			return 0;
+			goto mrdisc;
 
 		default:
 			break;
@@ -285,10 +642,11 @@ static int mroute4_add_vif(struct iface *iface)
 		return -1;
 	}
 
+mrdisc:
 	if (iface->mrdisc)
-		return mrdisc_register(iface->ifname, iface->vif);
+		return mrdisc_register(AF_INET, iface);
 
-	return mrdisc_deregister(iface->vif);
+	return mrdisc_deregister(AF_INET, iface);
 }
 
 static int mroute4_del_vif(struct iface *iface)
@@ -296,7 +654,7 @@ static int mroute4_del_vif(struct iface *iface)
 	int rc = 0;
 
 	if (iface->mrdisc)
-		rc = mrdisc_deregister(iface->vif);
+		rc = mrdisc_deregister(AF_INET, iface);
 
 	if (iface->vif == ALL_VIFS)
 		return 0;
@@ -320,22 +678,6 @@ static int mroute4_del_vif(struct iface *iface)
 	return rc;
 }
 
-static int is_exact_match(struct mroute *rule, struct mroute *cand)
-{
-	if (rule->group.ss_family != cand->group.ss_family)
-		return 0;
-	if (rule->inbound != cand->inbound)
-		return 0;
-
-	if (!inet_addr_cmp(&rule->source, &cand->source) &&
-	    !inet_addr_cmp(&rule->group,  &cand->group)  &&
-	    rule->len     == cand->len                   &&
-	    rule->src_len == cand->src_len)
-		return 1;
-
-	return 0;
-}
-
 /*
  * Used for (*,G) matches
  *
@@ -350,26 +692,24 @@ static int is_exact_match(struct mroute *rule, struct mroute *cand)
  */
 int is_match(struct mroute *rule, struct mroute *cand)
 {
-	inet_addr_t a, b;
-	int rc = 0;
+	struct inet_range range;
 
 	if (rule->group.ss_family != cand->group.ss_family)
 		return 0;
 	if (rule->inbound != cand->inbound)
-		return rc;
-
-	a = inet_netaddr(&rule->group, rule->len);
-	b = inet_netaddr(&cand->group, rule->len);
+		return 0;
 
-	rc = !inet_addr_cmp(&a, &b);
+	if (inet_range_init(&range, &rule->group, rule->len))
+		return 0;
+	if (!inet_range_contains(&range, &cand->group))
+		return 0;
 	if (is_anyaddr(&rule->source))
-		return rc;
+		return 1;
 
-	a = inet_netaddr(&rule->source, rule->src_len);
-	b = inet_netaddr(&cand->source, rule->src_len);
-	rc &= !inet_addr_cmp(&a, &b);
+	if (inet_range_init(&range, &rule->source, rule->src_len))
+		return 0;
 
-	return rc;
+	return inet_range_contains(&range, &cand->source);
 }
 
 static int is_ssm(struct mroute *route)
@@ -379,25 +719,102 @@ static int is_ssm(struct mroute *route)
 	return !is_anyaddr(&route->source) && route->src_len == max_len && route->len == max_len;
 }
 
-/* find any existing route, with matching inbound interface */
-static struct mroute *conf_find(struct mroute *route)
+/*
+ * Set up range query for kernel MFC entries with group in @route's
+ * group prefix and, unless any, source in its source prefix.  The
+ * inbound interface is not considered.
+ */
+static int query_init(struct query *q, struct mroute *route)
 {
-	struct mroute *entry;
+	memset(q, 0, sizeof(*q));
+	if (inet_range_init(&q->group, &route->group, route->len))
+		return -1;
 
-	TAILQ_FOREACH(entry, &conf_list, link) {
-		if (is_exact_match(route, entry))
-			return entry;
+	if (!is_anyaddr(&route->source)) {
+		if (inet_range_init(&q->source, &route->source, route->src_len))
+			return -1;
+		q->has_source = 1;
+		q->by_source  = route->src_len > route->len;
+	}
+
+	return 0;
+}
+
+/* From @entry, find first entry matching query, or NULL when out of range */
+static struct mroute *query_scan(struct query *q, struct mroute *entry)
+{
+	while (entry) {
+		if (q->by_source) {
+			if (!inet_range_contains(&q->source, &entry->source))
+				return NULL;
+			if (inet_range_contains(&q->group, &entry->group))
+				return entry;
+
+			entry = RB_NEXT(stree, &src_tree, entry);
+		} else {
+			if (!inet_range_contains(&q->group, &entry->group))
+				return NULL;
+			if (!q->has_source || inet_range_contains(&q->source, &entry->source))
+				return entry;
+
+			entry = RB_NEXT(ktree, &kern_tree, entry);
+		}
 	}
 
 	return NULL;
 }
 
+static struct mroute *query_first(struct query *q)
+{
+	struct mroute key;
+
+	memset(&key, 0, sizeof(key));
+	if (q->by_source) {
+		key.source = q->source.addr;
+		inet_anyaddr(key.source.ss_family, &key.group);
+		return query_scan(q, RB_NFIND(stree, &src_tree, &key));
+	}
+
+	key.group = q->group.addr;
+	inet_anyaddr(key.group.ss_family, &key.source);
+
+	return query_scan(q, RB_NFIND(ktree, &kern_tree, &key));
+}
+
+/* First entry matching query from @key, which may have been removed */
+static struct mroute *query_resume(struct query *q, struct mroute *key)
+{
+	if (q->by_source)
+		return query_scan(q, RB_NFIND(stree, &src_tree, key));
+
+	return query_scan(q, RB_NFIND(ktree, &kern_tree, key));
+}
+
+/* Next entry matching query, safe to call before removing @entry */
+static struct mroute *query_next(struct query *q, struct mroute *entry)
+{
+	if (q->by_source)
+		return query_scan(q, RB_NEXT(stree, &src_tree, entry));
+
+	return query_scan(q, RB_NEXT(ktree, &kern_tree, entry));
+}
+
+/* find configured route with the same prefixes and inbound interface */
+static struct mroute *conf_find(struct mroute *route)
+{
+	return RB_FIND(ctree, &conf_tree, route);
+}
+
 /* find any existing route, with matching inbound interface */
 static struct mroute *kern_find(struct mroute *route)
 {
 	struct mroute *entry;
+	struct query q;
 
-	TAILQ_FOREACH(entry, &kern_list, link) {
+	if (query_init(&q, route))
+		return NULL;
+
+	for (entry = query_first(&q); entry; entry = query_next(&q, entry)) {
 		if (is_match(route, entry))
 			return entry;
 	}
@@ -405,136 +822,470 @@ static struct mroute *kern_find(struct mroute *route)
 	return NULL;
 }
 
-static int is_active(struct mroute *route)
+static int has_oifs(const uint8_t *ttl)
 {
 	size_t i;
 
-	for (i = 0; i < NELEMS(route->ttl); i++) {
-		if (route->ttl[i])
+	for (i = 0; i < MAX_MC_VIFS; i++) {
+		if (ttl[i])
 			return 1;
 	}
 
 	return 0;
 }
 
+static int is_active(struct mroute *route)
+{
+	return has_oifs(mroute_ttl(route));
+}
+
 /*
  * Get valid packet usage statistics (i.e. number of actually forwarded
- * packets) from the kernel for an installed MFC entry
+ * packets) for an installed MFC entry.  Cumulative, so a reinstall of
+ * the kernel entry does not look like it has been used.
  */
-static unsigned long get_valid_pkt(struct mroute *route)
+static uint64_t get_valid_pkt(struct mroute *route)
 {
-	struct mroute_stats ms = { 0 };
+	struct counter *c;
 
-	if (kern_stats(route, &ms))
+	c = counter_sample(route);
+	if (!c)
 		return 0;
 
-	return ms.ms_pktcnt - ms.ms_wrong_if;
+	return c->pkt - c->wrong_if;
 }
 
-/**
- * mroute_expire - Expire dynamically added (*,G) routes
- * @max_idle: Timeout for routes in seconds, 0 to expire all dynamic routes
- *
- * This function flushes all (*,G) routes which haven't been used (i.e. no
- * packets matching them have been forwarded) in the last max_idle seconds.
- * It is called periodically on cache-timeout or on request of smcroutectl.
- * The latter is useful in case of topology changes (e.g. VRRP fail-over)
- * or similar.
- */
-void mroute_expire(int max_idle)
+/* Check if @entry, a kernel MFC entry from a (*,G) rule, has been idle too long */
+static void expire_one(struct mroute *entry, int max_idle, time_t now)
 {
-	struct mroute *entry, *tmp;
-	struct timespec now;
-
-	clock_gettime(CLOCK_MONOTONIC, &now);
-
-	TAILQ_FOREACH_SAFE(entry, &kern_list, link, tmp) {
-		char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
-		struct iface *iface;
-
-		/* XXX: only consider (*,G) routes, not pure (S,G), and no overlap handling for now */
-		if (conf_find(entry))
-			continue;
+	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
+	struct iface *iface;
 
-		inet_addr2str(&entry->group, group, sizeof(group));
-		inet_addr2str(&entry->source, origin, sizeof(origin));
-		iface = iface_find_by_inbound(entry);
+	/* XXX: only consider (*,G) routes, not pure (S,G), and no overlap handling for now */
+	if (conf_find(entry))
+		return;
 
-		if (!entry->last_use) {
-			/* New entry */
-			entry->last_use = now.tv_sec;
-			entry->valid_pkt = get_valid_pkt(entry);
-			continue;
-		}
+	inet_addr2str(&entry->group, group, sizeof(group));
+	inet_addr2str(&entry->source, origin, sizeof(origin));
+	iface = iface_find_by_inbound(entry);
 
-		smclog(LOG_DEBUG, "Checking (%s,%s) on %s, time to expire: last %ld max %d now: %ld",
-		       origin, group, iface ? iface->ifname : "UNKNOWN",
-		       entry->last_use, max_idle, now.tv_sec);
+	if (!entry->last_use) {
+		/* New entry */
+		entry->last_use = now;
+		entry->valid_pkt = get_valid_pkt(entry);
+		return;
+	}
 
-		if (entry->last_use + max_idle <= now.tv_sec) {
-			unsigned long valid_pkt;
+	smclog(LOG_DEBUG, "Checking (%s,%s) on %s, time to expire: last %ld max %d now: %ld",
+	       origin, group, iface ? iface->ifname : "UNKNOWN",
+	       entry->last_use, max_idle, now);
 
-			valid_pkt = get_valid_pkt(entry);
-			if (valid_pkt != entry->valid_pkt) {
-				/* Used since last check, update */
-				smclog(LOG_DEBUG, "  -> Nope, still active, valid %lu vs last valid %lu.",
-				       valid_pkt, entry->valid_pkt);
-				entry->last_use  = now.tv_sec;
-				entry->valid_pkt = valid_pkt;
-				continue;
-			}
+	if (entry->last_use + max_idle <= now) {
+		uint64_t valid_pkt;
 
-			/* Not used, expire */
-			smclog(LOG_DEBUG, "  -> Yup, stale route.");
-			kern_mroute_del(entry);
-			TAILQ_REMOVE(&kern_list, entry, link);
-			free(entry);
+		valid_pkt = get_valid_pkt(entry);
+		if (valid_pkt != entry->valid_pkt) {
+			/* Used since last check, update */
+			smclog(LOG_DEBUG, "  -> Nope, still active, valid %" PRIu64 " vs last valid %" PRIu64 ".",
+			       valid_pkt, entry->valid_pkt);
+			entry->last_use  = now;
+			entry->valid_pkt = valid_pkt;
+			return;
 		}
+
+		/* Not used, expire */
+		smclog(LOG_DEBUG, "  -> Yup, stale route.");
+		kern_del(entry);
+		kern_gone(entry);
 	}
 }
 
 /*
- * Install or update kernel MFC.  Installing a new route currently
- * requires an (S,G) entry, updating only requires a (*,G), which
- * is to handle overlaps.
- *
- * Currently, meaning Linux has support for (*,*) and (*,G) routing
- * but supporting that would require quite a bit of changes.  I.e.,
- * it's not just about removing the `!is_ssm(conf)` check ...
+ * Expire task, see mroute_expire().  Between slices entries may come
+ * and go, so the position is kept as the key of the next entry to check
+ * and looked up again in the ordered index.
  */
-static int mfc_install(struct mroute *route)
+struct expire {
+	int           sd;		/* client to reply to when done, or -1 */
+	int           max_idle;
+	time_t        now;
+
+	int           ranged;		/* only entries in range of q */
+	struct query  q;
+
+	int           started;
+	struct mroute key;		/* next entry to check */
+};
+
+static struct mroute *expire_first(struct expire *job)
 {
-	struct mroute *kern;
+	if (!job->started) {
+		job->started = 1;
+		if (job->ranged)
+			return query_first(&job->q);
 
-	kern = kern_find(route);
-	if (!kern) {
-		if (!is_ssm(route))
-			return 0;
+		return RB_MIN(ktree, &kern_tree);
+	}
 
-		kern = malloc(sizeof(struct mroute));
-		if (!kern) {
-			smclog(LOG_WARNING, "Cannot add kernel route: %s", strerror(errno));
+	if (job->ranged)
+		return query_resume(&job->q, &job->key);
+
+	return RB_NFIND(ktree, &kern_tree, &job->key);
+}
+
+static int expire_step(void *arg)
+{
+	struct expire *job = arg;
+	struct mroute *entry, *next;
+	int num;
+
+	entry = expire_first(job);
+	for (num = 0; entry && num < TASK_SLICE; num++, entry = next) {
+		if (job->ranged)
+			next = query_next(&job->q, entry);
+		else
+			next = RB_NEXT(ktree, &kern_tree, entry);
+
+		expire_one(entry, job->max_idle, job->now);
+	}
+
+	if (entry) {
+		memcpy(&job->key, entry, offsetof(struct mroute, ttl));
+		return 1;
+	}
+
+	if (job->sd != -1)
+		ipc_done(job->sd, 0);
+	free(job);
+
+	return 0;
+}
+
+/**
+ * mroute_expire - Expire dynamically added (*,G) routes
+ * @sd:       Client socket to reply to when done, or -1
+ * @max_idle: Timeout for routes in seconds, 0 to expire all dynamic routes
+ * @filter:   Optional group and source prefix, only expire routes in range
+ *
+ * This function flushes all (*,G) routes which haven't been used (i.e. no
+ * packets matching them have been forwarded) in the last max_idle seconds.
+ * It is called periodically on cache-timeout or on request of smcroutectl.
+ * The latter is useful in case of topology changes (e.g. VRRP fail-over)
+ * or similar.
+ *
+ * The routes are checked by a task, TASK_SLICE routes per slice, so new
+ * upcalls are served also when the kernel MFC is large.  A client socket
+ * is detached from the IPC server and replied to when the task is done.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute_expire(int sd, int max_idle, struct mroute *filter)
+{
+	struct timespec now;
+	struct expire *job;
+
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		return -1;
+	}
+
+	if (filter) {
+		if (query_init(&job->q, filter)) {
+			free(job);
+			errno = EINVAL;
+			return -1;
+		}
+		job->ranged = 1;
+	}
+
+	timer_now(&now);
+	job->now      = now.tv_sec;
+	job->sd       = sd;
+	job->max_idle = max_idle;
+
+	task_add(expire_step, job);
+	if (sd != -1)
+		ipc_detach();
+
+	return 0;
+}
+
+/* Does the kernel MFC entry differ from our view?  IIF and OIF presence only */
+static int mfc_differs(struct mroute *route, struct mroute *mfc)
+{
+	const uint8_t *a = mroute_ttl(route), *b = mroute_ttl(mfc);
+
+	if (route->inbound != mfc->inbound)
+		return 1;
+
+	for (size_t i = 0; i < MAX_MC_VIFS; i++) {
+		if (!a[i] != !b[i])
 			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Called for each entry in the kernel MFC dump.  The kernel MFC is
+ * keyed on (S,G) only, so look up all our entries for (S,G) in the
+ * ordered index, regardless of IIF, and mark them as seen.  Entries
+ * we do not know about are saved for removal after the dump.
+ */
+static void sync_entry(struct mroute *mfc, void *arg)
+{
+	struct mroute *entry, *first = NULL;
+	struct kl *strays = arg;
+	struct mroute key;
+	int ok = 0;
+
+	key = *mfc;
+	key.inbound = 0;
+	for (entry = RB_NFIND(ktree, &kern_tree, &key); entry; entry = RB_NEXT(ktree, &kern_tree, entry)) {
+		key.inbound = entry->inbound;
+		if (kern_cmp(&key, entry))
+			break;
+
+		if (!first)
+			first = entry;
+		if (!mfc_differs(entry, mfc))
+			ok = 1;
+		entry->sync = sync_pass;
+	}
+
+	if (!first) {
+		entry = malloc(sizeof(struct mroute));
+		if (!entry) {
+			smclog(LOG_WARNING, "Cannot reconcile kernel MFC: %s", strerror(errno));
+			return;
 		}
 
-		memcpy(kern, route, sizeof(struct mroute));
-		TAILQ_INSERT_TAIL(&kern_list, kern, link);
+		memcpy(entry, mfc, sizeof(struct mroute));
+		TAILQ_INSERT_TAIL(strays, entry, link);
+		return;
+	}
+
+	if (!ok)
+		first->drift = 1;
+}
 
-		return kern_mroute_add(kern);
+static void sync_repair(struct mroute *route, int add, int *budget)
+{
+	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
+
+	if (*budget <= 0) {
+		drift.deferred++;
+		return;
 	}
+	(*budget)--;
 
-	TAILQ_FOREACH(kern, &kern_list, link) {
-		if (!is_match(route, kern))
+	inet_addr2str(&route->source, origin, sizeof(origin));
+	inet_addr2str(&route->group, group, sizeof(group));
+	smclog(LOG_NOTICE, "Kernel MFC out of sync, %s (%s,%s)",
+	       add ? "restoring" : "removing stray", origin, group);
+
+	/* Lost behind our back, the restored entry counts from zero */
+	if (add)
+		counter_gone(route);
+
+	if (add ? kern_mroute_add(route) : kern_mroute_del(route))
+		drift.failed++;
+	else
+		drift.repaired++;
+}
+
+/**
+ * mroute_reconcile - Repair any drift between kern_list and kernel MFC
+ *
+ * A failed MRT_ADD_MFC, or someone else tampering with the kernel MFC,
+ * makes our view of the kernel diverge from what actually forwards.
+ * This function takes a bulk netlink dump of the kernel MFC, diffs it
+ * against kern_list, and repairs only the entries that differ.  At most
+ * RECONCILE_BUDGET entries are repaired per pass, the rest are deferred
+ * to the next pass.  Called periodically, see smcrouted -r SEC.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute_reconcile(void)
+{
+	struct kl strays = TAILQ_HEAD_INITIALIZER(strays);
+	int families[] = { AF_INET, AF_INET6 };
+	int dumped[NELEMS(families)] = { 0 };
+	struct mroute *entry, *tmp;
+	unsigned long deferred = drift.deferred;
+	int budget = RECONCILE_BUDGET;
+	unsigned long found = 0;
+	int rc = 0;
+	size_t i;
+
+	/* Compare with what we want the kernel to have */
+	mroute_flush();
+
+	sync_pass++;
+	for (i = 0; i < NELEMS(families); i++) {
+		if (!kern_mfc_dump(families[i], sync_entry, &strays)) {
+			dumped[i] = 1;
+			continue;
+		}
+
+		/* Address family not enabled, or not supported */
+		if (errno == EAGAIN || errno == EAFNOSUPPORT)
+			continue;
+
+		if (errno != ENOSYS)
+			smclog(LOG_WARNING, "Failed reading kernel MFC: %s", strerror(errno));
+		rc = 1;
+		goto done;
+	}
+
+	TAILQ_FOREACH_SAFE(entry, &strays, link, tmp) {
+		drift.stray++;
+		found++;
+		sync_repair(entry, 0, &budget);
+	}
+
+	TAILQ_FOREACH(entry, &kern_list, link) {
+		for (i = 0; i < NELEMS(families); i++) {
+			if (families[i] == entry->group.ss_family)
+				break;
+		}
+		if (i == NELEMS(families) || !dumped[i])
 			continue;
 
-		for (size_t i = 0; i < NELEMS(route->ttl); i++) {
-			if (route->ttl[i] > 0 && kern->ttl[i] != route->ttl[i])
-				kern->ttl[i] = route->ttl[i];
+		if (entry->sync != sync_pass) {
+			drift.missing++;
+			found++;
+			sync_repair(entry, 1, &budget);
+		} else if (entry->drift) {
+			drift.mismatch++;
+			found++;
+			sync_repair(entry, 1, &budget);
 		}
+		entry->drift = 0;
+	}
 
-		kern_mroute_add(kern);
+	drift.passes++;
+	drift.last_drift = found;
+	if (found)
+		smclog(LOG_INFO, "Reconciled kernel MFC, %lu discrepancies, %lu repairs deferred.",
+		       found, drift.deferred - deferred);
+done:
+	TAILQ_FOREACH_SAFE(entry, &strays, link, tmp) {
+		TAILQ_REMOVE(&strays, entry, link);
+		free(entry);
 	}
 
+	return rc;
+}
+
+static void reconcile(void *arg)
+{
+	(void)arg;
+	mroute_reconcile();
+}
+
+/*
+ * Add the OIFs of @route, a new rule or a changed (S,G), to all kernel MFC
+ * entries in its range that lack any of them.  Entries in the same
+ * interned OIF set all move to the same new set, so it is looked up
+ * only once per run of entries sharing a set.
+ */
+static void retarget(struct mroute *route)
+{
+	struct oifset *from = NULL, *to = NULL;
+	struct mroute *kern;
+	struct query q;
+
+	if (query_init(&q, route))
+		return;
+
+	for (kern = query_first(&q); kern; kern = query_next(&q, kern)) {
+		if (!is_match(route, kern) || oifset_has(kern->oifs, route->ttl))
+			continue;
+
+		if (kern->oifs != from) {
+			oifset_put(from);
+			oifset_put(to);
+
+			/* hold on to it, so the address is not reused */
+			from = oifset_get(kern->oifs->ttl);
+			to   = oifset_add(from, route->ttl);
+		}
+
+		kern_oifs(kern, to);
+	}
+
+	oifset_put(from);
+	oifset_put(to);
+}
+
+/*
+ * The (*,G) rule @tmpl, which had the OIFs in @old, has gained OIFs.
+ * Entries learned from it, or that it has been added to, are in sets
+ * with all of @old, so only the users of those sets are visited.  The
+ * new set is looked up once per set, not per entry.
+ */
+static void tmpl_retarget(struct mroute *tmpl, const uint8_t *old)
+{
+	struct mroute *kern, *tmp;
+	struct oifset *set, *to;
+
+	for (set = oifset_iterator(1); set; set = oifset_iterator(0)) {
+		if (!oifset_has(set, old) || oifset_has(set, tmpl->ttl))
+			continue;
+
+		/* moving the last user frees set, so do not touch it after */
+		to = oifset_add(set, tmpl->ttl);
+		LIST_FOREACH_SAFE(kern, &set->users, olink, tmp) {
+			if (is_match(tmpl, kern))
+				kern_oifs(kern, to);
+		}
+		oifset_put(to);
+	}
+}
+
+/*
+ * Install or update kernel MFC.  Installing a new route currently
+ * requires an (S,G) entry, updating only requires a (*,G), which
+ * is to handle overlaps.
+ *
+ * Currently, meaning Linux has support for (*,*) and (*,G) routing
+ * but supporting that would require quite a bit of changes.  I.e.,
+ * it's not just about removing the `!is_ssm(conf)` check ...
+ */
+static int mfc_install(struct mroute *route)
+{
+	struct oifset *set;
+	struct mroute *kern;
+
+	kern = kern_find(route);
+	if (!kern) {
+		if (!is_ssm(route))
+			return 0;
+
+		kern = oifset_dup(route);
+		if (!kern) {
+			smclog(LOG_WARNING, "Cannot add kernel route: %s", strerror(errno));
+			return 1;
+		}
+
+		kern->dirty   = 0;
+		kern->retries = 0;
+		kern->oifs    = NULL;
+		kern_add(kern);
+
+		set = oifset_get(route->ttl);
+		kern_oifs(kern, set);
+		oifset_put(set);
+
+		return 0;
+	}
+
+	retarget(route);
+
 	return 0;
 }
 
@@ -551,10 +1302,16 @@ static int mfc_uninstall(struct mroute *route)
 {
 	struct mroute *conf, *kern, *tmp;
 	int removal = !is_active(route);
-	int diff = 0;
+	uint8_t ttl[MAX_MC_VIFS];
+	struct oifset *set;
+	struct query q;
 	int rc = 0;
 
-	TAILQ_FOREACH_SAFE(kern, &kern_list, link, tmp) {
+	if (query_init(&q, route))
+		return 0;
+
+	for (kern = query_first(&q); kern; kern = tmp) {
+		tmp = query_next(&q, kern);
 		if (!is_match(route, kern))
 			continue;
 
@@ -562,11 +1319,10 @@ static int mfc_uninstall(struct mroute *route)
 			goto cleanup;
 
 		/* First remove OIFs from route entry */
-		for (size_t i = 0; i < NELEMS(route->ttl); i++) {
-			if (removal || route->ttl[i] > 0) {
-				kern->ttl[i] = 0;
-				diff++;
-			}
+		memcpy(ttl, kern->oifs->ttl, sizeof(ttl));
+		for (size_t i = 0; i < NELEMS(ttl); i++) {
+			if (removal || route->ttl[i] > 0)
+				ttl[i] = 0;
 		}
 
 		/* Then, for each matching conf we add its oifs */
@@ -575,30 +1331,283 @@ static int mfc_uninstall(struct mroute *route)
 				continue;
 
 			for (size_t i = 0; i < NELEMS(conf->ttl); i++) {
-				if (conf->ttl[i] > 0 && kern->ttl[i] == 0) {
-					kern->ttl[i] = conf->ttl[i];
-					diff++;
-				}
+				if (conf->ttl[i] > 0 && ttl[i] == 0)
+					ttl[i] = conf->ttl[i];
 			}
 		}
 
-		if (!diff && !removal)
+		if (has_oifs(ttl) || !removal) {
+			set = oifset_get(ttl);
+			kern_oifs(kern, set);
+			oifset_put(set);
 			continue;
+		}
 
-		if (is_active(kern) || !removal) {
-			rc += kern_mroute_add(kern);
+	cleanup:
+		kern_del(kern);
+		rc += kern_gone(kern);
+	}
+
+	return rc;
+}
+
+/* Retry timer, runs while there are kernel MFC writes waiting */
+static void wq_retry(void *arg)
+{
+	(void)arg;
+
+	mroute_flush();
+	if (!wq_depth)
+		timer_del(wq_retry, NULL);
+}
+
+/* No longer waiting for retry, written, failed, or removed */
+static void wq_done(struct mroute *route)
+{
+	if (route->retries)
+		wq_depth--;
+	route->retries  = 0;
+	route->retry_at = 0;
+}
+
+/* A new kernel MFC entry replaces any pending removal of the same (S,G) */
+static void wq_cancel(struct mroute *route)
+{
+	struct mroute *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, &gone_list, dlink, tmp) {
+		if (inet_addr_cmp(&entry->source, &route->source) ||
+		    inet_addr_cmp(&entry->group, &route->group))
 			continue;
+
+		TAILQ_REMOVE(&gone_list, entry, dlink);
+		wq_done(entry);
+		free(entry);
+	}
+}
+
+/*
+ * Handle the result, @err, of writing update, or removal, of @route to
+ * the kernel MFC.  On transient errors the write is scheduled for a
+ * retry, see kern_retry().
+ *
+ * Returns:
+ * POSIX OK(0) when written, -1 if waiting for retry, 1 on failure.
+ */
+static int wq_result(struct mroute *route, int add, int err)
+{
+	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
+	int retries = route->retries;
+
+	if (retries)
+		kern_wq.retries++;
+
+	if (!add && err == ENOENT)
+		err = 0;
+	if (!err) {
+		if (!add)
+			counter_gone(route);
+		wq_done(route);
+		return 0;
+	}
+
+	if (kern_retry(err, &route->retries, &route->retry_at)) {
+		if (!retries) {
+			wq_depth++;
+			wq_peak = MAX(wq_peak, wq_depth);
 		}
+		timer_add(1, wq_retry, NULL);
+		return -1;
+	}
 
-	cleanup:
-		rc += kern_mroute_del(kern);
-		TAILQ_REMOVE(&kern_list, kern, link);
-		free(kern);
+	if (retries) {
+		inet_addr2str(&route->source, origin, sizeof(origin));
+		inet_addr2str(&route->group, group, sizeof(group));
+		smclog(LOG_WARNING, "Giving up %s (%s,%s) after %d retries, left to reconciler",
+		       add ? "adding" : "removing", origin, group, retries);
+	}
+	wq_done(route);
+
+	return 1;
+}
+
+/* Write update, or removal, of @route to the kernel MFC, see wq_result() */
+static int wq_write(struct mroute *route, int add)
+{
+	int rc;
+
+	/* Fold in the last kernel counters before they are gone */
+	if (!add)
+		counter_sample(route);
+
+	rc = add ? kern_mroute_add(route) : kern_mroute_del(route);
+
+	return wq_result(route, add, rc ? errno : 0);
+}
+
+/*
+ * Remove kernel MFC entry, already taken off kern_list by kern_del().
+ * On transient errors it is kept on gone_list for retry.
+ */
+static int kern_gone(struct mroute *route)
+{
+	int rc;
+
+	rc = wq_write(route, 0);
+	if (rc < 0) {
+		TAILQ_INSERT_TAIL(&gone_list, route, dlink);
+		return 0;
+	}
+
+	free(route);
+
+	return rc;
+}
+
+/* Write at most @budget, 0 for all, pending updates, sets @more if any are left */
+static int flush(int budget, int *more)
+{
+	struct mroute *entry, *tmp;
+	struct timespec now;
+	int num = 0;
+	int rc = 0;
+
+	timer_now(&now);
+	*more = 0;
+
+	TAILQ_FOREACH_SAFE(entry, &gone_list, dlink, tmp) {
+		if (entry->retry_at > now.tv_sec || wq_write(entry, 0) < 0)
+			continue;
+
+		TAILQ_REMOVE(&gone_list, entry, dlink);
+		free(entry);
+	}
+
+	/* Submit dirty entries KERN_BATCH at a time, each batch in one go */
+	do {
+		struct kern_op ops[KERN_BATCH];
+		size_t i, n = 0;
+
+		TAILQ_FOREACH(entry, &dirty_list, dlink) {
+			if (entry->retry_at > now.tv_sec)
+				continue;
+
+			if (budget && num == budget) {
+				*more = 1;
+				break;
+			}
+			if (n == NELEMS(ops))
+				break;
+
+			ops[n].route = entry;
+			ops[n].add   = 1;
+			n++;
+			num++;
+		}
+		if (!n)
+			break;
+
+		kern_mroute_batch(ops, n);
+
+		/* Written, or waiting for retry at a later time */
+		for (i = 0; i < n; i++) {
+			int result;
+
+			entry = ops[i].route;
+			result = wq_result(entry, 1, ops[i].err);
+			if (result < 0)
+				continue;
+
+			gen_route(GEN_MFC, 0, entry);
+
+			TAILQ_REMOVE(&dirty_list, entry, dlink);
+			entry->dirty = 0;
+			rc += result;
+		}
+	} while (!*more);
+
+	if (mfc_combined) {
+		smclog(LOG_DEBUG, "Flushed %d kernel MFC updates, %lu redundant updates combined",
+		       num, mfc_combined);
+		mfc_combined = 0;
 	}
 
 	return rc;
 }
 
+/**
+ * mroute_flush - Write pending kernel MFC updates
+ *
+ * Routes added, or updated, by mfc_install() and mfc_uninstall() are
+ * only marked dirty.  The final state of each dirty entry is written to
+ * the kernel here, once, so any intermediate OIF sets, e.g., when many
+ * rules are merged on reload, are never seen by the kernel.  Removals
+ * are not deferred, unless they fail with a transient error.  Writes
+ * waiting for retry are skipped until their backoff has expired.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if any update failed permanently.
+ */
+int mroute_flush(void)
+{
+	int more;
+
+	return flush(0, &more);
+}
+
+/* Write pending updates in slices, scheduled by kern_dirty() */
+static int flush_step(void *arg)
+{
+	int more;
+
+	(void)arg;
+	flush(TASK_SLICE, &more);
+
+	return more;
+}
+
+/* Record route in replace transaction, merging OIFs of duplicates */
+static int stage_add(struct mroute *route)
+{
+	struct mroute *entry;
+
+	entry = RB_FIND(ctree, &stage_tree, route);
+	if (entry) {
+		for (size_t i = 0; i < NELEMS(entry->ttl); i++) {
+			if (route->ttl[i])
+				entry->ttl[i] = route->ttl[i];
+		}
+		return 0;
+	}
+
+	entry = malloc(sizeof(struct mroute));
+	if (!entry) {
+		smclog(LOG_WARNING, "Cannot stage multicast route: %s", strerror(errno));
+		return 1;
+	}
+
+	memcpy(entry, route, sizeof(struct mroute));
+	RB_INSERT(ctree, &stage_tree, entry);
+
+	return 0;
+}
+
+/* Is there a configured route to @group?  Used to join those first */
+int mroute_has_group(inet_addr_t *group)
+{
+	struct inet_range range;
+	struct mroute *entry;
+
+	TAILQ_FOREACH(entry, &conf_list, link) {
+		if (inet_range_init(&range, &entry->group, entry->len))
+			continue;
+		if (inet_range_contains(&range, group))
+			return 1;
+	}
+
+	return 0;
+}
+
 /**
  * mroute_add_route - Add route to kernel, or save a wildcard route for later use
  * @route: Pointer to multicast route to add
@@ -614,10 +1623,16 @@ int mroute_add_route(struct mroute *route)
 {
 	struct mroute *conf;
 
+	if (staging)
+		return stage_add(route);
+
 	conf = conf_find(route);
 	if (conf) {
+		uint8_t old[MAX_MC_VIFS];
 		size_t i;
 
+		memcpy(old, conf->ttl, sizeof(old));
+
 		/* .conf: replace found entry with new outbounds */
 		if (conf->unused) {
 			for (i = 0; i < NELEMS(conf->ttl); i++)
@@ -629,6 +1644,17 @@ int mroute_add_route(struct mroute *route)
 			if (route->ttl[i])
 				conf->ttl[i] = route->ttl[i];
 		}
+
+		/* .conf: new priority, ipc: keep the highest */
+		if (conf->unused || route->prio > conf->prio)
+			conf->prio = route->prio;
+		gen_route(GEN_RULE, 0, conf);
+
+		conf->unused = 0;
+		if (!is_ssm(conf)) {
+			tmpl_retarget(conf, old);
+			return 0;
+		}
 	} else {
 		conf = malloc(sizeof(struct mroute));
 		if (!conf) {
@@ -637,7 +1663,7 @@ int mroute_add_route(struct mroute *route)
 		}
 
 		memcpy(conf, route, sizeof(struct mroute));
-		TAILQ_INSERT_TAIL(&conf_list, conf, link);
+		conf_add(conf);
 	}
 
 	conf->unused = 0;
@@ -677,11 +1703,12 @@ int mroute_del_route(struct mroute *route)
 			if (route->ttl[i] > 0 && conf->ttl[i] != 0)
 				conf->ttl[i] = 0;
 		}
+		gen_route(GEN_RULE, 0, conf);
 
 		rc = mfc_uninstall(route);
 	} else {
 	cleanup:
-		TAILQ_REMOVE(&conf_list, conf, link);
+		conf_del(conf);
 		rc = mfc_uninstall(route);
 		free(conf);
 	}
@@ -692,24 +1719,20 @@ int mroute_del_route(struct mroute *route)
 #ifdef HAVE_IPV6_MULTICAST_ROUTING
 static int mroute6_add_mif(struct iface *iface);
 
-/*
- * Receive and drop ICMPv6 stuff. This is either MLD packets or upcall
- * messages sent up from the kernel.
- */
-static void handle_nocache6(int sd, void *arg)
+/* Read one ICMPv6 message, NOCACHE upcalls for (*,G) hits are returned in @route */
+static int upcall_parse6(int sd, struct mroute *route)
 {
 	char origin[INET_ADDRSTR_LEN], group[INET_ADDRSTR_LEN];
-	struct mroute mroute = { 0 };
 	struct mrt6msg *im6;
 	struct iface *iface;
 	char tmp[128];
-	int result;
+	ssize_t result;
 
-	(void)arg;
-	result = read(sd, tmp, sizeof(tmp));
+	result = recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT);
 	if (result < 0) {
-		smclog(LOG_INFO, "Failed clearing MLD message from kernel: %s", strerror(errno));
-		return;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			smclog(LOG_INFO, "Failed clearing MLD message from kernel: %s", strerror(errno));
+		return -1;
 	}
 
 	/*
@@ -721,51 +1744,33 @@ static void handle_nocache6(int sd, void *arg)
 	 */
 	im6 = (struct mrt6msg *)tmp;
 	if (im6->im6_mbz != 0 || im6->im6_msgtype == 0)
-		return;
+		return 0;
 
-	inet_addr6_set(&mroute.source, &im6->im6_src);
-	inet_addr6_set(&mroute.group, &im6->im6_dst);
-	mroute.inbound = im6->im6_mif;
-	mroute.len     = 128;
-	mroute.src_len = 128;
+	memset(route, 0, sizeof(*route));
+	inet_addr6_set(&route->source, &im6->im6_src);
+	inet_addr6_set(&route->group, &im6->im6_dst);
+	route->inbound = im6->im6_mif;
+	route->len     = 128;
+	route->src_len = 128;
 
-	inet_addr2str(&mroute.source, origin, sizeof(origin));
-	inet_addr2str(&mroute.group, group, sizeof(group));
+	inet_addr2str(&route->source, origin, sizeof(origin));
+	inet_addr2str(&route->group, group, sizeof(group));
 
-	iface = iface_find_by_inbound(&mroute);
+	iface = iface_find_by_inbound(route);
 	if (!iface) {
 		smclog(LOG_WARNING, "No matching interface for VIF %u, cannot handle MRT6MSG %u:%u. "
-		       "Multicast source %s, dest %s", mroute.inbound, im6->im6_mbz, im6->im6_msgtype,
+		       "Multicast source %s, dest %s", route->inbound, im6->im6_mbz, im6->im6_msgtype,
 		       origin, group);
-		return;
+		return 0;
 	}
 
 	switch (im6->im6_msgtype) {
 	case MRT6MSG_NOCACHE:
-		smclog(LOG_DEBUG, "New multicast data from %s to group %s on VIF %u",
-		       origin, group, mroute.inbound);
-
-		/* Find any matching route for this group on that iif. */
-		result = mroute_dyn_add(&mroute);
-		if (result) {
-			/*
-			 * This is a common error, the router receives streams it is not
-			 * set up to route -- we ignore these by default, but if the user
-			 * sets a more permissive log level we help out by showing what
-			 * is going on.
-			 */
-			if (ENOENT == errno)
-				smclog(LOG_INFO, "Multicast from %s, group %s, on %s does not match any (*,G) rule",
-				       origin, group, iface->ifname);
-			return;
-		}
-
-		script_exec(&mroute);
-		break;
+		return 1;
 
 	case MRT6MSG_WRONGMIF:
 		smclog(LOG_WARNING, "Multicast from %s, group %s, coming in on wrong MIF %u, iface %s",
-		       origin, group, mroute.inbound, iface->ifname);
+		       origin, group, route->inbound, iface->ifname);
 		break;
 
 	case MRT6MSG_WHOLEPKT:
@@ -776,6 +1781,18 @@ static void handle_nocache6(int sd, void *arg)
 		smclog(LOG_DEBUG, "Unknown MRT6MSG %u from kernel", im6->im6_msgtype);
 		break;
 	}
+
+	return 0;
+}
+
+/*
+ * Receive and drop ICMPv6 stuff. This is either MLD packets or upcall
+ * messages sent up from the kernel.
+ */
+static void handle_nocache6(int sd, void *arg)
+{
+	(void)arg;
+	upcall_handle(sd, upcall_parse6);
 }
 #endif /* HAVE_IPV6_MULTICAST_ROUTING */
 
@@ -864,12 +1881,13 @@ static void mroute6_prune_mif(int mif)
 			continue;
 
 		if (entry->inbound == mif) {
-			TAILQ_REMOVE(&conf_list, entry, link);
+			conf_del(entry);
 			entry->unused = 1;
 			mfc_uninstall(entry);
 			free(entry);
 		} else if (entry->ttl[mif] > 0) {
 			entry->ttl[mif] = 0;
+			gen_route(GEN_RULE, 0, entry);
 			mfc_install(entry);
 		}
 	}
@@ -895,7 +1913,7 @@ static int mroute6_add_mif(struct iface *iface)
 
 		case EEXIST:
 			smclog(LOG_DEBUG, "Interface %s already has MIF %d.", iface->ifname, iface->mif);
-			return 0;
+			goto mrdisc;
 
 		default:
 			break;
@@ -906,13 +1924,20 @@ static int mroute6_add_mif(struct iface *iface)
 		return -1;
 	}
 
-	return 0;
+mrdisc:
+	if (iface->mrdisc)
+		return mrdisc_register(AF_INET6, iface);
+
+	return mrdisc_deregister(AF_INET6, iface);
 }
 
 static int mroute6_del_mif(struct iface *iface)
 {
 	int rc = 0;
 
+	if (iface->mrdisc)
+		rc = mrdisc_deregister(AF_INET6, iface);
+
 	if (iface->mif == ALL_VIFS)
 		return 0;
 
@@ -939,26 +1964,19 @@ static int mroute6_del_mif(struct iface *iface)
 /**
  * mroute_dyn_add - Add route to kernel if it matches a known (*,G) route.
  * @route: Pointer to candidate multicast route
+ * @tmpl:  Matching (*,G) route from tmpl_find(), or %NULL
  *
  * Returns:
  * POSIX OK(0) on success, non-zero on error with @errno set.
  */
-static int mroute_dyn_add(struct mroute *route)
+static int mroute_dyn_add(struct mroute *route, struct mroute *tmpl)
 {
-	struct mroute *entry;
 	int rc;
 
-	TAILQ_FOREACH(entry, &conf_list, link) {
-		/* Find matching (*,G) ... and interface. */
-		if (is_ssm(entry) || !is_match(entry, route))
-			continue;
-
+	if (tmpl) {
 		/* Use configured template (*,G) outbound interfaces. */
-		memcpy(route->ttl, entry->ttl, NELEMS(route->ttl) * sizeof(route->ttl[0]));
-		break;
-	}
-
-	if (!entry) {
+		memcpy(route->ttl, tmpl->ttl, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	} else {
 		/*
 		 * No match, add entry without outbound interfaces
 		 * nevertheless to avoid continuous cache misses from
@@ -971,7 +1989,7 @@ static int mroute_dyn_add(struct mroute *route)
 	rc = mfc_install(route);
 
 	/* Signal to cache handler we've added a stop filter */
-	if (!entry) {
+	if (!tmpl) {
 		errno = ENOENT;
 		return -1;
 	}
@@ -979,25 +1997,96 @@ static int mroute_dyn_add(struct mroute *route)
 	return rc;
 }
 
-int mroute_init(int do_vifs, int table_id, int cache_tmo)
+/*
+ * Release on demand VIFs/MIFs no longer used by any route.  An unused
+ * interface is first marked idle, and released on the next pass if it
+ * is still unused, so routes can come and go within the hold-down.
+ */
+static void vif_reclaim(void *arg)
 {
-	static int running = 0;
+	uint8_t used4[MAX_MC_VIFS] = { 0 };
+	uint8_t used6[MAX_MC_VIFS] = { 0 };
+	struct mroute *entry;
+	struct iface *iface;
+	size_t i;
+
+	(void)arg;
+
+	TAILQ_FOREACH(entry, &conf_list, link) {
+		uint8_t *used = entry->group.ss_family == AF_INET6 ? used6 : used4;
+
+		if (entry->inbound < MAX_MC_VIFS)
+			used[entry->inbound] = 1;
+		for (i = 0; i < NELEMS(entry->ttl); i++) {
+			if (entry->ttl[i])
+				used[i] = 1;
+		}
+	}
+
+	for (iface = iface_iterator(1); iface; iface = iface_iterator(0)) {
+		if (!iface->lazy)
+			continue;
 
+		if ((iface->vif < MAX_MC_VIFS && used4[iface->vif]) ||
+		    (iface->mif < MAX_MC_VIFS && used6[iface->mif])) {
+			iface->idle = 0;
+			continue;
+		}
+
+		if (!iface->idle) {
+			iface->idle = 1;
+			continue;
+		}
+
+		smclog(LOG_DEBUG, "Releasing unused on demand VIF/MIF for %s", iface->ifname);
+		mroute4_del_vif(iface);
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+		mroute6_del_mif(iface);
+#endif
+		iface->lazy = 0;
+		iface->idle = 0;
+	}
+}
+
+int mroute_init(int do_vifs, int table_id, int cache_tmo, int sync_ivl, int vif_hd)
+{
 	TAILQ_INIT(&conf_list);
 	TAILQ_INIT(&kern_list);
+	RB_INIT(&conf_tree);
+	RB_INIT(&kern_tree);
+	RB_INIT(&src_tree);
 
-	if (cache_tmo > 0 && !running) {
-		running++;
+	if (cache_tmo > 0 && !cache_timeout) {
 		cache_timeout = cache_tmo;
 		timer_add(cache_tmo, cache_flush, NULL);
 	}
 
+	if (sync_ivl > 0 && !sync_interval) {
+		sync_interval = sync_ivl;
+		timer_add(sync_ivl, reconcile, NULL);
+	}
+
+	if (vif_hd > 0 && !vif_hold) {
+		vif_hold = vif_hd;
+		timer_add(vif_hd, vif_reclaim, NULL);
+	}
+
 	return  mroute4_enable(do_vifs, table_id) ||
 		mroute6_enable(do_vifs, table_id);
 }
 
 void mroute_exit(void)
 {
+	struct mroute *entry, *tmp;
+
+	timer_del(wq_retry, NULL);
+	task_del(flush_step, NULL);
+	TAILQ_FOREACH_SAFE(entry, &gone_list, dlink, tmp) {
+		TAILQ_REMOVE(&gone_list, entry, dlink);
+		free(entry);
+	}
+	wq_depth = 0;
+
 	mroute4_disable();
 	mroute6_disable();
 }
@@ -1015,6 +2104,7 @@ int mroute_add_vif(char *ifname, uint8_t mrdisc, uint8_t ttl)
 		iface->mrdisc    = mrdisc;
 		iface->threshold = ttl;
 		iface->unused    = 0;
+		iface->lazy      = 0;
 		rc += mroute4_add_vif(iface);
 #ifdef HAVE_IPV6_MULTICAST_ROUTING
 		rc += mroute6_add_mif(iface);
@@ -1029,6 +2119,44 @@ int mroute_add_vif(char *ifname, uint8_t mrdisc, uint8_t ttl)
 	return rc;
 }
 
+/**
+ * mroute_lazy_vif - Create VIFs/MIFs on demand for a route
+ * @ifname: Interface name, or wildcard, referenced by a route
+ *
+ * Only with on demand VIFs/MIFs, smcrouted -L, otherwise a no-op.  Also
+ * marks the interface as used, for reload.  The VIFs/MIFs are released
+ * by vif_reclaim() when no longer used.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int mroute_lazy_vif(char *ifname)
+{
+	struct ifmatch state;
+	struct iface *iface;
+	int rc = 0;
+
+	if (!vif_hold)
+		return 0;
+
+	iface_match_init(&state);
+	while ((iface = iface_match_by_name(ifname, 1, &state))) {
+		iface->unused = 0;
+		iface->idle   = 0;
+		if (iface->vif != NO_VIF || (iface->flags & IFF_MULTICAST) != IFF_MULTICAST)
+			continue;
+
+		smclog(LOG_DEBUG, "Creating multicast VIF for %s on demand", iface->ifname);
+		rc += mroute4_add_vif(iface);
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+		rc += mroute6_add_mif(iface);
+#endif
+		iface->lazy = 1;
+	}
+
+	return rc;
+}
+
 /* Used by file parser to remove VIFs/MIFs after setup */
 int mroute_del_vif(char *ifname)
 {
@@ -1099,6 +2227,95 @@ void mroute_reload_end(int do_vifs)
 		mfc_install(entry);
 }
 
+/*
+ * Start of a replace transaction from smcroutectl.  Until the matching
+ * mroute_replace_end(), routes are only recorded in stage_tree.
+ */
+void mroute_replace_beg(void)
+{
+	staging = 1;
+}
+
+/* Update configured route to the desired set of OIFs */
+static int replace_route(struct mroute *conf, struct mroute *route)
+{
+	struct mroute gone;
+	int diff = 0;
+	int rc = 0;
+
+	memcpy(&gone, conf, sizeof(gone));
+	for (size_t i = 0; i < NELEMS(conf->ttl); i++) {
+		if (conf->ttl[i] != route->ttl[i])
+			diff++;
+		if (route->ttl[i])
+			gone.ttl[i] = 0;
+	}
+
+	if (!diff)
+		return 0;
+
+	if (is_active(&gone))
+		rc += mroute_del_route(&gone);
+	if (is_active(route))
+		rc += mroute_add_route(route);
+
+	return rc;
+}
+
+/**
+ * mroute_replace_end - Commit, or abort, a replace transaction
+ * @commit: Non-zero to apply the staged set of routes, zero to abort
+ *
+ * The configured and the desired (staged) routes are both kept in the
+ * same order, so they are compared in a single merge pass.  Only routes
+ * that differ cause any kernel MFC updates, the rest are left as-is.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute_replace_end(int commit)
+{
+	struct mroute *conf, *route, *next;
+	int rc = 0;
+
+	staging = 0;
+
+	conf  = RB_MIN(ctree, &conf_tree);
+	route = RB_MIN(ctree, &stage_tree);
+	while (commit && (conf || route)) {
+		int cmp;
+
+		if (!conf)
+			cmp = 1;
+		else if (!route)
+			cmp = -1;
+		else
+			cmp = conf_cmp(conf, route);
+
+		if (cmp < 0) {
+			next = RB_NEXT(ctree, &conf_tree, conf);
+			conf->unused = 1;
+			rc += mroute_del_route(conf);
+			conf = next;
+		} else if (cmp > 0) {
+			rc += mroute_add_route(route);
+			route = RB_NEXT(ctree, &stage_tree, route);
+		} else {
+			next = RB_NEXT(ctree, &conf_tree, conf);
+			rc += replace_route(conf, route);
+			route = RB_NEXT(ctree, &stage_tree, route);
+			conf = next;
+		}
+	}
+
+	RB_FOREACH_SAFE(route, ctree, &stage_tree, next) {
+		RB_REMOVE(ctree, &stage_tree, route);
+		free(route);
+	}
+
+	return rc;
+}
+
 static int show_mroute(int sd, struct mroute *r, int inw, int detail)
 {
 	char src[INET_ADDRSTR_LEN] = "*";
@@ -1130,11 +2347,12 @@ static int show_mroute(int sd, struct mroute *r, int inw, int detail)
 	snprintf(buf, sizeof(buf), "%-42s %-*s ", sg, inw, iface->ifname);
 
 	if (detail) {
-		struct mroute_stats ms = { 0 };
-		char stats[30];
+		struct counter *c;
+		char stats[48];
 
-		kern_stats(r, &ms);
-		snprintf(stats, sizeof(stats), "%10lu %10lu ", ms.ms_pktcnt, ms.ms_bytecnt);
+		c = counter_sample(r);
+		snprintf(stats, sizeof(stats), "%10" PRIu64 " %10" PRIu64 " ",
+			 c ? c->pkt : 0, c ? c->bytes : 0);
 		strlcat(buf, stats, sizeof(buf));
 	}
 
@@ -1157,35 +2375,322 @@ static int show_mroute(int sd, struct mroute *r, int inw, int detail)
 	return 0;
 }
 
-static int has_any_ssm(void)
+/*
+ * Cursor for paginated show: "TABLE,GROUP/LEN,SOURCE/LEN,IIF", where
+ * TABLE is conf or kern, and IIF is the inbound VIF/MIF number.
+ */
+static void cursor_fmt(struct mroute *r, int kern, char *buf, size_t len)
+{
+	char src[INET_ADDRSTR_LEN], grp[INET_ADDRSTR_LEN];
+
+	inet_addr2str(&r->source, src, sizeof(src));
+	inet_addr2str(&r->group, grp, sizeof(grp));
+	snprintf(buf, len, "%s,%s/%d,%s/%d,%d", kern ? "kern" : "conf",
+		 grp, r->len, src, r->src_len, r->inbound);
+}
+
+/* Returns 1 for kern table, 0 for conf, or -1 on error */
+static int cursor_parse(const char *cursor, struct mroute *key)
+{
+	char buf[(INET_ADDRSTR_LEN + 5) * 2 + 16];
+	char *table, *grp, *src, *iif;
+	int kern;
+
+	strlcpy(buf, cursor, sizeof(buf));
+	table = strtok(buf, ",");
+	grp   = strtok(NULL, ",");
+	src   = strtok(NULL, ",");
+	iif   = strtok(NULL, ",");
+	if (!table || !grp || !src || !iif)
+		goto fail;
+
+	if (!strcmp(table, "conf"))
+		kern = 0;
+	else if (!strcmp(table, "kern"))
+		kern = 1;
+	else
+		goto fail;
+
+	memset(key, 0, sizeof(*key));
+	key->len     = is_range(grp);
+	key->src_len = is_range(src);
+	if (inet_str2addr(grp, &key->group) || inet_str2addr(src, &key->source))
+		goto fail;
+	if (key->group.ss_family != key->source.ss_family)
+		goto fail;
+	key->inbound = atoi(iif);
+
+	return kern;
+fail:
+	smclog(LOG_WARNING, "Invalid show cursor '%s'", cursor);
+	errno = EBADMSG;
+	return -1;
+}
+
+static struct mroute *page_next(struct mroute *entry, int kern)
+{
+	if (kern)
+		return RB_NEXT(ktree, &kern_tree, entry);
+
+	return RB_NEXT(ctree, &conf_tree, entry);
+}
+
+/*
+ * Show at most @limit routes, 0 for all, starting after @cursor, or
+ * from the beginning.  Uses the ordered index, so the work is bounded
+ * by the page size regardless of the number of routes.  When there
+ * are more routes, the last line holds the cursor for the next page.
+ */
+static int show_page(int sd, const char *line, int inw, int detail, int limit, const char *cursor)
 {
-	struct mroute *e;
+	const char *heading[] = {
+		"(*,G) Template Rules_\n",
+		"(S,G) Rules_\n",
+		"Kernel MFC Table_\n"
+	};
+	struct mroute key, *entry, *last = NULL;
+	int section = -1, kern = 0, lkern = 0;
+	int num = 0;
+
+	if (cursor) {
+		kern = cursor_parse(cursor, &key);
+		if (kern < 0)
+			return -1;
+
+		if (kern) {
+			entry = RB_NFIND(ktree, &kern_tree, &key);
+			if (entry && !kern_cmp(entry, &key))
+				entry = page_next(entry, kern);
+		} else {
+			entry = RB_NFIND(ctree, &conf_tree, &key);
+			if (entry && !conf_cmp(entry, &key))
+				entry = page_next(entry, kern);
+		}
+	} else
+		entry = RB_MIN(ctree, &conf_tree);
+
+	while (1) {
+		int next;
+
+		if (!entry && !kern) {
+			kern  = 1;
+			entry = RB_MIN(ktree, &kern_tree);
+		}
+		if (!entry || (limit > 0 && num == limit))
+			break;
+
+		next = kern ? 2 : is_ssm(entry);
+		if (next != section) {
+			section = next;
+			ipc_send(sd, heading[section], strlen(heading[section]));
+			ipc_send(sd, line, strlen(line));
+		}
 
-	TAILQ_FOREACH(e, &conf_list, link) {
-		if (is_ssm(e))
+		if (show_mroute(sd, entry, inw, detail) < 0)
 			return 1;
+
+		num++;
+		last  = entry;
+		lkern = kern;
+		entry = page_next(entry, kern);
+	}
+
+	if (entry && last) {
+		char buf[(INET_ADDRSTR_LEN + 5) * 2 + 32];
+		char next[sizeof(buf) - 16];
+
+		cursor_fmt(last, lkern, next, sizeof(next));
+		snprintf(buf, sizeof(buf), "Next: after %s\n", next);
+		ipc_send(sd, buf, strlen(buf));
 	}
 
 	return 0;
 }
 
-static int has_any_asm(void)
+/* Does the group, and source, prefix of @a overlap those of @b? */
+static int is_overlap(struct mroute *a, struct mroute *b)
 {
-	struct mroute *e;
+	struct inet_range ra, rb;
 
-	TAILQ_FOREACH(e, &conf_list, link) {
-		if (!is_ssm(e))
+	if (a->group.ss_family != b->group.ss_family)
+		return 0;
+
+	if (inet_range_init(&ra, &a->group, a->len) ||
+	    inet_range_init(&rb, &b->group, b->len) ||
+	    !inet_range_intersect(&ra, &rb, NULL))
+		return 0;
+
+	if (is_anyaddr(&a->source) || is_anyaddr(&b->source))
+		return 1;
+
+	if (inet_range_init(&ra, &a->source, a->src_len) ||
+	    inet_range_init(&rb, &b->source, b->src_len))
+		return 0;
+
+	return inet_range_intersect(&ra, &rb, NULL);
+}
+
+/*
+ * Show only routes in the group, and source, prefix of @filter.  Rules
+ * overlapping the prefix are shown, and kernel MFC entries in range,
+ * looked up in the ordered index.
+ */
+static int show_range(int sd, const char *line, int inw, int detail, struct mroute *filter)
+{
+	const char *heading[] = {
+		"(*,G) Template Rules_\n",
+		"(S,G) Rules_\n",
+	};
+	struct mroute *entry;
+	struct query q;
+
+	if (query_init(&q, filter)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (int ssm = 0; ssm < 2; ssm++) {
+		int first = 1;
+
+		TAILQ_FOREACH(entry, &conf_list, link) {
+			if (is_ssm(entry) != ssm || !is_overlap(filter, entry))
+				continue;
+
+			if (first) {
+				ipc_send(sd, heading[ssm], strlen(heading[ssm]));
+				ipc_send(sd, line, strlen(line));
+				first = 0;
+			}
+			if (show_mroute(sd, entry, inw, detail) < 0)
+				return 1;
+		}
+	}
+
+	entry = query_first(&q);
+	if (entry) {
+		char *kern = "Kernel MFC Table_\n";
+
+		ipc_send(sd, kern, strlen(kern));
+		ipc_send(sd, line, strlen(line));
+	}
+	for (; entry; entry = query_next(&q, entry)) {
+		if (show_mroute(sd, entry, inw, detail) < 0)
 			return 1;
 	}
 
 	return 0;
 }
 
-/* Write all (*,G) routes to client socket */
-int mroute_show(int sd, int detail)
+/*
+ * Show task, for a full dump of all routes, TASK_SLICE routes per slice
+ * in the order they were added, like before it was a task.  First the
+ * (*,G) rules, then the (S,G) rules, then active kernel MFC entries, and
+ * last the inactive ones.  The next entry to show is kept in the job, a
+ * removed entry is stepped past by show_unlink().
+ */
+struct show {
+	LIST_ENTRY(show) link;
+	int           sd;
+	int           detail;
+	int           inw;
+	char          line[256];
+
+	int           pass;		/* 0: (*,G), 1: (S,G), 2: active MFC, 3: inactive */
+	int           section;		/* last heading shown */
+
+	int           started;
+	struct mroute *next;		/* next entry to show */
+};
+
+static LIST_HEAD(, show) show_jobs = LIST_HEAD_INITIALIZER(show_jobs);
+
+/* Called before @route is removed from conf_list or kern_list */
+static void show_unlink(struct mroute *route)
+{
+	struct show *job;
+
+	LIST_FOREACH(job, &show_jobs, link) {
+		if (job->next == route)
+			job->next = TAILQ_NEXT(route, link);
+	}
+}
+
+static int show_step(void *arg)
 {
-	const char *r = "ROUTE (S,G)", *o = "OIFS", *i = "IIF";
+	const char *heading[] = {
+		"(*,G) Template Rules_\n",
+		"(S,G) Rules_\n",
+		"Kernel MFC Table_\n"
+	};
+	struct show *job = arg;
 	struct mroute *entry;
+	int num = 0;
+	int rc = 0;
+
+	while (job->pass < 4) {
+		int kern = job->pass > 1;
+
+		if (!job->started) {
+			job->started = 1;
+			entry = kern ? TAILQ_FIRST(&kern_list) : TAILQ_FIRST(&conf_list);
+		} else
+			entry = job->next;
+
+		for (; entry; entry = TAILQ_NEXT(entry, link)) {
+			int section;
+
+			if (num++ == TASK_SLICE) {
+				job->next = entry;
+				return 1;
+			}
+
+			if (kern && is_active(entry) != (job->pass == 2))
+				continue;
+			if (!kern && is_ssm(entry) != job->pass)
+				continue;
+
+			section = kern ? 2 : job->pass;
+			if (section != job->section) {
+				job->section = section;
+				ipc_send(job->sd, heading[section], strlen(heading[section]));
+				ipc_send(job->sd, job->line, strlen(job->line));
+			}
+
+			if (show_mroute(job->sd, entry, job->inw, job->detail) < 0) {
+				rc = 1;
+				goto done;
+			}
+		}
+
+		job->pass++;
+		job->started = 0;
+	}
+done:
+	LIST_REMOVE(job, link);
+	ipc_done(job->sd, rc);
+	free(job);
+
+	return 0;
+}
+
+/**
+ * mroute_show - Show routes
+ * @sd:     Client socket
+ * @detail: Non-zero to include packet and byte counters
+ * @limit:  Max routes to show, 0 for all
+ * @after:  Cursor to show routes after, from the last line of a page
+ * @filter: Optional group and source prefix, only show routes in range
+ *
+ * A full dump of all routes runs as a task, see show_step(), and the
+ * client socket is detached from the IPC server until it is done.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute_show(int sd, int detail, int limit, const char *after, struct mroute *filter)
+{
+	const char *r = "ROUTE (S,G)", *o = "OIFS", *i = "IIF";
+	struct show *job;
 	char line[256];
 	int inw;
 
@@ -1199,49 +2704,142 @@ int mroute_show(int sd, int detail)
 	} else
 		snprintf(line, sizeof(line), "%-42s %-*s  %s=\n", r, inw, i, o);
 
-	if (has_any_asm()) {
-		char *asm_conf = "(*,G) Template Rules_\n";
+	if (filter)
+		return show_range(sd, line, inw, detail, filter);
+	if (limit > 0 || after)
+		return show_page(sd, line, inw, detail, limit, after);
 
-		ipc_send(sd, asm_conf, strlen(asm_conf));
-		ipc_send(sd, line, strlen(line));
-		TAILQ_FOREACH(entry, &conf_list, link) {
-			if (is_ssm(entry))
-				continue;
-			if (show_mroute(sd, entry, inw, detail) < 0)
-				return 1;
-		}
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		return -1;
 	}
 
-	if (has_any_ssm()) {
-		char *ssm_list = "(S,G) Rules_\n";
+	job->sd      = sd;
+	job->detail  = detail;
+	job->inw     = inw;
+	job->section = -1;
+	strlcpy(job->line, line, sizeof(job->line));
 
-		ipc_send(sd, ssm_list, strlen(ssm_list));
-		ipc_send(sd, line, strlen(line));
-		TAILQ_FOREACH(entry, &conf_list, link) {
-			if (!is_ssm(entry))
-				continue;
-			if (show_mroute(sd, entry, inw, detail) < 0)
-				return 1;
-		}
+	LIST_INSERT_HEAD(&show_jobs, job, link);
+	task_add(show_step, job);
+	ipc_detach();
+
+	return 0;
+}
+
+static int show_stat(int sd, const char *name, unsigned long val)
+{
+	char line[80];
+
+	snprintf(line, sizeof(line), "%-20s %10lu\n", name, val);
+	if (ipc_send(sd, line, strlen(line)) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return -1;
 	}
 
-	if (!TAILQ_EMPTY(&kern_list)) {
-		char *asm_kern = "Kernel MFC Table_\n";
+	return 0;
+}
 
-		ipc_send(sd, asm_kern, strlen(asm_kern));
-		ipc_send(sd, line, strlen(line));
-		TAILQ_FOREACH(entry, &kern_list, link) {
-			if (!is_active(entry))
-				continue;
-			if (show_mroute(sd, entry, inw, detail) < 0)
-				return 1;
-		}
-		TAILQ_FOREACH(entry, &kern_list, link) {
-			if (is_active(entry))
-				continue;
-			if (show_mroute(sd, entry, inw, detail) < 0)
-				return 1;
-		}
+int mroute_show_stats(int sd, int detail)
+{
+	struct mcgroup_sync *sync;
+	struct mroute *entry;
+	unsigned long num = 0;
+	char line[80];
+	int i;
+
+	(void)detail;
+
+	TAILQ_FOREACH(entry, &kern_list, link)
+		num++;
+
+	snprintf(line, sizeof(line), "Kernel MFC_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	if (show_stat(sd, "Entries",          num) ||
+	    show_stat(sd, "Distinct OIF sets", oifset_count()))
+		return -1;
+
+	snprintf(line, sizeof(line), "Kernel MFC Reconciler_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	if (show_stat(sd, "Interval (sec)",   sync_interval)    ||
+	    show_stat(sd, "Passes",           drift.passes)     ||
+	    show_stat(sd, "Last pass drift",  drift.last_drift) ||
+	    show_stat(sd, "Missing",          drift.missing)    ||
+	    show_stat(sd, "Stray",            drift.stray)      ||
+	    show_stat(sd, "Mismatched",       drift.mismatch)   ||
+	    show_stat(sd, "Repaired",         drift.repaired)   ||
+	    show_stat(sd, "Failed",           drift.failed)     ||
+	    show_stat(sd, "Deferred",         drift.deferred))
+		return -1;
+
+	snprintf(line, sizeof(line), "Kernel Write Queue_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	if (show_stat(sd, "Kernel writes",     kern_wq.writes)    ||
+	    show_stat(sd, "Queue depth",       wq_depth + mcgroup_retry_depth()) ||
+	    show_stat(sd, "Queue peak",        wq_peak)           ||
+	    show_stat(sd, "Transient errors",  kern_wq.transient) ||
+	    show_stat(sd, "Permanent errors",  kern_wq.permanent) ||
+	    show_stat(sd, "Retries",           kern_wq.retries)   ||
+	    show_stat(sd, "Retries exhausted", kern_wq.expired)   ||
+	    show_stat(sd, "Throttled upcalls", kern_wq.throttled) ||
+	    show_stat(sd, "Batched writes",    kern_wq.batched)   ||
+	    show_stat(sd, "Batch submits",     kern_wq.submits))
+		return -1;
+
+	snprintf(line, sizeof(line), "Group Join Pacing_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	if (show_stat(sd, "Pending joins",     mcgroup_pace_depth()) ||
+	    show_stat(sd, "Paced joins",       mcgroup_pace_joined()))
+		return -1;
+
+	snprintf(line, sizeof(line), "Group Membership Reconciler_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	sync = mcgroup_sync_stats();
+	if (show_stat(sd, "Membership passes", sync->passes)     ||
+	    show_stat(sd, "Last pass missing", sync->last_drift) ||
+	    show_stat(sd, "Joins missing",     sync->missing)    ||
+	    show_stat(sd, "Rejoined",          sync->repaired)   ||
+	    show_stat(sd, "Rejoins failed",    sync->failed)     ||
+	    show_stat(sd, "Rejoins deferred",  sync->deferred))
+		return -1;
+
+	snprintf(line, sizeof(line), "Configuration_\n");
+	ipc_send(sd, line, strlen(line));
+	snprintf(line, sizeof(line), "%-20s %10s=\n", "COUNTER", "VALUE");
+	ipc_send(sd, line, strlen(line));
+
+	if (show_stat(sd, "Lines read", conf_phase(CONF_READ)->lines))
+		return -1;
+
+	for (i = 0; i < CONF_PHASES; i++) {
+		struct conf_phase *p = conf_phase(i);
+		char name[24];
+
+		snprintf(name, sizeof(name), "%s time (usec)", p->name);
+		if (show_stat(sd, name, p->usec))
+			return -1;
+		snprintf(name, sizeof(name), "%s kernel writes", p->name);
+		if (show_stat(sd, name, p->writes))
+			return -1;
+		snprintf(name, sizeof(name), "%s peak RSS (kB)", p->name);
+		if (show_stat(sd, name, p->rss))
+			return -1;
 	}
 
 	return 0;
@@ -14,6 +14,7 @@
 #endif
 #include <netinet/ip.h>
 #include "queue.h"		/* Needed by netinet/ip_mroute.h on FreeBSD */
+#include "tree.h"
 
 #ifdef HAVE_LINUX_MROUTE_H
 #define _LINUX_IN_H             /* For Linux <= 2.6.25 */
@@ -86,8 +87,19 @@
 typedef unsigned short mifi_t;
 #endif
 
+/* Highest priority class of a route, default is 0, see upcall_handle() */
+#define MROUTE_PRIO_MAX 7
+
+struct oifset;
+
 struct mroute {
 	TAILQ_ENTRY(mroute) link;
+	RB_ENTRY(mroute) node;		/* ordered index, for show */
+	RB_ENTRY(mroute) snode;		/* source ordered index, kernel MFC only */
+	TAILQ_ENTRY(mroute) dlink;	/* kernel MFC update pending */
+	int            dirty;
+	int            retries;		/* failed kernel MFC writes, see kern_retry() */
+	time_t         retry_at;	/* next retry, CLOCK_MONOTONIC sec */
 	int            unused;
 
 	inet_addr_t    source;		/* originating host, may be inet_anyaddr() */
@@ -97,27 +109,44 @@ struct mroute {
 	short	       len;		/* prefix len, or 0:disabled */
 
 	vifi_t         inbound;		/* incoming VIF	   */
-	uint8_t	       ttl[MAX_MC_VIFS];/* outgoing VIFs   */
+	uint8_t        prio;		/* upcall priority class, 0-7 */
+	struct oifset *oifs;		/* interned outgoing VIFs, kernel MFC only */
+	LIST_ENTRY(mroute) olink;	/* users of oifs */
 
-
-	unsigned long  valid_pkt;	/* packet counter at last mroute4_dyn_expire() */
+	uint64_t       valid_pkt;	/* packet counter at last mroute4_dyn_expire() */
 	time_t	       last_use;	/* timestamp of last forwarded packet */
+
+	unsigned int   sync;		/* reconcile pass last seen in kernel MFC */
+	int            drift;		/* kernel MFC differs, IIF or OIFs */
+
+	/* Must be last, kernel MFC entries are allocated without it */
+	uint8_t	       ttl[MAX_MC_VIFS];/* outgoing VIFs, unless oifs */
 };
 
-int  mroute_init       (int do_vifs, int table_id, int cache_tmo);
+void mroute_netns_swap(void **state);
+
+int  mroute_init       (int do_vifs, int table_id, int cache_tmo, int sync_ivl, int vif_hd);
 void mroute_exit       (void);
 
 int  mroute_add_vif    (char *ifname, uint8_t mrdisc, uint8_t threshold);
 int  mroute_del_vif    (char *ifname);
+int  mroute_lazy_vif   (char *ifname);
 
-void mroute_expire     (int max_idle);
+int  mroute_expire     (int sd, int max_idle, struct mroute *filter);
+int  mroute_reconcile  (void);
 
+int  mroute_has_group  (inet_addr_t *group);
 int  mroute_add_route  (struct mroute *mroute);
 int  mroute_del_route  (struct mroute *mroute);
+int  mroute_flush      (void);
 
 void mroute_reload_beg (void);
 void mroute_reload_end (int do_vifs);
 
-int  mroute_show       (int sd, int detail);
+void mroute_replace_beg(void);
+int  mroute_replace_end(int commit);
+
+int  mroute_show       (int sd, int detail, int limit, const char *after, struct mroute *filter);
+int  mroute_show_stats (int sd, int detail);
 
 #endif /* SMCROUTE_MROUTE_H_ */
@@ -21,22 +21,49 @@
 
 #include <errno.h>
 #include <signal.h>		/* sig_atomic_t */
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "conf.h"
+#include "gen.h"
 #include "log.h"
 #include "msg.h"
 #include "iface.h"
+#include "journal.h"
 #include "util.h"
 #include "mroute.h"
 #include "mcgroup.h"
+#include "netns.h"
+#include "reject.h"
+#include "timer.h"
 
 extern volatile sig_atomic_t running;
 extern volatile sig_atomic_t reloading;
 
+static int replacing = 0;
+static int rejected  = 0;
+static int replaying = 0;
+
+/*
+ * Client socket, and namespace, of the replace transaction in progress.
+ * Only one at a time, see ipc_attach()
+ */
+static int replace_sd = -1;
+static struct netns *replace_ns = NULL;
+
+/*
+ * Network namespace selected by the client for all commands on the
+ * connection, %NULL for our own.  The selection is sent first, with
+ * no reply, so the daemon waits for the command following it.
+ */
+static struct netns *client_ns = NULL;
+static char client_ns_name[NETNS_NAMELEN];
+static int client_ns_err = 0;
+static int selecting = 0;
+
 
 /*
  * Check for prefix length, only applicable for (*,G) routes
@@ -116,49 +143,382 @@ static int do_mroute(struct ipc_msg *msg)
 	while (pos < msg->count)
 		out[num++] = msg->argv[pos++];
 
-	return conf_mroute(NULL, msg->cmd == 'a' ? 1 : 0, ifname, source, group, out, num);
+	return conf_mroute(NULL, msg->cmd == 'a' ? 1 : 0, ifname, source, group, 0, out, num);
+}
+
+/*
+ * Parse one of the filter arguments 'group GROUP[/LEN]' or 'source
+ * ADDR[/LEN]', used to select a range of routes in show and flush.
+ * Returns 1 if @key is a filter argument, 0 if not, or -1 on error.
+ */
+static int filter_arg(struct mroute *filter, const char *key, char *val)
+{
+	inet_addr_t *addr;
+	short *len;
+
+	if (!strcmp(key, "group")) {
+		addr = &filter->group;
+		len  = &filter->len;
+	} else if (!strcmp(key, "source")) {
+		addr = &filter->source;
+		len  = &filter->src_len;
+	} else
+		return 0;
+
+	*len = is_range(val);
+	if (inet_str2addr(val, addr))
+		goto fail;
+	if (!*len)
+		*len = inet_max_len(addr);
+	if (*len < 0 || *len > inet_max_len(addr))
+		goto fail;
+
+	return 1;
+fail:
+	smclog(LOG_WARNING, "Invalid %s filter '%s'", key, val);
+	errno = EINVAL;
+	return -1;
+}
+
+/* Default to any group, or any source, of the same family as the other */
+static int filter_done(struct mroute *filter)
+{
+	if (!filter->group.ss_family) {
+		inet_anyaddr(filter->source.ss_family, &filter->group);
+		filter->len = 0;
+	}
+	if (!filter->source.ss_family) {
+		inet_anyaddr(filter->group.ss_family, &filter->source);
+		filter->src_len = 0;
+	}
+
+	if (filter->group.ss_family != filter->source.ss_family) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int do_flush(struct ipc_msg *msg, int sd)
+{
+	struct mroute filter;
+	size_t i;
+
+	memset(&filter, 0, sizeof(filter));
+	for (i = 0; i + 1 < msg->count; i += 2) {
+		if (filter_arg(&filter, msg->argv[i], msg->argv[i + 1]) != 1) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (!msg->count)
+		return mroute_expire(sd, 0, NULL);
+
+	if (i != msg->count || filter_done(&filter))
+		return -1;
+
+	return mroute_expire(sd, 0, &filter);
+}
+
+/* Is @arg an abbreviation of @word, at least @min characters? */
+static int is_abbrev(const char *arg, const char *word, size_t min)
+{
+	size_t len = strlen(arg);
+
+	return len >= min && !strncmp(arg, word, len);
+}
+
+/* Route filter argument, e.g., 'group GROUP', not the groups table */
+static int is_route_arg(struct ipc_msg *msg, size_t i)
+{
+	const char *args[] = { "group", "source", "since", "limit", "after" };
+	size_t j;
+
+	if (i + 1 >= msg->count)
+		return 0;
+
+	for (j = 0; j < NELEMS(args); j++) {
+		if (!strcmp(msg->argv[i], args[j]))
+			return 1;
+	}
+
+	return 0;
 }
 
 static int do_show(struct ipc_msg *msg, int sd, int detail)
 {
-	if (msg->count > 0) {
-		char cmd = msg->argv[0][0];
+	struct mroute filter;
+	char *after = NULL;
+	int ranged = 0;
+	int limit = 0;
+	size_t i = 0;
 
-		switch (cmd) {
-		case 'g':
-			return mcgroup_show(sd, detail);
+	/* show [groups | interfaces | rejected | routes | stats], abbreviated */
+	if (msg->count > 0 && !is_route_arg(msg, 0)) {
+		char *arg = msg->argv[0];
 
-		case 'i':
+		if (is_abbrev(arg, "groups", 1))
+			return mcgroup_show(sd, detail);
+		if (is_abbrev(arg, "interfaces", 1))
 			return iface_show(sd, detail);
+		if (is_abbrev(arg, "rejected", 3))
+			return reject_show(sd, detail);
+		if (is_abbrev(arg, "stats", 1))
+			return mroute_show_stats(sd, detail);
+		if (!is_abbrev(arg, "routes", 1)) {
+			errno = EINVAL;
+			return -1;
+		}
+		i++;
+	}
 
-		default:
-			break;
+	/* show [routes] since GEN */
+	if (i + 2 == msg->count && !strcmp(msg->argv[i], "since")) {
+		char *end;
+		uint64_t since;
+
+		errno = 0;
+		since = strtoull(msg->argv[i + 1], &end, 10);
+		if (errno || *end) {
+			errno = EINVAL;
+			return -1;
 		}
+
+		return gen_show(sd, since);
+	}
+
+	/* show [routes] [limit N] [after CURSOR] [group GROUP[/LEN]] [source ADDR[/LEN]] */
+	memset(&filter, 0, sizeof(filter));
+	for (; i < msg->count; i++) {
+		int rc;
+
+		if (i + 1 >= msg->count) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		rc = filter_arg(&filter, msg->argv[i], msg->argv[i + 1]);
+		if (rc < 0)
+			return -1;
+		if (rc) {
+			ranged = 1;
+			i++;
+		} else if (!strcmp(msg->argv[i], "limit")) {
+			limit = atoi(msg->argv[++i]);
+			if (limit < 0) {
+				errno = EINVAL;
+				return -1;
+			}
+		} else if (!strcmp(msg->argv[i], "after")) {
+			after = msg->argv[++i];
+		} else {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (ranged && filter_done(&filter))
+		return -1;
+
+	return mroute_show(sd, detail, limit, after, ranged ? &filter : NULL);
+}
+
+static int do_replace(int sd)
+{
+	mroute_replace_beg();
+	mcgroup_replace_beg();
+	replacing  = 1;
+	rejected   = 0;
+	replace_sd = sd;
+	replace_ns = netns_current();
+
+	return 0;
+}
+
+static int do_commit(void)
+{
+	int rc;
+
+	if (!replacing) {
+		smclog(LOG_WARNING, "No replace in progress to commit");
+		errno = ENOENT;
+		return -1;
 	}
 
-	return mroute_show(sd, detail);
+	replacing  = 0;
+	replace_sd = -1;
+	if (rejected) {
+		mroute_replace_end(0);
+		mcgroup_replace_end(0);
+		if (!replaying)
+			journal_abort();
+		smclog(LOG_WARNING, "Replace aborted, %d invalid routes or groups", rejected);
+		errno = EBADMSG;
+		return -1;
+	}
+
+	rc  = mroute_replace_end(1);
+	rc += mcgroup_replace_end(1);
+	if (!replaying)
+		journal_commit();
+
+	return rc;
 }
 
 /*
- * Convert IPC command from client to a mulicast route or group join/leave
+ * Between begin and commit of a replace, only add and join are allowed.
+ * Errors are counted and reported on commit, which is then aborted.
  */
-int msg_do(int sd, struct ipc_msg *msg)
+static int do_stage(struct ipc_msg *msg)
+{
+	int rc;
+
+	switch (msg->cmd) {
+	case 'a':
+		rc = do_mroute(msg);
+		break;
+
+	case 'j':
+		rc = do_mgroup(msg);
+		break;
+
+	case 'C':
+		return do_commit();
+
+	default:
+		smclog(LOG_WARNING, "IPC command '%c' not allowed in replace", msg->cmd);
+		rc = 1;
+		break;
+	}
+
+	if (rc)
+		rejected++;
+	else if (!replaying)
+		journal_stage(msg);
+
+	return 0;
+}
+
+static void do_select(struct ipc_msg *msg)
+{
+	client_ns = NULL;
+	client_ns_err = 0;
+	selecting = 1;
+
+	if (msg->count < 1) {
+		client_ns_err = EINVAL;
+		return;
+	}
+
+	strlcpy(client_ns_name, msg->argv[0], sizeof(client_ns_name));
+	client_ns = netns_find(client_ns_name);
+	if (!client_ns)
+		client_ns_err = ENOENT;
+}
+
+/* Is a namespace selection in progress, the command follows at once? */
+int msg_selecting(void)
+{
+	return selecting;
+}
+
+/* Is a replace transaction in progress?  Reload waits until it is done */
+int msg_busy(void)
+{
+	return replacing;
+}
+
+/* Does client @sd have a replace transaction in progress? */
+int msg_replacing(int sd)
+{
+	return replacing && sd == replace_sd;
+}
+
+/* Client disconnected, abort any replace transaction not committed */
+void msg_disconnect(int sd)
+{
+	struct netns *prev;
+
+	if (msg_replacing(sd)) {
+		prev = netns_enter(replace_ns);
+		smclog(LOG_WARNING, "Client disconnected, aborting replace");
+		mroute_replace_end(0);
+		mcgroup_replace_end(0);
+		journal_abort();
+		replacing  = 0;
+		replace_sd = -1;
+		netns_enter(prev);
+	}
+
+	client_ns = NULL;
+	client_ns_err = 0;
+	selecting = 0;
+}
+
+/* Does @msg change routes or groups? */
+static int is_change(struct ipc_msg *msg)
+{
+	switch (msg->cmd) {
+	case 'a':
+	case 'r':
+	case 'j':
+	case 'l':
+	case 'B':
+	case 'C':
+		return 1;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int do_msg(int sd, struct ipc_msg *msg)
 {
 	int result = 0;
 
+	if (msg_replacing(sd))
+		return do_stage(msg);
+
+	/* Changes from other clients would mix with the staged set */
+	if (replacing && is_change(msg)) {
+		smclog(LOG_WARNING, "Replace in progress, try again later");
+		errno = EBUSY;
+		return -1;
+	}
+
 	switch (msg->cmd) {
 	case 'a':
 	case 'r':
 		result = do_mroute(msg);
+		if (!result && !replaying)
+			journal_add(msg);
+		if (!replaying)
+			result += mroute_flush();
 		break;
 
 	case 'j':
 	case 'l':
 		result = do_mgroup(msg);
+		if (!result && !replaying)
+			journal_add(msg);
+		break;
+
+	case 'B':
+		result = do_replace(sd);
+		break;
+
+	case 'C':
+		result = do_commit();
+		if (!replaying)
+			result += mroute_flush();
 		break;
 
 	case 'F':
-		mroute_expire(0);
+		result = do_flush(msg, sd);
 		break;
 
 	case 'H':		/* HUP */
@@ -177,6 +537,15 @@ int msg_do(int sd, struct ipc_msg *msg)
 		result = do_show(msg, sd, 0);
 		break;
 
+	case 'W':
+		if (msg->count < 1) {
+			errno = EINVAL;
+			result = -1;
+			break;
+		}
+		result = timer_warp(atoi(msg->argv[0]));
+		break;
+
 	default:
 		errno = EINVAL;
 		result = -1;
@@ -185,6 +554,62 @@ int msg_do(int sd, struct ipc_msg *msg)
 	return result;
 }
 
+/*
+ * Convert IPC command from client to a mulicast route or group join/leave,
+ * in the network namespace selected by the client.
+ */
+int msg_do(int sd, struct ipc_msg *msg)
+{
+	struct netns *prev;
+	int result;
+
+	if (msg->cmd == 'N') {
+		do_select(msg);
+		return 0;
+	}
+
+	selecting = 0;
+	if (client_ns_err) {
+		if (client_ns_err == ENOENT)
+			smclog(LOG_WARNING, "No such network namespace %s", client_ns_name);
+		errno = client_ns_err;
+		return -1;
+	}
+
+	prev = netns_enter(msg_replacing(sd) ? replace_ns : client_ns);
+	result = do_msg(sd, msg);
+	netns_enter(prev);
+
+	return result;
+}
+
+/*
+ * Apply a change recorded in the journal, in network namespace @ns,
+ * %NULL for our own.  The kernel MFC is not written, the caller does
+ * that with mroute_flush() after the last change, for all of them.
+ */
+int msg_replay(const char *ns, struct ipc_msg *msg)
+{
+	struct netns *prev, *net = NULL;
+	int result;
+
+	if (ns) {
+		net = netns_find(ns);
+		if (!net) {
+			errno = ENOENT;
+			return -1;
+		}
+	}
+
+	prev = netns_enter(net);
+	replaying = 1;
+	result = do_msg(-1, msg);
+	replaying = 0;
+	netns_enter(prev);
+
+	return result;
+}
+
 /**
  * Local Variables:
  *  indent-tabs-mode: t
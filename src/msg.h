@@ -29,6 +29,24 @@
  *  +----+-----+---+--------------------------------------------+
  *                          |-----|
  *                                 `-----> For SSM group join/leave
+ *
+ * Replace all routes and groups:
+ *
+ *  begin   'B', no arguments
+ *  add     'a', as above
+ *  join    'j', as above
+ *  commit  'C', no arguments
+ *
+ * All add/join messages, in the same connection, between begin and
+ * commit make up the desired state.  No reply is sent until
+ * the commit, if the client disconnects before that nothing changes.
+ *
+ * Select network namespace:
+ *
+ *  netns   'N', one argument, name as in 'netns NAME' of the .conf
+ *
+ * Sent first, without reply, applies to all commands that follow in
+ * the same connection.
  */
 #ifndef SMCROUTE_MSG_H_
 #define SMCROUTE_MSG_H_
@@ -41,12 +59,20 @@
 
 struct ipc_msg {
 	size_t   len;		/* total size of packet including cmd header */
-	uint16_t cmd;		/* 'a'=Add,'r'=Remove,'j'=Join,'l'=Leave,'k'=Kill */
+	uint16_t cmd;		/* 'a'=Add,'r'=Remove,'j'=Join,'l'=Leave,'k'=Kill,
+				 * 'B'=Begin replace,'C'=Commit replace,
+				 * 'W'=Warp virtual clock,
+				 * 'N'=Select network namespace */
 	uint16_t count;		/* command argument count */
 	char    *argv[0]; 	/* 'count' * '\0' terminated strings + '\0' */
 };
 
-int msg_do(int sd, struct ipc_msg *msg);
+int  msg_do        (int sd, struct ipc_msg *msg);
+int  msg_replay    (const char *ns, struct ipc_msg *msg);
+int  msg_selecting (void);
+int  msg_busy      (void);
+int  msg_replacing (int sd);
+void msg_disconnect(int sd);
 
 #endif /* SMCROUTE_MSG_H_ */
 
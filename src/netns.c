@@ -0,0 +1,296 @@
+/* Network namespace contexts
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "iface.h"
+#include "kern.h"
+#include "mcgroup.h"
+#include "mrdisc.h"
+#include "mroute.h"
+#include "netns.h"
+#include "util.h"
+
+/*
+ * One smcrouted can route in many network namespaces, each selected by
+ * a 'netns NAME' block in the .conf file.  All namespaces share the
+ * event loop, timers, and IPC socket, but each has its own routing and
+ * group sockets, interfaces, VIFs, routes, and joins.
+ *
+ * The modules keep their state in file scope variables, as before, for
+ * the namespace currently entered.  The state of all other namespaces
+ * is swapped out to a per-module blob in struct netns, so switching is
+ * a setns() and a handful of pointer swaps.  Sockets and timers record
+ * the namespace they were created in and enter it before callback.
+ */
+#define NETNS_RUNDIR "/var/run/netns"
+
+struct netns {
+	TAILQ_ENTRY(netns) link;
+
+	char  name[NETNS_NAMELEN];
+	int   fd;			/* for setns() */
+
+	/* Swapped out state, see *_netns_swap() */
+	void *kern;
+	void *iface;
+	void *mroute;
+	void *mcgroup;
+	void *mrdisc;
+};
+
+static struct netns root = { .fd = -1 };
+static struct netns *cur = &root;
+static TAILQ_HEAD(, netns) netns_list = TAILQ_HEAD_INITIALIZER(netns_list);
+
+static int  (*setup_cb)(void);
+static void (*teardown_cb)(void);
+
+/* Exchange live module state with the saved state of @ns */
+static void swap(struct netns *ns)
+{
+	kern_netns_swap(&ns->kern);
+	iface_netns_swap(&ns->iface);
+	mroute_netns_swap(&ns->mroute);
+	mcgroup_netns_swap(&ns->mcgroup);
+	mrdisc_netns_swap(&ns->mrdisc);
+}
+
+static void release(struct netns *ns)
+{
+	free(ns->kern);
+	free(ns->iface);
+	free(ns->mroute);
+	free(ns->mcgroup);
+	free(ns->mrdisc);
+	if (ns->fd != -1)
+		close(ns->fd);
+}
+
+/**
+ * netns_init - Register setup and teardown of a new network namespace
+ * @setup:    Called in the namespace when opened, creates VIFs etc.
+ * @teardown: Called in the namespace at exit
+ */
+void netns_init(int (*setup)(void), void (*teardown)(void))
+{
+	setup_cb    = setup;
+	teardown_cb = teardown;
+}
+
+/**
+ * netns_exit - Tear down all network namespaces, except our own
+ */
+void netns_exit(void)
+{
+	struct netns *ns, *tmp;
+
+	TAILQ_FOREACH_SAFE(ns, &netns_list, link, tmp) {
+		netns_enter(ns);
+		if (teardown_cb)
+			teardown_cb();
+		netns_enter(&root);
+
+		TAILQ_REMOVE(&netns_list, ns, link);
+		release(ns);
+		free(ns);
+	}
+
+	release(&root);
+	root.kern = root.iface = root.mroute = root.mcgroup = root.mrdisc = NULL;
+	root.fd = -1;
+}
+
+/**
+ * netns_find - Find an opened network namespace
+ * @name: Name in /var/run/netns, or absolute path
+ *
+ * Returns:
+ * Pointer to the namespace, or %NULL with @errno set to ENOENT.
+ */
+struct netns *netns_find(const char *name)
+{
+	struct netns *ns;
+
+	TAILQ_FOREACH(ns, &netns_list, link) {
+		if (!strcmp(ns->name, name))
+			return ns;
+	}
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/**
+ * netns_open - Find, or open and set up, a network namespace
+ * @name: Name in /var/run/netns, e.g. from 'ip netns add', or absolute
+ *        path to a bind mounted namespace, e.g. from 'unshare --net=FILE'
+ *
+ * A namespace is opened once and stays open until exit.  On open, the
+ * @setup callback from netns_init() is called in the new namespace.
+ *
+ * Returns:
+ * Pointer to the namespace, or %NULL on error with @errno set.
+ */
+struct netns *netns_open(const char *name)
+{
+#ifdef HAVE_SETNS
+	char path[sizeof(NETNS_RUNDIR) + NETNS_NAMELEN + 1];
+	struct netns *ns, *prev;
+	int fd;
+
+	ns = netns_find(name);
+	if (ns)
+		return ns;
+
+	if (!name[0] || strlen(name) >= NETNS_NAMELEN || (name[0] != '/' && strchr(name, '/'))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (root.fd == -1) {
+		root.fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+		if (root.fd == -1)
+			return NULL;
+	}
+
+	if (name[0] == '/')
+		strlcpy(path, name, sizeof(path));
+	else
+		snprintf(path, sizeof(path), "%s/%s", NETNS_RUNDIR, name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	ns = calloc(1, sizeof(*ns));
+	if (!ns) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		exit(EX_OSERR);
+	}
+	strlcpy(ns->name, name, sizeof(ns->name));
+	ns->fd = fd;
+	TAILQ_INSERT_TAIL(&netns_list, ns, link);
+
+	smclog(LOG_INFO, "Opened network namespace %s", name);
+	prev = netns_enter(ns);
+	if (setup_cb && setup_cb())
+		smclog(LOG_WARNING, "Failed setting up multicast routing in network namespace %s", name);
+	netns_enter(prev);
+
+	return ns;
+#else
+	(void)name;
+	errno = ENOTSUP;
+	return NULL;
+#endif
+}
+
+/* Namespace currently entered, %NULL for our own */
+struct netns *netns_current(void)
+{
+	return cur == &root ? NULL : cur;
+}
+
+/* Name of namespace, empty string for our own */
+const char *netns_name(struct netns *ns)
+{
+	return ns ? ns->name : "";
+}
+
+/**
+ * netns_enter - Switch to a network namespace
+ * @ns: Namespace to enter, %NULL for our own
+ *
+ * Swaps in the module state of @ns, and moves the calling thread to
+ * it, so new sockets and interface lookups are in @ns.
+ *
+ * Returns:
+ * The previous namespace, for use with a second netns_enter() when done.
+ */
+struct netns *netns_enter(struct netns *ns)
+{
+	struct netns *prev = netns_current();
+
+	if (!ns)
+		ns = &root;
+	if (ns == cur)
+		return prev;
+
+	swap(cur);
+#ifdef HAVE_SETNS
+	if (setns(ns->fd, CLONE_NEWNET))
+		smclog(LOG_ERR, "Failed entering network namespace %s: %s",
+		       ns == &root ? "default" : ns->name, strerror(errno));
+#endif
+	swap(ns);
+	cur = ns;
+
+	return prev;
+}
+
+/**
+ * netns_foreach - Call function in each network namespace
+ * @cb: Function to call, first in our own namespace
+ */
+void netns_foreach(void (*cb)(void))
+{
+	struct netns *prev, *ns;
+
+	prev = netns_enter(NULL);
+	cb();
+
+	TAILQ_FOREACH(ns, &netns_list, link) {
+		netns_enter(ns);
+		cb();
+	}
+
+	netns_enter(prev);
+}
+
+/* Allocate zeroed saved module state, exits on out of memory */
+void *netns_alloc(size_t len)
+{
+	void *ptr;
+
+	ptr = calloc(1, len);
+	if (!ptr) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		exit(EX_OSERR);
+	}
+
+	return ptr;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
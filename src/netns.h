@@ -0,0 +1,68 @@
+/* Network namespace contexts
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_NETNS_H_
+#define SMCROUTE_NETNS_H_
+
+#include <stddef.h>
+#include "queue.h"
+
+#define NETNS_NAMELEN 64
+
+struct netns;
+
+/* Exchange a variable of the live state with the saved copy */
+#define NETNS_SWAP(a, b) do {						\
+	__typeof__(a) _tmp = (a);					\
+	(a) = (b);							\
+	(b) = _tmp;							\
+} while (0)
+
+/* Exchange two TAILQs, elements are not copied, only relinked */
+#define NETNS_SWAP_TAILQ(a, b, field) do {				\
+	__typeof__(*(a)) _tmp;						\
+	TAILQ_INIT(&_tmp);						\
+	TAILQ_CONCAT(&_tmp, (a), field);				\
+	TAILQ_CONCAT((a), (b), field);					\
+	TAILQ_CONCAT((b), &_tmp, field);				\
+} while (0)
+
+/* Exchange two LISTs, elements are not copied, only relinked */
+#define NETNS_SWAP_LIST(a, b, field) do {				\
+	NETNS_SWAP((a)->lh_first, (b)->lh_first);			\
+	if ((a)->lh_first)						\
+		(a)->lh_first->field.le_prev = &(a)->lh_first;		\
+	if ((b)->lh_first)						\
+		(b)->lh_first->field.le_prev = &(b)->lh_first;		\
+} while (0)
+
+void          netns_init    (int (*setup)(void), void (*teardown)(void));
+void          netns_exit    (void);
+
+struct netns *netns_open    (const char *name);
+struct netns *netns_find    (const char *name);
+struct netns *netns_current (void);
+const char   *netns_name    (struct netns *ns);
+
+struct netns *netns_enter   (struct netns *ns);
+void          netns_foreach (void (*cb)(void));
+
+void         *netns_alloc   (size_t len);
+
+#endif /* SMCROUTE_NETNS_H_ */
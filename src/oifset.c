@@ -0,0 +1,242 @@
+/* Interned, reference counted, sets of outbound interfaces
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <stddef.h>		/* offsetof() */
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "log.h"
+#include "oifset.h"
+
+/*
+ * Thousands of kernel MFC entries learned from the same (*,G) rule all
+ * have the same outbound interfaces.  Each distinct TTL vector is kept
+ * once, in a hash table, and kernel MFC entries only point to their set,
+ * they have no TTL vector of their own.  Each set also lists its users,
+ * so when a rule gains an outbound interface, only the entries in sets
+ * learned from it are visited, and each set's new set is looked up once,
+ * see tmpl_retarget() in mroute.c.
+ */
+#define OIFSET_BUCKETS 64
+
+static LIST_HEAD(, oifset) buckets[OIFSET_BUCKETS];
+static size_t num_sets = 0;
+
+/* FNV-1a */
+static uint32_t hash(const uint8_t *ttl)
+{
+	uint32_t h = 0x811c9dc5;
+	size_t i;
+
+	for (i = 0; i < MAX_MC_VIFS; i++) {
+		h ^= ttl[i];
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+
+/**
+ * oifset_get - Find, or create, the set with the given TTL vector
+ * @ttl: Vector of MAX_MC_VIFS TTL values, 0 for not an outbound VIF
+ *
+ * The caller holds a reference to the returned set, which must be
+ * released with oifset_put().  Exits on out of memory.
+ *
+ * Returns:
+ * Pointer to the interned set.
+ */
+struct oifset *oifset_get(const uint8_t *ttl)
+{
+	uint32_t h = hash(ttl);
+	struct oifset *set;
+
+	LIST_FOREACH(set, &buckets[h % OIFSET_BUCKETS], link) {
+		if (set->hash == h && !memcmp(set->ttl, ttl, sizeof(set->ttl))) {
+			set->refcnt++;
+			return set;
+		}
+	}
+
+	set = calloc(1, sizeof(*set));
+	if (!set) {
+		smclog(LOG_ERR, "Out of memory in %s()", __func__);
+		exit(EX_OSERR);
+	}
+
+	memcpy(set->ttl, ttl, sizeof(set->ttl));
+	LIST_INIT(&set->users);
+	set->hash   = h;
+	set->refcnt = 1;
+	LIST_INSERT_HEAD(&buckets[h % OIFSET_BUCKETS], set, link);
+	num_sets++;
+
+	return set;
+}
+
+/**
+ * oifset_add - Find, or create, the set with the OIFs of both arguments
+ * @set: Interned set
+ * @ttl: Vector of MAX_MC_VIFS TTL values, 0 for not an outbound VIF
+ *
+ * The TTL values in @ttl take precedence over those in @set.  As with
+ * oifset_get(), the caller holds a reference to the returned set.
+ *
+ * Returns:
+ * Pointer to the interned set.
+ */
+struct oifset *oifset_add(struct oifset *set, const uint8_t *ttl)
+{
+	uint8_t sum[MAX_MC_VIFS];
+	size_t i;
+
+	for (i = 0; i < MAX_MC_VIFS; i++)
+		sum[i] = ttl[i] ? ttl[i] : set->ttl[i];
+
+	return oifset_get(sum);
+}
+
+/* Release reference to set, freed when the last reference is gone */
+void oifset_put(struct oifset *set)
+{
+	if (!set || --set->refcnt > 0)
+		return;
+
+	LIST_REMOVE(set, link);
+	num_sets--;
+	free(set);
+}
+
+/**
+ * oifset_move - Move kernel MFC entry to another set
+ * @route: Kernel MFC entry
+ * @set:   New set, or NULL to only leave the current one
+ *
+ * The entry holds its own reference to @set, the caller keeps its own.
+ * The previous set is released, and freed if this was its last user.
+ *
+ * Returns:
+ * 1 if the entry changed set, else 0.
+ */
+int oifset_move(struct mroute *route, struct oifset *set)
+{
+	struct oifset *prev = route->oifs;
+
+	if (prev == set)
+		return 0;
+
+	if (prev)
+		LIST_REMOVE(route, olink);
+	if (set) {
+		LIST_INSERT_HEAD(&set->users, route, olink);
+		set->refcnt++;
+	}
+	route->oifs = set;
+	oifset_put(prev);
+
+	return 1;
+}
+
+/**
+ * oifset_dup - Copy route for use as kernel MFC entry
+ * @route: Route with a ttl[], e.g. a rule
+ *
+ * Kernel MFC entries have their OIFs in a set, so the copy is allocated
+ * without the trailing ttl[].  It is not in any set yet.
+ *
+ * Returns:
+ * Pointer to the copy, or %NULL on out of memory.
+ */
+struct mroute *oifset_dup(const struct mroute *route)
+{
+	size_t len = offsetof(struct mroute, ttl);
+	struct mroute *dup;
+
+	dup = malloc(len);
+	if (dup)
+		memcpy(dup, route, len);
+
+	return dup;
+}
+
+/**
+ * oifset_has - Check if set already has all of the given OIFs
+ * @set: Interned set
+ * @ttl: Vector of MAX_MC_VIFS TTL values, 0 for not an outbound VIF
+ *
+ * Returns:
+ * 1 if every OIF in @ttl is also in @set, with the same TTL, else 0.
+ */
+int oifset_has(struct oifset *set, const uint8_t *ttl)
+{
+	size_t i;
+
+	for (i = 0; i < MAX_MC_VIFS; i++) {
+		if (ttl[i] && set->ttl[i] != ttl[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * oifset_iterator - Set iterator
+ * @first: Set to start from beginning
+ *
+ * The set returned may be freed before the next call, but no other.
+ *
+ * Returns:
+ * Pointer to a @struct oifset, or %NULL when no more sets exist.
+ */
+struct oifset *oifset_iterator(int first)
+{
+	static struct oifset *next;
+	static size_t bucket;
+	struct oifset *set;
+
+	if (first) {
+		next   = NULL;
+		bucket = 0;
+	}
+
+	while (!next && bucket < OIFSET_BUCKETS)
+		next = LIST_FIRST(&buckets[bucket++]);
+
+	set = next;
+	if (set)
+		next = LIST_NEXT(set, link);
+
+	return set;
+}
+
+/* Number of distinct sets */
+size_t oifset_count(void)
+{
+	return num_sets;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
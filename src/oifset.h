@@ -0,0 +1,48 @@
+/* Interned, reference counted, sets of outbound interfaces
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_OIFSET_H_
+#define SMCROUTE_OIFSET_H_
+
+#include "mroute.h"
+
+struct oifset {
+	LIST_ENTRY(oifset) link;
+	LIST_HEAD(, mroute) users;	/* kernel MFC entries with this set */
+	unsigned int   refcnt;
+	uint32_t       hash;
+	uint8_t        ttl[MAX_MC_VIFS];
+};
+
+struct oifset *oifset_get      (const uint8_t *ttl);
+struct oifset *oifset_add      (struct oifset *set, const uint8_t *ttl);
+void           oifset_put      (struct oifset *set);
+int            oifset_move     (struct mroute *route, struct oifset *set);
+struct mroute *oifset_dup      (const struct mroute *route);
+int            oifset_has      (struct oifset *set, const uint8_t *ttl);
+struct oifset *oifset_iterator (int first);
+size_t         oifset_count    (void);
+
+/* Outgoing VIFs of @route, kernel MFC entries have no ttl[] of their own */
+static inline const uint8_t *mroute_ttl(const struct mroute *route)
+{
+	return route->oifs ? route->oifs->ttl : route->ttl;
+}
+
+#endif /* SMCROUTE_OIFSET_H_ */
@@ -0,0 +1,285 @@
+/* Analytics of rejected, unmatched, multicast flows
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "ipc.h"
+#include "iface.h"
+#include "reject.h"
+#include "timer.h"
+#include "util.h"
+
+/*
+ * Upcalls for (S,G,IIF) that do not match any (*,G) rule are counted
+ * in a count-min sketch: REJECT_DEPTH rows of REJECT_WIDTH counters,
+ * each row indexed by its own hash of the flow.  The estimate for a
+ * flow is the smallest of its counters, it never undercounts and only
+ * overcounts on collisions in all rows.  Memory use is fixed, 16 kiB,
+ * regardless of the number of flows.
+ *
+ * The sketch cannot list flows, so the REJECT_TOP flows with highest
+ * estimate are also kept in a small heavy-hitter list.  Everything is
+ * reset every REJECT_WINDOW sec, the last complete window is kept for
+ * show.
+ */
+#define REJECT_DEPTH  4
+#define REJECT_WIDTH  1024
+#define REJECT_TOP    16
+#define REJECT_WINDOW 60
+
+struct flow {
+	inet_addr_t source;
+	inet_addr_t group;
+	vifi_t      inbound;
+	char        ifname[IFNAMSIZ];
+	uint32_t    count;
+};
+
+struct window {
+	time_t        start;
+	time_t        end;
+	unsigned long total;
+	size_t        num;
+	struct flow   top[REJECT_TOP];
+};
+
+static uint32_t sketch[REJECT_DEPTH][REJECT_WIDTH];
+static struct window curr, prev;
+
+static const uint32_t seed[REJECT_DEPTH] = {
+	0x811c9dc5, 0x9e3779b9, 0x85ebca6b, 0xc2b2ae35
+};
+
+static time_t now_sec(void)
+{
+	struct timespec now;
+
+	timer_now(&now);
+
+	return now.tv_sec;
+}
+
+/* FNV-1a, one seed per row of the sketch */
+static uint32_t hash(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x01000193;
+	}
+
+	return h;
+}
+
+static uint32_t hash_addr(uint32_t h, inet_addr_t *addr)
+{
+#ifdef HAVE_IPV6_MULTICAST_HOST
+	if (addr->ss_family == AF_INET6)
+		return hash(h, &inet_addr6_get(addr)->sin6_addr, sizeof(struct in6_addr));
+#endif
+	return hash(h, inet_addr_get(addr), sizeof(struct in_addr));
+}
+
+static size_t slot(int row, struct mroute *route)
+{
+	uint32_t h = seed[row];
+
+	h = hash_addr(h, &route->source);
+	h = hash_addr(h, &route->group);
+	h = hash(h, &route->inbound, sizeof(route->inbound));
+
+	return h % REJECT_WIDTH;
+}
+
+/* Start new window if the current one is complete */
+static void rotate(time_t now)
+{
+	if (curr.start && now - curr.start < REJECT_WINDOW)
+		return;
+
+	if (curr.start && now - curr.start < 2 * REJECT_WINDOW) {
+		prev = curr;
+		prev.end = curr.start + REJECT_WINDOW;
+	} else
+		memset(&prev, 0, sizeof(prev));
+
+	memset(&curr, 0, sizeof(curr));
+	memset(sketch, 0, sizeof(sketch));
+	curr.start = now;
+}
+
+static int is_flow(struct flow *f, struct mroute *route)
+{
+	return f->inbound == route->inbound &&
+		!inet_addr_cmp(&f->source, &route->source) &&
+		!inet_addr_cmp(&f->group, &route->group);
+}
+
+/**
+ * reject_add - Count upcall for flow not matching any (*,G) rule
+ * @route:  Flow (S,G) and inbound VIF from the upcall
+ * @ifname: Name of inbound interface
+ */
+void reject_add(struct mroute *route, const char *ifname)
+{
+	uint32_t est = UINT32_MAX;
+	struct flow *f, *min;
+	size_t i;
+
+	rotate(now_sec());
+	curr.total++;
+
+	for (i = 0; i < REJECT_DEPTH; i++) {
+		uint32_t *cnt = &sketch[i][slot(i, route)];
+
+		if (*cnt < UINT32_MAX)
+			(*cnt)++;
+		est = MIN(est, *cnt);
+	}
+
+	min = NULL;
+	for (i = 0; i < curr.num; i++) {
+		f = &curr.top[i];
+		if (is_flow(f, route)) {
+			f->count = est;
+			return;
+		}
+
+		if (!min || f->count < min->count)
+			min = f;
+	}
+
+	if (curr.num < REJECT_TOP)
+		f = &curr.top[curr.num++];
+	else if (est > min->count)
+		f = min;
+	else
+		return;
+
+	f->source  = route->source;
+	f->group   = route->group;
+	f->inbound = route->inbound;
+	f->count   = est;
+	strlcpy(f->ifname, ifname, sizeof(f->ifname));
+}
+
+static int flow_cmp(const void *a, const void *b)
+{
+	const struct flow *fa = a, *fb = b;
+
+	if (fa->count == fb->count)
+		return 0;
+
+	return fa->count < fb->count ? 1 : -1;
+}
+
+static int show_window(int sd, struct window *w, time_t now, int inw)
+{
+	struct flow top[REJECT_TOP];
+	char line[256];
+	time_t len;
+	size_t i;
+
+	len = (w->end ? w->end : now) - w->start;
+	if (len < 1)
+		len = 1;
+
+	memcpy(top, w->top, w->num * sizeof(top[0]));
+	qsort(top, w->num, sizeof(top[0]), flow_cmp);
+
+	for (i = 0; i < w->num; i++) {
+		char src[INET_ADDRSTR_LEN], grp[INET_ADDRSTR_LEN];
+		char sg[(INET_ADDRSTR_LEN + 3) * 2 + 5];
+
+		inet_addr2str(&top[i].source, src, sizeof(src));
+		inet_addr2str(&top[i].group, grp, sizeof(grp));
+		snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
+		snprintf(line, sizeof(line), "%-42s %-*s %10u %10lu\n", sg, inw,
+			 top[i].ifname, top[i].count, (unsigned long)top[i].count * 60 / len);
+		if (ipc_send(sd, line, strlen(line)) < 0)
+			goto fail;
+	}
+
+	snprintf(line, sizeof(line), "%lu rejected upcalls in %ld sec, top %zu flows shown\n",
+		 w->total, (long)len, w->num);
+	if (ipc_send(sd, line, strlen(line)) < 0)
+		goto fail;
+
+	return 0;
+fail:
+	smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+	return -1;
+}
+
+/**
+ * reject_show - Show flows with most rejected upcalls
+ * @sd:     Client socket
+ * @detail: Also show the previous window
+ *
+ * Counts are estimates from the sketch, rate is per minute.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int reject_show(int sd, int detail)
+{
+	const char *f = "FLOW (S,G)", *i = "IIF", *c = "UPCALLS", *r = "PER MIN";
+	time_t now = now_sec();
+	char line[256];
+	char head[256];
+	int inw;
+
+	rotate(now);
+
+	inw = iface_ifname_maxlen();
+	if (inw < (int)strlen(i))
+		inw = (int)strlen(i);
+	snprintf(head, sizeof(head), "%-42s %-*s %10s %10s=\n", f, inw, i, c, r);
+
+	snprintf(line, sizeof(line), "Rejected Flows, Current Window_\n");
+	ipc_send(sd, line, strlen(line));
+	ipc_send(sd, head, strlen(head));
+	if (show_window(sd, &curr, now, inw))
+		return 1;
+
+	if (!detail || !prev.start)
+		return 0;
+
+	snprintf(line, sizeof(line), "Rejected Flows, Previous Window_\n");
+	ipc_send(sd, line, strlen(line));
+	ipc_send(sd, head, strlen(head));
+
+	return show_window(sd, &prev, now, inw) ? 1 : 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
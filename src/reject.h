@@ -0,0 +1,28 @@
+/* Analytics of rejected, unmatched, multicast flows
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_REJECT_H_
+#define SMCROUTE_REJECT_H_
+
+#include "mroute.h"
+
+void reject_add  (struct mroute *route, const char *ifname);
+int  reject_show (int sd, int detail);
+
+#endif /* SMCROUTE_REJECT_H_ */
@@ -24,24 +24,36 @@
 #include <poll.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <sysexits.h>
 #ifdef HAVE_TERMIOS_H
 # include <termios.h>
 #endif
+#include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 
 #include "msg.h"
 #include "util.h"
 
 static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
 
+/* max words in one replace line: add IIF SOURCE GROUP OIF1 .. OIF32 */
+#define MAX_WORDS 40
+
+/* bench defaults: number of routes/groups, worker processes, requests in flight */
+#define BENCH_COUNT 1000
+#define BENCH_JOBS  1
+#define BENCH_DEPTH 1
+
 static char *ident = PACKAGE;
 static char *sock_file = NULL;
+static char *netns = NULL;
 static char *prognm = NULL;
 static int   heading = 1;
 static int   plain = 0;
@@ -58,6 +70,7 @@ struct arg {
 	{ NULL,      0, 'd', NULL,   "Detailed output in show command", NULL, 0 },
 	{ NULL,      1, 'i', "NAME", "Identity of routing daemon instance, default: " PACKAGE, "foo", 0 },
 	{ NULL,      1, 'I', "NAME", NULL, NULL, 0 }, /* Alias, compat with older versions */
+	{ NULL,      1, 'n', "NAME", "Network namespace, as in 'netns NAME' of the .conf file", "ns1", 0 },
 	{ NULL,      0, 'p', NULL,   "Use plain table headings, no ctrl chars", NULL, 0 },
 	{ NULL,      0, 't', NULL,   "Skip table heading in show command", NULL, 0 },
 	{ NULL,      1, 'u', "FILE", "UNIX domain socket for daemon, default: " RUNSTATEDIR "/" PACKAGE ".sock", "/tmp/foo.sock", 0 },
@@ -73,6 +86,9 @@ struct arg {
 	{ "del",     2, 'r', NULL,   NULL, NULL, 0 }, /* Alias */
 	{ "join",    2, 'j', NULL,   "Join multicast group on an interface", "eth0 225.1.2.3", 0 },
 	{ "leave",   2, 'l', NULL,   "Leave joined multicast group",         "eth0 225.1.2.3", 0 },
+	{ "replace", 1, 'R', NULL,   "Replace all routes and groups with those in FILE", "/etc/smcroute.state", 0 },
+	{ "bench",   2, 'b', NULL,   "Benchmark add, join, leave, and remove commands", "eth0 eth1 count 10000 jobs 4 depth 8", 0 },
+	{ "warp",    1, 'W', NULL,   "Advance virtual clock of smcrouted -T, for testing", "3600", 0 },
 	{ NULL, 0, 0, NULL, NULL, NULL, 0 }
 };
 
@@ -241,23 +257,14 @@ static int ipc_connect(char *path)
 	return sd;
 }
 
-static int ipc_command(uint16_t cmd, char *argv[], size_t count)
+/*
+ * Connect to the daemon, retrying for a while if it is starting up
+ */
+static int ipc_open(void)
 {
-	char buf[MX_CMDPKT_SZ + 1];
-	struct ipc_msg *msg;
 	int retries = 30;
-	int result = 0;
-	ssize_t total;
-	ssize_t len;
-	FILE *fp;
 	int sd;
 
-	msg = msg_create(cmd, argv, count);
-	if (!msg) {
-		warn("Failed constructing IPC command");
-		return 1;
-	}
-
 	while ((sd = ipc_connect(sock_file)) < 0) {
 		switch (errno) {
 		case EACCES:
@@ -285,25 +292,47 @@ static int ipc_command(uint16_t cmd, char *argv[], size_t count)
 			break;
 		}
 
-		free(msg);
-		return 1;
+		return -1;
 	}
 
-	/* Send command */
-	if (write(sd, msg, msg->len) != (ssize_t)msg->len) {
-		warn("Communication with daemon failed");
-		close(sd);
-		free(msg);
+	/* Select network namespace for all commands on this connection */
+	if (netns) {
+		struct ipc_msg *msg;
+		ssize_t len;
 
-		return 1;
+		msg = msg_create('N', &netns, 1);
+		if (!msg) {
+			close(sd);
+			return -1;
+		}
+
+		len = write(sd, msg, msg->len);
+		if (len != (ssize_t)msg->len) {
+			warn("Communication with daemon failed");
+			close(sd);
+			sd = -1;
+		}
+		free(msg);
 	}
 
+	return sd;
+}
+
+/*
+ * Read reply from daemon, print it for show commands, otherwise it
+ * is an error message.
+ */
+static int ipc_reply(int sd, uint16_t cmd)
+{
+	char buf[MX_CMDPKT_SZ + 1];
+	int result = 0;
+	ssize_t total;
+	ssize_t len;
+	FILE *fp;
+
 	fp = tempfile();
-	if (!fp) {
-		close(sd);
-		free(msg);
+	if (!fp)
 		err(EX_OSERR, "Failed creating tempfile()");
-	}
 
 	total = 0;
 	while ((len = read(sd, buf, sizeof(buf) - 1)) > 0) {
@@ -325,12 +354,399 @@ static int ipc_command(uint16_t cmd, char *argv[], size_t count)
 	}
 
 	fclose(fp);
+
+	return result;
+}
+
+static int ipc_command(uint16_t cmd, char *argv[], size_t count)
+{
+	struct ipc_msg *msg;
+	int result;
+	int sd;
+
+	msg = msg_create(cmd, argv, count);
+	if (!msg) {
+		warn("Failed constructing IPC command");
+		return 1;
+	}
+
+	sd = ipc_open();
+	if (sd < 0) {
+		free(msg);
+		return 1;
+	}
+
+	/* Send command */
+	if (write(sd, msg, msg->len) != (ssize_t)msg->len) {
+		warn("Communication with daemon failed");
+		close(sd);
+		free(msg);
+
+		return 1;
+	}
+
+	result = ipc_reply(sd, cmd);
 	close(sd);
 	free(msg);
 
 	return result;
 }
 
+static int ipc_write(int sd, uint16_t cmd, char *argv[], size_t count)
+{
+	struct ipc_msg *msg;
+	int rc = 0;
+
+	msg = msg_create(cmd, argv, count);
+	if (!msg)
+		return 1;
+
+	if (write(sd, msg, msg->len) != (ssize_t)msg->len)
+		rc = 1;
+	free(msg);
+
+	return rc;
+}
+
+/*
+ * Send the complete desired set of routes and groups from @file, one
+ * 'add' or 'join' command per line, as a single replace transaction.
+ * The daemon applies only the difference to its current state.
+ */
+static int ipc_replace(char *file)
+{
+	char *argv[MAX_WORDS], line[MX_CMDPKT_SZ];
+	int lineno = 0;
+	int result = 1;
+	FILE *fp;
+	int sd;
+
+	if (!strcmp(file, "-"))
+		fp = stdin;
+	else
+		fp = fopen(file, "r");
+	if (!fp) {
+		warn("Failed opening %s", file);
+		return 1;
+	}
+
+	sd = ipc_open();
+	if (sd < 0)
+		goto done;
+
+	if (ipc_write(sd, 'B', NULL, 0))
+		goto error;
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct arg *cmd = NULL;
+		size_t num = 0;
+		char *token;
+		int i;
+
+		lineno++;
+		token = strtok(line, " \t\r\n");
+		if (!token || token[0] == '#')
+			continue;
+
+		for (i = 0; args[i].val; i++) {
+			if (!args[i].name || (args[i].val != 'a' && args[i].val != 'j'))
+				continue;
+			if (!strncmp(token, args[i].name, strlen(token))) {
+				cmd = &args[i];
+				break;
+			}
+		}
+		if (!cmd) {
+			warnx("%s:%d: only add and join allowed, not %s", file, lineno, token);
+			goto out;
+		}
+
+		while ((token = strtok(NULL, " \t\r\n")) && num < NELEMS(argv))
+			argv[num++] = token;
+		if ((int)num < cmd->min_args) {
+			warnx("%s:%d: not enough arguments to %s", file, lineno, cmd->name);
+			goto out;
+		}
+
+		if (ipc_write(sd, cmd->val, argv, num))
+			goto error;
+	}
+
+	if (ipc_write(sd, 'C', NULL, 0))
+		goto error;
+
+	result = ipc_reply(sd, 'C');
+	goto out;
+error:
+	warn("Communication with daemon failed");
+out:
+	close(sd);
+done:
+	if (fp != stdin)
+		fclose(fp);
+
+	return result;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Build arguments for operation @i, (10.0.0.1,232.x.y.z) routes to
+ * the OIF and ASM joins of the same groups on the IIF.
+ */
+static size_t bench_args(uint16_t cmd, char *iif, char *oif, int i, char *argv[], char *grp, size_t len)
+{
+	static char src[] = "10.0.0.1";
+	size_t num = 0;
+
+	snprintf(grp, len, "232.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+
+	argv[num++] = iif;
+	if (cmd == 'a' || cmd == 'r')
+		argv[num++] = src;
+	argv[num++] = grp;
+	if (cmd == 'a')
+		argv[num++] = oif;
+
+	return num;
+}
+
+/*
+ * Worker process, sends every @jobs:th operation starting at @first,
+ * with up to @depth requests in flight, each on its own connection.
+ * Reports number of failed requests and the latency of each request,
+ * in usec, to the parent on @fd.
+ */
+static int bench_worker(uint16_t cmd, char *iif, char *oif, int first, int count,
+			int jobs, int depth, int fd)
+{
+	struct pollfd *pfd;
+	uint64_t *start;
+	uint32_t *lat;
+	int next = first;
+	int failed = 0;
+	int done = 0;
+	size_t *len;
+	int num, i;
+
+	num = count / jobs + (first < count % jobs);
+	pfd   = calloc(depth, sizeof(*pfd));
+	start = calloc(depth, sizeof(*start));
+	len   = calloc(depth, sizeof(*len));
+	lat   = calloc(num + 1, sizeof(*lat));
+	if (!pfd || !start || !len || !lat)
+		err(EX_OSERR, "Failed allocating memory for bench");
+
+	for (i = 0; i < depth; i++)
+		pfd[i].fd = -1;
+
+	while (done < num) {
+		for (i = 0; i < depth; i++) {
+			char *argv[4], grp[INET_ADDRSTRLEN];
+			size_t argc;
+
+			if (pfd[i].fd != -1 || next >= count)
+				continue;
+
+			argc = bench_args(cmd, iif, oif, next, argv, grp, sizeof(grp));
+			next += jobs;
+
+			start[i] = now_usec();
+			pfd[i].fd = ipc_open();
+			if (pfd[i].fd < 0 || ipc_write(pfd[i].fd, cmd, argv, argc)) {
+				if (pfd[i].fd >= 0)
+					close(pfd[i].fd);
+				pfd[i].fd = -1;
+				lat[done++] = now_usec() - start[i];
+				failed++;
+				continue;
+			}
+			pfd[i].events = POLLIN;
+			len[i] = 0;
+		}
+
+		if (poll(pfd, depth, -1) < 0)
+			err(EX_OSERR, "Failed polling daemon");
+
+		for (i = 0; i < depth; i++) {
+			char buf[MX_CMDPKT_SZ];
+			ssize_t n;
+
+			if (pfd[i].fd == -1 || !pfd[i].revents)
+				continue;
+
+			n = read(pfd[i].fd, buf, sizeof(buf));
+			if (n > 0) {
+				len[i] += n;
+				continue;
+			}
+
+			/* Daemon closes after reply, "" on success */
+			lat[done++] = now_usec() - start[i];
+			if (n < 0 || len[i] > 1)
+				failed++;
+			close(pfd[i].fd);
+			pfd[i].fd = -1;
+		}
+	}
+
+	if (write(fd, &failed, sizeof(failed)) != sizeof(failed) ||
+	    write(fd, lat, num * sizeof(*lat)) != (ssize_t)(num * sizeof(*lat)))
+		return 1;
+
+	return 0;
+}
+
+/* Run one command type in @jobs worker processes and print the result */
+static int bench_run(uint16_t cmd, char *name, char *iif, char *oif, int count, int jobs, int depth)
+{
+	uint64_t start, usec;
+	uint32_t *lat;
+	int failed = 0;
+	int rc = 0;
+	int *fds;
+	int num = 0;
+	int i;
+
+	lat = calloc(count + 1, sizeof(*lat));
+	fds = calloc(jobs, sizeof(*fds));
+	if (!lat || !fds)
+		err(EX_OSERR, "Failed allocating memory for bench");
+
+	fflush(stdout);
+	start = now_usec();
+	for (i = 0; i < jobs; i++) {
+		int fd[2];
+		pid_t pid;
+
+		if (pipe(fd))
+			err(EX_OSERR, "Failed creating pipe");
+
+		pid = fork();
+		if (pid < 0)
+			err(EX_OSERR, "Failed starting bench worker");
+		if (!pid) {
+			close(fd[0]);
+			_exit(bench_worker(cmd, iif, oif, i, count, jobs, depth, fd[1]));
+		}
+
+		close(fd[1]);
+		fds[i] = fd[0];
+	}
+
+	for (i = 0; i < jobs; i++) {
+		size_t len = (count / jobs + (i < count % jobs)) * sizeof(*lat);
+		size_t pos = 0;
+		int val = 0;
+		ssize_t n;
+
+		if (read(fds[i], &val, sizeof(val)) != sizeof(val))
+			rc = 1;
+		while (pos < len && (n = read(fds[i], (char *)&lat[num] + pos, len - pos)) > 0)
+			pos += n;
+		if (pos < len)
+			rc = 1;
+
+		num += pos / sizeof(*lat);
+		failed += val;
+		close(fds[i]);
+	}
+
+	while (wait(NULL) > 0)
+		;
+	usec = now_usec() - start;
+
+	if (rc) {
+		warnx("Lost results from bench worker");
+		num = 0;
+	}
+
+	if (num > 0) {
+		qsort(lat, num, sizeof(*lat), bench_cmp);
+		printf("%-7s %8d %7d %9.0f %8u %8u %8u %8u\n", name, num, failed,
+		       usec ? num * 1000000.0 / usec : 0.0,
+		       lat[(num - 1) * 50 / 100], lat[(num - 1) * 90 / 100],
+		       lat[(num - 1) * 99 / 100], lat[num - 1]);
+	}
+
+	free(fds);
+	free(lat);
+
+	return rc || failed;
+}
+
+/*
+ * Generate @count route and group operations against the daemon, in
+ * @jobs parallel processes with @depth requests in flight each, and
+ * report throughput and latency percentiles per command type.  Use a
+ * daemon started with 'smcrouted -K' to measure the daemon itself,
+ * without the kernel.
+ */
+static int ipc_bench(char *argv[], int argc)
+{
+	struct {
+		uint16_t  cmd;
+		char     *name;
+	} ops[] = {
+		{ 'a', "add"    },
+		{ 'j', "join"   },
+		{ 'l', "leave"  },
+		{ 'r', "remove" },
+	};
+	int count = BENCH_COUNT;
+	int jobs  = BENCH_JOBS;
+	int depth = BENCH_DEPTH;
+	char *iif, *oif;
+	int rc = 0;
+	int i;
+
+	iif = argv[0];
+	oif = argv[1];
+	for (i = 2; i + 1 < argc; i += 2) {
+		int val = atoi(argv[i + 1]);
+
+		if (!strcmp(argv[i], "count"))
+			count = val;
+		else if (!strcmp(argv[i], "jobs"))
+			jobs = val;
+		else if (!strcmp(argv[i], "depth"))
+			depth = val;
+		else
+			break;
+	}
+	if (i < argc || count < 1 || count > 0x1000000 || jobs < 1 || depth < 1) {
+		warnx("Invalid bench arguments, see help bench");
+		return 1;
+	}
+	if (jobs > count)
+		jobs = count;
+
+	if (heading) {
+		char line[] = "COMMAND      OPS  FAILED     OPS/s   p50 us   p90 us   p99 us   max us=";
+
+		print(line, 0);
+	}
+	for (i = 0; i < (int)NELEMS(ops); i++)
+		rc |= bench_run(ops[i].cmd, ops[i].name, iif, oif, count, jobs, depth);
+
+	return rc;
+}
+
 static int usage(int code)
 {
 	int i;
@@ -371,6 +787,28 @@ static int usage(int code)
 	       "  show   interfaces    Show configured multicast interfaces\n"
 	       "  show   groups        Show joined multicast groups\n"
 	       "  show   routes        Show (*,G) and (S,G) multicast routes, default\n"
+	       "  show   routes limit N [after CURSOR]\n"
+	       "                       Show N routes at a time, starting after CURSOR\n"
+	       "  show   routes [group GROUP[/LEN]] [source SOURCE-IP[/LEN]]\n"
+	       "                       Show only routes in the given prefixes\n"
+	       "  show   routes since GEN\n"
+	       "                       Show changes to routes and groups since GEN\n"
+	       "  show   stats         Show kernel MFC and group reconciler statistics\n"
+	       "  show   rejected      Show flows not matching any (*,G) rule, -d for\n"
+	       "                       the previous window as well\n"
+	       "\n"
+	       "  flush  [group GROUP[/LEN]] [source SOURCE-IP[/LEN]]\n"
+	       "                       Flush dynamic routes, optionally only in range\n"
+	       "\n"
+	       "  replace FILE         Replace all routes and groups with the add and join\n"
+	       "                       commands in FILE, one per line, - for stdin\n"
+	       "\n"
+	       "  bench  IIF OIF [count N] [jobs N] [depth N]\n"
+	       "                       Add, join, leave, and remove N routes and groups,\n"
+	       "                       using jobs processes with depth requests in flight\n"
+	       "\n"
+	       "  warp   SEC           Advance virtual clock SEC seconds, running all timers\n"
+	       "                       as they expire, only with smcrouted -T\n"
 	       "\n"
 	       "Note:\n"
 	       "  Inbound (IIF) and outbound (OIF) interfaces can be either an interface\n"
@@ -411,7 +849,7 @@ int main(int argc, char *argv[])
 	struct arg *cmd = NULL;
 
 	prognm = progname(argv[0]);
-	while ((c = getopt(argc, argv, "dhI:i:ptu:v")) != EOF) {
+	while ((c = getopt(argc, argv, "dhI:i:n:ptu:v")) != EOF) {
 		switch (c) {
 		case 'd':
 			detail++;
@@ -426,6 +864,10 @@ int main(int argc, char *argv[])
 			ident = optarg;
 			break;
 
+		case 'n':
+			netns = optarg;
+			break;
+
 		case 'p':
 			plain = 1;
 			break;
@@ -508,6 +950,11 @@ int main(int argc, char *argv[])
 	if (detail && cmd->has_detail)
 		c -= 0x20;
 
+	if (c == 'R')
+		return ipc_replace(argv[pos]);
+	if (c == 'b')
+		return ipc_bench(&argv[pos], argc - pos);
+
 	return ipc_command(c, &argv[pos], argc - pos);
 }
 
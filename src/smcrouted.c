@@ -35,32 +35,44 @@
 #include "log.h"
 #include "msg.h"
 #include "conf.h"
+#include "counter.h"
 #include "iface.h"
+#include "journal.h"
+#include "kern.h"
 #include "util.h"
 #include "timer.h"
 #include "notify.h"
 #include "script.h"
 #include "socket.h"
+#include "task.h"
+#include "uring.h"
 #include "mrdisc.h"
 #include "mroute.h"
 #include "mcgroup.h"
+#include "netns.h"
 
 int background = 1;
 int do_vifs    = 1;
 int do_syslog  = 1;
 int cache_tmo  = 60;
+int sync_ivl   = 0;
 int interval   = MRDISC_INTERVAL_DEFAULT;
 int startup_delay = 0;
 int exit_delay = 0;
 int table_id   = 0;
+int join_rate  = 0;
+int vif_hold   = 0;
 
 char *script    = NULL;
 char *ident     = PACKAGE;
 char *prognm    = NULL;
 char *pid_file  = NULL;
 char *conf_file = NULL;
+char *jrnl_file = NULL;
 char *sock_file = NULL;
 int   conf_vrfy = 0;
+int   kern_sim  = 0;
+int   timer_sim = 0;
 
 static uid_t uid = 0;
 static gid_t gid = 0;
@@ -68,37 +80,106 @@ static gid_t gid = 0;
 volatile sig_atomic_t reloading = 0;
 volatile sig_atomic_t running   = 1;
 
+static int ready     = 0;
+static int ifchanged = 0;
+
 static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
 
 
 /* Cleans up, i.e. releases allocated resources. Called via atexit() */
 static void clean(void)
 {
+	journal_exit();
+	netns_exit();
+	mrdisc_exit();
+	task_exit();
+	uring_exit();
 	timer_exit();
 	mroute_exit();
 	mcgroup_exit();
+	counter_exit();
 	ipc_exit();
 	iface_exit();
 	smclog(LOG_NOTICE, "Exiting.");
 }
 
-void reload(void)
+/*
+ * Re-read .conf and reconcile, used both on SIGHUP/reload and when
+ * interfaces appear or change state.
+ */
+static void reconf_beg(void)
 {
-	notify_reload();
-
 	mcgroup_reload_beg();
 	mroute_reload_beg();
-
 	iface_update();
-	conf_read(conf_file, do_vifs);
+}
 
+static void reconf_end(void)
+{
 	mroute_reload_end(do_vifs);
 	mcgroup_reload_end();
+}
+
+static void reconf(void)
+{
+	netns_foreach(reconf_beg);
+	conf_read(conf_file, do_vifs);
+
+	/*
+	 * Changes made with smcroutectl are not in .conf, restore them
+	 * before reconf_end(), or they are removed and re-added.
+	 */
+	journal_replay();
+	netns_foreach(reconf_end);
+}
+
+/*
+ * Signal readiness, i.e., create PID file and notify systemd, only once
+ * all 'phyint IFNAME required' interfaces exist and are up.  Privileges
+ * are kept until then, the PID file may need to be chown'ed.
+ */
+static void check_ready(void)
+{
+	char buf[256];
+
+	if (ready)
+		return;
+
+	if (iface_required(buf, sizeof(buf))) {
+		smclog(LOG_NOTICE, "Waiting for required interfaces:%s", buf);
+		return;
+	}
+
+	ready = 1;
+	notify_ready(pid_file, uid, gid);
+
+	/* Drop root privileges before continuing in the server loop */
+	cap_drop_root(uid, gid);
+}
+
+void reload(void)
+{
+	if (!ready) {
+		reconf();
+		check_ready();
+		return;
+	}
+
+	notify_reload();
+	conf_phase_beg(CONF_RELOAD);
+	reconf();
 
 	/* Acknowledge client SIGHUP/reload */
 	notify_ready(NULL, uid, gid);
 }
 
+/* Interface appeared, or changed state, called from iface watcher */
+static void iface_changed(void *arg)
+{
+	(void)arg;
+	ifchanged = 1;
+}
+
 /*
  * Signal handler.  Take note of the fact that the signal arrived
  * so that the main loop can take care of it.
@@ -140,27 +221,72 @@ static void server_exit(void *arg)
 static int server_loop(void)
 {
 	script_init(script);
-	mrdisc_init(interval);
 
 	while (running) {
-		if (reloading) {
+		/* The .conf file is re-read once a replace from a client is done */
+		if (reloading && !msg_busy()) {
 			reload();
 			reloading = 0;
 		}
 
-		socket_poll(NULL);
+		if (ifchanged && !msg_busy()) {
+			smclog(LOG_DEBUG, "Interfaces changed, reloading .conf");
+			ifchanged = 0;
+			reconf();
+			check_ready();
+		}
+
+		/* Only poll, without blocking, while tasks have more to do */
+		if (task_pending()) {
+			struct timeval tv = { 0, 0 };
+
+			socket_poll(&tv);
+		} else {
+			/* All done, stop measuring apply or reload of .conf */
+			conf_phase_end(CONF_APPLY);
+			conf_phase_end(CONF_RELOAD);
+			socket_poll(NULL);
+		}
+
+		/* Next slice of tasks, e.g., combined kernel MFC updates */
+		task_run();
 	}
 
 	return 0;
 }
 
+/*
+ * Set up multicast routing in a network namespace from 'netns NAME' in
+ * the .conf file, like start_server() does for our own.
+ */
+static int netns_setup(void)
+{
+	iface_init();
+
+	if (mroute_init(do_vifs, table_id, cache_tmo, sync_ivl, vif_hold))
+		return 1;
+
+	if (iface_watch_init(iface_changed, NULL))
+		smclog(LOG_WARNING, "Failed watching for new interfaces: %s", strerror(errno));
+
+	return 0;
+}
+
+static void netns_teardown(void)
+{
+	mrdisc_exit();
+	mroute_exit();
+	mcgroup_exit();
+	iface_exit();
+}
+
 /* Init everything before forking, so we can fail and return an
  * error code in the parent and the initscript will fail */
 static int start_server(void)
 {
 	int api = 2, busy = 0;
 
-	if (geteuid() != 0) {
+	if (!kern_sim && geteuid() != 0) {
 		smclog(LOG_ERR, "Need root privileges to start %s", prognm);
 		return EX_NOPERM;
 	}
@@ -181,9 +307,11 @@ static int start_server(void)
 	}
 
 	/*
-	 * Timer API needs to be initilized before mroute_init()
+	 * Timer API needs to be initilized before mroute_init(), and
+	 * mrdisc before any VIFs are created
 	 */
 	timer_init();
+	mrdisc_init(interval);
 
 	if (exit_delay > 0) {
 		smclog(LOG_INFO, "Exit delay requested, starting background timer, %d sec", exit_delay);
@@ -195,7 +323,7 @@ static int start_server(void)
 	 */
 	iface_init();
 
-	if (mroute_init(do_vifs, table_id, cache_tmo)) {
+	if (mroute_init(do_vifs, table_id, cache_tmo, sync_ivl, vif_hold)) {
 		if (errno == EADDRINUSE)
 			busy++;
 		api--;
@@ -215,16 +343,25 @@ static int start_server(void)
 
 	atexit(clean);
 	signal_init();
-	mcgroup_init();
+	if (!kern_sim)
+		uring_init(KERN_BATCH);
+	mcgroup_init(join_rate, sync_ivl);
+	counter_init();
 	ipc_init(sock_file);
+	netns_init(netns_setup, netns_teardown);
+
+	/* Apply routes and joins as interfaces appear, replaces -d SEC */
+	if (iface_watch_init(iface_changed, NULL))
+		smclog(LOG_WARNING, "Failed watching for new interfaces: %s", strerror(errno));
 
 	conf_read(conf_file, do_vifs);
+	conf_phase_beg(CONF_APPLY);
 
-	/* Everything setup, notify any clients waiting for us */
-	notify_ready(pid_file, uid, gid);
+	/* Restore changes made with smcroutectl before we were restarted */
+	journal_init(jrnl_file);
 
-	/* Drop root privileges before entering the server loop */
-	cap_drop_root(uid, gid);
+	/* Notify any clients waiting for us, if required interfaces are up */
+	check_ready();
 
 	return server_loop();
 }
@@ -237,6 +374,9 @@ static void cleanup(void)
 	if (sock_file)
 		free(sock_file);
 	sock_file = NULL;
+	if (jrnl_file)
+		free(jrnl_file);
+	jrnl_file = NULL;
 }
 
 static int compose_paths(void)
@@ -292,13 +432,13 @@ static int usage(int code)
 		snprintf(pidfn, len, "%s", pid_file);
 
 	printf("Usage:\n"
-	       "  %s [-hnNsv] [-c SEC] [-d SEC] [-e CMD] [-f FILE] [-i NAME] [-l LVL] "
+	       "  %s [-hKnNsTv] [-c SEC] [-d SEC] [-e CMD] [-f FILE] [-i NAME] [-j RATE] "
 	       "\n"
-	       "                     "
+	       "                     [-J FILE] [-L SEC] [-l LVL] "
 #ifdef ENABLE_MRDISC
 	       "[-m SEC] "
 #endif
-	       "[-P FILE] [-t ID] [-u FILE]\n"
+	       "[-P FILE] [-r SEC] [-t ID] [-u FILE]\n"
 	       "\n"
 	       "Options:\n"
 	       "  -c SEC          Flush dynamic (*,G) multicast routes every SEC seconds,\n"
@@ -310,7 +450,15 @@ static int usage(int code)
 	       "  -F FILE         Check configuration file syntax, use -l to increase verbosity\n"
 	       "  -h              This help text\n"
 	       "  -i NAME         Identity for .conf/.pid/.sock file, and syslog, default: %s\n"
+	       "  -j RATE         Pace group joins, at most RATE per interface and second.\n"
+	       "                  Groups with a route are joined first.  Default: 0, off\n"
+	       "  -J FILE         Journal of changes made with smcroutectl, restored on\n"
+	       "                  restart and reload.  Compacted to FILE.snap\n"
+	       "  -K              Simulated kernel backend, nothing is set in the kernel.\n"
+	       "                  For benchmarking, e.g., with smcroutectl bench\n"
 	       "  -l LVL          Set log level: none, err, notice*, info, debug\n"
+	       "  -L SEC          On demand VIFs/MIFs, created only for interfaces used by\n"
+	       "                  routes, released when unused for SEC seconds.  Implies -N\n"
 #ifdef ENABLE_MRDISC
 	       "  -m SEC          Multicast router discovery, 4-180, default: 20 sec\n"
 #endif
@@ -322,8 +470,12 @@ static int usage(int code)
 #endif
 	       "  -P FILE         Set daemon PID file name, with optional path.\n"
 	       "                  Default use ident NAME: %s\n"
+	       "  -r SEC          Reconcile kernel MFC and group memberships with smcrouted\n"
+	       "                  every SEC seconds, default 0, disabled\n"
 	       "  -s              Use syslog, default unless running in foreground, -n\n"
 	       "  -t ID           Set multicast routing table ID, default: 0\n"
+	       "  -T              Virtual clock, time only advances with smcroutectl warp.\n"
+	       "                  For testing timers and route expiry\n"
 	       "  -u FILE         UNIX domain socket path, for use with smcroutectl.\n"
 	       "                  Default use ident NAME: %s\n"
 	       "  -v              Show program version and support information\n"
@@ -365,7 +517,7 @@ int main(int argc, char *argv[])
 	int c, new_log_level = -1;
 
 	prognm = progname(argv[0]);
-	while ((c = getopt(argc, argv, "c:d:D:e:f:F:hI:i:l:m:nNp:P:st:u:v")) != EOF) {
+	while ((c = getopt(argc, argv, "c:d:D:e:f:F:hI:i:j:J:KL:l:m:nNp:P:r:st:Tu:v")) != EOF) {
 		switch (c) {
 		case 'c':	/* cache timeout */
 			cache_tmo = atoi(optarg);
@@ -399,6 +551,27 @@ int main(int argc, char *argv[])
 			ident = optarg;
 			break;
 
+		case 'j':	/* paced joins per interface and second */
+			join_rate = atoi(optarg);
+			if (join_rate < 0)
+				return usage(EX_USAGE);
+			break;
+
+		case 'J':	/* journal of runtime changes */
+			jrnl_file = strdup(optarg);
+			break;
+
+		case 'K':
+			kern_sim = 1;
+			break;
+
+		case 'L':	/* on demand VIFs/MIFs, with hold-down */
+			vif_hold = atoi(optarg);
+			if (vif_hold < 1)
+				return usage(EX_USAGE);
+			do_vifs = 0;
+			break;
+
 		case 'l':
 			new_log_level = loglvl(optarg);
 			break;
@@ -431,6 +604,10 @@ int main(int argc, char *argv[])
 			pid_file = optarg;
 			break;
 
+		case 'r':	/* kernel MFC reconcile interval */
+			sync_ivl = atoi(optarg);
+			break;
+
 		case 's':	/* Force syslog even though in foreground */
 			do_syslog++;
 			break;
@@ -445,6 +622,10 @@ int main(int argc, char *argv[])
 #endif
 			break;
 
+		case 'T':	/* virtual clock, for testing */
+			timer_sim = 1;
+			break;
+
 		case 'u':
 			sock_file = strdup(optarg);
 			break;
@@ -35,6 +35,7 @@
 #include <sys/types.h>
 
 #include "log.h"
+#include "netns.h"
 
 struct sock {
 	LIST_ENTRY(sock) link;
@@ -43,11 +44,19 @@ struct sock {
 
 	void (*cb)(int, void *arg);
 	void *arg;
+	struct netns *ns;	/* network namespace to run callback in */
 };
 
 static int max_fdnum = -1;
 static LIST_HEAD(slist, sock) sock_list = LIST_HEAD_INITIALIZER();
 
+/*
+ * Callbacks may unregister any socket, also other than their own, so
+ * while socket_poll() walks sock_list entries are only marked, sd -1,
+ * and freed after the walk.
+ */
+static int polling = 0;
+
 
 int nfds(void)
 {
@@ -70,6 +79,7 @@ int socket_register(int sd, void (*cb)(int, void *), void *arg)
 	entry->sd  = sd;
 	entry->cb  = cb;
 	entry->arg = arg;
+	entry->ns  = netns_current();
 	LIST_INSERT_HEAD(&sock_list, entry, link);
 
 #if !defined(HAVE_SOCK_CLOEXEC) && defined(HAVE_FCNTL_H)
@@ -129,14 +139,21 @@ done:
 	return sd;
 }
 
-int socket_close(int sd)
+/*
+ * unregister socket, without closing it
+ */
+int socket_unregister(int sd)
 {
 	struct sock *entry, *tmp;
 
 	LIST_FOREACH_SAFE(entry, &sock_list, link, tmp) {
 		if (entry->sd == sd) {
+			if (polling) {
+				entry->sd = -1;
+				return 0;
+			}
+
 			LIST_REMOVE(entry, link);
-			close(entry->sd);
 			free(entry);
 
 			return 0;
@@ -147,11 +164,19 @@ int socket_close(int sd)
 	return -1;
 }
 
+int socket_close(int sd)
+{
+	if (socket_unregister(sd))
+		return -1;
+
+	return close(sd);
+}
+
 int socket_poll(struct timeval *timeout)
 {
 	int num;
 	fd_set fds;
-	struct sock *entry;
+	struct sock *entry, *tmp;
 
 	FD_ZERO(&fds);
 	LIST_FOREACH(entry, &sock_list, link)
@@ -166,12 +191,27 @@ int socket_poll(struct timeval *timeout)
 		return num;
 	}
 
+	polling = 1;
 	LIST_FOREACH(entry, &sock_list, link) {
-		if (!FD_ISSET(entry->sd, &fds))
+		if (entry->sd < 0 || !FD_ISSET(entry->sd, &fds))
 			continue;
 
-		if (entry->cb)
+		if (entry->cb) {
+			struct netns *prev;
+
+			prev = netns_enter(entry->ns);
 			entry->cb(entry->sd, entry->arg);
+			netns_enter(prev);
+		}
+	}
+	polling = 0;
+
+	LIST_FOREACH_SAFE(entry, &sock_list, link, tmp) {
+		if (entry->sd >= 0)
+			continue;
+
+		LIST_REMOVE(entry, link);
+		free(entry);
 	}
 
 	return num;
@@ -26,6 +26,7 @@
 
 int socket_register(int sd, void (*cb)(int, void *), void *arg);
 int socket_create  (int domain, int type, int proto, void (*cb)(int, void *), void *arg);
+int socket_unregister(int sd);
 int socket_close   (int sd);
 int socket_poll    (struct timeval *timeout);
 
@@ -0,0 +1,201 @@
+/* Cooperative task scheduler
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+#include "queue.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "log.h"
+#include "netns.h"
+#include "task.h"
+
+/*
+ * Long running operations, e.g., expiring or showing all entries of a
+ * large kernel MFC, or joining a large group range, run as tasks.  A
+ * task callback handles at most TASK_SLICE items per call and returns
+ * non-zero while there is more to do.  The event loop polls sockets
+ * between each round of slices, so an upcall or IPC command waits for
+ * at most TASK_BUDGET usec, instead of the whole operation.
+ */
+#define TASK_BUDGET 1000
+
+struct task {
+	TAILQ_ENTRY(task) link;
+	int             active;	/* Set to 0 to delete */
+
+	int (*cb)(void *arg);
+	void *arg;
+	struct netns *ns;	/* network namespace to run in */
+};
+
+static TAILQ_HEAD(, task) task_list = TAILQ_HEAD_INITIALIZER(task_list);
+
+
+static struct task *find(int (*cb)(void *), void *arg)
+{
+	struct task *entry;
+
+	TAILQ_FOREACH(entry, &task_list, link) {
+		if (!entry->active || entry->cb != cb || entry->arg != arg)
+			continue;
+		if (entry->ns != netns_current())
+			continue;
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+/* Real time, in usec, since @start, also with the virtual clock */
+static long elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * task_add - Schedule a task
+ * @cb:  Runs one slice of the task, returns non-zero while not done
+ * @arg: Argument to @cb, identifies the task together with @cb
+ *
+ * Tasks run in the order they are added, one slice each per round,
+ * in the network namespace they were added in.
+ *
+ * Returns:
+ * POSIX OK(0) on success, or -1 with @errno set to EEXIST if the task
+ * is already scheduled.
+ */
+int task_add(int (*cb)(void *), void *arg)
+{
+	struct task *t;
+
+	if (find(cb, arg)) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	t = malloc(sizeof(*t));
+	if (!t) {
+		smclog(LOG_ERR, "Failed allocating memory for task: %s", strerror(errno));
+		exit(EX_OSERR);
+	}
+
+	t->active = 1;
+	t->cb     = cb;
+	t->arg    = arg;
+	t->ns     = netns_current();
+	TAILQ_INSERT_TAIL(&task_list, t, link);
+
+	return 0;
+}
+
+/*
+ * Cancel a scheduled task, any resources held by @arg are released
+ * by the caller
+ */
+int task_del(int (*cb)(void *), void *arg)
+{
+	struct task *t;
+
+	t = find(cb, arg);
+	if (!t) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* Reaped by task_run() */
+	t->active = 0;
+
+	return 0;
+}
+
+/* Are there any tasks to run?  I.e., should the event loop not block */
+int task_pending(void)
+{
+	struct task *t;
+
+	TAILQ_FOREACH(t, &task_list, link) {
+		if (t->active)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Run rounds of one slice of each task, until all are done or the
+ * TASK_BUDGET is spent.  Called from the event loop after each poll.
+ */
+void task_run(void)
+{
+	struct task *entry, *tmp;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		TAILQ_FOREACH(entry, &task_list, link) {
+			struct netns *prev;
+
+			if (!entry->active)
+				continue;
+
+			prev = netns_enter(entry->ns);
+			if (!entry->cb(entry->arg))
+				entry->active = 0;
+			netns_enter(prev);
+		}
+
+		TAILQ_FOREACH_SAFE(entry, &task_list, link, tmp) {
+			if (entry->active)
+				continue;
+
+			TAILQ_REMOVE(&task_list, entry, link);
+			free(entry);
+		}
+	} while (!TAILQ_EMPTY(&task_list) && elapsed(&start) < TASK_BUDGET);
+}
+
+/*
+ * Drop all tasks, called at exit
+ */
+void task_exit(void)
+{
+	struct task *entry, *tmp;
+
+	TAILQ_FOREACH_SAFE(entry, &task_list, link, tmp) {
+		TAILQ_REMOVE(&task_list, entry, link);
+		free(entry);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
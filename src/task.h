@@ -0,0 +1,33 @@
+/* Cooperative task scheduler
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_TASK_H_
+#define SMCROUTE_TASK_H_
+
+/* Max number of items, e.g., routes or joins, a task handles per slice */
+#define TASK_SLICE 64
+
+int  task_add     (int (*cb)(void *), void *arg);
+int  task_del     (int (*cb)(void *), void *arg);
+
+int  task_pending (void);
+void task_run     (void);
+void task_exit    (void);
+
+#endif /* SMCROUTE_TASK_H_ */
@@ -28,7 +28,9 @@
 #include <time.h>
 
 #include "log.h"
+#include "netns.h"
 #include "socket.h"
+#include "task.h"
 #include "timer.h"
 
 /*
@@ -41,28 +43,57 @@ struct timer {
 	int             active;	/* Set to 0 to delete */
 
 	int             period;	/* period time in seconds */
+	int             msec;	/* sub-second period time in msec, or 0 */
+	int             jitter;	/* max random offset in msec, or 0 */
 	struct timespec timeout;
 
 	void (*cb)(void *arg);
 	void *arg;
+	struct netns *ns;	/* network namespace to run in */
 };
 
 static timer_t timer;
 static int timerfd[2];
 static LIST_HEAD(tlist, timer) timer_list = LIST_HEAD_INITIALIZER();
 
+/*
+ * Virtual clock, smcrouted -T, for testing.  Time stands still until
+ * advanced by timer_warp(), the POSIX timer is never armed.
+ */
+static struct timespec vnow;
+
+
+static void offset(struct timespec *ts, long msec)
+{
+	ts->tv_sec  += msec / 1000;
+	ts->tv_nsec += (msec % 1000) * 1000000;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec  -= 1;
+		ts->tv_nsec += 1000000000;
+	} else if (ts->tv_nsec > 999999999) {
+		ts->tv_sec  += 1;
+		ts->tv_nsec -= 1000000000;
+	}
+}
 
 static void set(struct timer *t, struct timespec *now)
 {
 	t->timeout.tv_sec  = now->tv_sec + t->period;
 	t->timeout.tv_nsec = now->tv_nsec;
+	if (t->msec)
+		offset(&t->timeout, t->msec);
+
+	/* +/- jitter/2 msec, keeps jittered timers from drifting into lockstep */
+	if (t->jitter)
+		offset(&t->timeout, random() % (t->jitter + 1) - t->jitter / 2);
 }
 
 static int expired(struct timer *t, struct timespec *now)
 {
 	long round_nsec;
 
-	round_nsec = now->tv_nsec + 250000000;
+	/* Up to 250 msec early, sub-second timers half their period */
+	round_nsec = now->tv_nsec + (t->msec ? t->msec / 2 : 250) * 1000000L;
 	round_nsec = round_nsec > 999999999 ? 999999999 : round_nsec;
 
 	if (t->timeout.tv_sec < now->tv_sec)
@@ -95,7 +126,7 @@ static struct timer *find(void (*cb), void *arg)
 	struct timer *entry;
 
 	LIST_FOREACH(entry, &timer_list, link) {
-		if (entry->cb != cb || entry->arg != arg)
+		if (entry->cb != cb || entry->arg != arg || entry->ns != netns_current())
 			continue;
 
 		return entry;
@@ -112,6 +143,8 @@ static int start(struct timespec *now)
 
 	if (LIST_EMPTY(&timer_list))
 		return -1;
+	if (timer_sim)
+		return 0;
 
 	next = LIST_FIRST(&timer_list);
 	LIST_FOREACH(entry, &timer_list, link)
@@ -133,23 +166,21 @@ static int start(struct timespec *now)
 	return 0;
 }
 
-/* callback for activity on pipe */
-static void run(int sd, void *arg)
+/* run callbacks of all expired timers and reap deleted ones */
+static void expire(struct timespec *now)
 {
 	struct timer *entry, *tmp;
-	struct timespec now;
-	char dummy;
 
-	(void)arg;
-	if (read(sd, &dummy, 1) < 0)
-		smclog(LOG_DEBUG, "Failed read(pipe): %s", strerror(errno));
-
-	clock_gettime(CLOCK_MONOTONIC, &now);
 	LIST_FOREACH_SAFE(entry, &timer_list, link, tmp) {
-		if (expired(entry, &now)) {
-			if (entry->cb)
+		if (entry->active && expired(entry, now)) {
+			if (entry->cb) {
+				struct netns *prev;
+
+				prev = netns_enter(entry->ns);
 				entry->cb(entry->arg);
-			set(entry, &now);
+				netns_enter(prev);
+			}
+			set(entry, now);
 		}
 
 		if (!entry->active) {
@@ -157,7 +188,20 @@ static void run(int sd, void *arg)
 			free(entry);
 		}
 	}
+}
+
+/* callback for activity on pipe */
+static void run(int sd, void *arg)
+{
+	struct timespec now;
+	char dummy;
 
+	(void)arg;
+	if (read(sd, &dummy, 1) < 0)
+		smclog(LOG_DEBUG, "Failed read(pipe): %s", strerror(errno));
+
+	timer_now(&now);
+	expire(&now);
 	start(&now);
 }
 
@@ -189,6 +233,12 @@ int timer_init(void)
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGALRM, &sa, NULL);
 
+	/* Seed for jittered timers */
+	srandom(time(NULL) ^ getpid());
+
+	/* Virtual clock starts at the real time, then stands still */
+	clock_gettime(CLOCK_MONOTONIC, &vnow);
+
 	if (timer_create(CLOCK_MONOTONIC, NULL, &timer)) {
 		socket_close(timerfd[0]);
 		socket_close(timerfd[1]);
@@ -216,10 +266,7 @@ void timer_exit(void)
 	}
 }
 
-/*
- * create periodic timer (seconds)
- */
-int timer_add(int period, void (*cb)(void *), void *arg)
+static int add(int period, int msec, int jitter, void (*cb)(void *), void *arg)
 {
 	struct timespec now;
 	struct timer *t;
@@ -230,7 +277,7 @@ int timer_add(int period, void (*cb)(void *), void *arg)
 		return -1;
 	}
 
-	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+	if (timer_now(&now) < 0)
 		return -1;
 
 	t = malloc(sizeof(*t));
@@ -241,16 +288,147 @@ int timer_add(int period, void (*cb)(void *), void *arg)
 
 	t->active = 1;
 	t->period = period;
+	t->msec   = msec;
+	t->jitter = jitter;
 	t->cb     = cb;
 	t->arg    = arg;
+	t->ns     = netns_current();
 
-	set(t, &now);
+	if (jitter) {
+		/* First expiry at a random point within jitter msec */
+		t->timeout = now;
+		offset(&t->timeout, random() % (jitter + 1));
+	} else
+		set(t, &now);
 
 	LIST_INSERT_HEAD(&timer_list, t, link);
 
 	return start(&now);
 }
 
+/*
+ * create periodic timer (seconds)
+ */
+int timer_add(int period, void (*cb)(void *), void *arg)
+{
+	return add(period, 0, 0, cb, arg);
+}
+
+/*
+ * create periodic sub-second timer (msec), e.g., to spread work evenly
+ * over each second
+ */
+int timer_add_msec(int msec, void (*cb)(void *), void *arg)
+{
+	if (msec <= 0 || msec >= 1000) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return add(0, msec, 0, cb, arg);
+}
+
+/*
+ * create periodic timer (seconds) with random jitter (msec), the first
+ * callback is at a random time within @jitter msec, after that every
+ * @period sec +/- @jitter/2 msec.  Useful to spread out many timers
+ * started at the same time, e.g. one per interface.
+ */
+int timer_add_jitter(int period, int jitter, void (*cb)(void *), void *arg)
+{
+	if (jitter < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return add(period, 0, jitter, cb, arg);
+}
+
+/**
+ * timer_now - Read the daemon clock
+ * @now: Set to current time
+ *
+ * All daemon time queries go through this function, it is either
+ * CLOCK_MONOTONIC or, for testing, the virtual clock.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int timer_now(struct timespec *now)
+{
+	if (timer_sim) {
+		*now = vnow;
+		return 0;
+	}
+
+	return clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+static int before(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec == b->tv_sec)
+		return a->tv_nsec < b->tv_nsec;
+
+	return a->tv_sec < b->tv_sec;
+}
+
+/**
+ * timer_warp - Advance the virtual clock
+ * @sec: Number of seconds to advance
+ *
+ * Timers run in order, each at its own expiry time, as if @sec seconds
+ * had passed.  So hours of aging can be tested in milliseconds.  Only
+ * available with the virtual clock, smcrouted -T.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int timer_warp(int sec)
+{
+	struct timespec end;
+
+	if (!timer_sim) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (sec < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	end = vnow;
+	end.tv_sec += sec;
+
+	while (1) {
+		struct timer *entry, *next = NULL;
+
+		LIST_FOREACH(entry, &timer_list, link) {
+			if (!entry->active)
+				continue;
+			if (!next || before(&entry->timeout, &next->timeout))
+				next = entry;
+		}
+
+		if (!next || before(&end, &next->timeout))
+			break;
+
+		/* Zero period timer, would never let time advance */
+		if (!before(&vnow, &next->timeout) && next->period == 0 && next->msec == 0)
+			break;
+
+		if (before(&vnow, &next->timeout))
+			vnow = next->timeout;
+		expire(&vnow);
+
+		/* Finish any tasks started, e.g., route expiry, before moving on */
+		while (task_pending())
+			task_run();
+	}
+	vnow = end;
+
+	return 0;
+}
+
 /*
  * delete a timer
  */
@@ -20,10 +20,19 @@
 #ifndef SMCROUTE_TIMER_H_
 #define SMCROUTE_TIMER_H_
 
-int  timer_init (void);
-void timer_exit (void);
+#include <time.h>
 
-int  timer_add  (int period, void (*cb)(void *), void *arg);
-int  timer_del  (void (*cb)(void *), void *arg);
+extern int timer_sim;
+
+int  timer_init       (void);
+void timer_exit       (void);
+
+int  timer_now        (struct timespec *now);
+int  timer_warp       (int sec);
+
+int  timer_add        (int period, void (*cb)(void *), void *arg);
+int  timer_add_msec   (int msec,   void (*cb)(void *), void *arg);
+int  timer_add_jitter (int period, int jitter, void (*cb)(void *), void *arg);
+int  timer_del        (void (*cb)(void *), void *arg);
 
 #endif /* SMCROUTE_TIMER_H_ */
@@ -0,0 +1,336 @@
+/* Batched socket operations using io_uring
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+#include "uring.h"
+
+/*
+ * Each setsockopt(), e.g., MRT_ADD_MFC, is a system call of its own.
+ * On reload, or startup, with many routes that is a lot of them.  With
+ * io_uring socket commands, Linux 6.7 and later, a batch of them can be
+ * queued on a ring shared with the kernel and submitted with one call.
+ *
+ * This is a minimal ring, without liburing.  Submissions are always
+ * waited for before uring_submit() returns, so the caller can keep the
+ * option values on its stack.  Older kernels are detected at init, and
+ * then the ring is not used at all.
+ */
+
+/* Older headers lack the socket command, the SQE layout is the same */
+#ifndef SOCKET_URING_OP_SETSOCKOPT
+#define SOCKET_URING_OP_SETSOCKOPT 3
+#endif
+
+static struct {
+	int                  fd;
+	unsigned int         entries;
+	unsigned int         tail;	/* our SQ tail, published on submit */
+	unsigned int         queued;
+
+	unsigned int        *sq_head;
+	unsigned int        *sq_tail;
+	unsigned int        *sq_mask;
+	unsigned int        *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned int        *cq_head;
+	unsigned int        *cq_tail;
+	unsigned int        *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void                *sq_ring;
+	size_t               sq_len;
+	void                *cq_ring;
+	size_t               cq_len;
+	size_t               sqes_len;
+} ring = { .fd = -1 };
+
+
+static int enter(unsigned int submit, unsigned int wait)
+{
+	return syscall(__NR_io_uring_enter, ring.fd, submit, wait,
+		       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* Call @cb for each completion, returns number of completions */
+static unsigned int reap(void (*cb)(void *, int))
+{
+	unsigned int head, tail, num = 0;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+
+		cb((void *)(uintptr_t)cqe->user_data, cqe->res);
+		head++;
+		num++;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	return num;
+}
+
+static int map(struct io_uring_params *p)
+{
+	ring.sq_len   = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	ring.cq_len   = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	ring.sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_len > ring.sq_len)
+			ring.sq_len = ring.cq_len;
+		ring.cq_len = 0;
+	}
+
+	ring.sq_ring = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			    ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ring == MAP_FAILED)
+		return -1;
+
+	if (ring.cq_len) {
+		ring.cq_ring = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				    ring.fd, IORING_OFF_CQ_RING);
+		if (ring.cq_ring == MAP_FAILED)
+			return -1;
+	} else
+		ring.cq_ring = ring.sq_ring;
+
+	ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		return -1;
+
+	ring.sq_head  = (unsigned int *)((char *)ring.sq_ring + p->sq_off.head);
+	ring.sq_tail  = (unsigned int *)((char *)ring.sq_ring + p->sq_off.tail);
+	ring.sq_mask  = (unsigned int *)((char *)ring.sq_ring + p->sq_off.ring_mask);
+	ring.sq_array = (unsigned int *)((char *)ring.sq_ring + p->sq_off.array);
+	ring.cq_head  = (unsigned int *)((char *)ring.cq_ring + p->cq_off.head);
+	ring.cq_tail  = (unsigned int *)((char *)ring.cq_ring + p->cq_off.tail);
+	ring.cq_mask  = (unsigned int *)((char *)ring.cq_ring + p->cq_off.ring_mask);
+	ring.cqes     = (struct io_uring_cqe *)((char *)ring.cq_ring + p->cq_off.cqes);
+
+	ring.entries  = p->sq_entries;
+	ring.tail     = *ring.sq_tail;
+	ring.queued   = 0;
+
+	return 0;
+}
+
+static void probe_done(void *ctx, int res)
+{
+	*(int *)ctx = res;
+}
+
+/*
+ * Set SO_REUSEADDR on a scratch socket using the ring, and read it back
+ * the old way.  Fails on kernels without socket commands.
+ */
+static int probe(void)
+{
+	int val = 1, res = -EINVAL;
+	socklen_t len = sizeof(val);
+	int sd, rc = -1;
+
+	sd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+
+	if (uring_setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val), &res) ||
+	    uring_submit(probe_done))
+		goto done;
+
+	val = 0;
+	if (!res && !getsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &val, &len) && val)
+		rc = 0;
+	else
+		errno = res ? -res : EOPNOTSUPP;
+done:
+	close(sd);
+
+	return rc;
+}
+
+/**
+ * uring_init - Set up ring for batched socket operations
+ * @entries: Max number of operations queued before uring_submit()
+ *
+ * If the kernel does not have io_uring, or lacks socket commands, this
+ * is logged and uring_setsockopt() fails, so callers use setsockopt().
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int uring_init(unsigned int entries)
+{
+	struct io_uring_params p;
+
+	if (ring.fd != -1)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_SUBMIT_ALL;
+	ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring.fd < 0) {
+		smclog(LOG_INFO, "No io_uring, kernel MFC updates not batched: %s", strerror(errno));
+		ring.fd = -1;
+		return -1;
+	}
+
+	if (map(&p)) {
+		smclog(LOG_WARNING, "Failed mapping io_uring: %s", strerror(errno));
+		uring_exit();
+		return -1;
+	}
+
+	if (probe()) {
+		smclog(LOG_INFO, "No io_uring socket commands, kernel MFC updates not batched: %s",
+		       strerror(errno));
+		uring_exit();
+		return -1;
+	}
+
+	smclog(LOG_DEBUG, "Batching kernel MFC updates using io_uring, %u entries", ring.entries);
+
+	return 0;
+}
+
+void uring_exit(void)
+{
+	if (ring.sqes && ring.sqes != MAP_FAILED)
+		munmap(ring.sqes, ring.sqes_len);
+	if (ring.cq_len && ring.cq_ring && ring.cq_ring != MAP_FAILED)
+		munmap(ring.cq_ring, ring.cq_len);
+	if (ring.sq_ring && ring.sq_ring != MAP_FAILED)
+		munmap(ring.sq_ring, ring.sq_len);
+	if (ring.fd != -1)
+		close(ring.fd);
+
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = -1;
+}
+
+/**
+ * uring_setsockopt - Queue a setsockopt() for the next uring_submit()
+ * @sd:    Socket
+ * @level: Protocol level, e.g., IPPROTO_IP
+ * @op:    Option, e.g., MRT_ADD_MFC
+ * @arg:   Option value, must be valid until uring_submit() returns
+ * @len:   Length of @arg
+ * @ctx:   Passed to the callback of uring_submit() with the result
+ *
+ * Returns:
+ * POSIX OK(0) on success, or -1 with @errno set to ENOSPC if the ring
+ * is full, or ENOTCONN if there is no ring.
+ */
+int uring_setsockopt(int sd, int level, int op, const void *arg, socklen_t len, void *ctx)
+{
+	uint32_t opt[2] = { level, op };
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	if (ring.fd == -1) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	if (ring.queued == ring.entries) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	idx = ring.tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode     = IORING_OP_URING_CMD;
+	sqe->fd         = sd;
+	sqe->cmd_op     = SOCKET_URING_OP_SETSOCKOPT;
+	memcpy(&sqe->addr, opt, sizeof(opt));	/* level, optname */
+	sqe->file_index = len;			/* optlen */
+	sqe->addr3      = (uintptr_t)arg;	/* optval */
+	sqe->user_data  = (uintptr_t)ctx;
+
+	ring.sq_array[idx] = idx;
+	ring.tail++;
+	ring.queued++;
+
+	return 0;
+}
+
+/**
+ * uring_submit - Submit all queued operations and wait for them
+ * @cb: Called with the context and result, 0 or -errno, of each
+ *
+ * Usually one system call, regardless of the number of operations.  On
+ * error the ring is closed, and the caller should fall back to regular
+ * system calls, for the operations @cb has not been called for.
+ *
+ * Returns:
+ * POSIX OK(0) on success, or -1 on error.
+ */
+int uring_submit(void (*cb)(void *ctx, int res))
+{
+	unsigned int num = ring.queued, done = 0;
+
+	if (ring.fd == -1) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	__atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+	ring.queued = 0;
+
+	while (done < num) {
+		unsigned int pending;
+		int rc;
+
+		pending = ring.tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+		rc = enter(pending, num - done);
+		if (rc < 0 && errno != EINTR)
+			break;
+		if (pending && rc == 0) {
+			errno = EBUSY;
+			break;
+		}
+
+		done += reap(cb);
+	}
+
+	if (done < num) {
+		smclog(LOG_WARNING, "Failed io_uring submit, disabling: %s", strerror(errno));
+		uring_exit();
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,37 @@
+/* Batched socket operations using io_uring
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SMCROUTE_URING_H_
+#define SMCROUTE_URING_H_
+
+#include "config.h"
+
+#ifdef ENABLE_IO_URING
+#include <sys/socket.h>
+
+int  uring_init       (unsigned int entries);
+void uring_exit       (void);
+
+int  uring_setsockopt (int sd, int level, int op, const void *arg, socklen_t len, void *ctx);
+int  uring_submit     (void (*cb)(void *ctx, int res));
+
+#else
+#define uring_init(entries) do { } while (0)
+#define uring_exit()        do { } while (0)
+#endif
+
+#endif /* SMCROUTE_URING_H_ */
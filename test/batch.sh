@@ -0,0 +1,52 @@
+#!/bin/sh
+# Verifies kernel MFC updates from .conf are written in batches with
+# io_uring, and that all of them reach the kernel.  Skipped on kernels
+# without io_uring socket commands, or when built without io_uring.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+{
+    echo "phyint a1 enable"
+    echo "phyint a2 enable"
+    for i in $(seq 1 300); do
+	echo "mroute from a1 source 10.0.$((i / 250)).$((i % 250 + 1)) group 225.1.2.$((i % 250)) to a2"
+    done
+} > "/tmp/$NM/conf"
+head -n 4 "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 2
+
+print "Checking batch counters ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | tee "/tmp/$NM/stats"
+batched=$(awk '/^Batched writes/ { print $3 }' "/tmp/$NM/stats")
+submits=$(awk '/^Batch submits/ { print $3 }' "/tmp/$NM/stats")
+[ -n "$batched" ] && [ "$batched" -gt 0 ] || SKIP "No io_uring socket commands"
+
+echo " => $batched writes in $submits batches"
+[ "$batched" -eq 300 ] || FAIL "Not all writes batched"
+# At most 64 per batch, and at least a few per batch
+[ "$submits" -ge 5 ] && [ "$submits" -le 30 ] || FAIL "Unexpected number of batches"
+
+print "Verifying kernel MFC ..."
+num=$(ip mroute | grep -c "Iif: a1 *Oifs: a2")
+echo " => $num routes in kernel, expected 300"
+[ "$num" -eq 300 ] || FAIL "Not all routes written to kernel"
+
+print "Removing route and re-adding, single writes ..."
+../src/smcroutectl -u "/tmp/$NM/sock" del a1 10.0.0.2 225.1.2.1 || FAIL "Failed removing route"
+../src/smcroutectl -u "/tmp/$NM/sock" add a1 10.0.0.2 225.1.2.1 a2 || FAIL "Failed adding route"
+sleep 1
+ip mroute | grep -q "(10.0.0.2,225.1.2.1) *Iif: a1 *Oifs: a2" || FAIL "Route not re-added"
+
+OK
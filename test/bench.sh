@@ -0,0 +1,41 @@
+#!/bin/sh
+# Verifies 'smcroutectl bench' against a daemon on the simulated kernel
+# backend, 'smcrouted -K'.  All operations must succeed, and nothing may
+# be set in the kernel.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted on simulated kernel ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -K -P "/tmp/$NM/pid" -l notice -u "/tmp/$NM/sock" &
+sleep 1
+
+print "Running benchmark ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" bench a1 a2 count 500 jobs 2 depth 4 \
+    | tee "/tmp/$NM/result" || FAIL "Benchmark failed"
+
+print "Verifying result ..."
+for cmd in add join leave remove; do
+    awk -v cmd="$cmd" '$1 == cmd && $2 == 500 && $3 == 0 { found = 1 } END { exit !found }' \
+	"/tmp/$NM/result" || FAIL "Missing or failed $cmd"
+done
+
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes
+[ -z "$(ip mroute)" ] || FAIL "Simulated kernel backend modified the kernel MFC"
+ip maddr show dev a1 | grep -q 232.0 && FAIL "Simulated kernel backend joined groups"
+
+OK
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Verifies the virtual clock, smcrouted -T.  A learned (*,G) route must
+# not expire before two cache flush intervals have passed, and must be
+# gone right after, without waiting in real time.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+learned()
+{
+    ip mroute | grep -q "(10.0.0.1,225.1.2.3)"
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 group 225.1.2.3 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -T -c 600 -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 1
+
+print "Starting emitter ..."
+ping -c 3 -W 1 -I a1 -t 3 225.1.2.3 >/dev/null
+show_mroute
+learned || FAIL "Failed learning (*,G) route"
+
+print "Warping 599 sec, before first cache flush ..."
+../src/smcroutectl -u "/tmp/$NM/sock" warp 599 || FAIL "Failed warping clock"
+show_mroute
+learned || FAIL "Learned route expired early"
+
+print "Warping 601 sec, past second cache flush ..."
+../src/smcroutectl -u "/tmp/$NM/sock" warp 601 || FAIL "Failed warping clock"
+show_mroute
+learned && FAIL "Learned route not expired"
+
+OK
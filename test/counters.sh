@@ -0,0 +1,76 @@
+#!/bin/sh
+# Verifies route counters are cumulative, so they never go backwards
+# when the kernel MFC entry is reinstalled, and, with smcrouted -J FILE,
+# are saved to FILE.counters and restored on restart.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+# Packets forwarded by (10.0.0.1,225.1.2.3), from show routes -d
+pkts()
+{
+    ../src/smcroutectl -pdu "/tmp/$NM/sock" show routes | \
+	awk '/\(10.0.0.1, 225.1.2.3\)/ { print $4; exit }'
+}
+
+check_pkts()
+{
+    num=$(pkts)
+    echo " => $num packets"
+    [ "${num:-0}" -ge "$1" ] || FAIL "$2, expected at least $1 packets"
+}
+
+emit()
+{
+    ping -c "$1" -W 1 -I a1 -t 3 225.1.2.3 >/dev/null
+}
+
+start()
+{
+    ../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		     -J "/tmp/$NM/journal" >>"/tmp/$NM/log" 2>&1 &
+    sleep 1
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+mroute from a1 source 10.0.0.1 group 225.1.2.3 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+start
+
+print "Starting emitter ..."
+emit 3
+show_mroute
+check_pkts 3 "Not forwarding"
+
+print "Reinstalling route ..."
+ctl="../src/smcroutectl -u /tmp/$NM/sock"
+$ctl del a1 10.0.0.1 225.1.2.3    || FAIL "Failed deleting route"
+$ctl add a1 10.0.0.1 225.1.2.3 a2 || FAIL "Failed adding route"
+check_pkts 3 "Counters lost on reinstall"
+emit 2
+check_pkts 5 "Counters lost on reinstall"
+
+print "Restarting smcrouted ..."
+kill "$(cat "/tmp/$NM/pid")"
+sleep 1
+cat "/tmp/$NM/journal.counters" || FAIL "Counters not saved"
+start
+show_mroute
+check_pkts 5 "Counters lost on restart"
+emit 2
+check_pkts 7 "Counters lost on restart"
+
+OK
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Verifies the journal, smcrouted -J FILE, of changes made with
+# smcroutectl: restored after a crash and restart, kept in place across
+# reload, and compacted into FILE.snap when it grows.  A replace
+# supersedes all changes before it.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+check_route()
+{
+    ip mroute | grep -q "$2"
+    [ "$?" = "$1" ] || FAIL "$3"
+}
+
+check_group()
+{
+    ip maddr show dev a2 | grep -q "$2"
+    [ "$?" = "$1" ] || FAIL "$3"
+}
+
+check_state()
+{
+    check_route 0 "(10.0.0.1,225.1.2.1) *Iif: a1 *Oifs: a2"  "Route from .conf missing"
+    check_route 0 "(10.0.0.2,225.1.2.2) *Iif: a1 *Oifs: a2"  "Added route missing"
+    check_route 1 "(10.0.0.3,225.1.2.3)"                     "Deleted route restored"
+    check_route 0 "(10.0.0.4,225.1.2.4) *Iif: a1 *Oifs: a2"  "Route changed twice missing"
+    check_group 0 "225.3.2.1"                                "Joined group missing"
+    check_group 1 "225.3.2.2"                                "Left group restored"
+}
+
+start()
+{
+    ../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		     -J "/tmp/$NM/journal" >>"/tmp/$NM/log" 2>&1 &
+    sleep 1
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 source 10.0.0.1 group 225.1.2.1 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+start
+
+print "Changing routes and groups ..."
+ctl="../src/smcroutectl -u /tmp/$NM/sock"
+$ctl add  a1 10.0.0.2 225.1.2.2 a2       || FAIL "Failed adding route"
+$ctl add  a1 10.0.0.3 225.1.2.3 a2       || FAIL "Failed adding route"
+$ctl del  a1 10.0.0.3 225.1.2.3          || FAIL "Failed deleting route"
+$ctl add  a1 10.0.0.4 225.1.2.4 a2       || FAIL "Failed adding route"
+$ctl del  a1 10.0.0.4 225.1.2.4          || FAIL "Failed deleting route"
+$ctl add  a1 10.0.0.4 225.1.2.4 a2       || FAIL "Failed adding route"
+$ctl join a2 225.3.2.1                   || FAIL "Failed joining group"
+$ctl join a2 225.3.2.2                   || FAIL "Failed joining group"
+$ctl leave a2 225.3.2.2                  || FAIL "Failed leaving group"
+cat "/tmp/$NM/journal"
+check_state
+
+print "Crashing and restarting smcrouted ..."
+kill -9 "$(cat "/tmp/$NM/pid")"
+sleep 1
+start
+show_mroute
+check_state
+
+print "Reloading smcrouted ..."
+gen=$($ctl -p show routes since 0 | awk '/^Generation:/ { print $2 }')
+$ctl reload
+sleep 1
+check_state
+$ctl -p show routes since "$gen" | tee "/tmp/$NM/since"
+grep -q "^[0-9]* *- *mfc *(10.0.0.2, 225.1.2.2)" "/tmp/$NM/since" && FAIL "Journaled route flapped on reload"
+grep -q "^[0-9]* *- *group *(\*, 225.3.2.1)" "/tmp/$NM/since"     && FAIL "Journaled group flapped on reload"
+
+print "Verifying compaction ..."
+for i in $(seq 1 600); do
+    $ctl add a1 10.0.1.1 225.1.3.1 a2
+    $ctl del a1 10.0.1.1 225.1.3.1
+done
+[ -s "/tmp/$NM/journal.snap" ] || FAIL "No snapshot"
+num=$(cat "/tmp/$NM/journal.snap" "/tmp/$NM/journal" | wc -l)
+echo " => $num records in journal and snapshot"
+[ "$num" -lt 1024 ] || FAIL "Journal not compacted"
+check_route 1 "(10.0.1.1,225.1.3.1)" "Deleted route in kernel"
+check_state
+
+print "Replacing, crashing, and restarting smcrouted ..."
+cat <<EOF > "/tmp/$NM/state"
+add  a1 10.0.0.1 225.1.2.1 a2
+add  a1 10.0.0.5 225.1.2.5 a2
+join a2 225.3.2.5
+EOF
+$ctl replace "/tmp/$NM/state" || FAIL "Replace failed"
+kill -9 "$(cat "/tmp/$NM/pid")"
+sleep 1
+start
+show_mroute
+check_route 0 "(10.0.0.1,225.1.2.1) *Iif: a1 *Oifs: a2"  "Route in replace missing"
+check_route 0 "(10.0.0.5,225.1.2.5) *Iif: a1 *Oifs: a2"  "Route in replace missing"
+check_route 1 "(10.0.0.2,225.1.2.2)"                     "Route before replace restored"
+check_group 0 "225.3.2.5"                                "Group in replace missing"
+check_group 1 "225.3.2.1"                                "Group before replace restored"
+
+OK
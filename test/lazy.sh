@@ -0,0 +1,60 @@
+#!/bin/sh
+# Verifies on demand VIFs, smcrouted -L SEC.  Only interfaces used by
+# routes get a VIF, and it is released after the hold-down when no
+# route uses it anymore.  Uses the virtual clock, -T, to not wait.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+has_vif()
+{
+    grep -q " $1 " /proc/net/ip_mr_vif
+}
+
+warp()
+{
+    ../src/smcroutectl -u "/tmp/$NM/sock" warp "$1" || FAIL "Failed warping clock"
+}
+
+print "Creating world ..."
+topo basic
+ip link add a3 type dummy
+ip link set a3 up
+ip link set a3 multicast on
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip addr add 30.0.0.1/24 dev a3
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+mroute from a1 group 225.1.2.3 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -T -L 30 -f "/tmp/$NM/conf" -n -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 1
+
+print "Verifying VIFs only for interfaces used by routes ..."
+cat /proc/net/ip_mr_vif
+has_vif a1 && has_vif a2 || FAIL "Missing VIF for route"
+has_vif a3              && FAIL "VIF for unused interface a3"
+
+print "Adding route to a3 ..."
+../src/smcroutectl -u "/tmp/$NM/sock" add a1 225.3.2.1 a3
+cat /proc/net/ip_mr_vif
+has_vif a3 || FAIL "No VIF created on demand for a3"
+
+print "Removing route to a3, verifying hold-down ..."
+../src/smcroutectl -u "/tmp/$NM/sock" del a1 225.3.2.1
+warp 30
+cat /proc/net/ip_mr_vif
+has_vif a3 || FAIL "VIF for a3 released before hold-down"
+warp 30
+cat /proc/net/ip_mr_vif
+has_vif a3 && FAIL "VIF for a3 not released"
+has_vif a1 && has_vif a2 || FAIL "VIF still in use released"
+
+OK
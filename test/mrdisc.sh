@@ -1,5 +1,5 @@
 #!/bin/sh
-# Verifies IPv4 mrdisc messages on all interfaces it is enabled on
+# Verifies IPv4 and IPv6 mrdisc messages on all interfaces it is enabled on
 # Runs for two intervals to ensure interval timer works properly.
 #set -x
 
@@ -23,14 +23,16 @@ print "Starting smcrouted ..."
 ../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" -m 4 &
 sleep 1
 
-collect a2 -c3 'dst 224.0.0.106'
+collect a2 -c6 'dst 224.0.0.106 or dst ff02::6a'
 sleep 10
 
 print "Analyzing ..."
-lines=$(tshark -r "/tmp/$NM/pcap" 2>/dev/null | grep 224.0.0.106 | tee "/tmp/$NM/result" | wc -l)
-cat "/tmp/$NM/result"
-echo " => $lines for 224.0.0.106 (MRDISC), expected >= 2"
+tshark -r "/tmp/$NM/pcap" 2>/dev/null | tee "/tmp/$NM/result"
+lines4=$(grep -c 224.0.0.106 "/tmp/$NM/result")
+lines6=$(grep -c ff02::6a "/tmp/$NM/result")
+echo " => $lines4 for 224.0.0.106 (MRDISC), expected >= 2"
+echo " => $lines6 for ff02::6a (MRDISC), expected >= 2"
 
 # shellcheck disable=SC2086
-[ $lines -ge 2 ] && OK
+[ $lines4 -ge 2 ] && [ $lines6 -ge 2 ] && OK
 FAIL
@@ -0,0 +1,79 @@
+#!/bin/sh
+# Verifies one smcrouted routing in two network namespaces, its own and
+# one from a 'netns NAME' block in the .conf file.  Routes end up in the
+# kernel of the right namespace, and smcroutectl -n NAME selects the
+# namespace for a command.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+NS="/tmp/$NM/ns1"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+touch "$NS"
+echo "$NS" > "/tmp/$NM/mounts"
+unshare --net="$NS" -- ip link set lo up
+for i in 0 1; do
+    nsenter --net="$NS" -- ip link add eth$i type veth peer peer$i
+    nsenter --net="$NS" -- ip link set eth$i up
+    nsenter --net="$NS" -- ip link set peer$i up
+    nsenter --net="$NS" -- ip link set eth$i multicast on
+done
+nsenter --net="$NS" -- ip addr add 30.0.0.1/24 dev eth0
+nsenter --net="$NS" -- ip addr add 40.0.0.1/24 dev eth1
+nsenter --net="$NS" -- ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+mroute from a1 source 10.0.0.10 group 225.1.2.3 to a2
+
+netns $NS
+mroute from eth0 source 30.0.0.10 group 225.3.2.1 to eth1
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 1
+
+print "Verifying routes in each namespace ..."
+ip mroute
+nsenter --net="$NS" -- ip mroute
+ip mroute | grep -q "(10.0.0.10,225.1.2.3) *Iif: a1 *Oifs: a2" \
+    || FAIL "Missing route in own namespace"
+ip mroute | grep -q "225.3.2.1" && FAIL "Route from netns block in own namespace"
+nsenter --net="$NS" -- ip mroute | grep -q "(30.0.0.10,225.3.2.1) *Iif: eth0 *Oifs: eth1" \
+    || FAIL "Missing route in $NS"
+nsenter --net="$NS" -- ip mroute | grep -q "225.1.2.3" && FAIL "Route leaked into $NS"
+
+print "Adding route in namespace with smcroutectl -n ..."
+../src/smcroutectl -u "/tmp/$NM/sock" -n "$NS" add eth0 30.0.0.11 225.3.2.2 eth1 \
+    || FAIL "Failed adding route in $NS"
+nsenter --net="$NS" -- ip mroute | grep -q "(30.0.0.11,225.3.2.2) *Iif: eth0 *Oifs: eth1" \
+    || FAIL "Route not added in $NS"
+../src/smcroutectl -pt -u "/tmp/$NM/sock" -n "$NS" show routes | tee "/tmp/$NM/show"
+grep -q "225.3.2.2" "/tmp/$NM/show" || FAIL "Route not shown in $NS"
+../src/smcroutectl -pt -u "/tmp/$NM/sock" show routes | grep -q "225.3.2" \
+    && FAIL "Route in $NS shown in own namespace"
+
+print "Verifying unknown namespace is an error ..."
+../src/smcroutectl -u "/tmp/$NM/sock" -n nosuch add eth0 30.0.0.12 225.3.2.3 eth1 && FAIL "Unknown namespace accepted"
+
+print "Reloading .conf, verifying routes in both namespaces remain ..."
+../src/smcroutectl -u "/tmp/$NM/sock" reload
+sleep 1
+ip mroute | grep -q "(10.0.0.10,225.1.2.3)" || FAIL "Route lost in own namespace"
+nsenter --net="$NS" -- ip mroute | grep -q "(30.0.0.10,225.3.2.1)" \
+    || FAIL "Route lost in $NS"
+
+# Daemon holds the namespace open, stop it before teardown unmounts it
+../src/smcroutectl -u "/tmp/$NM/sock" kill
+sleep 1
+
+OK
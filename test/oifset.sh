@@ -0,0 +1,77 @@
+#!/bin/sh
+# Verifies interned OIF sets.  Flows learned from the same (*,G) rule
+# share one set of outbound interfaces, adding an outbound interface to
+# the rule must retarget all of them, and only them, and removing it
+# must move them back.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Checking dependencies ..."
+check_dep ping
+
+print "Creating world ..."
+topo basic
+ip link add a3 type dummy
+ip link set a3 up
+ip link set a3 multicast on
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip addr add 30.0.0.1/24 dev a3
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+phyint a3 enable
+
+mroute from a1 group 225.1.2.0/24 to a2
+mroute from a1 group 225.3.0.0/24 to a3
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Learning flows ..."
+for i in 1 2 3; do
+    ping -c 1 -W 1 -I a1 -t 3 "225.1.2.$i" >/dev/null
+done
+ping -c 1 -W 1 -I a1 -t 3 225.3.0.1 >/dev/null
+sleep 1
+show_mroute
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | grep -q "Distinct OIF sets *2" \
+    || FAIL "Flows not sharing OIF sets"
+
+print "Adding a3 to (*,G) rule ..."
+../src/smcroutectl -u "/tmp/$NM/sock" add a1 225.1.2.0/24 a3
+sleep 1
+show_mroute
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | grep -q "Distinct OIF sets *2" \
+    || FAIL "Flows not moved to one OIF set"
+
+print "Analyzing ..."
+for i in 1 2 3; do
+    ip mroute | grep -q "(10.0.0.1,225.1.2.$i) *Iif: a1 *Oifs: a2 a3" \
+	|| FAIL "225.1.2.$i not retargeted"
+done
+ip mroute | grep -q "(10.0.0.1,225.3.0.1) *Iif: a1 *Oifs: a3 *State" \
+    || FAIL "225.3.0.1 changed"
+
+print "Removing a3 from (*,G) rule ..."
+../src/smcroutectl -u "/tmp/$NM/sock" del a1 225.1.2.0/24 a3
+sleep 1
+show_mroute
+for i in 1 2 3; do
+    ip mroute | grep -q "(10.0.0.1,225.1.2.$i) *Iif: a1 *Oifs: a2 *State" \
+	|| FAIL "225.1.2.$i still forwarding to a3"
+done
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | grep -q "Distinct OIF sets *2" \
+    || FAIL "Flows not moved back to one OIF set"
+
+OK
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Verifies paced joins, smcrouted -j RATE.  Groups must be joined at
+# most RATE per interface and second, groups with a route first, and
+# all groups must be joined eventually.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+joined()
+{
+    ip maddr show dev a1 | grep -c "$1"
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mgroup from a1 group 225.1.0.0/28
+mgroup from a1 group 225.9.0.0/29
+
+mroute from a1 group 225.9.0.0/24 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -j 4 -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1.5
+
+print "Verifying pacing ..."
+ip maddr show dev a1
+lo=$(joined 225.1.0.)
+hi=$(joined 225.9.0.)
+echo " => $hi groups with route, $lo groups without route joined"
+[ "$((lo + hi))" -le 8 ] || FAIL "Joins not paced"
+[ "$lo" -eq 0 ]          || FAIL "Groups without route joined first"
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | grep -A4 "Join Pacing"
+
+print "Waiting for all joins ..."
+sleep 6
+ip maddr show dev a1
+cat "/tmp/$NM/log"
+lo=$(joined 225.1.0.)
+hi=$(joined 225.9.0.)
+echo " => $hi groups with route, $lo groups without route joined"
+[ "$hi" -eq 8 ] && [ "$lo" -eq 16 ] || FAIL "Not all groups joined"
+grep -q "Paced joins done, 24 groups joined" "/tmp/$NM/log" || FAIL "No progress reported"
+
+OK
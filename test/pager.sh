@@ -0,0 +1,65 @@
+#!/bin/sh
+# Verifies paginated show routes, i.e., 'show routes limit N after CURSOR'
+# returns all routes exactly once when fetched one page at a time.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+{
+    echo "phyint a1 enable"
+    echo "phyint a2 enable"
+    for i in $(seq 1 20); do
+	echo "mroute from a1 source 10.0.0.$i group 225.1.2.$i to a2"
+    done
+    for i in $(seq 1 5); do
+	echo "mroute from a1 group 226.0.0.$i to a2"
+    done
+} > "/tmp/$NM/conf"
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 1
+
+print "Fetching all routes ..."
+../src/smcroutectl -ptu "/tmp/$NM/sock" show routes | grep -v '^$' | tee "/tmp/$NM/all"
+
+print "Fetching routes, 4 at a time ..."
+cursor=""
+pages=0
+: > "/tmp/$NM/pages"
+while :; do
+    if [ -z "$cursor" ]; then
+	../src/smcroutectl -ptu "/tmp/$NM/sock" show routes limit 4 > "/tmp/$NM/page"
+    else
+	../src/smcroutectl -ptu "/tmp/$NM/sock" show routes limit 4 after "$cursor" > "/tmp/$NM/page"
+    fi
+    cat "/tmp/$NM/page"
+    grep -v -e '^Next:' -e '^$' "/tmp/$NM/page" >> "/tmp/$NM/pages"
+    cursor=$(awk '/^Next: after/ { print $3 }' "/tmp/$NM/page")
+    pages=$((pages + 1))
+
+    [ -z "$cursor" ] && break
+    [ $pages -gt 50 ] && FAIL "Runaway pagination, cursor $cursor"
+done
+
+print "Analyzing ..."
+sort "/tmp/$NM/all"   > "/tmp/$NM/all.sorted"
+sort "/tmp/$NM/pages" > "/tmp/$NM/pages.sorted"
+lines=$(wc -l < "/tmp/$NM/all.sorted")
+echo " => $pages pages, $lines routes, expected 12 pages and 45 routes"
+
+# 5 (*,G) + 20 (S,G) + 20 kernel routes
+[ "$lines" -eq 45 ] || FAIL
+[ "$pages" -eq 12 ] || FAIL
+cmp "/tmp/$NM/all.sorted" "/tmp/$NM/pages.sorted" || FAIL
+
+OK
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Verifies upcall priority classes.  The daemon is stopped while a burst
+# of multicast to low priority groups is followed by one stream to a high
+# priority group.  When the daemon resumes, the backlog of upcalls must
+# be served highest priority first.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Checking dependencies ..."
+check_dep ping
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 group 225.1.0.0/16 to a2
+mroute from a1 group 225.9.0.0/16 priority 7 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Stopping smcrouted, queueing upcalls ..."
+kill -STOP "$(cat "/tmp/$NM/pid")"
+for i in 1 2 3 4 5; do
+    ping -c 1 -W 1 -I a1 -t 3 "225.1.0.$i" >/dev/null
+done
+ping -c 1 -W 1 -I a1 -t 3 225.9.0.1 >/dev/null
+kill -CONT "$(cat "/tmp/$NM/pid")"
+sleep 1
+show_mroute
+
+print "Analyzing ..."
+cat "/tmp/$NM/log"
+grep -q "Upcall backlog" "/tmp/$NM/log" || FAIL "No upcall backlog"
+high=$(grep -n "Add 10.0.0.1 -> 225.9.0.1" "/tmp/$NM/log" | cut -d: -f1)
+low=$(grep -n "Add 10.0.0.1 -> 225.1.0.1" "/tmp/$NM/log" | cut -d: -f1)
+echo " => high priority installed at line ${high:-none}, low priority at line ${low:-none}"
+[ -n "$high" ] && [ -n "$low" ] || FAIL "Routes not installed"
+[ "$high" -lt "$low" ] || FAIL "High priority upcall not served first"
+
+OK
@@ -0,0 +1,82 @@
+#!/bin/sh
+# Verifies range queries over the kernel MFC.  Flows are learned from
+# two (*,G) rules, 'show routes group' and 'show routes source', also
+# without 'routes', must list only the flows in range, and 'flush group'
+# must only flush the flows in range.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Checking dependencies ..."
+check_dep ping
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 group 225.1.0.0/16 to a2
+mroute from a1 group 225.2.0.0/16 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Learning flows ..."
+for grp in 225.1.2.1 225.1.2.2 225.1.3.1 225.2.0.1; do
+    ping -c 1 -W 1 -I a1 -t 3 "$grp" >/dev/null
+done
+sleep 1
+show_mroute
+
+print "Verifying show routes group 225.1.2.0/24 ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes group 225.1.2.0/24 | tee "/tmp/$NM/show"
+num=$(grep -c "^(10.0.0.1, 225" "/tmp/$NM/show")
+echo " => $num flows, expected 2"
+[ "$num" -eq 2 ] || FAIL "Wrong number of flows in group range"
+grep -q "225.1.2.1" "/tmp/$NM/show" && grep -q "225.1.2.2" "/tmp/$NM/show" \
+    || FAIL "Missing flows in group range"
+grep -q "(\*, 225.1.0.0/16)" "/tmp/$NM/show" || FAIL "Missing overlapping rule"
+grep -q "225.2.0.0/16" "/tmp/$NM/show" && FAIL "Rule out of range shown"
+
+print "Verifying show routes source 10.0.0.0/24 group 225.1.0.0/16 ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes source 10.0.0.0/24 group 225.1.0.0/16 \
+    | tee "/tmp/$NM/show"
+num=$(grep -c "^(10.0.0.1, 225" "/tmp/$NM/show")
+echo " => $num flows, expected 3"
+[ "$num" -eq 3 ] || FAIL "Wrong number of flows in source range"
+
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes source 10.9.0.0/16 | tee "/tmp/$NM/show"
+grep -q "^(10.0.0.1, 225" "/tmp/$NM/show" && FAIL "Flows out of source range shown"
+
+print "Verifying show source and group, without routes ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show source 10.0.0.0/24 group 225.1.2.0/24 | tee "/tmp/$NM/show"
+num=$(grep -c "^(10.0.0.1, 225" "/tmp/$NM/show")
+echo " => $num flows, expected 2"
+[ "$num" -eq 2 ] || FAIL "Show source not a route filter"
+../src/smcroutectl -pu "/tmp/$NM/sock" show group 225.1.2.0/24 | tee "/tmp/$NM/show"
+grep -q "^(10.0.0.1, 225.1.2.1)" "/tmp/$NM/show" || FAIL "Show group not a route filter"
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes bogus 1 | grep -q "malformed" \
+    || FAIL "Unknown show argument accepted"
+
+print "Flushing group 225.1.0.0/16 ..."
+# First flush marks new entries, second expires entries unused since
+../src/smcroutectl -u "/tmp/$NM/sock" flush group 225.1.0.0/16
+../src/smcroutectl -u "/tmp/$NM/sock" flush group 225.1.0.0/16
+show_mroute
+
+print "Analyzing ..."
+ip mroute | grep -q "225.1." && FAIL "Flows in range not flushed"
+ip mroute | grep -q "(10.0.0.1,225.2.0.1)" || FAIL "Flow out of range flushed"
+
+OK
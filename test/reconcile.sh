@@ -0,0 +1,115 @@
+#!/bin/sh
+# Verifies the kernel MFC reconciler, smcrouted -r SEC, does not find any
+# drift when the kernel MFC and smcrouted are in sync.  Every route would
+# otherwise be reported as missing, stray, or mismatched.  Then removes
+# an entry from, and adds a foreign entry to, the kernel MFC behind the
+# back of smcrouted, and verifies that both are repaired.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24  dev a1
+ip addr add 20.0.0.1/24  dev a2
+ip addr add 2001:1::1/64 dev a1
+ip addr add 2001:2::1/64 dev a2
+ip -br a
+
+print "Creating config ..."
+{
+    echo "phyint a1 enable"
+    echo "phyint a2 enable"
+    for i in $(seq 1 10); do
+	echo "mroute from a1 source 10.0.0.$i group 225.1.2.$i to a2"
+	echo "mroute from a1 source 2001:1::$i group ff04::$i to a2"
+    done
+    echo "mroute from a2 source 20.0.0.1 group 225.3.2.1"
+} > "/tmp/$NM/conf"
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -r 1 -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 3
+
+show_mroute
+print "Reconciler statistics ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | tee "/tmp/$NM/stats"
+
+print "Analyzing ..."
+stat()
+{
+    awk -v name="$1" '$0 ~ "^" name { print $NF }' "/tmp/$NM/stats"
+}
+
+[ "$(stat Passes)"     -ge 2 ] || FAIL "Reconciler not running"
+[ "$(stat Missing)"    -eq 0 ] || FAIL "Reconciler reports missing routes"
+[ "$(stat Stray)"      -eq 0 ] || FAIL "Reconciler reports stray routes"
+[ "$(stat Mismatched)" -eq 0 ] || FAIL "Reconciler reports mismatched routes"
+
+# Change the kernel MFC using netlink, like another tool would
+command -v python3 >/dev/null || OK "Cannot find python3, skipping repair tests."
+cat <<'EOF' > "/tmp/$NM/mfc.py"
+import socket, struct, sys
+
+RTM_NEWROUTE, RTM_DELROUTE = 24, 25
+RTNL_FAMILY_IPMR, RT_TABLE_DEFAULT, RTPROT_STATIC, RTN_MULTICAST = 128, 253, 4, 5
+
+def attr(kind, data):
+    return struct.pack("HH", 4 + len(data), kind) + data + b"\0" * (-len(data) % 4)
+
+def ifindex(name):
+    return socket.if_nametoindex(name)
+
+# The kernel takes the TTL of each VIF in order, as the hops of each nexthop
+def vifs():
+    with open("/proc/net/ip_mr_vif") as fp:
+        return {line.split()[1]: int(line.split()[0]) for line in fp.readlines()[1:]}
+
+cmd, src, grp, iif, oifs = sys.argv[1], sys.argv[2], sys.argv[3], sys.argv[4], sys.argv[5:]
+ttls = [0] * (max([vifs()[oif] for oif in oifs] or [-1]) + 1)
+for oif in oifs:
+    ttls[vifs()[oif]] = 1
+nhs = b"".join(struct.pack("HBBi", 8, 0, ttl, 0) for ttl in ttls)
+body = struct.pack("BBBBBBBBI", RTNL_FAMILY_IPMR, 32, 32, 0, RT_TABLE_DEFAULT, RTPROT_STATIC, 0, RTN_MULTICAST, 0)
+body += attr(15, struct.pack("I", RT_TABLE_DEFAULT))
+body += attr(2, socket.inet_aton(src)) + attr(1, socket.inet_aton(grp))
+body += attr(3, struct.pack("I", ifindex(iif)))
+if nhs:
+    body += attr(9, nhs)
+
+if cmd == "add":
+    kind, flags = RTM_NEWROUTE, 0x1 | 0x4 | 0x400 | 0x100
+else:
+    kind, flags = RTM_DELROUTE, 0x1 | 0x4
+
+sd = socket.socket(socket.AF_NETLINK, socket.SOCK_RAW, socket.NETLINK_ROUTE)
+sd.send(struct.pack("IHHII", 16 + len(body), kind, flags, 1, 0) + body)
+err = struct.unpack("i", sd.recv(4096)[16:20])[0]
+sys.exit(1 if err else 0)
+EOF
+
+check_route()
+{
+    ip mroute | grep -q "$2"
+    [ "$?" = "$1" ] || FAIL "$3"
+}
+
+print "Removing route, and adding foreign route, behind our back ..."
+python3 "/tmp/$NM/mfc.py" del 10.0.0.1  225.1.2.1  a1    || FAIL "Failed removing kernel MFC entry"
+python3 "/tmp/$NM/mfc.py" add 10.0.0.99 225.1.2.99 a1 a2 || FAIL "Failed adding kernel MFC entry"
+show_mroute
+check_route 1 "(10.0.0.1,225.1.2.1)"                      "Route not removed"
+check_route 0 "(10.0.0.99,225.1.2.99) *Iif: a1 *Oifs: a2" "Foreign route not added"
+
+print "Waiting for reconciler ..."
+sleep 3
+show_mroute
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | tee "/tmp/$NM/stats"
+check_route 0 "(10.0.0.1,225.1.2.1) *Iif: a1 *Oifs: a2"   "Removed route not restored"
+check_route 1 "(10.0.0.99,225.1.2.99)"                    "Foreign route not removed"
+[ "$(stat Missing)"    -ge 1 ] || FAIL "Reconciler did not report missing route"
+[ "$(stat Stray)"      -ge 1 ] || FAIL "Reconciler did not report stray route"
+
+OK
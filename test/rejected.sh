@@ -0,0 +1,49 @@
+#!/bin/sh
+# Verifies 'smcroutectl show rejected'.  Multicast to groups that do not
+# match any (*,G) rule must be counted per (S,G) and inbound interface,
+# while groups that match are not.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Checking dependencies ..."
+check_dep ping
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 group 225.1.0.0/16 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Sending matching and unmatched multicast ..."
+for i in 1 2 3; do
+    ping -c 1 -W 1 -I a1 -t 3 "225.1.0.$i" >/dev/null
+    ping -c 1 -W 1 -I a1 -t 3 "225.9.0.$i" >/dev/null
+done
+sleep 1
+show_mroute
+
+print "Verifying rejected flows ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show rejected | tee "/tmp/$NM/result"
+for i in 1 2 3; do
+    grep -q "(10.0.0.1, 225.9.0.$i) *a1 *1 " "/tmp/$NM/result" || FAIL "Missing 225.9.0.$i"
+done
+grep -q "225.1.0" "/tmp/$NM/result" && FAIL "Matching flow counted as rejected"
+grep -q "^3 rejected upcalls" "/tmp/$NM/result" || FAIL "Wrong total"
+
+OK
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Verifies the group membership reconciler, smcrouted -r SEC, rejoins
+# groups lost in the kernel.  Moving an interface to another network
+# namespace, and back, drops all its memberships behind our back.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+stat()
+{
+    ../src/smcroutectl -pu "/tmp/$NM/sock" show stats > "/tmp/$NM/stats"
+    awk -v name="$1" '$0 ~ "^" name { print $NF }' "/tmp/$NM/stats"
+}
+
+check_groups()
+{
+    ip maddr show dev a2 | grep -q "225.3.2.1" || FAIL "$1 225.3.2.1"
+    ip maddr show dev a2 | grep -q "ff04::1"   || FAIL "$1 ff04::1"
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24  dev a1
+ip addr add 20.0.0.1/24  dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+mgroup from a2 group 225.3.2.1
+mgroup from a2 group ff04::1
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -r 1 -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 3
+check_groups "Not joined"
+
+print "Verifying no drift when in sync ..."
+[ "$(stat "Membership passes")" -ge 2 ] || FAIL "Reconciler not running"
+[ "$(stat "Joins missing")"     -eq 0 ] || FAIL "Reconciler reports missing joins"
+
+print "Dropping memberships behind smcrouted's back ..."
+ip netns del "$NM" 2>/dev/null
+ip netns add "$NM" 2>/dev/null || SKIP "Cannot create network namespace"
+kill -STOP "$(cat "/tmp/$NM/pid")"
+ip link set a2 netns "$NM"
+ip netns exec "$NM" ip link set a2 netns $$
+ip link set a2 up
+ip addr add 20.0.0.1/24 dev a2
+ip maddr show dev a2
+ip netns del "$NM"
+ip maddr show dev a2 | grep -q "225.3.2.1" && SKIP "Memberships not dropped by kernel"
+kill -CONT "$(cat "/tmp/$NM/pid")"
+sleep 3
+
+print "Verifying groups are rejoined ..."
+ip maddr show dev a2
+../src/smcroutectl -pu "/tmp/$NM/sock" show stats | tail -9
+check_groups "Not rejoined"
+[ "$(stat "Rejoined")" -ge 2 ] || FAIL "Reconciler did not rejoin"
+
+OK
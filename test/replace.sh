@@ -0,0 +1,109 @@
+#!/bin/sh
+# Verifies 'smcroutectl replace FILE', i.e., that the desired state of
+# routes and groups is applied and that unchanged routes are left alone.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+check_route()
+{
+    ip mroute | grep -q "$2"
+    [ "$?" = "$1" ] || FAIL "$3"
+}
+
+check_group()
+{
+    ip maddr show dev a2 | grep -q "$2"
+    [ "$?" = "$1" ] || FAIL "$3"
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 source 10.0.0.1 group 225.1.2.1 to a2
+mroute from a1 source 10.0.0.2 group 225.1.2.2 to a2
+mroute from a1 source 10.0.0.3 group 225.1.2.3 to a2
+mgroup from a2 group 225.3.2.1
+mgroup from a2 group 225.3.2.2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+show_mroute
+
+print "Replacing with desired state ..."
+cat <<EOF > "/tmp/$NM/state"
+# Keep 10.0.0.1, drop 10.0.0.2, stop 10.0.0.3, add 10.0.0.4
+add  a1 10.0.0.1 225.1.2.1 a2
+add  a1 10.0.0.3 225.1.2.3
+add  a1 10.0.0.4 225.1.2.4 a2
+join a2 225.3.2.2
+join a2 225.3.2.3
+EOF
+cat "/tmp/$NM/state"
+../src/smcroutectl -u "/tmp/$NM/sock" replace "/tmp/$NM/state" || FAIL "Replace failed"
+show_mroute
+ip maddr show dev a2
+
+print "Verifying routes and groups ..."
+check_route 0 "(10.0.0.1,225.1.2.1) *Iif: a1 *Oifs: a2" "Unchanged route lost"
+check_route 1 "(10.0.0.2,225.1.2.2)"                    "Old route not removed"
+check_route 1 "(10.0.0.3,225.1.2.3) *Iif: a1 *Oifs: a2" "Changed route still forwards"
+check_route 0 "(10.0.0.3,225.1.2.3)"                    "Changed route removed"
+check_route 0 "(10.0.0.4,225.1.2.4) *Iif: a1 *Oifs: a2" "New route not added"
+check_group 1 "225.3.2.1" "Old group not left"
+check_group 0 "225.3.2.2" "Unchanged group lost"
+check_group 0 "225.3.2.3" "New group not joined"
+
+print "Verifying unchanged route was not rewritten ..."
+cat "/tmp/$NM/log"
+num=$(grep -c "Add 10.0.0.1 -> 225.1.2.1" "/tmp/$NM/log")
+echo " => route (10.0.0.1,225.1.2.1) installed $num time(s), expected 1"
+[ "$num" -eq 1 ] || FAIL
+
+print "Replacing with invalid state, nothing should change ..."
+cat <<EOF > "/tmp/$NM/state"
+add  a1 10.0.0.5 225.1.2.5 a2
+add  nonexistent 10.0.0.6 225.1.2.6 a2
+EOF
+../src/smcroutectl -u "/tmp/$NM/sock" replace "/tmp/$NM/state" && FAIL "Invalid replace succeeded"
+show_mroute
+check_route 1 "(10.0.0.5,225.1.2.5)" "Aborted replace was applied"
+check_route 0 "(10.0.0.1,225.1.2.1)" "Aborted replace removed routes"
+
+print "Replacing slowly, other clients should still be served ..."
+(
+    echo "add  a1 10.0.0.1 225.1.2.1 a2"
+    sleep 3
+    echo "add  a1 10.0.0.7 225.1.2.7 a2"
+) | ../src/smcroutectl -u "/tmp/$NM/sock" replace - &
+slow=$!
+sleep 1
+timeout 2 ../src/smcroutectl -u "/tmp/$NM/sock" show routes >/dev/null || FAIL "Show blocked by replace"
+timeout 2 ../src/smcroutectl -u "/tmp/$NM/sock" add a1 10.0.0.8 225.1.2.8 a2 && FAIL "Add during replace"
+wait $slow || FAIL "Slow replace failed"
+show_mroute
+check_route 0 "(10.0.0.7,225.1.2.7) *Iif: a1 *Oifs: a2" "Slow replace not applied"
+check_route 1 "(10.0.0.8,225.1.2.8)"                    "Add during replace applied"
+
+print "Replacing with idle client, should time out ..."
+(
+    echo "add  a1 10.0.0.9 225.1.2.9 a2"
+    sleep 8
+) | ../src/smcroutectl -u "/tmp/$NM/sock" replace - && FAIL "Idle replace succeeded"
+check_route 1 "(10.0.0.9,225.1.2.9)"                    "Idle replace was applied"
+check_route 0 "(10.0.0.7,225.1.2.7)"                    "Idle replace removed routes"
+
+OK
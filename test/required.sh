@@ -0,0 +1,48 @@
+#!/bin/sh
+# Verifies 'phyint IFNAME required'.  The daemon is started before one
+# of its interfaces exists, it must not signal readiness until the
+# interface appears, and the routes referring to it must be installed
+# without a reload.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a3 enable required
+
+mroute from a1 source 10.0.0.1 group 225.1.2.3 to a3
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Verifying daemon waits for a3 ..."
+grep "Waiting for required" "/tmp/$NM/log" || FAIL "Not waiting for required interface"
+[ -f "/tmp/$NM/pid" ] && FAIL "PID file created before required interface is up"
+ip mroute | grep -q "225.1.2.3.*Oifs: a3" && FAIL "Route to missing interface installed"
+
+print "Creating a3 ..."
+ip link add a3 type dummy
+ip link set a3 up
+ip link set a3 multicast on
+ip addr add 30.0.0.1/24 dev a3
+sleep 1
+show_mroute
+
+print "Verifying route and readiness ..."
+cat "/tmp/$NM/log"
+ip mroute | grep -q "(10.0.0.1,225.1.2.3) *Iif: a1 *Oifs: a3" || FAIL "Route not installed"
+[ -f "/tmp/$NM/pid" ] || FAIL "No PID file, daemon not ready"
+
+OK
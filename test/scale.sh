@@ -0,0 +1,138 @@
+#!/bin/sh
+# Config-scale benchmark, shows how reading, applying, and reloading the
+# .conf file grows with its size.  Generates synthetic .conf files, with
+# a mix of SSM routes, (*,G/LEN) templates, wildcard phyints, include
+# files, and prefix mgroups, and runs smcrouted on the simulated kernel
+# backend.  Reports wall time, kernel writes, and peak RSS per phase,
+# from 'smcroutectl show stats'.
+#
+# Not part of 'make check', run manually, e.g., only the smaller sizes:
+#
+#     SCALE_SIZES="1000 10000" unshare -mrun ./scale.sh
+#
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+SCALE_SIZES=${SCALE_SIZES:-1000 10000 100000 1000000}	# Lines of .conf
+SCALE_CHUNK=${SCALE_CHUNK:-10000}	# Lines per include file
+SCALE_WAIT=${SCALE_WAIT:-600}		# Max time per phase, seconds
+
+# The daemon does not answer while reading .conf, so give up after a while
+stat()
+{
+    timeout 5 ../src/smcroutectl -pu "/tmp/$NM/sock" show stats > "/tmp/$NM/stats"
+    awk -v name="$1" '$0 ~ "^" name { print $NF }' "/tmp/$NM/stats"
+}
+
+# Wait for phase to complete, its time is set when done.  On timeout
+# the phase is reported as such, larger sizes would only take longer.
+wait_phase()
+{
+    end=$(($(date +%s) + SCALE_WAIT))
+    while [ "$(stat "$1 time")" = "0" ] || [ -z "$(stat "$1 time")" ]; do
+	kill -0 "$pid" 2>/dev/null || FAIL "smcrouted died during $1 of $2 lines"
+	if [ "$(date +%s)" -gt "$end" ]; then
+	    printf "%10s  %-7s %12s\n" "$2" "$1" "timeout" >> "/tmp/$NM/result"
+	    return 1
+	fi
+	sleep 0.1
+    done
+}
+
+report()
+{
+    time=$(stat "$1 time")
+    printf "%10s  %-7s %12s %14s %14s\n" "$2" "$1" "$((time / 1000))" \
+	   "$(stat "$1 kernel writes")" "$(stat "$1 peak RSS")" >> "/tmp/$NM/result"
+}
+
+# Generate .conf of $1 lines, in include files of SCALE_CHUNK lines.
+# Every 100 lines: 60 SSM routes, 30 (*,G/LEN) templates to a wildcard
+# OIF, 6 ASM joins, 3 SSM joins, and a /30 prefix join.
+generate()
+{
+    rm -rf "/tmp/$NM/conf.d"
+    mkdir -p "/tmp/$NM/conf.d"
+
+    cat <<-EOF > "/tmp/$NM/conf"
+	phyint a1 enable
+	phyint a+ enable
+	include /tmp/$NM/conf.d/*.conf
+	EOF
+
+    awk -v num="$1" -v chunk="$SCALE_CHUNK" -v dir="/tmp/$NM/conf.d" '
+	function addr(base, n) {
+	    return sprintf("%d.%d.%d.%d", base + int(n / 16777216),
+			   int(n / 65536) % 256, int(n / 256) % 256, n % 256)
+	}
+	BEGIN {
+	    for (i = 0; i < num; i++) {
+		file = sprintf("%s/%05d.conf", dir, int(i / chunk))
+		n = int(i / 100)
+		k = i % 100
+		if (k < 60)
+		    line = "mroute from a1 source " addr(10, i) " group " addr(232, n) " to a2"
+		else if (k < 90)
+		    line = "mroute from a1 group " addr(225, (n * 30 + k - 60) * 256) "/24 to a+"
+		else if (k < 96)
+		    line = "mgroup from a2 group " addr(239, n * 6 + k - 90)
+		else if (k < 99)
+		    line = "mgroup from a2 source " addr(10, i) " group " addr(233, n)
+		else
+		    line = "mgroup from a2 group " addr(238, n * 4) "/30"
+
+		print line > file
+		if (i % chunk == chunk - 1)
+		    close(file)
+	    }
+	}'
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+# One socket per 20 joins
+ulimit -n 65536 2>/dev/null
+
+printf "%10s  %-7s %12s %14s %14s\n" "LINES" "PHASE" "TIME (ms)" "KERN WRITES" "PEAK RSS (kB)" \
+       > "/tmp/$NM/result"
+
+for num in $SCALE_SIZES; do
+    print "Generating .conf with $num lines ..."
+    generate "$num"
+    ls "/tmp/$NM/conf.d" | wc -l | xargs printf " => %s include files\n"
+
+    print "Starting smcrouted on simulated kernel ..."
+    ../src/smcrouted -f "/tmp/$NM/conf" -n -N -K -P "/tmp/$NM/pid" -l notice -u "/tmp/$NM/sock" &
+    pid=$!
+    sleep 1
+    if wait_phase Apply "$num"; then
+	[ "$(stat "Lines read")" -ge "$num" ] || FAIL "Did not read all $num lines"
+	report Read  "$num"
+	report Apply "$num"
+
+	print "Reloading smcrouted ..."
+	timeout "$SCALE_WAIT" ../src/smcroutectl -pu "/tmp/$NM/sock" reload
+	wait_phase Reload "$num" && report Reload "$num"
+    fi
+
+    # Still busy on timeout, and only checks for SIGTERM when done
+    if grep -q timeout "/tmp/$NM/result"; then
+	kill -9 "$pid"
+	wait "$pid"
+	break
+    fi
+    kill "$pid"
+    wait "$pid"
+done
+
+print "Result ..."
+cat "/tmp/$NM/result"
+[ -z "$(ip mroute)" ] || FAIL "Simulated kernel backend modified the kernel MFC"
+
+OK
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Verifies 'show routes since GEN'.  Changes to routes and groups after
+# a noted generation must be listed, in order, with tombstones for
+# removed entries, and a generation too old must give a resync marker.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+ctl()
+{
+    ../src/smcroutectl -pu "/tmp/$NM/sock" "$@"
+}
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 source 10.0.0.1 group 225.1.2.3 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+
+print "Noting current generation ..."
+ctl show routes since 0 | tee "/tmp/$NM/show"
+gen=$(awk '/^Generation:/ { print $2 }' "/tmp/$NM/show")
+echo " => generation $gen"
+[ -n "$gen" ] && [ "$gen" -gt 0 ] || FAIL "No generation"
+
+print "Changing routes and groups ..."
+ctl add a1 10.0.0.1 225.3.2.1 a2
+ctl join a2 225.4.4.4
+ctl remove a1 10.0.0.1 225.1.2.3
+
+print "Verifying changes since $gen ..."
+ctl show routes since "$gen" | tee "/tmp/$NM/show"
+grep -q "^[0-9]* *+ *rule *(10.0.0.1, 225.3.2.1) *a1 *a2" "/tmp/$NM/show" || FAIL "Missing added rule"
+grep -q "^[0-9]* *+ *mfc *(10.0.0.1, 225.3.2.1) *a1 *a2" "/tmp/$NM/show"  || FAIL "Missing added MFC"
+grep -q "^[0-9]* *+ *group *(\*, 225.4.4.4) *a2" "/tmp/$NM/show"          || FAIL "Missing joined group"
+grep -q "^[0-9]* *- *rule *(10.0.0.1, 225.1.2.3)" "/tmp/$NM/show"         || FAIL "Missing removed rule"
+grep -q "^[0-9]* *- *mfc *(10.0.0.1, 225.1.2.3)" "/tmp/$NM/show"          || FAIL "Missing removed MFC"
+grep -q "225.1.2.3 .*a2" "/tmp/$NM/show" && FAIL "Change before $gen listed"
+ctl show since "$gen" | grep -q "^[0-9]* *+ *rule *(10.0.0.1, 225.3.2.1)" \
+    || FAIL "Show since, without routes, not a changes query"
+
+last=$(awk '/^Generation:/ { print $2 }' "/tmp/$NM/show")
+ctl show routes since "$last" | tee "/tmp/$NM/show"
+grep -q "^[0-9]* *[+-] " "/tmp/$NM/show" && FAIL "Changes listed when up to date"
+
+print "Verifying resync marker ..."
+for i in $(seq 1 520); do
+    ctl add a1 10.0.0.1 "225.5.$((i / 250)).$((i % 250 + 1))" a2
+done
+ctl show routes since 1 | tee "/tmp/$NM/show"
+grep -q "Resync required" "/tmp/$NM/show" || FAIL "No resync marker"
+
+OK
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Verifies operations run in slices by the task scheduler complete: the
+# kernel MFC writes from .conf, a large mgroup range join, and a full
+# show routes dump, each spanning many slices.  The dump must list
+# routes in the order they were added.
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+{
+    echo "phyint a1 enable"
+    echo "phyint a2 enable"
+    echo "mgroup from a1 group 225.3.0.0/23"
+    for i in $(seq 1 300); do
+	echo "mroute from a1 source 10.0.$((i / 250)).$((i % 250 + 1)) group 225.1.2.$((i % 250)) to a2"
+    done
+    for i in $(seq 1 5); do
+	echo "mroute from a1 group 226.0.0.$i to a2"
+    done
+} > "/tmp/$NM/conf"
+head -n 8 "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -P "/tmp/$NM/pid" -l debug -u "/tmp/$NM/sock" &
+sleep 2
+
+print "Verifying kernel MFC ..."
+num=$(ip mroute | grep -c "Iif: a1 *Oifs: a2")
+echo " => $num routes in kernel, expected 300"
+[ "$num" -eq 300 ] || FAIL "Not all routes written to kernel"
+
+print "Verifying group range join ..."
+num=$(ip maddr show dev a1 | grep -c "inet *225\.3\.")
+echo " => $num groups joined, expected 512"
+[ "$num" -eq 512 ] || FAIL "Not all groups in range joined"
+
+print "Verifying full show routes ..."
+../src/smcroutectl -pu "/tmp/$NM/sock" show routes > "/tmp/$NM/show"
+head -n 5 "/tmp/$NM/show"
+num=$(grep -cE "^\((\*|[0-9.]+), " "/tmp/$NM/show")
+echo " => $num routes shown, expected 605"
+# 5 (*,G) + 300 (S,G) + 300 kernel routes
+[ "$num" -eq 605 ] || FAIL "Not all routes shown"
+for heading in "(\*,G) Template Rules" "(S,G) Rules" "Kernel MFC Table"; do
+    [ "$(grep -c "^$heading" "/tmp/$NM/show")" -eq 1 ] || FAIL "Heading $heading not shown once"
+done
+# Sliced dump must not repeat or skip entries between slices
+num=$(sed -n '/^Kernel MFC Table/,$p' "/tmp/$NM/show" | grep -E "^\([0-9.]+, " | sort -u | wc -l)
+echo " => $num unique kernel routes shown, expected 300"
+[ "$num" -eq 300 ] || FAIL "Kernel routes repeated or skipped"
+# Listed in the order they were added, not sorted
+sed -n '/^(S,G) Rules/,/^Kernel MFC Table/p' "/tmp/$NM/show" \
+    | awk '/^\([0-9.]+, / { print $1 $2 }' > "/tmp/$NM/order"
+awk '/source/ { print "(" $5 "," $7 ")" }' "/tmp/$NM/conf" | cmp -s - "/tmp/$NM/order" \
+    || FAIL "Rules not shown in the order they were added"
+
+OK
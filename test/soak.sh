@@ -0,0 +1,175 @@
+#!/bin/sh
+# Long-running churn test, meant to catch slow leaks and performance
+# decay that the short valgrind run in mem.sh cannot see.  Drives route
+# add/remove, joins/leaves, interface flaps, reloads, and, if ping is
+# available, upcalls for (*,G) routes.  Samples RSS, heap size, open
+# file descriptors, and install latency of smcrouted periodically and
+# fails on growth or drift beyond the thresholds below.
+#
+# Not part of 'make check', run manually, e.g., for four hours:
+#
+#     SOAK_TIME=14400 unshare -mrun ./soak.sh
+#
+#set -x
+
+# shellcheck source=/dev/null
+. "$(dirname "$0")/lib.sh"
+
+SOAK_TIME=${SOAK_TIME:-60}		# Total run time, seconds
+SOAK_SAMPLE=${SOAK_SAMPLE:-10}		# Sample interval, seconds
+SOAK_WINDOW=${SOAK_WINDOW:-50}		# Number of live routes and groups
+SOAK_RSS=${SOAK_RSS:-512}		# Max RSS/heap growth, kiB
+SOAK_FDS=${SOAK_FDS:-2}			# Max growth of open descriptors
+SOAK_LAT=${SOAK_LAT:-50}		# Max latency drift, msec
+
+ctl()
+{
+    ../src/smcroutectl -u "/tmp/$NM/sock" "$@" >/dev/null
+}
+
+now()
+{
+    date +%s%N | cut -c1-13
+}
+
+status()
+{
+    awk -v key="$1:" '$1 == key { print $2 }' "/proc/$PID/status"
+}
+
+nfds()
+{
+    ls "/proc/$PID/fd" | wc -l
+}
+
+# Wait for a route to show up, or disappear, prints latency in msec
+wait_route()
+{
+    beg=$(now)
+    for _ in $(seq 1 200); do
+	if ip mroute | grep -q "$2"; then
+	    [ "$1" = "add" ] && break
+	else
+	    [ "$1" = "del" ] && break
+	fi
+	sleep 0.01
+    done
+    echo $(($(now) - beg))
+}
+
+addr()
+{
+    echo "$1.$(($2 / 250 % 250)).$(($2 % 250 + 1))"
+}
+
+print "Checking dependencies ..."
+check_dep date
+check_dep awk
+if command -v ping >/dev/null; then
+    upcalls=1
+else
+    upcalls=0
+    echo "Cannot find ping, skipping upcall churn."
+fi
+
+print "Creating world ..."
+topo basic
+ip addr add 10.0.0.1/24 dev a1
+ip addr add 20.0.0.1/24 dev a2
+ip -br a
+
+print "Creating config ..."
+cat <<EOF > "/tmp/$NM/conf"
+phyint a1 enable
+phyint a2 enable
+
+mroute from a1 group 225.2.0.0/16 to a2
+mgroup from a2 group 225.4.0.1
+mroute from a1 source 10.0.0.1 group 225.4.0.1 to a2
+EOF
+cat "/tmp/$NM/conf"
+
+print "Starting smcrouted ..."
+../src/smcrouted -f "/tmp/$NM/conf" -n -N -c 10 -P "/tmp/$NM/pid" -l notice -u "/tmp/$NM/sock" \
+		 >"/tmp/$NM/log" 2>&1 &
+sleep 1
+PID=$(cat "/tmp/$NM/pid")
+[ -d "/proc/$PID" ] || FAIL "smcrouted not running"
+
+print "Churning for $SOAK_TIME sec, sampling every $SOAK_SAMPLE sec ..."
+printf "%8s %10s %10s %6s %8s %8s %8s\n" TIME RSS HEAP FDS CYCLES ADD UPCALL
+start=$(date +%s)
+next=$((start + SOAK_SAMPLE))
+cycle=0
+samples=0
+n=0; add=0; upc=0; nupc=0
+
+while [ $(($(date +%s) - start)) -lt "$SOAK_TIME" ]; do
+    cycle=$((cycle + 1))
+
+    # Sliding window of routes and groups, add new and remove oldest
+    src=$(addr 10.0 "$cycle")
+    grp=$(addr 225.1 "$cycle")
+    ctl add a1 "$src" "$grp" a2
+    lat=$(wait_route add "($src,$grp)")
+    add=$((add + lat)); n=$((n + 1))
+    ctl join a2 "$(addr 225.3 "$cycle")"
+
+    if [ "$cycle" -gt "$SOAK_WINDOW" ]; then
+	old=$((cycle - SOAK_WINDOW))
+	ctl remove a1 "$(addr 10.0 "$old")" "$(addr 225.1 "$old")"
+	ctl leave a2 "$(addr 225.3 "$old")"
+    fi
+
+    # Unknown (S,G) on a (*,G) route, the kernel sends an upcall
+    if [ "$upcalls" -eq 1 ]; then
+	grp=$(addr 225.2 "$cycle")
+	ping -c 1 -W 1 -I a1 -t 3 "$grp" >/dev/null 2>&1 &
+	lat=$(wait_route add "(10.0.0.1,$grp)")
+	upc=$((upc + lat)); nupc=$((nupc + 1))
+    fi
+
+    if [ $((cycle % 10)) -eq 0 ]; then
+	ip link set a2 down
+	ip link set a2 up
+    fi
+    [ $((cycle % 25)) -eq 0 ] && ctl reload
+
+    [ "$(date +%s)" -lt "$next" ] && continue
+    next=$((next + SOAK_SAMPLE))
+
+    [ -d "/proc/$PID" ] || FAIL "smcrouted died"
+    rss=$(status VmRSS)
+    heap=$(status VmData)
+    fds=$(nfds)
+    avg=$((add / n))
+    uavg=0
+    [ "$nupc" -gt 0 ] && uavg=$((upc / nupc))
+    printf "%8d %10d %10d %6d %8d %8d %8d\n" $(($(date +%s) - start)) \
+	   "$rss" "$heap" "$fds" "$cycle" "$avg" "$uavg"
+
+    # First sample is after warm-up, when the window is full
+    samples=$((samples + 1))
+    if [ "$samples" -eq 1 ]; then
+	rss0=$rss; heap0=$heap; fds0=$fds; avg0=$avg; uavg0=$uavg
+    fi
+    n=0; add=0; upc=0; nupc=0
+done
+
+[ "$samples" -ge 2 ] || FAIL "Too few samples, increase SOAK_TIME or lower SOAK_SAMPLE"
+
+print "Analyzing ..."
+tail -20 "/tmp/$NM/log"
+echo "RSS     $rss0 -> $rss kiB, max growth $SOAK_RSS kiB"
+echo "Heap    $heap0 -> $heap kiB, max growth $SOAK_RSS kiB"
+echo "FDs     $fds0 -> $fds, max growth $SOAK_FDS"
+echo "Add     $avg0 -> $avg msec, max drift $SOAK_LAT msec"
+echo "Upcall  $uavg0 -> $uavg msec, max drift $SOAK_LAT msec"
+
+[ $((rss - rss0))   -le "$SOAK_RSS" ] || FAIL "RSS grew by $((rss - rss0)) kiB"
+[ $((heap - heap0)) -le "$SOAK_RSS" ] || FAIL "Heap grew by $((heap - heap0)) kiB"
+[ $((fds - fds0))   -le "$SOAK_FDS" ] || FAIL "Leaking file descriptors"
+[ $((avg - avg0))   -le "$SOAK_LAT" ] || FAIL "Route install latency drift"
+[ $((uavg - uavg0)) -le "$SOAK_LAT" ] || FAIL "Upcall latency drift"
+
+OK